@@ -26,18 +26,25 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <math.h>
 
 // htslib
 //#include "htslib/bgzf.h"
 //#include "htslib/sam.h"
 
-// cfuhash
-#include "cfuhash.h"
-
 // local includes
 #include "bamParser.h"
 #include "pairedLink.h"
-#include "stats.h"
+#include "parallelParser.h"
+#include "perBamParser.h"
+#include "batchParser.h"
+#include "cigarDepth.h"
+#include "depthBuffer.h"
+#include "regions.h"
+#include "resultsFile.h"
+#include "resultCache.h"
+#include "pipeline.h"
+#include "pmTrace.h"
 
 // proper linking read is a properly paired, (primary alignment) of the first read in thr pair
 #define PM_BAM_FSUPP (BAM_FSECONDARY | BAM_FSUPPLEMENTARY)
@@ -69,13 +76,19 @@ void init_MR(PM_mapping_results * MR,
     MR->is_links_included = doLinks;
     MR->is_outlier_coverage = doOutlierCoverage;
     MR->is_ignore_supps = ignoreSuppAlignments;
+    MR->coverage_lower = PM_COVERAGE_DEFAULT_LOWER;
+    MR->coverage_upper = PM_COVERAGE_DEFAULT_UPPER;
+    MR->region_lengths = NULL;
+    MR->region_digest = 0;
+    MR->seen_contigs = NULL;
+    MR->mapping = NULL;
+    MR->mapping_size = 0;
+    MR->row_offset = 0;
+    initParseStats(&MR->stats, numBams);
 
     if(MR->num_contigs != 0 && MR->num_bams != 0) {
         // make room to store read counts
-        MR->plp_bp = calloc(MR->num_contigs, sizeof(uint32_t*));
-        for(i = 0; i < MR->num_contigs; ++i) {
-            MR->plp_bp[i] = calloc(MR->num_bams, sizeof(uint32_t));
-        }
+        MR->plp_bp = calloc((size_t)MR->num_contigs * MR->num_bams, sizeof(uint32_t));
 
         // store BAM file names
         MR->bam_file_names = calloc(MR->num_bams, sizeof(char*));
@@ -95,19 +108,15 @@ void init_MR(PM_mapping_results * MR,
         // only allocate if we NEED to
         //----------------------------
         if (MR->is_outlier_coverage) {
-            MR->contig_length_correctors = calloc(MR->num_contigs, sizeof(uint32_t*));
-            for(i = 0; i < MR->num_contigs; ++i) {
-                MR->contig_length_correctors[i] = calloc(MR->num_bams, sizeof(uint32_t));
-            }
+            MR->contig_length_correctors = calloc((size_t)MR->num_contigs * MR->num_bams, sizeof(uint32_t));
         } else {
             MR->contig_length_correctors = NULL;
         }
 
         if(doLinks)
         {
-            cfuhash_table_t *links = cfuhash_new_with_initial_size(30);
-            cfuhash_set_flag(links, CFUHASH_FROZEN_UNTIL_GROWS);
-            MR->links = links;
+            // most contigs link to a handful of others at most
+            MR->links = createLinkTable(MR->num_contigs);
         }
         else
         {
@@ -116,154 +125,143 @@ void init_MR(PM_mapping_results * MR,
     }
 }
 
-void merge_MRs(PM_mapping_results * MR_A, PM_mapping_results * MR_B)
+static uint64_t headerDigest(PM_mapping_results * MR)
 {
-    //----
-    // Merge the contents of MR_B into MR_A
+    //-----
+    // everything two MRs must agree on before their columns can sit side by side
     //
-    // Check to see that the number of contigs are the same
-    int i = 0, j = 0, k = 0;
-    if(MR_A->num_contigs != MR_B->num_contigs)
-    {
-        char str[80];
-        sprintf(str, "Unequal number of contigs in MR structs to be merged (Num contigs: %d, %d)", MR_A->num_contigs, MR_B->num_contigs);
-        printError(str, __LINE__);
-        return;
+    uint64_t hash = PM_FNV_OFFSET;
+    int has_regions = (MR->region_lengths != NULL);
+    uint32_t i = 0;
+    hash = hashBytes(hash, &MR->num_contigs, sizeof(uint32_t));
+    hash = hashBytes(hash, &has_regions, sizeof(int));
+    hash = hashBytes(hash, &MR->region_digest, sizeof(uint64_t));
+    if(MR->num_contigs != 0 && MR->num_bams != 0) {
+        hash = hashBytes(hash, MR->contig_lengths, MR->num_contigs * sizeof(uint32_t));
+        for(i = 0; i < MR->num_contigs; ++i) {
+            hash = hashBytes(hash, MR->contig_names[i], strlen(MR->contig_names[i]) + 1);
+        }
+        if(has_regions)
+            hash = hashBytes(hash, MR->region_lengths, MR->num_contigs * sizeof(uint32_t));
     }
+    return hash;
+}
 
-    // now check that the lengths of all the contigs are the same
-    // just check every 100th contig
-    for(i=0; i < MR_A->num_contigs; ++i)
-    {
-        if(i < MR_A->num_contigs)
-        {
-            if(MR_A->contig_lengths[i] != MR_B->contig_lengths[i])
-            {
-                char str[80];
-                sprintf(str, "Unequal contig lengths in MR structs to be merged (Contig#: %d, Lengths: %d, %d)", i, MR_A->num_contigs, MR_B->num_contigs);
-                printError(str, __LINE__);
-                return;
-            }
-        }
-        else
-        {
-            break;
+static uint32_t * mergeColumns(PM_mapping_results * MR_out,
+                               uint32_t * outBlock,
+                               PM_mapping_results ** MR_in,
+                               uint32_t ** inBlocks,
+                               int numIn,
+                               uint32_t numCols)
+{
+    //-----
+    // one new block, filled a row at a time with a block move per MR
+    //
+    uint32_t * ret = malloc((size_t)MR_out->num_contigs * numCols * sizeof(uint32_t));
+    uint32_t * dest = ret;
+    uint32_t row = 0;
+    int k = 0;
+    for(row = 0; row < MR_out->num_contigs; ++row) {
+        memcpy(dest, outBlock + (size_t)row * MR_out->num_bams, MR_out->num_bams * sizeof(uint32_t));
+        dest += MR_out->num_bams;
+        for(k = 0; k < numIn; ++k) {
+            memcpy(dest, inBlocks[k] + (size_t)row * MR_in[k]->num_bams, MR_in[k]->num_bams * sizeof(uint32_t));
+            dest += MR_in[k]->num_bams;
         }
-//        i += 100;
     }
+    return ret;
+}
 
-    // we can assume that the headers are the same. So now time to merge the data
-
-    // keep a backup of these guys
-    uint32_t old_num_bams = MR_A->num_bams;
-    char ** old_bam_file_names = MR_A->bam_file_names;
-    uint32_t ** old_contig_length_correctors = MR_A->contig_length_correctors;
-    uint32_t ** old_plp_bp = MR_A->plp_bp;
+int merge_MRs_many(PM_mapping_results * MR_out, PM_mapping_results ** MR_in, int numIn)
+{
+    //----
+    // Append the contents of every MR_in to MR_out
+    //
+    int k = 0;
+    uint32_t i = 0, total_bams = MR_out->num_bams, offset = 0;
+    uint64_t digest = headerDigest(MR_out);
+    for(k = 0; k < numIn; ++k) {
+        if(headerDigest(MR_in[k]) != digest) {
+            char str[80];
+            sprintf(str, "Headers of MR structs to be merged differ (MR: %d)", k);
+            printError(str, __LINE__);
+            return 1;
+        }
+        total_bams += MR_in[k]->num_bams;
+    }
+    if(MR_out->num_contigs == 0 || total_bams == MR_out->num_bams) {
+        return 0; // nothing to copy
+    }
+    PM_TRACE2(merge_start, numIn, total_bams);
 
     //-----
-    // Fix the num bams and bam file names
-    MR_A->num_bams += MR_B->num_bams;
-    // realloc the memory for MR_A
-    MR_A->bam_file_names = calloc(MR_A->num_bams, sizeof(char*));
-    for (i = 0; i < old_num_bams; ++i) {
-        MR_A->bam_file_names[i] = strdup(old_bam_file_names[i]);
-    }
-    for (j = 0; j < MR_B->num_bams; ++j) {
-        MR_A->bam_file_names[i] = strdup(MR_B->bam_file_names[j]);
-        ++i;
-    }
-    // free these original data
-    if(old_bam_file_names != 0) {
-        for(i = 0; i < old_num_bams; ++i) {
-            if(old_bam_file_names[i] != 0)
-                free(old_bam_file_names[i]);
+    // BAM file names, only the new ones are copied
+    //
+    MR_out->bam_file_names = realloc(MR_out->bam_file_names, total_bams * sizeof(char*));
+    offset = MR_out->num_bams;
+    for(k = 0; k < numIn; ++k) {
+        for(i = 0; i < MR_in[k]->num_bams; ++i) {
+            MR_out->bam_file_names[offset++] = strdup(MR_in[k]->bam_file_names[i]);
         }
-        free(old_bam_file_names);
     }
 
     //-----
-    // Pileups
-    MR_A->plp_bp = calloc(MR_A->num_contigs, sizeof(uint32_t*));
-    for(i = 0; i < MR_A->num_contigs; ++i) {
-        MR_A->plp_bp[i] = calloc(MR_A->num_bams, sizeof(uint32_t));
+    // Pileups and contig length correctors
+    //
+    uint32_t ** blocks = calloc(numIn, sizeof(uint32_t*));
+    uint32_t * old_block = MR_out->plp_bp;
+    for(k = 0; k < numIn; ++k) {
+        blocks[k] = MR_in[k]->plp_bp;
     }
-    for(k = 0; k < MR_A->num_contigs; ++k)
-    {
-        for (i = 0; i < old_num_bams; ++i) {
-            printf("A: %d, %d, %d\n", k, i, old_plp_bp[k][i]);
-            MR_A->plp_bp[k][i] = old_plp_bp[k][i];
-        }
-        for (j = 0; j < MR_B->num_bams; ++j) {
-            printf("B: %d, %d, %d\n", k, i, MR_B->plp_bp[k][j]);
-            MR_A->plp_bp[k][i] = MR_B->plp_bp[k][j];
-            ++i;
+    MR_out->plp_bp = mergeColumns(MR_out, old_block, MR_in, blocks, numIn, total_bams);
+    freeMRBlock(MR_out, old_block);
+
+    if (MR_out->is_outlier_coverage) {
+        old_block = MR_out->contig_length_correctors;
+        for(k = 0; k < numIn; ++k) {
+            blocks[k] = MR_in[k]->contig_length_correctors;
         }
+        MR_out->contig_length_correctors = mergeColumns(MR_out, old_block, MR_in, blocks, numIn, total_bams);
+        freeMRBlock(MR_out, old_block);
     }
-    if(old_plp_bp != 0) {
-        for(i = 0; i < MR_A->num_contigs; ++i) {
-            if(old_plp_bp[i] != 0)
-                free(old_plp_bp[i]);
-        }
-        free(old_plp_bp);
+    free(blocks);
+
+    //-----
+    // Links, whole chunks at a time with the BAM ids moved along
+    //
+    offset = MR_out->num_bams;
+    for(k = 0; k < numIn; ++k) {
+        if(MR_out->is_links_included && MR_in[k]->links != NULL)
+            copyLinks(MR_out->links, MR_in[k]->links, offset);
+        addParseStats(&MR_out->stats, &MR_in[k]->stats, offset);
+        offset += MR_in[k]->num_bams;
     }
 
     //-----
-    // Contig length correctors
+    // Contigs with reads, only known if every MR kept them
     //
-    if (MR_A->is_outlier_coverage) {
-        MR_A->contig_length_correctors = calloc(MR_A->num_contigs, sizeof(uint32_t*));
-        for(i = 0; i < MR_A->num_contigs; ++i) {
-            MR_A->contig_length_correctors[i] = calloc(MR_A->num_bams, sizeof(uint32_t));
-        }
-        for(k = 0; k < MR_A->num_contigs; ++k)
-        {
-            for (i = 0; i < old_num_bams; ++i) {
-                MR_A->contig_length_correctors[k][i] = old_contig_length_correctors[k][i];
-            }
-            for (j = 0; j < MR_B->num_bams; ++j) {
-                MR_A->contig_length_correctors[k][i] = MR_B->contig_length_correctors[k][j];
-                ++i;
-            }
+    for(k = 0; k < numIn && MR_out->seen_contigs != NULL; ++k) {
+        if(MR_in[k]->seen_contigs == NULL) {
+            freeMRBlock(MR_out, MR_out->seen_contigs);
+            MR_out->seen_contigs = NULL;
+            break;
         }
-        if(old_contig_length_correctors != 0) {
-            for(i = 0; i < MR_A->num_contigs; ++i) {
-                if(old_contig_length_correctors[i] != 0)
-                    free(old_contig_length_correctors[i]);
-            }
-            free(old_contig_length_correctors);
+        for(i = 0; i < (MR_out->num_contigs + 7) / 8; ++i) {
+            MR_out->seen_contigs[i] |= MR_in[k]->seen_contigs[i];
         }
     }
 
+    MR_out->num_bams = total_bams;
+    PM_TRACE1(merge_end, 0);
+    return 0;
+}
 
-    //-----
-    // Links
-    if(MR_A->is_links_included)
-    {
-        // break the pattern of overwriting. We can just add the links here
-        char **keys = NULL;
-        size_t *key_sizes = NULL;
-        size_t key_count = 0;
-        keys = (char **)cfuhash_keys_data(MR_B->links, &key_count, &key_sizes, 0);
-
-        for (i = 0; i < (int)key_count; i++) {
-            PM_link_pair * LP = cfuhash_get(MR_B->links, keys[i]);
-            free(keys[i]);
-            PM_link_info* LI = LP->LI;
-            do {
-                addLink(MR_A->links,
-                        LP->cid_1,
-                        LP->cid_2,
-                        LI->pos_1,
-                        LI->pos_2,
-                        LI->orient_1,
-                        LI->orient_2,
-                        LI->bam_ID+old_num_bams);
-            } while(getNextLinkInfo(&LI));
-
-        }
-        free(keys);
-        free(key_sizes);
-    }
+void merge_MRs(PM_mapping_results * MR_A, PM_mapping_results * MR_B)
+{
+    //----
+    // Merge the contents of MR_B into MR_A
+    //
+    merge_MRs_many(MR_A, &MR_B, 1);
 }
 
 void destroy_MR(PM_mapping_results * MR)
@@ -273,13 +271,7 @@ void destroy_MR(PM_mapping_results * MR)
     //
     int i = 0;
     if(MR->num_contigs != 0 && MR->num_bams != 0) {
-        if(MR->plp_bp != 0) {
-            for(i = 0; i < MR->num_contigs; ++i) {
-                if(MR->plp_bp[i] != 0)
-                    free(MR->plp_bp[i]);
-            }
-            free(MR->plp_bp);
-        }
+        freeMRBlock(MR, MR->plp_bp);
 
         if(MR->bam_file_names != 0) {
             for(i = 0; i < MR->num_bams; ++i) {
@@ -291,31 +283,28 @@ void destroy_MR(PM_mapping_results * MR)
 
         if(MR->contig_names != 0) {
             for(i = 0; i < MR->num_contigs; ++i) {
-                if(MR->contig_names[i] != 0)
-                    free(MR->contig_names[i]);
+                freeMRBlock(MR, MR->contig_names[i]);
             }
             free(MR->contig_names);
         }
 
-        if(MR->contig_lengths != 0)
-            free(MR->contig_lengths);
-
-        if(MR->contig_length_correctors != 0) {
-            for(i = 0; i < MR->num_contigs; ++i) {
-                if(MR->contig_length_correctors[i] != 0)
-                    free(MR->contig_length_correctors[i]);
-            }
-            free(MR->contig_length_correctors);
-        }
+        freeMRBlock(MR, MR->contig_lengths);
+        freeMRBlock(MR, MR->contig_length_correctors);
+        freeMRBlock(MR, MR->region_lengths);
+        freeMRBlock(MR, MR->seen_contigs);
     }
 
     // destroy paired links
     if(MR->is_links_included)
     {
         destroyLinks(MR->links);
-        cfuhash_clear(MR->links);
-        cfuhash_destroy(MR->links);
+        MR->links = NULL;
     }
+
+    destroyParseStats(&MR->stats);
+
+    // everything pointing into the file is gone now
+    unmapMR(MR);
 }
 
 // This function reads a BAM alignment from one BAM file.
@@ -323,14 +312,59 @@ int read_bam(void *data,
              bam1_t *b) // read level filters better go here to avoid pileup
 {
     aux_t *aux = (aux_t*)data; // data in fact is a pointer to an auxiliary structure
+    if (aux->ahead) return readAhead(aux->ahead, b); // already read and filtered
+    PM_parse_stats *stats = aux->stats;
+    // only a few reads are timed, a clock read per read would cost more than the read
+    int timed = (stats != NULL && (stats->records_read & PM_STATS_SAMPLE_MASK) == 0);
+    uint64_t start = timed ? statsClock() : 0;
     int ret = aux->iter? hts_itr_next(aux->fp, aux->iter, b, 0) : bam_read1(aux->fp, b);
+    if (ret >= 0)
+        PM_TRACE4(read, aux->bam_ID, b->core.tid, b->core.pos, b->core.flag);
+    if (stats != NULL && ret >= 0) {
+        ++stats->records_read;
+        stats->bytes_inflated[aux->bam_ID] += PM_BAM_CORE_BYTES + b->l_data;
+        if (timed) stats->timer_ns[PM_TIMER_READ] += (statsClock() - start) << PM_STATS_SAMPLE_SHIFT;
+    }
     if (!(b->core.flag&BAM_FUNMAP)) {
-        if ((int)b->core.qual < aux->min_mapQ) b->core.flag |= BAM_FUNMAP;
-        else if (aux->min_len && bam_cigar2qlen((&b->core)->n_cigar, bam_get_cigar(b)) < aux->min_len) b->core.flag |= BAM_FUNMAP;
+        if ((int)b->core.qual < aux->min_mapQ) {
+            b->core.flag |= BAM_FUNMAP;
+            if (stats != NULL && ret >= 0) ++stats->mapq_filtered;
+        }
+        else if (aux->min_len && bam_cigar2qlen((&b->core)->n_cigar, bam_get_cigar(b)) < aux->min_len) {
+            b->core.flag |= BAM_FUNMAP;
+            if (stats != NULL && ret >= 0) ++stats->length_filtered;
+        }
     }
     return ret;
 }
 
+uint64_t compressedBytesRead(aux_t ** data, int numBams)
+{
+    uint64_t bytes = 0;
+    int i = 0;
+    for (i = 0; i < numBams; ++i) {
+        // the top 48 bits of a virtual offset are the compressed offset
+        if (data[i]->ahead) bytes += readAheadBytes(data[i]->ahead);
+        else if (data[i]->fp) bytes += (uint64_t)bgzf_tell(data[i]->fp) >> 16;
+    }
+    return bytes;
+}
+
+void init_parse_options(PM_parse_options * opts)
+{
+    //----
+    // defaults: no filters, no links, no outliers, one thread
+    //
+    memset(opts, 0, sizeof(PM_parse_options));
+    opts->ignore_supps = 1;
+    opts->num_workers = 1;
+    opts->num_threads = 1;
+    opts->coverage_lower = PM_COVERAGE_DEFAULT_LOWER;
+    opts->coverage_upper = PM_COVERAGE_DEFAULT_UPPER;
+    opts->cache_dir = getenv(PM_CACHE_DIR_ENV);
+    opts->progress_mb = PM_PROGRESS_DEFAULT_MB;
+}
+
 int parseCoverageAndLinks(int numBams,
                           int baseQ,
                           int mapQ,
@@ -338,32 +372,343 @@ int parseCoverageAndLinks(int numBams,
                           int doLinks,
                           int ignoreSuppAlignments,
                           int doOutlierCoverage,
+                          int numThreads,
                           char* bamFiles[],
                           PM_mapping_results * MR
 ) {
     //-----
     // work out coverage depths and also pairwise linkages if asked to do so
     //
+    PM_parse_options opts;
+    init_parse_options(&opts);
+    opts.baseQ = baseQ;
+    opts.mapQ = mapQ;
+    opts.min_len = minLen;
+    opts.do_links = doLinks;
+    opts.ignore_supps = ignoreSuppAlignments;
+    opts.do_outlier_coverage = doOutlierCoverage;
+    opts.num_threads = numThreads;
+    return parseCoverageAndLinksWithOptions(numBams, bamFiles, &opts, MR);
+}
+
+int isLinkingRead(bam1_core_t * core, int ignoreSuppAlignments)
+{
     int supp_check = 0x0; // include supp mappings
     if (ignoreSuppAlignments) {
         supp_check = PM_BAM_FSUPP;
     }
+    // check to see if this is a proper linking paired read
+    return ((core->flag & BAM_FPAIRED) &&                // read is a paired read
+            (core->flag & BAM_FREAD1) &&                 // read is first in pair (avoid dupe links)
+            ((core->flag & PM_BAM_FMAPPED) == 0) &&      // both ends are mapped
+            ((core->flag & supp_check) == 0) &&          // is primary mapping (optional)
+            core->tid != core->mtid);                    // hits different contigs
+}
 
-    // initialize the auxiliary data structures
+void countPileupBam(PM_mapping_results * MR,
+                    PM_link_table * links,
+                    PM_parse_stats * stats,
+                    PM_depth_buffer * depth,
+                    PM_parse_options * opts,
+                    int bamID,
+                    uint32_t slot,
+                    int n_plp,
+                    const bam_pileup1_t * plp
+) {
+    int j = 0, del_rejects = 0, qual_rejects = 0;
+    // for each read in the pileup
+    for (j = 0; j < n_plp; ++j) {
+        const bam_pileup1_t *p = plp + j; // DON'T modfity plp[][] unless you really know
+        if (p->is_del || p->is_refskip) {++del_rejects;} // having dels or refskips at tid:pos
+        else if (bam_get_qual(p->b)[p->qpos] < opts->baseQ) {++qual_rejects;} // low base quality
+        else if(MR->is_links_included) {
+            // now we do links if we've been asked to
+            bam1_core_t core = p->b[0].core;
+            if (p->is_head &&                               // first time we've seen this read
+                isLinkingRead(&core, opts->ignore_supps)) {
+                // looks legit
+                int timed = ((stats->links_added++ & PM_STATS_SAMPLE_MASK) == 0);
+                uint64_t start = timed ? statsClock() : 0;
+                addLink(links,
+                        core.tid,                           // contig 1
+                        core.mtid,                          // contig 2
+                        core.pos,                           // pos 1
+                        core.mpos,                          // pos 2
+                        ((core.flag&BAM_FREVERSE) != 0),    // 1 == reversed
+                        ((core.flag&BAM_FMREVERSE) != 0),   // 0 = agrees
+                        bamID);                             // bam file ID
+                if (timed) stats->timer_ns[PM_TIMER_LINKS] += (statsClock() - start) << PM_STATS_SAMPLE_SHIFT;
+            }
+        }
+    }
+    setDepth(depth, slot, n_plp - del_rejects - qual_rejects); // add this position's depth
+    stats->del_refskip_rejects += del_rejects;
+    stats->baseq_rejects += qual_rejects;
+}
+
+void countPileupColumn(PM_mapping_results * MR,
+                       PM_link_table * links,
+                       PM_parse_stats * stats,
+                       PM_depth_buffers * depths,
+                       PM_parse_options * opts,
+                       int tid,
+                       int pos,
+                       uint32_t slot,
+                       int * n_plp,
+                       const bam_pileup1_t ** plp
+) {
+    int i = 0;
+    if(pos >= MR->contig_lengths[tid]) return; // read hangs off the end of the contig
+    for (i = 0; i < MR->num_bams; ++i) {
+        countPileupBam(MR, links, stats, &depths->buffers[i], opts, i, slot, n_plp[i], plp[i]);
+    }
+}
+
+static int parseWithPileup(aux_t ** data,
+                           PM_parse_options * opts,
+                           PM_progress_tracker * progress,
+                           PM_contig_stream * stream,
+                           PM_mapping_results * MR
+) {
+    //-----
+    // the core multi-pileup loop
+    //
     const bam_pileup1_t **plp;
+    bam_mplp_t mplp;
+    int i = 0, tid = 0, *n_plp, mplp_ret = 0;
+    int numBams = MR->num_bams;
+    int beg = 0, end = 1<<30;  // set the default region
+    mplp = bam_mplp_init(numBams, read_bam, (void**)data); // initialization
+    n_plp = calloc(numBams, sizeof(int)); // n_plp[i] is the number of covering reads from the i-th BAM
+    plp = calloc(numBams, sizeof(void*)); // plp[i] points to the array of covering reads (internal in mplp)
+
+    // initialise
+    int prev_tid = -1;  // the id of the previous positions tid
+    int pos = 0; // current position in the contig ( 1 indexed )
+    int contigs_done = 0; // contigs before prev_tid, including any with no reads
+    uint32_t columns = 0;
+    uint64_t bytes_done = 0, bytes_now = 0;
+    uint32_t longest = 0;
+    for (i = 0; i < MR->num_contigs; ++i) {
+        if (MR->contig_lengths[i] > longest)
+            longest = MR->contig_lengths[i];
+    }
+    // hold the pileup count at each position in the contig, reused for every contig
+    PM_depth_buffers * depths = createDepthBuffers(numBams, longest, PM_COVERAGE_USES_HISTOGRAM(MR->is_outlier_coverage));
+    // or swapped for a spare while a finaliser adjusts it (the streamed row can't be shared)
+    PM_finaliser_pool finalisers;
+    finalisers.num_finalisers = 0;
+    if(opts->num_finalisers > 0 && stream == NULL)
+        startFinalisers(&finalisers, MR, opts->num_finalisers, longest, PM_COVERAGE_USES_HISTOGRAM(MR->is_outlier_coverage));
+    // go through each of the contigs in the file, from tid == 0 --> end
+    uint64_t start = statsClock(), adjust_start = 0;
+
+    while ((mplp_ret = bam_mplp_auto(mplp, &tid, &pos, n_plp, plp)) > 0) { // come to the next covered position
+        if (pos < beg || pos >= end) continue; // out of range; skip
+        if(tid != prev_tid) {  // we've arrived at a new contig
+            if(prev_tid != -1 && finalisers.num_finalisers > 0) {
+                // at the end of a contig, carry on with a clean set while it's adjusted
+                depths = finaliseContig(&finalisers, depths, prev_tid);
+            } else if(prev_tid != -1) {
+                // at the end of a contig
+                adjust_start = statsClock();
+                adjustPlpBp(MR, depths, prev_tid);
+                clearDepthBuffers(depths); // reset for next contig
+                MR->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - adjust_start;
+                PM_TRACE3(contig_end, prev_tid, PM_MR_LENGTH(MR, prev_tid), contigPlpSum(MR, prev_tid));
+            }
+            // hand over what's done and move the row along to this contig
+            if(stream != NULL && streamContigsBefore(stream, MR, tid)) break;
+            PM_TRACE2(contig_start, tid, PM_MR_LENGTH(MR, tid));
+            PM_MARK_SEEN(opts, tid);
+            prev_tid = tid;
+            if(progress != NULL) {
+                bytes_now = compressedBytesRead(data, numBams);
+                if(updateProgress(progress, tid, bytes_now - bytes_done, tid - contigs_done)) break;
+                bytes_done = bytes_now;
+                contigs_done = tid;
+            }
+        } else if(progress != NULL && ((++columns) & PM_PROGRESS_COLUMN_MASK) == 0) {
+            // long contigs still report by bytes and can be cancelled part way
+            bytes_now = compressedBytesRead(data, numBams);
+            if(updateProgress(progress, tid, bytes_now - bytes_done, 0)) break;
+            bytes_done = bytes_now;
+        }
+        countPileupColumn(MR, MR->links, &MR->stats, depths, opts, tid, pos, pos, n_plp, plp);
+    }
+
+    if(PM_PROGRESS_IS_CANCELLED(progress) || PM_STREAM_IS_CANCELLED(stream)) {
+        MR->stats.timer_ns[PM_TIMER_PILEUP] += statsClock() - start;
+        if(finalisers.num_finalisers > 0)
+            stopFinalisers(&finalisers, &MR->stats);
+        destroyDepthBuffers(depths);
+        free(n_plp); free(plp);
+        bam_mplp_destroy(mplp);
+        return PM_PARSE_CANCELLED;
+    }
+    if(mplp_ret < 0) {
+        // a reader hit a truncated or corrupt BAM, which is not the end of it
+        printError("Could not read a BAM, it may be truncated", __LINE__);
+        MR->stats.timer_ns[PM_TIMER_PILEUP] += statsClock() - start;
+        if(finalisers.num_finalisers > 0)
+            stopFinalisers(&finalisers, &MR->stats);
+        destroyDepthBuffers(depths);
+        free(n_plp); free(plp);
+        bam_mplp_destroy(mplp);
+        return 1;
+    }
+
+    if(prev_tid != -1 && finalisers.num_finalisers > 0) {
+        depths = finaliseContig(&finalisers, depths, prev_tid);
+    } else if(prev_tid != -1) {
+        // at the end of a contig
+        adjust_start = statsClock();
+        adjustPlpBp(MR, depths, prev_tid);
+        MR->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - adjust_start;
+        PM_TRACE3(contig_end, prev_tid, PM_MR_LENGTH(MR, prev_tid), contigPlpSum(MR, prev_tid));
+    }
+    // every row is written once the finalisers have drained
+    if(finalisers.num_finalisers > 0)
+        stopFinalisers(&finalisers, &MR->stats);
+    MR->stats.timer_ns[PM_TIMER_PILEUP] += statsClock() - start;
+
+    destroyDepthBuffers(depths);
+
+    free(n_plp); free(plp);
+    bam_mplp_destroy(mplp);
+
+    // the last contig and any trailing ones with no reads
+    if(stream != NULL && streamContigsBefore(stream, MR, MR->num_contigs))
+        return PM_PARSE_CANCELLED;
+
+    // the last report covers the trailing contigs with no reads
+    if(progress != NULL) {
+        bytes_now = compressedBytesRead(data, numBams);
+        if(updateProgress(progress, prev_tid, bytes_now - bytes_done, MR->num_contigs - contigs_done))
+            return PM_PARSE_CANCELLED;
+    }
+    return 0;
+}
+
+static int checkCoverageOptions(PM_parse_options * opts)
+{
+    //-----
+    // an unknown mode would leave every cell zero and fractions outside
+    // [0, 1] aren't ranks, so refuse both before anything is opened
+    //
+    if(opts->do_outlier_coverage < PM_COVERAGE_MEAN || opts->do_outlier_coverage > PM_COVERAGE_PERCENTILE_CLIP) {
+        printError("Unknown coverage mode", __LINE__);
+        return 1;
+    }
+    if(!(opts->coverage_lower >= 0 && opts->coverage_lower < opts->coverage_upper && opts->coverage_upper <= 1)) {
+        printError("Coverage fractions must satisfy 0 <= lower < upper <= 1", __LINE__);
+        return 1;
+    }
+    return 0;
+}
+
+static void emptyMR(PM_mapping_results * MR)
+{
+    // what's left of a cancelled parse, safe to destroy again
+    destroy_MR(MR);
+    memset(MR, 0, sizeof(PM_mapping_results));
+}
+
+int parseCoverageAndLinksWithOptions(int numBams,
+                                     char* bamFiles[],
+                                     PM_parse_options * opts,
+                                     PM_mapping_results * MR
+) {
+    uint64_t start = statsClock();
+    int ret = 0;
+    PM_TRACE2(parse_start, numBams, opts->num_workers);
+    if(checkCoverageOptions(opts) != 0) {
+        PM_TRACE1(parse_end, 1);
+        return 1;
+    }
+
+    //-----
+    // only parse what isn't cached already
+    //
+    if(opts->cache_dir != NULL && opts->consumer == NULL) {
+        ret = parseCoverageAndLinksCached(numBams, bamFiles, opts, MR);
+        if(ret == PM_PARSE_CANCELLED)
+            emptyMR(MR);
+        else
+            MR->stats.timer_ns[PM_TIMER_TOTAL] = statsClock() - start;
+        PM_TRACE1(parse_end, ret);
+        return ret;
+    }
+
+    //-----
+    // too many BAMs to have open at once, so take them a group at a time
+    //
+    if(PM_USE_BATCHES(opts) && opts->consumer == NULL) {
+        ret = parseCoverageAndLinksBatched(numBams, bamFiles, opts, MR);
+        if(ret == PM_PARSE_CANCELLED)
+            emptyMR(MR);
+        else
+            MR->stats.timer_ns[PM_TIMER_TOTAL] = statsClock() - start;
+        PM_TRACE1(parse_end, ret);
+        return ret;
+    }
+
+    //-----
+    // one pool of inflaters shared by every BAM we open
+    //
+    hts_tpool * pool = NULL;
+    if(opts->num_threads > 1) {
+        pool = hts_tpool_init(opts->num_threads);
+        if(pool == NULL)
+            printError("Could not start BGZF threads, decompressing inline", __LINE__);
+    }
+
+    //-----
+    // hand off to the contig workers if we can, otherwise one pass over everything
+    //
+    if(opts->num_workers > 1 || PM_USE_REGIONS(opts)) {
+        ret = parseCoverageAndLinksParallel(numBams, bamFiles, opts, pool, MR);
+        if(ret != PM_PARALLEL_NO_INDEX || PM_USE_REGIONS(opts)) {
+            if(pool) hts_tpool_destroy(pool);
+            if(ret == PM_PARSE_CANCELLED)
+                emptyMR(MR);
+            else
+                MR->stats.timer_ns[PM_TIMER_TOTAL] = statsClock() - start;
+            PM_TRACE1(parse_end, ret);
+            return ret;
+        }
+        printError("Parsing serially", __LINE__);
+    }
+
+    //-----
+    // or let each BAM go at its own pace
+    //
+    if(opts->num_bam_workers > 0 && opts->consumer == NULL) {
+        ret = parseCoverageAndLinksPerBam(numBams, bamFiles, opts, pool, MR);
+        if(pool) hts_tpool_destroy(pool);
+        if(ret == PM_PARSE_CANCELLED)
+            emptyMR(MR);
+        else
+            MR->stats.timer_ns[PM_TIMER_TOTAL] = statsClock() - start;
+        PM_TRACE1(parse_end, ret);
+        return ret;
+    }
+
+    // initialize the auxiliary data structures
     bam_hdr_t *h = 0; // BAM header of the 1st input
     aux_t **data;
-    bam_mplp_t mplp;
-    int i = 0, tid = 0, *n_plp;
+    int i = 0;
     // load contig names and BAM index.
     data = calloc(numBams, sizeof(void*)); // data[i] for the i-th input
-    int beg = 0, end = 1<<30;  // set the default region
 
     for (i = 0; i < numBams; ++i) {
         data[i] = calloc(1, sizeof(aux_t));
         data[i]->fp = bgzf_open(bamFiles[i], "r"); // open BAM
-        data[i]->min_mapQ = mapQ;                    // set the mapQ filter
-        data[i]->min_len  = minLen;                 // set the qlen filter
+        if(pool) bgzf_thread_pool(data[i]->fp, pool, 0); // inflate ahead of the pileup
+        data[i]->min_mapQ = opts->mapQ;           // set the mapQ filter
+        data[i]->min_len  = opts->min_len;        // set the qlen filter
+        data[i]->stats = &MR->stats;              // zeroed by init_MR before any reads
+        data[i]->bam_ID = i;
         bam_hdr_t *htmp;
         htmp = bam_hdr_read(data[i]->fp);         // read the BAM header ( I think this must be done for each file for legitness!)
         if (i == 0) {
@@ -376,155 +721,260 @@ int parseCoverageAndLinks(int numBams,
             h,
             numBams,
             bamFiles,
-            doLinks,
-            doOutlierCoverage,
-            ignoreSuppAlignments
+            opts->do_links,
+            opts->do_outlier_coverage,
+            opts->ignore_supps
            );
+    MR->coverage_lower = opts->coverage_lower;
+    MR->coverage_upper = opts->coverage_upper;
+    MR->stats.timer_ns[PM_TIMER_SETUP] = statsClock() - start;
 
-    // the core multi-pileup loop
-    mplp = bam_mplp_init(numBams, read_bam, (void**)data); // initialization
-    n_plp = calloc(numBams, sizeof(int)); // n_plp[i] is the number of covering reads from the i-th BAM
-    plp = calloc(numBams, sizeof(void*)); // plp[i] points to the array of covering reads (internal in mplp)
-
-    // initialise
-    int prev_tid = -1;  // the id of the previous positions tid
-    int j, rejects = 0;
-    int pos = 0; // current position in the contig ( 1 indexed )
-    uint32_t ** position_holder; // hold the pileup count at each position in the contig
-    position_holder = calloc(numBams, sizeof(uint32_t*));
-    // go through each of the contigs in the file, from tid == 0 --> end
+    PM_progress_tracker tracker, * progress = NULL;
+    if(opts->progress != NULL) {
+        initProgress(&tracker, opts->progress, opts->progress_data, opts->progress_contigs,
+                     opts->progress_mb, numBams, bamFiles, MR->num_contigs);
+        progress = &tracker;
+    }
 
-    while (bam_mplp_auto(mplp, &tid, &pos, n_plp, plp) > 0) { // come to the next covered position
-        if (pos < beg || pos >= end) continue; // out of range; skip
-        if(tid != prev_tid) {  // we've arrived at a new contig
-            if(prev_tid != -1) {
-                // at the end of a contig
-                adjustPlpBp(MR, position_holder, prev_tid);
-                for (i = 0; i < numBams; ++i) {
-                    free(position_holder[i]); // free this up
-                }
-            }
-            for (i = 0; i < numBams; ++i) {
-                // reset for next contig
-                position_holder[i] = calloc(MR->contig_lengths[tid], sizeof(uint32_t));
-            }
-            prev_tid = tid;
-        }
+    // records are read and filtered ahead of the pileup if asked to
+    if(opts->read_ahead > 0) {
         for (i = 0; i < numBams; ++i) {
-            rejects = 0;
-            // for each read in the pileup
-            for (j = 0; j < n_plp[i]; ++j) {
-                const bam_pileup1_t *p = plp[i] + j; // DON'T modfity plp[][] unless you really know
-                if (p->is_del || p->is_refskip) {++rejects;} // having dels or refskips at tid:pos
-                else if (bam_get_qual(p->b)[p->qpos] < baseQ) {++rejects;} // low base quality
-                else if(MR->is_links_included) {
-                    // now we do links if we've been asked to
-                    bam1_core_t core = p->b[0].core;
-                    // check to see if this is a proper linking paired read
-                    if (p->is_head &&                               // first time we've seen this read
-                        (core.flag & BAM_FPAIRED) &&                // read is a paired read
-                        (core.flag & BAM_FREAD1) &&                 // read is first in pair (avoid dupe links)
-                        ((core.flag & PM_BAM_FMAPPED) == 0) &&      // both ends are mapped
-                        ((core.flag & supp_check) == 0) &&          // is primary mapping (optional)
-                        core.tid != core.mtid) {                    // hits different contigs
-
-                        // looks legit
-                        addLink(MR->links,
-                                core.tid,                           // contig 1
-                                core.mtid,                          // contig 2
-                                core.pos,                           // pos 1
-                                core.mpos,                          // pos 2
-                                ((core.flag&BAM_FREVERSE) != 0),    // 1 == reversed
-                                ((core.flag&BAM_FMREVERSE) != 0),   // 0 = agrees
-                                i);                                 // bam file ID
-                    }
-                }
+            if(startReadAhead(data[i], opts->read_ahead, numBams) != 0) {
+                printError("Could not start read ahead thread, reading inline", __LINE__);
+                break;
             }
-            position_holder[i][pos] = n_plp[i] - rejects; // add this position's depth
         }
     }
 
-    if(prev_tid != -1) {
-        // at the end of a contig
-        adjustPlpBp(MR, position_holder, prev_tid);
-        for (i = 0; i < numBams; ++i) {
-            free(position_holder[i]);
-        }
+    PM_contig_stream contig_stream, * stream = NULL;
+    if(opts->consumer != NULL) {
+        initContigStream(&contig_stream, opts->consumer, opts->consumer_data);
+        initStreamRows(MR);
+        stream = &contig_stream;
     }
 
-    free(position_holder);
+    // without a base quality filter there is no need to build a pileup
+    if(PM_USE_CIGAR_ENGINE(opts))
+        ret = parseWithCigars(data, opts, progress, stream, MR);
+    else
+        ret = parseWithPileup(data, opts, progress, stream, MR);
+    destroyProgress(progress);
+
+    if(stream != NULL) {
+        // everything has been handed over
+        destroyStreamRows(MR);
+        destroyLinks(MR->links);
+        MR->links = NULL;
+        destroyContigStream(stream);
+    }
 
-    free(n_plp); free(plp);
-    bam_mplp_destroy(mplp);
     bam_hdr_destroy(h);
 
     for (i = 0; i < numBams; ++i) {
+        stopReadAhead(data[i], &MR->stats);
         bgzf_close(data[i]->fp);
         if (data[i]->iter) bam_itr_destroy(data[i]->iter);
         free(data[i]);
     }
     free(data);
 
-    return 0;
+    // only safe once every file using it is closed
+    if(pool) hts_tpool_destroy(pool);
+
+    if(ret == PM_PARSE_CANCELLED)
+        emptyMR(MR);
+    else
+        MR->stats.timer_ns[PM_TIMER_TOTAL] = statsClock() - start;
+    PM_TRACE1(parse_end, ret);
+    return ret;
 }
 
-void adjustPlpBp(PM_mapping_results * MR,
-                 uint32_t ** positionHolder,
-                 int tid
+static uint32_t saturatePlpBp(PM_mapping_results * MR, uint64_t count)
+{
+    //-----
+    // plp_bp is 32 bits wide, clamp rather than wrap and count the clamps
+    // (columns can be adjusted on several threads at once)
+    //
+    if(count <= UINT32_MAX)
+        return (uint32_t)count;
+    __atomic_add_fetch(&MR->stats.plp_bp_saturated, 1, __ATOMIC_RELAXED);
+    return UINT32_MAX;
+}
+
+static void adjustPlpBpHistogram(PM_mapping_results * MR,
+                                 PM_depth_histogram * hist,
+                                 int tid,
+                                 int bamID
+) {
+    //-----
+    // robust estimators straight from the histogram, O(distinct depths)
+    //
+    uint64_t kept = 0, drops = 0;
+    finishDepthHistogram(hist, PM_MR_LENGTH(MR, tid));
+    switch(MR->is_outlier_coverage) {
+        case PM_COVERAGE_TRIMMED_MEAN:
+            histogramTrimmedSum(hist, MR->coverage_lower, MR->coverage_upper, &kept, &drops);
+            break;
+        case PM_COVERAGE_MEDIAN:
+            histogramMedianSum(hist, &kept, &drops);
+            break;
+        case PM_COVERAGE_PERCENTILE_CLIP:
+            histogramPercentileClipSum(hist, MR->coverage_lower, MR->coverage_upper, &kept, &drops);
+            break;
+        default:
+            // checked before the parse, but keep every position rather than none
+            histogramTrimmedSum(hist, 0, 1, &kept, &drops);
+            break;
+    }
+    MR->plp_bp[PM_MR_CELL(MR, tid, bamID)] = saturatePlpBp(MR, kept);
+    MR->contig_length_correctors[PM_MR_CELL(MR, tid, bamID)] = (uint32_t)drops; // at most the contig length
+    PM_TRACE5(adjust, tid, bamID, kept, kept, drops);
+}
+
+void adjustPlpBpColumn(PM_mapping_results * MR,
+                       PM_depth_buffer * depth,
+                       int tid,
+                       int bamID
 ) {
-    uint32_t num_bams = MR->num_bams;
-    uint32_t * plp_sum = calloc(num_bams, sizeof(uint32_t));
-    int pos = 0, i = 0;
+    uint32_t contig_length = PM_MR_LENGTH(MR, tid);
+    uint64_t plp_sum = 0, sq_sum = 0;
+    if(depth->hist) {
+        adjustPlpBpHistogram(MR, depth->hist, tid, bamID);
+        return;
+    }
+    // pass one: nothing outside [lo, hi) was written so it adds nothing
+    depthBufferMoments(depth, &plp_sum, &sq_sum);
     if(MR->is_outlier_coverage) {
-        uint32_t * drops = calloc(num_bams, sizeof(uint32_t));
-        for(i = 0; i < num_bams; ++i) {
-            // set the cut off at a stdev either side of the mean
-            float m = PM_mean(positionHolder[i], MR->contig_lengths[tid]);
-            float std = PM_stdDev(positionHolder[i], MR->contig_lengths[tid], m);
-            float lower_cut = ((m-std) < 0) ? 0 : (m-std);
-            float upper_cut = m+std;
-            for(pos = 0; pos < MR->contig_lengths[tid]; ++pos) {
-                if((positionHolder[i][pos] <= upper_cut) && (positionHolder[i][pos] >= lower_cut)) {
-                    // OK
-                    plp_sum[i] += positionHolder[i][pos];
-                } else {
-                    // DROP
-                    ++drops[i];
-                }
-            }
-            MR->plp_bp[tid][i] = plp_sum[i];
-            MR->contig_length_correctors[tid][i] = drops[i];
+        uint64_t kept = 0, drops = 0;
+        // set the cut off at a stdev either side of the mean
+        double m = (double)plp_sum/(double)contig_length;
+        double var = (double)sq_sum/(double)contig_length - m*m;
+        double std = (var > 0) ? sqrt(var) : 0;
+        double lower_cut = ((m-std) < 0) ? 0 : ceil(m-std);
+        double upper_cut = floor(m+std);
+        if(upper_cut > UINT32_MAX) upper_cut = UINT32_MAX;
+        // pass two
+        if(lower_cut <= upper_cut)
+            depthBufferClippedSum(depth, (uint32_t)lower_cut, (uint32_t)upper_cut, &kept, &drops);
+        else
+            drops = depth->hi - depth->lo; // nothing can be kept
+        if(lower_cut > 0) {
+            // the unwritten positions are all zero depth
+            drops += contig_length - (depth->hi - depth->lo);
         }
-        free(drops);
+        MR->plp_bp[PM_MR_CELL(MR, tid, bamID)] = saturatePlpBp(MR, kept);
+        MR->contig_length_correctors[PM_MR_CELL(MR, tid, bamID)] = (uint32_t)drops; // at most the contig length
+        PM_TRACE5(adjust, tid, bamID, plp_sum, kept, drops);
     } else {
-        for(i = 0; i < num_bams; ++i) {
-            for(pos = 0; pos < MR->contig_lengths[tid]; ++pos) {
-                plp_sum[i] += positionHolder[i][pos];
+        MR->plp_bp[PM_MR_CELL(MR, tid, bamID)] = saturatePlpBp(MR, plp_sum);
+        PM_TRACE5(adjust, tid, bamID, plp_sum, plp_sum, 0);
+    }
+}
+
+void adjustPlpBp(PM_mapping_results * MR,
+                 PM_depth_buffers * depths,
+                 int tid
+) {
+    int i = 0;
+    for(i = 0; i < MR->num_bams; ++i) {
+        adjustPlpBpColumn(MR, &depths->buffers[i], tid, i);
+    }
+}
+
+uint64_t contigPlpSum(PM_mapping_results * MR, int tid) {
+    uint64_t sum = 0;
+    int i = 0;
+    for(i = 0; i < MR->num_bams; ++i) {
+        sum += MR->plp_bp[PM_MR_CELL(MR, tid, i)];
+    }
+    return sum;
+}
+
+void initStreamRows(PM_mapping_results * MR) {
+    freeMRBlock(MR, MR->plp_bp);
+    freeMRBlock(MR, MR->contig_length_correctors);
+    MR->plp_bp = calloc(MR->num_bams, sizeof(uint32_t));
+    MR->contig_length_correctors = MR->is_outlier_coverage ? calloc(MR->num_bams, sizeof(uint32_t)) : NULL;
+    MR->row_offset = 0;
+}
+
+int streamContig(PM_contig_stream * stream, PM_mapping_results * MR, int tid) {
+    PM_contig_result result;
+    int cancelled = 0;
+    result.tid = tid;
+    result.name = MR->contig_names[tid];
+    result.length = PM_MR_LENGTH(MR, tid);
+    result.num_bams = MR->num_bams;
+    result.plp_bp = MR->plp_bp;
+    result.correctors = MR->contig_length_correctors;
+    result.links = MR->is_links_included ? MR->links : NULL;
+    cancelled = emitContig(stream, &result);
+
+    // ready for the next one
+    memset(MR->plp_bp, 0, MR->num_bams * sizeof(uint32_t));
+    if(MR->contig_length_correctors != NULL)
+        memset(MR->contig_length_correctors, 0, MR->num_bams * sizeof(uint32_t));
+    if(result.links != NULL)
+        clearLinks(result.links);
+    return cancelled;
+}
+
+int streamContigsBefore(PM_contig_stream * stream, PM_mapping_results * MR, int tid) {
+    for(; stream->next_tid < tid; ++stream->next_tid) {
+        MR->row_offset = stream->next_tid;
+        if(streamContig(stream, MR, stream->next_tid))
+            break;
+    }
+    MR->row_offset = tid;
+    return stream->cancelled;
+}
+
+void destroyStreamRows(PM_mapping_results * MR) {
+    free(MR->plp_bp);
+    free(MR->contig_length_correctors);
+    MR->plp_bp = NULL;
+    MR->contig_length_correctors = NULL;
+    MR->row_offset = 0;
+}
+
+int calculateCoveragesInto(PM_mapping_results * MR, float * out) {
+    size_t cell = 0;
+    int i = 0, j = 0;
+    if(MR->num_contigs == 0 || MR->num_bams == 0 || MR->plp_bp == NULL)
+        return 1;
+    for(i = 0; i < MR->num_contigs; ++i) {
+        uint32_t length = PM_MR_LENGTH(MR, i);
+        for(j = 0; j < MR->num_bams; ++j, ++cell) {
+            // print average coverages
+            if(length == 0) {
+                // contig wasn't in the regions parsed
+                out[cell] = 0;
+            } else if(MR->is_outlier_coverage && MR->contig_length_correctors[cell] >= length) {
+                // every position was dropped, nothing to average
+                out[cell] = 0;
+            } else if(MR->is_outlier_coverage) {
+                // the counts are reduced so we should reduce the contig length accordingly
+                out[cell] = (float)MR->plp_bp[cell]/(float)(length-MR->contig_length_correctors[cell]);
+            } else {
+                // otherwise it's just a straight up average
+                out[cell] = (float)MR->plp_bp[cell]/(float)length;
             }
-            MR->plp_bp[tid][i] = plp_sum[i];
         }
     }
-    free(plp_sum);
+    return 0;
 }
 
 float ** calculateCoverages(PM_mapping_results * MR) {
-    int i = 0, j = 0;
+    int i = 0;
     if(MR->num_contigs != 0 && MR->num_bams != 0) {
         if(MR->plp_bp != NULL) {
+            // one block for the numbers and row pointers into it
             float ** ret_matrix = calloc(MR->num_contigs, sizeof(float*));
-            for(i = 0; i < MR->num_contigs; ++i) {
-                ret_matrix[i] = calloc(MR->num_bams, sizeof(float));
-                for(j = 0; j < MR->num_bams; ++j) {
-                    // print average coverages
-                    if(MR->is_outlier_coverage) {
-                        // the counts are reduced so we should reduce the contig length accordingly
-                        ret_matrix[i][j] = (float)MR->plp_bp[i][j]/(float)(MR->contig_lengths[i]-MR->contig_length_correctors[i][j]);
-                    } else {
-                        // otherwise it's just a straight up average
-                        ret_matrix[i][j] = (float)MR->plp_bp[i][j]/(float)MR->contig_lengths[i];
-                    }
-                }
+            ret_matrix[0] = calloc((size_t)MR->num_contigs * MR->num_bams, sizeof(float));
+            for(i = 1; i < MR->num_contigs; ++i) {
+                ret_matrix[i] = ret_matrix[0] + (size_t)i * MR->num_bams;
             }
+            calculateCoveragesInto(MR, ret_matrix[0]);
             return ret_matrix;
         }
     }
@@ -532,10 +982,10 @@ float ** calculateCoverages(PM_mapping_results * MR) {
 }
 
 void destroyCoverages(float ** covs, int numContigs) {
-    int i = 0;
-    for(i = 0; i < numContigs; ++i) {
-        free(covs[i]);
-    }
+    if(covs == NULL)
+        return;
+    if(numContigs > 0)
+        free(covs[0]);
     free(covs);
 }
 
@@ -560,6 +1010,7 @@ void print_MR(PM_mapping_results * MR) {
                 }
                 printf("\n");
                 for(i = 0; i < MR->num_contigs; ++i) {
+                    if(PM_MR_LENGTH(MR, i) == 0) continue; // not in the regions parsed
                     printf("%s\t%d", MR->contig_names[i], MR->contig_lengths[i]);
                     for(j = 0; j < MR->num_bams; ++j) {
                         printf("\t%0.4f", covs[i][j]);
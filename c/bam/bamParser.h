@@ -34,12 +34,14 @@
 // htslib
 #include "htslib/bgzf.h"
 #include "htslib/sam.h"
-
-// cfuhash
-#include "cfuhash.h"
+#include "htslib/thread_pool.h"
 
 // local includes
 #include "pairedLink.h"
+#include "depthBuffer.h"
+#include "parseStats.h"
+#include "progress.h"
+#include "contigStream.h"
 
 typedef BGZF bamFile;
 
@@ -55,31 +57,85 @@ extern int vomit(int fred);
  @field iter NULL if a region not specified
  @field min_mapQ mapQ filter
  @field min_len length filter
+ @field stats counters to update (NULL to count nothing)
+ @field bam_ID index of this BAM in stats->bytes_inflated
+ @field ahead thread reading this BAM ahead of the pileup (NULL to read inline, see pipeline.h)
  */
 typedef struct {                    //
     bamFile *fp;                    // the file handler
     hts_itr_t *iter;                // NULL if a region not specified
     int min_mapQ, min_len;          // mapQ filter; length filter
+    PM_parse_stats *stats;          // where the read counters go
+    int bam_ID;                     // which BAM this is
+    struct PM_read_ahead *ahead;    // records read on another thread
 } aux_t;
 
+/*! @typedef
+ @abstract Ways of turning per-position depths into a contig's coverage
+ @constant PM_COVERAGE_MEAN plain average depth
+ @constant PM_COVERAGE_OUTLIER_SD ignore positions more than a stdev from the mean
+ @constant PM_COVERAGE_TRIMMED_MEAN ignore the lowest and highest ranked positions
+ @constant PM_COVERAGE_MEDIAN median depth
+ @constant PM_COVERAGE_PERCENTILE_CLIP ignore positions deeper or shallower than two percentile depths
+ */
+typedef enum {
+    PM_COVERAGE_MEAN = 0,
+    PM_COVERAGE_OUTLIER_SD = 1,
+    PM_COVERAGE_TRIMMED_MEAN = 2,
+    PM_COVERAGE_MEDIAN = 3,
+    PM_COVERAGE_PERCENTILE_CLIP = 4
+} PM_coverage_mode;
+
+// these modes only need a depth histogram, not the depth at every position
+#define PM_COVERAGE_USES_HISTOGRAM(mode) ((mode) >= PM_COVERAGE_TRIMMED_MEAN)
+
+// default fractions used by the trimmed mean and percentile clip
+#define PM_COVERAGE_DEFAULT_LOWER 0.05
+#define PM_COVERAGE_DEFAULT_UPPER 0.95
+
+// index of (contig, bam) in the row-major plp_bp and contig_length_correctors blocks
+#define PM_MR_CELL(MR, tid, bam) ((size_t)((tid) - (MR)->row_offset) * (MR)->num_bams + (bam))
+
+// number of positions of a contig that were parsed
+#define PM_MR_LENGTH(MR, tid) ((MR)->region_lengths ? (MR)->region_lengths[(tid)] : (MR)->contig_lengths[(tid)])
+
+// bit tid of a bitmap with one bit per contig ((num_contigs + 7) / 8 bytes)
+#define PM_SEEN(seen, tid) ((seen)[(tid) >> 3] & (1 << ((tid) & 7)))
+#define PM_SET_SEEN(seen, tid) ((seen)[(tid) >> 3] |= (uint8_t)(1 << ((tid) & 7)))
+
+// set bit tid of opts->seen_contigs if there is one, contig workers share it
+#define PM_MARK_SEEN(opts, tid) do { \
+        if((opts)->seen_contigs != NULL) \
+            __atomic_or_fetch(&(opts)->seen_contigs[(tid) >> 3], (uint8_t)(1 << ((tid) & 7)), __ATOMIC_RELAXED); \
+    } while(0)
+
 /*! @typedef
  @abstract Structure for returning mapping results
- @field plp_bp number of bases piled up on each contig
+ @field plp_bp number of bases piled up on each contig (num_contigs x num_bams, row-major), UINT32_MAX if it overflowed (see stats.plp_bp_saturated)
  @field contig_lengths lengths of the referene sequences
- @field contig_length_correctors corrections to contig lengths used when doing outlier coverage
+ @field contig_length_correctors corrections to contig lengths used when doing outlier coverage (as plp_bp)
  @field num_bams number of BAM files parsed
  @field num_contigs number of reference sequences
  @field contig_names names of the reference sequences
  @field bam_file_names names of the bam files used in this mapping result
  @field is_links_included are links being calculated
- @field is_outlier_coverage is outlier adjusted coverage being calculated
+ @field is_outlier_coverage PM_coverage_mode used, non-zero when contig_length_correctors is set
  @field is_ignore_supps are supplementary alignments being ignored
  @field links linking pairs
+ @field coverage_lower lower fraction used by the trimmed mean and percentile clip
+ @field coverage_upper upper fraction used by the trimmed mean and percentile clip
+ @field region_lengths bases of each contig inside the parsed regions (NULL if whole contigs were parsed)
+ @field mapping file mapped by load_MR which the arrays point into (NULL if they were allocated)
+ @field mapping_size size of mapping in bytes
+ @field stats where the parse spent its time and what it dropped (zero if loaded with load_MR)
+ @field row_offset tid of the first row of plp_bp and contig_length_correctors (0 unless streaming, see contigStream.h)
+ @field region_digest regionSetDigest of the parsed regions (0 if whole contigs were parsed)
+ @field seen_contigs bit per contig (see PM_SEEN) set if any of the BAMs had reads there (NULL unless kept by the cache)
  */
 typedef struct {
-    uint32_t ** plp_bp;
+    uint32_t * plp_bp;
     uint32_t * contig_lengths;
-    uint32_t ** contig_length_correctors;
+    uint32_t * contig_length_correctors;
     uint32_t num_bams;
     uint32_t num_contigs;
     char ** contig_names;
@@ -87,12 +143,103 @@ typedef struct {
     int is_links_included;
     int is_outlier_coverage;
     int is_ignore_supps;
-    cfuhash_table_t * links;
+    PM_link_table * links;
+    float coverage_lower;
+    float coverage_upper;
+    uint32_t * region_lengths;
+    void * mapping;
+    size_t mapping_size;
+    PM_parse_stats stats;
+    int row_offset;
+    uint64_t region_digest;
+    uint8_t * seen_contigs;
 } PM_mapping_results;
 
+/*! @typedef
+ @abstract Settings which control how the BAM files are parsed
+ @field baseQ base quality threshold
+ @field mapQ mapping quality threshold
+ @field min_len min query length
+ @field do_links 1 if links should be calculated
+ @field ignore_supps only use primary alignments
+ @field do_outlier_coverage PM_coverage_mode to use (1 is the stdev clip)
+ @field num_workers number of contig worker threads (<= 1 means parse serially)
+ @field num_threads number of BGZF decompression threads shared by all BAMs (<= 1 means none)
+ @field coverage_lower lower fraction for the trimmed mean and percentile clip
+ @field coverage_upper upper fraction for the trimmed mean and percentile clip
+ @field regions contig names or contig:beg-end strings to restrict the parse to (see regions.h)
+ @field num_regions number of strings in regions
+ @field bed_file BED file of regions to restrict the parse to (NULL for none)
+ @field cache_dir directory of cached per-BAM results to reuse and add to (NULL for no cache)
+ @field progress called as the parse goes, return non-zero to cancel it (NULL for none)
+ @field progress_data passed through to progress
+ @field progress_contigs call progress after this many contigs (<= 0 for never)
+ @field progress_mb call progress after this many MB of compressed input (<= 0 for never)
+ @field consumer called with each contig as it is finished instead of keeping it in MR (NULL to keep everything)
+ @field consumer_data passed through to consumer
+ @field num_finalisers threads finishing contigs while the serial pileup moves on (0 for inline)
+ @field read_ahead records to read and filter ahead of a serial parse, per BAM on its own thread (0 for inline)
+ @field chunk_size cut contigs into chunks of this many bases, scheduled per BAM with work stealing (0 for whole contigs)
+ @field num_bam_workers threads each parsing whole BAMs one at a time with a single BAM pileup (0 for a lock-step multi-pileup)
+ @field max_open_files most BAM files to have open at once, parsing them a group at a time (0 for no limit)
+ @field memory_mb rough memory budget for the open BAM files in MB, also parsing them a group at a time (0 for no limit)
+ @field seen_contigs if set, bit tid (see PM_SEEN) is set for each contig with reads piled up or walked, (num_contigs + 7) / 8 bytes which are never cleared
+ */
+typedef struct {
+    int baseQ;
+    int mapQ;
+    int min_len;
+    int do_links;
+    int ignore_supps;
+    int do_outlier_coverage;
+    int num_workers;
+    int num_threads;
+    float coverage_lower;
+    float coverage_upper;
+    char ** regions;
+    int num_regions;
+    char * bed_file;
+    char * cache_dir;
+    PM_progress_callback progress;
+    void * progress_data;
+    int progress_contigs;
+    int progress_mb;
+    PM_contig_consumer consumer;
+    void * consumer_data;
+    int num_finalisers;
+    int read_ahead;
+    int chunk_size;
+    int num_bam_workers;
+    int max_open_files;
+    int memory_mb;
+    uint8_t * seen_contigs;
+} PM_parse_options;
+
 int read_bam(void *data,
              bam1_t *b);
 
+/*!
+ * @abstract How far through their BAMs a set of readers are
+ *
+ * @param  data  one reader per BAM
+ * @param  numBams  number of readers
+ * @return compressed bytes read so far, summed over the readers
+ */
+uint64_t compressedBytesRead(aux_t ** data, int numBams);
+
+/*!
+ * @abstract Set the parse options to their default values
+ *
+ * @param opts  options struct to initialise
+ * @return void
+ *
+ * @discussion Defaults match parseCoverageAndLinks called with all zeros
+ * except that supplementary alignments are ignored. cache_dir is taken from
+ * the PM_CACHE_DIR environment variable if it is set. There is no progress
+ * callback but progress_mb is set to PM_PROGRESS_DEFAULT_MB for when there is.
+ */
+void init_parse_options(PM_parse_options * opts);
+
 
 /*!
  * @abstract Allocate space for a new MR struct
@@ -111,13 +258,13 @@ PM_mapping_results * create_MR(void);
  * @param BAM_header  htslib BAM header
  * @param numBams  number of BAM files to parse
  * @param bamFiles  filenames of BAMs parsed
- * @param doOutlierCoverage  set to 1 if should initialise contig_length_correctors
+ * @param doOutlierCoverage  PM_coverage_mode, non-zero initialises contig_length_correctors
  * @param doLinks  1 if links should be calculated
  * @param ignoreSuppAlignments  only use primary alignments
  * @return void
  *
  * @discussion If you call this function then you MUST call destroy_MR
- * when you're done.
+ * when you're done. coverage_lower and coverage_upper get the defaults.
  */
 void init_MR(PM_mapping_results * MR,
              bam_hdr_t * BAM_header,
@@ -138,17 +285,35 @@ void init_MR(PM_mapping_results * MR,
  * @discussion MR_B remains unchanged.
  * MR_A is updated to include all the info contained in MR_B
  *
- * NOTE: We assume that all the haders of all the files are in sync. If they
- * are not, if contigs have been removed etc, then doom will swiftly follow.
- * Also, we assume that flags like do_links, do_outlier match... ...or DOOM!
+ * NOTE: We assume that flags like do_links, do_outlier match... ...or DOOM!
+ * Same as merge_MRs_many with a single MR, so headers are checked.
  */
 void merge_MRs(PM_mapping_results * MR_A, PM_mapping_results * MR_B);
 
+/*!
+ * @abstract Append the contents of several MRs to another in one go
+ *
+ * @param  MR_out  mapping results struct to copy to
+ * @param  MR_in  mapping results structs to copy from, in BAM order
+ * @param  numIn  number of structs in MR_in
+ * @return 0 for success, 1 if the headers don't match (MR_out is unchanged)
+ *
+ * @discussion The MR_in are unchanged. Contig names and lengths (and the
+ * region lengths and coordinates) are compared through one digest per MR. The combined plp_bp and
+ * contig_length_correctors are allocated once and filled with a block move
+ * per row per MR, and links are copied a pair at a time (see copyLinks),
+ * so merging n MRs costs the same as one pass over their data. The
+ * seen_contigs are ORed together, or dropped if any MR_in has none.
+ */
+int merge_MRs_many(PM_mapping_results * MR_out, PM_mapping_results ** MR_in, int numIn);
+
 /*!
  * @abstract Free all the memory calloced in init_MR
  *
  * @param  MR  mapping results struct to destroy
  * @return void
+ *
+ * @discussion If MR came from load_MR the file is unmapped as well.
  */
 void destroy_MR(PM_mapping_results * MR);
 
@@ -161,7 +326,8 @@ void destroy_MR(PM_mapping_results * MR);
  * @param minLen  min query length
  * @param doLinks  1 if links should be calculated
  * @param ignoreSuppAlignments  only use primary alignments
- * @param doOutlierCoverage  set to 1 if should initialise contig_length_correctors
+ * @param doOutlierCoverage  PM_coverage_mode, 1 clips at a stdev either side of the mean
+ * @param numThreads  number of BGZF decompression threads (<= 1 for none)
  * @param bamFiles  filenames of BAM files to parse
  * @param MR  mapping results struct to write to
  * @return 0 for success
@@ -170,6 +336,11 @@ void destroy_MR(PM_mapping_results * MR);
  * init_MR and stores info accordingly. TL;DR If you call this function
  * then you MUST call destroy_MR when you're done.
  *
+ * When numThreads > 1 a single htslib thread pool is attached to every
+ * BAM so blocks are inflated ahead of the pileup.
+ *
+ * If PM_CACHE_DIR is set results are cached there (see resultCache.h).
+ *
  */
 int parseCoverageAndLinks(int numBams,
                           int baseQ,
@@ -178,25 +349,244 @@ int parseCoverageAndLinks(int numBams,
                           int doLinks,
                           int ignoreSuppAlignments,
                           int doOutlierCoverage,
+                          int numThreads,
                           char* bamFiles[],
                           PM_mapping_results * MR);
 
+/*!
+ * @abstract Initialise the mapping results struct <- read in the BAM files
+ *
+ * @param numBams  number of BAM files to parse
+ * @param bamFiles  filenames of BAM files to parse
+ * @param opts  settings to parse with (see PM_parse_options)
+ * @param MR  mapping results struct to write to
+ * @return 0 for success, PM_PARSE_CANCELLED if opts->progress or opts->consumer asked to stop,
+ * non-zero if a BAM could not be read (a truncated BAM is an error, not a short one)
+ *
+ * @discussion Same contract as parseCoverageAndLinks. If opts->num_workers
+ * is more than 1 and every BAM is indexed then contigs are shared out
+ * between worker threads (see parallelParser.h). The results are identical
+ * to those of the serial parser.
+ *
+ * When opts->baseQ is 0 depths are counted by walking each read's CIGAR
+ * (see cigarDepth.h) instead of building a pileup.
+ *
+ * If opts->regions or opts->bed_file are set only those regions are read,
+ * using the index of every BAM, and the parse fails if a BAM has no .bai.
+ * MR still has a row for every contig but only the requested ones are
+ * filled. MR->region_lengths is set and coverage is averaged over just the
+ * bases inside the regions. Links are kept for reads starting inside them.
+ *
+ * If opts->cache_dir is set BAMs already parsed with the same settings are
+ * loaded from there instead (see resultCache.h).
+ *
+ * If opts->progress is set it is called every opts->progress_contigs
+ * contigs or opts->progress_mb MB of compressed input (see progress.h).
+ * With a cache it is called for each BAM that has to be parsed. If it
+ * returns non-zero the parse stops at the next check, everything is freed
+ * and MR is left empty (destroy_MR is still safe to call).
+ *
+ * If opts->consumer is set each contig's row of plp_bp and
+ * contig_length_correctors and its links are handed to it as soon as the
+ * contig has been adjusted, then reused for the next contig (see
+ * contigStream.h). Contigs with no reads are handed over as zeros. Memory
+ * stays at one row per worker whatever the number of contigs. Afterwards MR
+ * only holds the names, lengths and stats, plp_bp and links are NULL, so it
+ * can't be merged, saved or turned into coverages. The cache is not used.
+ * Returning non-zero from the consumer cancels the parse as above.
+ *
+ * Serial parses can be split into stages on their own threads (see
+ * pipeline.h). With opts->read_ahead each BAM is read and filtered by a
+ * thread of its own up to that many records ahead of the pileup. With
+ * opts->num_finalisers a finished contig's depths go to a finaliser thread
+ * for adjustPlpBp and the pileup carries straight on with the next contig,
+ * which costs a set of depth buffers per finaliser. Finalisers are not used
+ * with a consumer or by the CIGAR engine, which finishes a BAM at a time.
+ * The results are the same either way.
+ *
+ * opts->chunk_size makes a parallel parse schedule (BAM, chunk) tasks with
+ * work stealing instead of giving each worker whole contigs, which evens
+ * out parses dominated by a few large contigs. It is ignored by serial
+ * parses and when streaming.
+ *
+ * opts->num_bam_workers swaps the multi-pileup of a serial parse for that
+ * many threads each taking whole BAMs in turn (see perBamParser.h), so a
+ * deep BAM doesn't hold up the others and only one file per thread is open.
+ * A parallel parse takes precedence, and read ahead, finalisers and
+ * streaming don't apply. The results are the same.
+ *
+ * opts->max_open_files and opts->memory_mb bound how many BAMs are open at
+ * once. If they don't all fit the BAMs are parsed a group at a time, up to
+ * opts->num_workers groups at once, and the groups' columns are copied into
+ * MR as they finish (see batchParser.h). Streaming doesn't apply.
+ *
+ * A do_outlier_coverage outside PM_COVERAGE_MEAN..PM_COVERAGE_PERCENTILE_CLIP
+ * or fractions not satisfying 0 <= coverage_lower < coverage_upper <= 1 are
+ * rejected before anything is opened, returning 1 with MR untouched.
+ */
+int parseCoverageAndLinksWithOptions(int numBams,
+                                     char* bamFiles[],
+                                     PM_parse_options * opts,
+                                     PM_mapping_results * MR);
+
+/*!
+ * @abstract Test whether a read is the first of a pair linking two contigs
+ *
+ * @param  core  core alignment info of the read
+ * @param  ignoreSuppAlignments  reject secondary and supplementary alignments
+ * @return 1 if a link should be added for this read
+ */
+int isLinkingRead(bam1_core_t * core, int ignoreSuppAlignments);
+
+/*!
+ * @abstract Add the depth one BAM has in a pileup column and any links it starts
+ *
+ * @param  MR  mapping results struct to write to
+ * @param  links  link table to add any linking reads to
+ * @param  stats  counters for rejected bases and links added
+ * @param  depth  pileup depths for the current contig in this BAM
+ * @param  opts  settings to parse with
+ * @param  bamID  BAM the reads come from
+ * @param  slot  depth buffer slot for this position
+ * @param  n_plp  number of covering reads
+ * @param  plp  covering reads
+ * @return void
+ *
+ * @discussion The caller skips positions past the end of the contig.
+ */
+void countPileupBam(PM_mapping_results * MR,
+                    PM_link_table * links,
+                    PM_parse_stats * stats,
+                    PM_depth_buffer * depth,
+                    PM_parse_options * opts,
+                    int bamID,
+                    uint32_t slot,
+                    int n_plp,
+                    const bam_pileup1_t * plp);
+
+/*!
+ * @abstract Add the depths of a single pileup column to the position holders
+ *
+ * @param  MR  mapping results struct to write to
+ * @param  links  link table to add any linking reads to
+ * @param  stats  counters for rejected bases and links added
+ * @param  depths  pileup depths for the current contig, one buffer per BAM
+ * @param  opts  settings to parse with
+ * @param  tid  contig currently being processed
+ * @param  pos  position in the contig (0 indexed)
+ * @param  slot  depth buffer slot for this position (pos unless parsing regions)
+ * @param  n_plp  number of covering reads from each BAM
+ * @param  plp  covering reads from each BAM
+ * @return void
+ *
+ * @discussion Shared by the serial and the threaded parsers so that both
+ * count depth and find links in exactly the same way.
+ */
+void countPileupColumn(PM_mapping_results * MR,
+                       PM_link_table * links,
+                       PM_parse_stats * stats,
+                       PM_depth_buffers * depths,
+                       PM_parse_options * opts,
+                       int tid,
+                       int pos,
+                       uint32_t slot,
+                       int * n_plp,
+                       const bam_pileup1_t ** plp);
+
 /*!
  * @abstract Adjust (reduce) the number of piled-up bases along a contig
  *
  * @param  MR  mapping results struct to write to
- * @param  position_holder  array of pileup depths
+ * @param  depths  pileup depths along the contig, one buffer per BAM
  * @param  tid  contig currently being processed
- * @param  doOutlierCoverage  remove effects fo very high or very low regions
  * @return void
  *
  * @discussion This function expects MR to be initialised.
- * it can change the values of contig_length_correctors and plp_bp
+ * it can change the values of contig_length_correctors and plp_bp.
+ * If MR->is_outlier_coverage is set the effects of very high or very low
+ * regions are removed, using the histograms for the PM_COVERAGE_USES_HISTOGRAM
+ * modes.
  */
 void adjustPlpBp(PM_mapping_results * MR,
-                 uint32_t ** position_holder,
+                 PM_depth_buffers * depths,
                  int tid);
 
+/*!
+ * @abstract Adjust the piled-up bases along a contig for a single BAM
+ *
+ * @param  MR  mapping results struct to write to
+ * @param  depth  pileup depths along the contig for this BAM
+ * @param  tid  contig currently being processed
+ * @param  bamID  index of the BAM the depths came from
+ * @return void
+ *
+ * @discussion As adjustPlpBp but for one column of plp_bp, so BAMs can be
+ * finished one at a time with a single buffer. A count too big for plp_bp
+ * is stored as UINT32_MAX and counted in MR->stats.plp_bp_saturated.
+ */
+void adjustPlpBpColumn(PM_mapping_results * MR,
+                       PM_depth_buffer * depth,
+                       int tid,
+                       int bamID);
+
+/*!
+ * @abstract Sum the piled-up bases of a contig over every BAM
+ *
+ * @param  MR  mapping results struct with mapping info
+ * @param  tid  contig to sum
+ * @return sum of the contig's row of plp_bp
+ */
+uint64_t contigPlpSum(PM_mapping_results * MR, int tid);
+
+/*!
+ * @abstract Cut an initialised MR down to the single row a streaming parse fills
+ *
+ * @param  MR  mapping results struct to shrink
+ * @return void
+ *
+ * @discussion plp_bp and contig_length_correctors are replaced with one
+ * zeroed row each and row_offset is set to 0. Set row_offset to the tid being
+ * parsed before filling the row. MR->links is kept to hold one contig's links.
+ */
+void initStreamRows(PM_mapping_results * MR);
+
+/*!
+ * @abstract Hand the contig in MR's row to the consumer and reset the row
+ *
+ * @param  stream  where to send the contig
+ * @param  MR  mapping results struct set up with initStreamRows
+ * @param  tid  contig to send, must be MR->row_offset
+ * @return 1 if the parse has been cancelled, otherwise 0
+ *
+ * @discussion The row is zeroed and MR->links cleared ready for the next contig.
+ */
+int streamContig(PM_contig_stream * stream, PM_mapping_results * MR, int tid);
+
+/*!
+ * @abstract Hand every contig before tid not yet sent to the consumer
+ *
+ * @param  stream  where to send the contigs
+ * @param  MR  mapping results struct set up with initStreamRows
+ * @param  tid  contig the serial parse is about to start (num_contigs at the end)
+ * @return 1 if the parse has been cancelled, otherwise 0
+ *
+ * @discussion For the serial parsers, which move through the contigs in
+ * order. The first contig sent is the one in the row, any after it had no
+ * reads and are sent as zeros. MR->row_offset is left at tid.
+ */
+int streamContigsBefore(PM_contig_stream * stream, PM_mapping_results * MR, int tid);
+
+/*!
+ * @abstract Free the rows made by initStreamRows
+ *
+ * @param  MR  mapping results struct set up with initStreamRows
+ * @return void
+ *
+ * @discussion plp_bp and contig_length_correctors are left NULL. Links are
+ * not touched.
+ */
+void destroyStreamRows(PM_mapping_results * MR);
+
 /*!
  * @abstract Calculate the coverage for each contig for each BAM
  *
@@ -205,10 +595,24 @@ void adjustPlpBp(PM_mapping_results * MR,
  *
  * @discussion This function expects MR to be initialised.
  * NOTE: YOU are responsible for freeing the return value
- * recommended method is to use destroyCoverages
+ * recommended method is to use destroyCoverages. The rows all sit in one
+ * block starting at ret[0].
  */
 float ** calculateCoverages(PM_mapping_results * MR);
 
+/*!
+ * @abstract Calculate the coverage for each contig for each BAM into a buffer
+ *
+ * @param  MR  mapping results struct with mapping info
+ * @param  out  num_contigs x num_bams floats, written row-major
+ * @return 0 for success
+ *
+ * @discussion This function expects MR to be initialised. Nothing is
+ * allocated so out can be memory owned by the caller (e.g. a numpy array).
+ * A contig with every position dropped by the coverage mode gets 0.
+ */
+int calculateCoveragesInto(PM_mapping_results * MR, float * out);
+
 /*!
  * @abstract Destroy the coverages structure made in  calculateCoverages
  *
@@ -0,0 +1,339 @@
+//#############################################################################
+//
+//   batchParser.c
+//
+//   Parse more BAM files than can be open at once, a group at a time
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// local includes
+#include "batchParser.h"
+#include "cigarDepth.h"
+#include "depthBuffer.h"
+#include "depthHistogram.h"
+#include "pairedLink.h"
+
+void planBatches(int numBams,
+                 bam_hdr_t * header,
+                 PM_parse_options * opts,
+                 PM_batch_plan * plan)
+{
+    int i = 0, slots = numBams, concurrent = 1;
+    uint64_t longest = 0, depth_bytes = 0;
+    for(i = 0; i < header->n_targets; ++i) {
+        if(header->target_len[i] > longest)
+            longest = header->target_len[i];
+    }
+
+    //-----
+    // what each open BAM costs
+    //
+    if(PM_COVERAGE_USES_HISTOGRAM(opts->do_outlier_coverage))
+        depth_bytes = sizeof(PM_depth_histogram);
+    else
+        depth_bytes = (longest + 1) * sizeof(uint16_t);
+    plan->bam_bytes = PM_BATCH_HANDLE_BYTES;
+    plan->bam_bytes += depth_bytes * (1 + (uint64_t)opts->num_finalisers);
+    plan->bam_bytes += (uint64_t)opts->read_ahead * PM_BATCH_RECORD_BYTES;
+    plan->bam_bytes += (uint64_t)header->n_targets * sizeof(uint32_t) * (opts->do_outlier_coverage ? 2 : 1);
+    if(PM_USE_CIGAR_ENGINE(opts))
+        plan->bam_bytes += (longest + 1) * sizeof(int32_t);
+
+    //-----
+    // how many can be open at once
+    //
+    if(opts->max_open_files > 0 && slots > opts->max_open_files)
+        slots = opts->max_open_files;
+    if(opts->memory_mb > 0) {
+        uint64_t fit = ((uint64_t)opts->memory_mb << 20) / plan->bam_bytes;
+        if(fit < 1)
+            fit = 1;
+        if((uint64_t)slots > fit)
+            slots = (int)fit;
+    }
+    if(slots >= numBams) {
+        plan->group_size = numBams;
+        plan->num_groups = 1;
+        plan->concurrent = 1;
+        return;
+    }
+
+    //-----
+    // share the slots between the groups parsed at once, then even the groups out
+    //
+    if(opts->num_workers > 1)
+        concurrent = opts->num_workers;
+    if(concurrent > slots)
+        concurrent = slots;
+    plan->group_size = slots / concurrent;
+    plan->num_groups = (numBams + plan->group_size - 1) / plan->group_size;
+    plan->group_size = (numBams + plan->num_groups - 1) / plan->num_groups;
+    plan->concurrent = (concurrent < plan->num_groups) ? concurrent : plan->num_groups;
+}
+
+static int groupProgress(PM_progress * progress, void * userData)
+{
+    //-----
+    // pass the group's bytes on to the tracker of the whole parse; each
+    // contig a group finishes is a num_groups share of one contig of the
+    // whole parse, so the count reaches num_contigs with the last group
+    //
+    PM_batch_group * group = (PM_batch_group *)userData;
+    PM_batch_shared * S = group->shared;
+    uint64_t bytes = progress->bytes_read - group->bytes_reported;
+    int shares = progress->contigs_done - group->contigs_reported;
+    int after = __atomic_add_fetch(&S->contig_shares, shares, __ATOMIC_RELAXED);
+    int before = after - shares;
+    group->bytes_reported = progress->bytes_read;
+    group->contigs_reported = progress->contigs_done;
+    return updateProgress(S->progress, progress->tid, bytes,
+                          after / S->plan.num_groups - before / S->plan.num_groups);
+}
+
+static void copyGroup(PM_batch_shared * S, PM_mapping_results * groupMR, int firstBam)
+{
+    //-----
+    // one block move per row into the group's columns of MR
+    //
+    PM_mapping_results * MR = S->MR;
+    size_t row_bytes = groupMR->num_bams * sizeof(uint32_t);
+    uint32_t tid = 0;
+    for(tid = 0; tid < MR->num_contigs; ++tid) {
+        memcpy(&MR->plp_bp[PM_MR_CELL(MR, tid, firstBam)],
+               &groupMR->plp_bp[PM_MR_CELL(groupMR, tid, 0)],
+               row_bytes);
+        if(MR->is_outlier_coverage) {
+            memcpy(&MR->contig_length_correctors[PM_MR_CELL(MR, tid, firstBam)],
+                   &groupMR->contig_length_correctors[PM_MR_CELL(groupMR, tid, 0)],
+                   row_bytes);
+        }
+    }
+    if(MR->is_links_included && groupMR->links != NULL)
+        copyLinks(MR->links, groupMR->links, firstBam);
+    if(MR->region_lengths == NULL && groupMR->region_lengths != NULL) {
+        // the same for every group, so the first one in hands its over
+        MR->region_lengths = groupMR->region_lengths;
+        MR->region_digest = groupMR->region_digest;
+        groupMR->region_lengths = NULL;
+    }
+    addParseStats(&MR->stats, &groupMR->stats, firstBam);
+}
+
+static void adjustUnseenGroups(PM_batch_shared * S)
+{
+    //-----
+    // a group with no reads on a contig never adjusts it, but parsed with
+    // the rest its BAMs would have been adjusted with nothing piled up,
+    // which gives non-zero correctors in the histogram modes
+    //
+    PM_mapping_results * MR = S->MR;
+    size_t bytes = ((size_t)MR->num_contigs + 7) / 8;
+    uint8_t * any = calloc(bytes, 1);
+    PM_depth_buffers * empty = NULL;
+    int size = S->plan.group_size, group = 0, i = 0;
+    uint32_t tid = 0;
+    size_t k = 0;
+    for(group = 0; group < S->plan.num_groups; ++group) {
+        for(k = 0; k < bytes; ++k) {
+            any[k] |= S->seen[group][k];
+        }
+    }
+    for(k = 0; S->opts.seen_contigs != NULL && k < bytes; ++k) {
+        S->opts.seen_contigs[k] |= any[k];
+    }
+    if(!MR->is_outlier_coverage) {
+        free(any);
+        return; // nothing piled up is zero either way
+    }
+    empty = createDepthBuffers(1, 0, PM_COVERAGE_USES_HISTOGRAM(MR->is_outlier_coverage));
+    for(tid = 0; tid < MR->num_contigs; ++tid) {
+        if(!PM_SEEN(any, tid))
+            continue; // nobody had reads here
+        for(group = 0; group < S->plan.num_groups; ++group) {
+            int first = group * size;
+            int num_bams = (first + size > S->num_bams) ? S->num_bams - first : size;
+            if(PM_SEEN(S->seen[group], tid))
+                continue;
+            for(i = first; i < first + num_bams; ++i) {
+                adjustPlpBpColumn(MR, &empty->buffers[0], tid, i);
+                clearDepthBuffer(&empty->buffers[0]);
+            }
+        }
+    }
+    destroyDepthBuffers(empty);
+    free(any);
+}
+
+static int parseGroup(PM_batch_shared * S, int group)
+{
+    int first = group * S->plan.group_size;
+    int num_bams = S->plan.group_size;
+    int ret = 0;
+    if(first + num_bams > S->num_bams)
+        num_bams = S->num_bams - first;
+
+    PM_parse_options opts = S->opts;
+    opts.seen_contigs = S->seen[group];
+    PM_batch_group progress;
+    progress.shared = S;
+    progress.bytes_reported = 0;
+    progress.contigs_reported = 0;
+    if(S->progress != NULL) {
+        opts.progress = groupProgress;
+        opts.progress_data = &progress;
+    }
+
+    PM_mapping_results * group_MR = create_MR();
+    ret = parseCoverageAndLinksWithOptions(num_bams, S->bam_files + first, &opts, group_MR);
+    if(ret == 0) {
+        uint64_t start = statsClock();
+        pthread_mutex_lock(&S->lock);
+        copyGroup(S, group_MR, first);
+        S->MR->stats.timer_ns[PM_TIMER_MERGE] += statsClock() - start;
+        pthread_mutex_unlock(&S->lock);
+    }
+    destroy_MR(group_MR);
+    free(group_MR);
+    return ret;
+}
+
+static void * batchWorker(void * arg)
+{
+    PM_batch_shared * S = (PM_batch_shared *)arg;
+    int group = 0, ret = 0;
+    while(__atomic_load_n(&S->status, __ATOMIC_RELAXED) == 0) {
+        group = __atomic_fetch_add(&S->next_group, 1, __ATOMIC_RELAXED);
+        if(group >= S->plan.num_groups)
+            break;
+        ret = parseGroup(S, group);
+        if(ret != 0) {
+            // first failure wins, the others stop taking groups
+            int zero = 0;
+            __atomic_compare_exchange_n(&S->status, &zero, ret, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+    }
+    return NULL;
+}
+
+int parseCoverageAndLinksBatched(int numBams,
+                                 char* bamFiles[],
+                                 PM_parse_options * opts,
+                                 PM_mapping_results * MR)
+{
+    int i = 0, ret = 0;
+    uint64_t start = statsClock();
+    PM_batch_shared shared;
+    memset(&shared, 0, sizeof(PM_batch_shared));
+
+    // we only need the header from the first BAM
+    BGZF * fp = bgzf_open(bamFiles[0], "r");
+    if(fp == NULL)
+        return 1;
+    bam_hdr_t * h = bam_hdr_read(fp);
+    bgzf_close(fp);
+    planBatches(numBams, h, opts, &shared.plan);
+
+    //-----
+    // the groups are ordinary parses, minus anything that works on the whole set
+    //
+    shared.opts = *opts;
+    shared.opts.max_open_files = 0;
+    shared.opts.memory_mb = 0;
+    shared.opts.cache_dir = NULL;
+    shared.opts.consumer = NULL;
+    if(shared.plan.num_groups == 1) {
+        bam_hdr_destroy(h);
+        return parseCoverageAndLinksWithOptions(numBams, bamFiles, &shared.opts, MR);
+    }
+    shared.opts.num_workers = 1;
+    if(opts->num_threads > shared.plan.concurrent)
+        shared.opts.num_threads = opts->num_threads / shared.plan.concurrent;
+    else
+        shared.opts.num_threads = 1;
+
+    init_MR(MR,
+            h,
+            numBams,
+            bamFiles,
+            opts->do_links,
+            opts->do_outlier_coverage,
+            opts->ignore_supps
+           );
+    MR->coverage_lower = opts->coverage_lower;
+    MR->coverage_upper = opts->coverage_upper;
+    bam_hdr_destroy(h);
+    shared.bam_files = bamFiles;
+    shared.num_bams = numBams;
+    shared.MR = MR;
+    shared.seen = calloc(shared.plan.num_groups, sizeof(uint8_t*));
+    for(i = 0; i < shared.plan.num_groups; ++i) {
+        shared.seen[i] = calloc(((size_t)MR->num_contigs + 7) / 8, 1);
+    }
+    pthread_mutex_init(&shared.lock, NULL);
+
+    PM_progress_tracker tracker;
+    if(opts->progress != NULL) {
+        initProgress(&tracker, opts->progress, opts->progress_data, opts->progress_contigs,
+                     opts->progress_mb, numBams, bamFiles, MR->num_contigs);
+        shared.progress = &tracker;
+    }
+    MR->stats.timer_ns[PM_TIMER_SETUP] += statsClock() - start;
+
+    //-----
+    // off they go, each thread taking the next group until there are none left
+    //
+    pthread_t * threads = calloc(shared.plan.concurrent, sizeof(pthread_t));
+    int * joinable = calloc(shared.plan.concurrent, sizeof(int));
+    for(i = 0; i < shared.plan.concurrent; ++i) {
+        if(pthread_create(&threads[i], NULL, batchWorker, &shared) == 0) {
+            joinable[i] = 1;
+        } else {
+            // take groups here instead
+            batchWorker(&shared);
+        }
+    }
+    for(i = 0; i < shared.plan.concurrent; ++i) {
+        if(joinable[i])
+            pthread_join(threads[i], NULL);
+    }
+    ret = shared.status;
+    if(PM_PROGRESS_IS_CANCELLED(shared.progress))
+        ret = PM_PARSE_CANCELLED;
+    else if(ret != 0 && ret != PM_PARSE_CANCELLED)
+        printError("Could not parse a group of BAMs", __LINE__);
+    if(ret == 0) {
+        start = statsClock();
+        adjustUnseenGroups(&shared);
+        MR->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - start;
+    }
+
+    destroyProgress(shared.progress);
+    pthread_mutex_destroy(&shared.lock);
+    for(i = 0; i < shared.plan.num_groups; ++i) {
+        free(shared.seen[i]);
+    }
+    free(shared.seen);
+    free(joinable);
+    free(threads);
+    return ret;
+}
@@ -0,0 +1,161 @@
+//#############################################################################
+//
+//   batchParser.h
+//
+//   Parse more BAM files than can be open at once, a group at a time
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_BATCH_PARSER_H
+  #define PM_BATCH_PARSER_H
+
+// system includes
+#include <stdint.h>
+#include <pthread.h>
+
+// htslib
+#include "htslib/sam.h"
+
+// local includes
+#include "bamParser.h"
+#include "progress.h"
+
+// rough memory held by each open BAM: BGZF buffers and cache, pileup state
+#define PM_BATCH_HANDLE_BYTES (1 << 20)
+// rough memory held by each record read ahead
+#define PM_BATCH_RECORD_BYTES 512
+
+// does a parse with these options go through the batching layer
+#define PM_USE_BATCHES(opts) ((opts)->max_open_files > 0 || (opts)->memory_mb > 0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract How the BAMs of a batched parse are split up
+ @field group_size BAMs parsed together, the last group may have fewer
+ @field num_groups number of groups
+ @field concurrent groups parsed at once, each on a thread of its own
+ @field bam_bytes estimated memory needed for each BAM while it is open
+ */
+typedef struct {
+    int group_size;
+    int num_groups;
+    int concurrent;
+    uint64_t bam_bytes;
+} PM_batch_plan;
+
+/*! @typedef
+ @abstract State shared by the threads of a batched parse
+ @field bam_files filenames of all the BAM files
+ @field num_bams number of BAM files
+ @field opts settings the groups are parsed with (no batching, cache or consumer)
+ @field plan how the BAMs are split up
+ @field MR mapping results struct every group's columns are copied into
+ @field progress where the groups report progress (NULL for nowhere)
+ @field next_group next group nobody has started on
+ @field contig_shares contigs finished so far summed over the groups
+ @field lock held while a finished group is copied into MR
+ @field status first non-zero status of a group (later groups are not started)
+ @field seen bit per contig for each group, set if any of its BAMs has reads there
+ */
+typedef struct {
+    char ** bam_files;
+    int num_bams;
+    PM_parse_options opts;
+    PM_batch_plan plan;
+    PM_mapping_results * MR;
+    PM_progress_tracker * progress;
+    int next_group;
+    int contig_shares;
+    pthread_mutex_t lock;
+    int status;
+    uint8_t ** seen;
+} PM_batch_shared;
+
+/*! @typedef
+ @abstract One group's view of the parse progress
+ @field shared state shared by all the groups
+ @field bytes_reported compressed bytes of the group already passed on
+ @field contigs_reported contigs of the group already passed on
+ */
+typedef struct {
+    PM_batch_shared * shared;
+    uint64_t bytes_reported;
+    int contigs_reported;
+} PM_batch_group;
+
+/*!
+ * @abstract Work out how to split the BAMs into groups
+ *
+ * @param numBams  number of BAM files to parse
+ * @param header  header of the first BAM
+ * @param opts  settings to parse with (max_open_files, memory_mb and num_workers are used)
+ * @param plan  set to the split
+ * @return void
+ *
+ * @discussion The memory of an open BAM is estimated from its handle,
+ * depth buffers (one more per finaliser) for the longest contig, any read
+ * ahead and its columns of the group's results. Open BAMs are capped by
+ * opts->max_open_files and by opts->memory_mb divided by that estimate,
+ * never going below one. If every BAM fits there is a single group.
+ * Otherwise the cap is shared out between up to opts->num_workers groups
+ * parsed at once and the BAMs are dealt into evenly sized groups.
+ */
+void planBatches(int numBams,
+                 bam_hdr_t * header,
+                 PM_parse_options * opts,
+                 PM_batch_plan * plan);
+
+/*!
+ * @abstract Parse the BAM files a group at a time
+ *
+ * @param numBams  number of BAM files to parse
+ * @param bamFiles  filenames of BAM files to parse
+ * @param opts  settings to parse with, PM_USE_BATCHES(opts) should be true
+ * @param MR  mapping results struct to write to
+ * @return 0 for success, PM_PARSE_CANCELLED if opts->progress asked to stop
+ *
+ * @discussion MR is set up for every BAM from the first BAM's header and
+ * each group is parsed with parseCoverageAndLinksWithOptions into a
+ * mapping results struct of its own. As soon as a group finishes its
+ * columns are copied into its BAMs' columns of MR, its links are copied in
+ * with their BAM ids moved along (see copyLinks) and it is freed, so
+ * putting n groups together costs one pass over their data and only the
+ * groups in flight are held on top of MR. Coverage is the same as parsing
+ * every BAM at once. So is the set of links, though a chain's links come
+ * group by group in the order the groups finish.
+ *
+ * Each group is parsed serially, the threads of the parse go into parsing
+ * several groups at once instead, and the BGZF threads are shared out
+ * between them. Progress counts bytes as the groups go, and a contig is
+ * done once every group has finished it. A cancel stops the groups in
+ * flight and no more are started. With a single group MR is parsed into
+ * directly.
+ */
+int parseCoverageAndLinksBatched(int numBams,
+                                 char* bamFiles[],
+                                 PM_parse_options * opts,
+                                 PM_mapping_results * MR);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_BATCH_PARSER_H
@@ -0,0 +1,622 @@
+//#############################################################################
+//
+//   bench.c
+//
+//   Generate reproducible synthetic BAMs and time the parser on them
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// htslib
+#include "htslib/sam.h"
+#include "htslib/bgzf.h"
+
+// local includes
+#include "bamParser.h"
+#include "pairedLink.h"
+#include "outputWriter.h"
+
+#define PM_BENCH_MAX_LIST 32
+#define PM_BENCH_MAPQ 60
+#define PM_BENCH_BASEQ 30
+// spread of log(length) for the lognormal contig length distribution
+#define PM_BENCH_LOGNORMAL_SIGMA 1.0
+
+/*! @typedef
+ @abstract The timed parts of one run
+ @constant PM_STAGE_PARSE parseCoverageAndLinksWithOptions (or the depth pass)
+ @constant PM_STAGE_COVERAGE calculateCoverages
+ @constant PM_STAGE_LINKS compactLinks
+ @constant PM_STAGE_WRITE write_MR as TSV to /dev/null
+ */
+typedef enum {
+    PM_STAGE_PARSE = 0,
+    PM_STAGE_COVERAGE,
+    PM_STAGE_LINKS,
+    PM_STAGE_WRITE,
+    PM_NUM_STAGES
+} PM_bench_stage;
+
+static const char * PM_STAGE_NAMES[PM_NUM_STAGES] = {"parse", "coverage", "links", "write"};
+
+/*! @typedef
+ @abstract One point in the sweep
+ @field num_contigs contigs in each BAM
+ @field lognormal 0 for equal length contigs, 1 for lognormal lengths
+ @field contig_length length (median length if lognormal) of the contigs
+ @field depth mean depth of every contig
+ @field num_bams BAMs parsed together
+ @field link_rate fraction of reads whose mate is on another contig
+ @field read_length length of every read
+ @field seed seed of the random numbers, the same seed makes the same BAMs
+ */
+typedef struct {
+    int num_contigs;
+    int lognormal;
+    int contig_length;
+    double depth;
+    int num_bams;
+    double link_rate;
+    int read_length;
+    uint64_t seed;
+} PM_bench_config;
+
+/*! @typedef
+ @abstract What a run sends back from its child process
+ @field ret return value of the parse
+ @field seconds wall time of each PM_bench_stage
+ */
+typedef struct {
+    int ret;
+    double seconds[PM_NUM_STAGES];
+} PM_bench_timings;
+
+static uint64_t nextRandom(uint64_t * state)
+{
+    //-----
+    // splitmix64, small and the same everywhere
+    //
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double randomUniform(uint64_t * state)
+{
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double randomNormal(uint64_t * state)
+{
+    double u = randomUniform(state);
+    double v = randomUniform(state);
+    return sqrt(-2.0 * log(u + 1e-300)) * cos(2.0 * M_PI * v);
+}
+
+static uint32_t randomBelow(uint64_t * state, uint32_t bound)
+{
+    return (uint32_t)(randomUniform(state) * bound);
+}
+
+static void contigLengths(PM_bench_config * cfg, uint32_t * lengths)
+{
+    //-----
+    // the same for every BAM in a config so their headers match
+    //
+    uint64_t state = cfg->seed;
+    int i = 0;
+    for(i = 0; i < cfg->num_contigs; ++i) {
+        double length = cfg->contig_length;
+        if(cfg->lognormal)
+            length = exp(log(length) + PM_BENCH_LOGNORMAL_SIGMA * randomNormal(&state));
+        if(length < 2 * cfg->read_length)
+            length = 2 * cfg->read_length;
+        if(length > INT32_MAX)
+            length = INT32_MAX;
+        lengths[i] = (uint32_t)length;
+    }
+}
+
+static uint64_t readsOnContig(PM_bench_config * cfg, uint32_t length)
+{
+    return (uint64_t)(cfg->depth * length / cfg->read_length);
+}
+
+static uint64_t totalReads(PM_bench_config * cfg)
+{
+    uint64_t total = 0;
+    int i = 0;
+    uint32_t * lengths = malloc(cfg->num_contigs * sizeof(uint32_t));
+    contigLengths(cfg, lengths);
+    for(i = 0; i < cfg->num_contigs; ++i) {
+        total += readsOnContig(cfg, lengths[i]);
+    }
+    free(lengths);
+    return total * cfg->num_bams;
+}
+
+static bam_hdr_t * makeHeader(PM_bench_config * cfg)
+{
+    bam_hdr_t * h = bam_hdr_init();
+    size_t text_size = 32 + (size_t)cfg->num_contigs * 48;
+    size_t used = 0;
+    int i = 0;
+    h->n_targets = cfg->num_contigs;
+    h->target_len = malloc(cfg->num_contigs * sizeof(uint32_t));
+    h->target_name = malloc(cfg->num_contigs * sizeof(char*));
+    contigLengths(cfg, h->target_len);
+    h->text = malloc(text_size);
+    used = sprintf(h->text, "@HD\tVN:1.0\tSO:coordinate\n");
+    for(i = 0; i < cfg->num_contigs; ++i) {
+        char name[24];
+        sprintf(name, "contig_%d", i);
+        h->target_name[i] = strdup(name);
+        used += sprintf(h->text + used, "@SQ\tSN:%s\tLN:%u\n", name, h->target_len[i]);
+    }
+    h->l_text = (uint32_t)used;
+    return h;
+}
+
+static void fillRead(bam1_t * b,
+                     PM_bench_config * cfg,
+                     uint64_t readNum,
+                     int tid,
+                     int32_t pos,
+                     uint16_t flag,
+                     int mtid,
+                     int32_t mpos)
+{
+    //-----
+    // qname, one M cigar op, all A's at a good quality
+    //
+    int l_qname = 12; // 11 characters and a NUL keeps the cigar aligned
+    int l_seq = cfg->read_length;
+    int l_data = l_qname + 4 + (l_seq + 1) / 2 + l_seq;
+    uint32_t cigar = (uint32_t)l_seq << BAM_CIGAR_SHIFT | BAM_CMATCH;
+    if(b->m_data < l_data) {
+        b->m_data = l_data;
+        b->data = realloc(b->data, l_data);
+    }
+    b->l_data = l_data;
+    snprintf((char *)b->data, l_qname, "r%010llu", (unsigned long long)readNum);
+    memcpy(b->data + l_qname, &cigar, 4);
+    memset(b->data + l_qname + 4, 0x11, (l_seq + 1) / 2);
+    memset(b->data + l_qname + 4 + (l_seq + 1) / 2, PM_BENCH_BASEQ, l_seq);
+    b->core.tid = tid;
+    b->core.pos = pos;
+    b->core.bin = hts_reg2bin(pos, pos + l_seq, 14, 5);
+    b->core.qual = PM_BENCH_MAPQ;
+    b->core.l_qname = l_qname;
+    b->core.flag = flag;
+    b->core.n_cigar = 1;
+    b->core.l_qseq = l_seq;
+    b->core.mtid = mtid;
+    b->core.mpos = mpos;
+    b->core.isize = 0;
+}
+
+static int compareInt32(const void * a, const void * b)
+{
+    int32_t x = *(const int32_t *)a;
+    int32_t y = *(const int32_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int generateBam(PM_bench_config * cfg, int bamNum, char * fileName)
+{
+    //-----
+    // reads start uniformly along each contig, link_rate of them are the
+    // first of a pair whose mate is on another contig
+    //
+    uint64_t state = cfg->seed ^ (0x5851f42d4c957f2dULL * (uint64_t)(bamNum + 1));
+    uint64_t read_num = 0;
+    bam_hdr_t * h = makeHeader(cfg);
+    bam1_t * b = bam_init1();
+    int32_t * starts = NULL;
+    int tid = 0, ret = 0;
+    BGZF * fp = bgzf_open(fileName, "w");
+    if(fp == NULL) {
+        bam_destroy1(b);
+        bam_hdr_destroy(h);
+        return 1;
+    }
+    ret = bam_hdr_write(fp, h);
+    for(tid = 0; tid < h->n_targets && ret >= 0; ++tid) {
+        uint64_t n = readsOnContig(cfg, h->target_len[tid]);
+        uint32_t span = h->target_len[tid] - cfg->read_length + 1;
+        uint64_t i = 0;
+        starts = realloc(starts, (n > 0 ? n : 1) * sizeof(int32_t));
+        for(i = 0; i < n; ++i) {
+            starts[i] = (int32_t)randomBelow(&state, span);
+        }
+        qsort(starts, n, sizeof(int32_t), compareInt32);
+        for(i = 0; i < n && ret >= 0; ++i) {
+            uint16_t flag = (nextRandom(&state) & 1) ? BAM_FREVERSE : 0;
+            int mtid = -1;
+            int32_t mpos = -1;
+            if(h->n_targets > 1 && randomUniform(&state) < cfg->link_rate) {
+                mtid = (tid + 1 + randomBelow(&state, h->n_targets - 1)) % h->n_targets;
+                mpos = (int32_t)randomBelow(&state, h->target_len[mtid] - cfg->read_length + 1);
+                flag |= BAM_FPAIRED | BAM_FREAD1;
+                if(nextRandom(&state) & 1)
+                    flag |= BAM_FMREVERSE;
+            }
+            fillRead(b, cfg, read_num++, tid, starts[i], flag, mtid, mpos);
+            ret = bam_write1(fp, b);
+        }
+    }
+    free(starts);
+    bam_destroy1(b);
+    bam_hdr_destroy(h);
+    if(bgzf_close(fp) != 0 || ret < 0)
+        return 1;
+    // parallel parsing and regions need an index
+    return (bam_index_build(fileName, 0) == 0) ? 0 : 1;
+}
+
+static char ** syntheticBams(PM_bench_config * cfg, char * dataDir)
+{
+    //-----
+    // file names encode the whole config so BAMs are reused between runs
+    //
+    char ** bam_files = calloc(cfg->num_bams, sizeof(char*));
+    int i = 0;
+    for(i = 0; i < cfg->num_bams; ++i) {
+        struct stat st;
+        char index_name[1024];
+        bam_files[i] = malloc(1024);
+        snprintf(bam_files[i], 1024, "%s/syn_c%d_%s%d_d%g_p%g_r%d_s%llu_%d.bam",
+                 dataDir, cfg->num_contigs, cfg->lognormal ? "ln" : "fx",
+                 cfg->contig_length, cfg->depth, cfg->link_rate, cfg->read_length,
+                 (unsigned long long)cfg->seed, i);
+        snprintf(index_name, sizeof(index_name), "%s.bai", bam_files[i]);
+        if(stat(index_name, &st) == 0)
+            continue;
+        fprintf(stderr, "Generating %s\n", bam_files[i]);
+        if(generateBam(cfg, i, bam_files[i]) != 0) {
+            fprintf(stderr, "Could not write %s\n", bam_files[i]);
+            unlink(bam_files[i]);
+            for(; i >= 0; --i) {
+                free(bam_files[i]);
+            }
+            free(bam_files);
+            return NULL;
+        }
+    }
+    return bam_files;
+}
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int depthPass(int numBams, char ** bamFiles, uint64_t * totalDepth)
+{
+    //-----
+    // what samtools depth does: one pileup over every BAM, summing depths
+    //
+    aux_t ** data = calloc(numBams, sizeof(aux_t*));
+    const bam_pileup1_t ** plp = calloc(numBams, sizeof(bam_pileup1_t*));
+    int * n_plp = calloc(numBams, sizeof(int));
+    int i = 0, tid = 0, pos = 0, ret = 0;
+    bam_mplp_t mplp;
+    *totalDepth = 0;
+    for(i = 0; i < numBams; ++i) {
+        bam_hdr_t * h = NULL;
+        data[i] = calloc(1, sizeof(aux_t));
+        data[i]->fp = bgzf_open(bamFiles[i], "r");
+        if(data[i]->fp == NULL || (h = bam_hdr_read(data[i]->fp)) == NULL)
+            ret = 1;
+        bam_hdr_destroy(h);
+    }
+    if(ret == 0) {
+        mplp = bam_mplp_init(numBams, read_bam, (void**)data);
+        while(bam_mplp_auto(mplp, &tid, &pos, n_plp, plp) > 0) {
+            for(i = 0; i < numBams; ++i) {
+                *totalDepth += n_plp[i];
+            }
+        }
+        bam_mplp_destroy(mplp);
+    }
+    for(i = 0; i < numBams; ++i) {
+        if(data[i]->fp != NULL)
+            bgzf_close(data[i]->fp);
+        free(data[i]);
+    }
+    free(data);
+    free(plp);
+    free(n_plp);
+    return ret;
+}
+
+static void timeRun(int numBams,
+                    char ** bamFiles,
+                    PM_parse_options * opts,
+                    int depthOnly,
+                    PM_bench_timings * T)
+{
+    PM_mapping_results * MR = NULL;
+    uint64_t total_depth = 0;
+    double start = now();
+    memset(T, 0, sizeof(PM_bench_timings));
+    if(depthOnly) {
+        T->ret = depthPass(numBams, bamFiles, &total_depth);
+        T->seconds[PM_STAGE_PARSE] = now() - start;
+        return;
+    }
+
+    MR = create_MR();
+    T->ret = parseCoverageAndLinksWithOptions(numBams, bamFiles, opts, MR);
+    T->seconds[PM_STAGE_PARSE] = now() - start;
+    if(T->ret == 0) {
+        start = now();
+        destroyCoverages(calculateCoverages(MR), MR->num_contigs);
+        T->seconds[PM_STAGE_COVERAGE] = now() - start;
+        if(MR->is_links_included) {
+            start = now();
+            destroyLinkColumns(compactLinks(MR->links));
+            T->seconds[PM_STAGE_LINKS] = now() - start;
+        }
+        start = now();
+        T->ret = write_MR(MR, "/dev/null", PM_OUTPUT_TSV);
+        T->seconds[PM_STAGE_WRITE] = now() - start;
+    }
+    destroy_MR(MR);
+    free(MR);
+}
+
+static int runInChild(int numBams,
+                      char ** bamFiles,
+                      PM_parse_options * opts,
+                      int depthOnly,
+                      PM_bench_timings * T,
+                      long * peakRssKb)
+{
+    //-----
+    // every run gets a fresh process so peak RSS is its own
+    //
+    int fds[2];
+    int status = 0;
+    struct rusage usage;
+    pid_t pid;
+    if(pipe(fds) != 0)
+        return 1;
+    fflush(NULL);
+    pid = fork();
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return 1;
+    }
+    if(pid == 0) {
+        PM_bench_timings child;
+        close(fds[0]);
+        timeRun(numBams, bamFiles, opts, depthOnly, &child);
+        if(write(fds[1], &child, sizeof(child)) != sizeof(child))
+            _exit(1);
+        _exit(0);
+    }
+    close(fds[1]);
+    memset(T, 0, sizeof(PM_bench_timings));
+    T->ret = 1;
+    if(read(fds[0], T, sizeof(PM_bench_timings)) != sizeof(PM_bench_timings))
+        T->ret = 1;
+    close(fds[0]);
+    if(wait4(pid, &status, 0, &usage) != pid)
+        return 1;
+    *peakRssKb = usage.ru_maxrss;
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return 1;
+    return T->ret;
+}
+
+static void printRecord(FILE * out,
+                        int first,
+                        PM_bench_config * cfg,
+                        PM_parse_options * opts,
+                        const char * mode,
+                        int rep,
+                        uint64_t reads,
+                        PM_bench_timings * T,
+                        long peakRssKb)
+{
+    double total = 0;
+    int s = 0;
+    for(s = 0; s < PM_NUM_STAGES; ++s) {
+        total += T->seconds[s];
+    }
+    fprintf(out, "%s  {\"mode\": \"%s\", \"rep\": %d, \"ok\": %s,\n", first ? "" : ",\n", mode, rep, T->ret == 0 ? "true" : "false");
+    fprintf(out, "   \"num_contigs\": %d, \"length_dist\": \"%s\", \"contig_length\": %d,\n",
+            cfg->num_contigs, cfg->lognormal ? "lognormal" : "fixed", cfg->contig_length);
+    fprintf(out, "   \"depth\": %g, \"num_bams\": %d, \"link_rate\": %g, \"read_length\": %d, \"seed\": %llu,\n",
+            cfg->depth, cfg->num_bams, cfg->link_rate, cfg->read_length, (unsigned long long)cfg->seed);
+    fprintf(out, "   \"do_links\": %d, \"do_outlier_coverage\": %d, \"num_workers\": %d, \"num_threads\": %d,\n",
+            opts->do_links, opts->do_outlier_coverage, opts->num_workers, opts->num_threads);
+    fprintf(out, "   \"reads\": %llu, \"bases\": %llu, \"seconds\": %.6f,\n",
+            (unsigned long long)reads, (unsigned long long)reads * cfg->read_length, total);
+    fprintf(out, "   \"reads_per_sec\": %.1f, \"bases_per_sec\": %.1f, \"peak_rss_kb\": %ld,\n",
+            T->seconds[PM_STAGE_PARSE] > 0 ? reads / T->seconds[PM_STAGE_PARSE] : 0.0,
+            T->seconds[PM_STAGE_PARSE] > 0 ? reads * (double)cfg->read_length / T->seconds[PM_STAGE_PARSE] : 0.0,
+            peakRssKb);
+    fprintf(out, "   \"stages\": {");
+    for(s = 0; s < PM_NUM_STAGES; ++s) {
+        fprintf(out, "%s\"%s\": %.6f", s ? ", " : "", PM_STAGE_NAMES[s], T->seconds[s]);
+    }
+    fprintf(out, "}}");
+    fflush(out);
+}
+
+static int parseIntList(char * str, int * values)
+{
+    int n = 0;
+    char * save = NULL;
+    char * tok = strtok_r(str, ",", &save);
+    for(; tok != NULL && n < PM_BENCH_MAX_LIST; tok = strtok_r(NULL, ",", &save)) {
+        values[n++] = atoi(tok);
+    }
+    return n;
+}
+
+static int parseDoubleList(char * str, double * values)
+{
+    int n = 0;
+    char * save = NULL;
+    char * tok = strtok_r(str, ",", &save);
+    for(; tok != NULL && n < PM_BENCH_MAX_LIST; tok = strtok_r(NULL, ",", &save)) {
+        values[n++] = atof(tok);
+    }
+    return n;
+}
+
+static int parseDistList(char * str, int * values)
+{
+    int n = 0;
+    char * save = NULL;
+    char * tok = strtok_r(str, ",", &save);
+    for(; tok != NULL && n < PM_BENCH_MAX_LIST; tok = strtok_r(NULL, ",", &save)) {
+        values[n++] = (strcmp(tok, "lognormal") == 0);
+    }
+    return n;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Usage: pmBench [options]\n");
+    fprintf(stderr, "Every combination of the comma separated lists is generated and parsed\n");
+    fprintf(stderr, "with links on/off and outlier coverage on/off, plus a samtools depth\n");
+    fprintf(stderr, "style pileup as a baseline.\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "   -c <int,...>        number of contigs [100,10000]\n");
+    fprintf(stderr, "   -D <dist,...>       contig lengths: fixed or lognormal [fixed,lognormal]\n");
+    fprintf(stderr, "   -l <int,...>        contig length (median for lognormal) [5000]\n");
+    fprintf(stderr, "   -d <float,...>      depth [10]\n");
+    fprintf(stderr, "   -b <int,...>        number of BAMs [1,4]\n");
+    fprintf(stderr, "   -p <float,...>      fraction of reads linking two contigs [0,0.05]\n");
+    fprintf(stderr, "   -r <int>            read length [100]\n");
+    fprintf(stderr, "   -s <int>            random seed [1]\n");
+    fprintf(stderr, "   -n <int>            repeats of each run [1]\n");
+    fprintf(stderr, "   -w <int>            contig worker threads [1]\n");
+    fprintf(stderr, "   -t <int>            BGZF decompression threads [1]\n");
+    fprintf(stderr, "   -o <dir>            where the BAMs go, reused if there [bench_data]\n");
+    fprintf(stderr, "   -j <file>           JSON results [bench.json]\n");
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int contigs[PM_BENCH_MAX_LIST] = {100, 10000};
+    int dists[PM_BENCH_MAX_LIST] = {0, 1};
+    int lengths[PM_BENCH_MAX_LIST] = {5000};
+    double depths[PM_BENCH_MAX_LIST] = {10};
+    int bams[PM_BENCH_MAX_LIST] = {1, 4};
+    double rates[PM_BENCH_MAX_LIST] = {0, 0.05};
+    int num_contigs = 2, num_dists = 2, num_lengths = 1, num_depths = 1, num_bams = 2, num_rates = 2;
+    int read_length = 100, reps = 1, n = 0, first = 1, ret = 0;
+    uint64_t seed = 1;
+    char * data_dir = "bench_data";
+    char * json_file = "bench.json";
+    int ci, di, li, ddi, bi, ri, rep, mode;
+    FILE * out = NULL;
+    PM_parse_options opts;
+    init_parse_options(&opts);
+
+    while ((n = getopt(argc, argv, "c:D:l:d:b:p:r:s:n:w:t:o:j:h")) >= 0) {
+        switch (n) {
+            case 'c': num_contigs = parseIntList(optarg, contigs); break;
+            case 'D': num_dists = parseDistList(optarg, dists); break;
+            case 'l': num_lengths = parseIntList(optarg, lengths); break;
+            case 'd': num_depths = parseDoubleList(optarg, depths); break;
+            case 'b': num_bams = parseIntList(optarg, bams); break;
+            case 'p': num_rates = parseDoubleList(optarg, rates); break;
+            case 'r': read_length = atoi(optarg); break;
+            case 's': seed = strtoull(optarg, NULL, 10); break;
+            case 'n': reps = atoi(optarg); break;
+            case 'w': opts.num_workers = atoi(optarg); break;
+            case 't': opts.num_threads = atoi(optarg); break;
+            case 'o': data_dir = optarg; break;
+            case 'j': json_file = optarg; break;
+            default: usage(); return 1;
+        }
+    }
+    mkdir(data_dir, 0777); // fine if it's already there
+    out = fopen(json_file, "w");
+    if(out == NULL) {
+        fprintf(stderr, "Could not open %s\n", json_file);
+        return 1;
+    }
+    fprintf(out, "[\n");
+
+    //-----
+    // every combination, each BAM set parsed 4 ways and piled up once
+    //
+    for(ci = 0; ci < num_contigs; ++ci)
+    for(di = 0; di < num_dists; ++di)
+    for(li = 0; li < num_lengths; ++li)
+    for(ddi = 0; ddi < num_depths; ++ddi)
+    for(bi = 0; bi < num_bams; ++bi)
+    for(ri = 0; ri < num_rates; ++ri) {
+        PM_bench_config cfg = {contigs[ci], dists[di], lengths[li], depths[ddi],
+                               bams[bi], rates[ri], read_length, seed};
+        uint64_t reads = totalReads(&cfg);
+        char ** bam_files = syntheticBams(&cfg, data_dir);
+        int i = 0;
+        if(bam_files == NULL) {
+            ret = 1;
+            continue;
+        }
+        for(mode = 0; mode < 5; ++mode) {
+            for(rep = 0; rep < reps; ++rep) {
+                PM_bench_timings T;
+                long peak_rss_kb = 0;
+                opts.do_links = mode & 1;
+                opts.do_outlier_coverage = (mode >> 1) & 1;
+                fprintf(stderr, "Running %s (%d BAMs, links %d, outlier %d)\n",
+                        mode == 4 ? "depth" : "parse", cfg.num_bams,
+                        opts.do_links, opts.do_outlier_coverage);
+                if(runInChild(cfg.num_bams, bam_files, &opts, mode == 4, &T, &peak_rss_kb) != 0)
+                    ret = 1;
+                printRecord(out, first, &cfg, &opts, mode == 4 ? "depth" : "parse",
+                            rep, reads, &T, peak_rss_kb);
+                first = 0;
+            }
+        }
+        for(i = 0; i < cfg.num_bams; ++i) {
+            free(bam_files[i]);
+        }
+        free(bam_files);
+    }
+    fprintf(out, "\n]\n");
+    fclose(out);
+    return ret;
+}
@@ -0,0 +1,241 @@
+//#############################################################################
+//
+//   cigarDepth.c
+//
+//   Count per-position depths straight from read CIGARs
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// htslib
+#include "htslib/sam.h"
+
+// local includes
+#include "cigarDepth.h"
+#include "bamParser.h"
+#include "pairedLink.h"
+#include "depthBuffer.h"
+#include "pmTrace.h"
+
+int addReadToDiff(bam1_t * b, int32_t * diff, uint32_t contigLength, uint64_t * skipped)
+{
+    uint32_t * cigar = bam_get_cigar(b);
+    int64_t pos = b->core.pos;
+    int64_t block_end = 0;
+    int k = 0, first_aligned = -1;
+    for (k = 0; k < b->core.n_cigar && pos < contigLength; ++k) {
+        int64_t len = bam_cigar_oplen(cigar[k]);
+        switch (bam_cigar_op(cigar[k])) {
+            case BAM_CMATCH:
+            case BAM_CEQUAL:
+            case BAM_CDIFF:
+                if (first_aligned == -1) first_aligned = 1;
+                block_end = pos + len;
+                if (block_end > contigLength) block_end = contigLength;
+                ++diff[pos];
+                --diff[block_end];
+                pos += len;
+                break;
+            case BAM_CDEL:
+            case BAM_CREF_SKIP:
+                if (first_aligned == -1) first_aligned = 0;
+                *skipped += (pos + len > contigLength) ? contigLength - pos : len;
+                pos += len;
+                break;
+            default:
+                // I, S, H and P don't touch the reference
+                break;
+        }
+    }
+    return (first_aligned == 1);
+}
+
+void diffToDepth(int32_t * diff, PM_depth_buffer * depth, uint32_t contigLength)
+{
+    int32_t running = 0;
+    uint32_t pos = 0;
+    for (pos = 0; pos < contigLength; ++pos) {
+        running += diff[pos];
+        diff[pos] = 0;
+        setDepth(depth, pos, (uint32_t)running);
+    }
+    diff[contigLength] = 0;
+}
+
+void diffToRegionDepth(int32_t * diff,
+                       PM_depth_buffer * depth,
+                       PM_region * regions,
+                       uint32_t numRegions,
+                       uint32_t from,
+                       uint32_t to)
+{
+    //-----
+    // nothing before from was touched so the running total can start there
+    //
+    int32_t running = 0;
+    uint32_t pos = from, r = 0;
+    for (r = 0; r < numRegions && pos < to; ++r) {
+        for (; pos < regions[r].beg && pos < to; ++pos) {
+            running += diff[pos];
+            diff[pos] = 0;
+        }
+        for (; pos < regions[r].end && pos < to; ++pos) {
+            running += diff[pos];
+            diff[pos] = 0;
+            setDepth(depth, regions[r].offset + (pos - regions[r].beg), (uint32_t)running);
+        }
+    }
+    // reads running on past the last region
+    if (pos < to)
+        memset(diff + pos, 0, (size_t)(to - pos) * sizeof(int32_t));
+}
+
+void countCigarRead(PM_mapping_results * MR,
+                    PM_link_table * links,
+                    PM_parse_stats * stats,
+                    PM_parse_options * opts,
+                    bam1_t * b,
+                    int32_t * diff,
+                    int bamID)
+{
+    bam1_core_t * core = &b->core;
+    if (core->flag & PM_CIGAR_SKIP_FLAGS) return; // dropped by read_bam or never piled up
+    // a pileup only sees the read's head if it starts with an aligned base
+    if (addReadToDiff(b, diff, MR->contig_lengths[core->tid], &stats->del_refskip_rejects) &&
+        links != NULL &&
+        MR->is_links_included &&
+        isLinkingRead(core, opts->ignore_supps)) {
+        int timed = ((stats->links_added++ & PM_STATS_SAMPLE_MASK) == 0);
+        uint64_t start = timed ? statsClock() : 0;
+        addLink(links,
+                core->tid,                          // contig 1
+                core->mtid,                         // contig 2
+                core->pos,                          // pos 1
+                core->mpos,                         // pos 2
+                ((core->flag&BAM_FREVERSE) != 0),   // 1 == reversed
+                ((core->flag&BAM_FMREVERSE) != 0),  // 0 = agrees
+                bamID);                             // bam file ID
+        if (timed) stats->timer_ns[PM_TIMER_LINKS] += (statsClock() - start) << PM_STATS_SAMPLE_SHIFT;
+    }
+}
+
+int parseWithCigars(aux_t ** data,
+                    PM_parse_options * opts,
+                    PM_progress_tracker * progress,
+                    PM_contig_stream * stream,
+                    PM_mapping_results * MR)
+{
+    int numBams = MR->num_bams;
+    int i = 0, tid = 0, contigs_done = 0, bad_bam = -1;
+    uint32_t reads = 0;
+    uint64_t bytes_done = 0, bytes_now = 0;
+    uint32_t longest = 0;
+    uint64_t start = statsClock(), adjust_start = 0;
+    for (tid = 0; tid < MR->num_contigs; ++tid) {
+        if (MR->contig_lengths[tid] > longest)
+            longest = MR->contig_lengths[tid];
+    }
+
+    // one difference array and depth buffer is enough as BAMs are done one after the other
+    int32_t * diff = calloc((size_t)longest + 1, sizeof(int32_t));
+    PM_depth_buffers * depths = createDepthBuffers(1, longest, PM_COVERAGE_USES_HISTOGRAM(MR->is_outlier_coverage));
+    PM_depth_buffer * depth = &depths->buffers[0];
+
+    // keep one read from each BAM in hand so we know which contig is next
+    bam1_t ** b = calloc(numBams, sizeof(bam1_t*));
+    int * ret = calloc(numBams, sizeof(int));
+    for (i = 0; i < numBams; ++i) {
+        b[i] = bam_init1();
+        ret[i] = read_bam(data[i], b[i]);
+        if (ret[i] < -1) bad_bam = i;
+    }
+
+    while (bad_bam == -1) {
+        // BAMs are sorted so the next contig is the lowest one in hand
+        tid = -1;
+        for (i = 0; i < numBams; ++i) {
+            if (ret[i] >= 0 && b[i]->core.tid >= 0 &&
+                (tid == -1 || b[i]->core.tid < tid))
+                tid = b[i]->core.tid;
+        }
+        if (tid == -1) break; // all done (unmapped reads come last)
+        if (stream != NULL && streamContigsBefore(stream, MR, tid)) break;
+
+        PM_TRACE2(contig_start, tid, PM_MR_LENGTH(MR, tid));
+        PM_MARK_SEEN(opts, tid);
+        for (i = 0; i < numBams; ++i) {
+            while (ret[i] >= 0 && b[i]->core.tid == tid) {
+                countCigarRead(MR, MR->links, &MR->stats, opts, b[i], diff, i);
+                ret[i] = read_bam(data[i], b[i]);
+                if (ret[i] < -1) {
+                    bad_bam = i; // truncated or corrupt, not the end
+                    break;
+                }
+                if (progress != NULL && ((++reads) & PM_PROGRESS_COLUMN_MASK) == 0) {
+                    // long contigs still report by bytes and can be cancelled part way
+                    bytes_now = compressedBytesRead(data, numBams);
+                    if (updateProgress(progress, tid, bytes_now - bytes_done, 0)) break;
+                    bytes_done = bytes_now;
+                }
+            }
+            if (bad_bam != -1 || PM_PROGRESS_IS_CANCELLED(progress)) break;
+            // at the end of this BAM's reads on the contig
+            adjust_start = statsClock();
+            diffToDepth(diff, depth, MR->contig_lengths[tid]);
+            adjustPlpBpColumn(MR, depth, tid, i);
+            clearDepthBuffer(depth);
+            MR->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - adjust_start;
+        }
+        if (bad_bam != -1 || PM_PROGRESS_IS_CANCELLED(progress)) break;
+        PM_TRACE3(contig_end, tid, PM_MR_LENGTH(MR, tid), contigPlpSum(MR, tid));
+        if (progress != NULL) {
+            bytes_now = compressedBytesRead(data, numBams);
+            if (updateProgress(progress, tid, bytes_now - bytes_done, tid + 1 - contigs_done)) break;
+            bytes_done = bytes_now;
+            contigs_done = tid + 1;
+        }
+    }
+    if (bad_bam != -1) {
+        char str[1024];
+        snprintf(str, sizeof(str), "Could not read %s, it may be truncated", MR->bam_file_names[bad_bam]);
+        printError(str, __LINE__);
+    } else if (stream != NULL && !PM_PROGRESS_IS_CANCELLED(progress) && !stream->cancelled) {
+        // the last contig and any after it with no reads
+        streamContigsBefore(stream, MR, MR->num_contigs);
+    }
+    if (bad_bam == -1 && progress != NULL && !progress->cancelled && !PM_STREAM_IS_CANCELLED(stream)) {
+        // contigs after the last one with reads
+        updateProgress(progress, MR->num_contigs - 1, 0, MR->num_contigs - contigs_done);
+    }
+    MR->stats.timer_ns[PM_TIMER_PILEUP] += statsClock() - start;
+
+    for (i = 0; i < numBams; ++i) {
+        bam_destroy1(b[i]);
+    }
+    free(b);
+    free(ret);
+    destroyDepthBuffers(depths);
+    free(diff);
+    if (bad_bam != -1)
+        return 1;
+    return (PM_PROGRESS_IS_CANCELLED(progress) || PM_STREAM_IS_CANCELLED(stream)) ? PM_PARSE_CANCELLED : 0;
+}
@@ -0,0 +1,149 @@
+//#############################################################################
+//
+//   cigarDepth.h
+//
+//   Count per-position depths straight from read CIGARs
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_CIGAR_DEPTH_H
+  #define PM_CIGAR_DEPTH_H
+
+// system includes
+#include <stdint.h>
+
+// htslib
+#include "htslib/sam.h"
+
+// local includes
+#include "bamParser.h"
+#include "depthBuffer.h"
+#include "regions.h"
+
+// base qualities are only visible in a pileup so we can only skip it without a filter
+#define PM_USE_CIGAR_ENGINE(opts) ((opts)->baseQ <= 0)
+
+// reads a pileup never sees (bam_plp's default mask) so the CIGAR walk skips them too
+#define PM_CIGAR_SKIP_FLAGS (BAM_FUNMAP | BAM_FSECONDARY | BAM_FQCFAIL | BAM_FDUP)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * @abstract Add the aligned blocks of a read to a difference array
+ *
+ * @param  b  read to add
+ * @param  diff  difference array for the read's contig (contigLength + 1 long)
+ * @param  contigLength  length of the read's contig
+ * @param  skipped  incremented by the number of D and N bases on the contig
+ * @return 1 if the read starts with an aligned base, 0 if it starts with a deletion
+ *
+ * @discussion Each M/=/X block adds +1 where it starts and -1 one past where
+ * it ends. D and N blocks move along the contig without counting, which is
+ * the same as the is_del/is_refskip rejects made on a pileup.
+ */
+int addReadToDiff(bam1_t * b, int32_t * diff, uint32_t contigLength, uint64_t * skipped);
+
+/*!
+ * @abstract Turn a difference array into per-position depths
+ *
+ * @param  diff  difference array (contigLength + 1 long)
+ * @param  depth  cleared buffer to write depths to (at least contigLength long)
+ * @param  contigLength  length of the contig
+ * @return void
+ *
+ * @discussion diff is zeroed as it is read so it can be reused straight away.
+ */
+void diffToDepth(int32_t * diff, PM_depth_buffer * depth, uint32_t contigLength);
+
+/*!
+ * @abstract Turn a difference array into depths for some regions of a contig
+ *
+ * @param  diff  difference array for the contig
+ * @param  depth  cleared buffer to write depths to
+ * @param  regions  sorted, non-overlapping regions of the contig
+ * @param  numRegions  number of regions
+ * @param  from  first entry of diff the reads touched
+ * @param  to  one past the last entry of diff the reads touched
+ * @return void
+ *
+ * @discussion The depth at each position inside a region is written to the
+ * region's slots (see PM_region) and the rest are skipped. diff is zeroed
+ * over [from, to) so it can be reused straight away.
+ */
+void diffToRegionDepth(int32_t * diff,
+                       PM_depth_buffer * depth,
+                       PM_region * regions,
+                       uint32_t numRegions,
+                       uint32_t from,
+                       uint32_t to);
+
+/*!
+ * @abstract Count a single read's depth and link
+ *
+ * @param  MR  mapping results struct being filled
+ * @param  links  link table to add a link to (NULL to count depth only)
+ * @param  stats  counters for rejected bases and links added
+ * @param  opts  settings being parsed with
+ * @param  b  read to count (already through read_bam)
+ * @param  diff  difference array for the read's contig
+ * @param  bamID  index of the BAM the read came from
+ * @return void
+ *
+ * @discussion Reads with any of PM_CIGAR_SKIP_FLAGS set add neither depth
+ * nor a link, the same as a pileup.
+ */
+void countCigarRead(PM_mapping_results * MR,
+                    PM_link_table * links,
+                    PM_parse_stats * stats,
+                    PM_parse_options * opts,
+                    bam1_t * b,
+                    int32_t * diff,
+                    int bamID);
+
+/*!
+ * @abstract Fill the mapping results by walking every read's CIGAR
+ *
+ * @param  data  one open reader per BAM, positioned after the header
+ * @param  opts  settings to parse with
+ * @param  progress  where to report progress (NULL for nowhere)
+ * @param  stream  where to hand finished contigs (NULL to keep them in MR)
+ * @param  MR  initialised mapping results struct to write to
+ * @return 0 for success, PM_PARSE_CANCELLED if progress or stream was cancelled,
+ * 1 if a BAM is truncated or corrupt
+ *
+ * @discussion Reads are taken in read_bam order and contigs are finished
+ * one at a time. Each BAM's depths go through adjustPlpBpColumn as soon as
+ * its reads on the contig are done, so only one depth buffer is needed.
+ * Only valid when there is no base quality filter. Unmapped, secondary,
+ * QC failed and duplicate reads are skipped as in bam_mplp, but unlike it
+ * there is no cap on the depth at a single position, and links are found
+ * BAM by BAM so link chains can be in a different order to a pileup parse.
+ */
+int parseWithCigars(aux_t ** data,
+                    PM_parse_options * opts,
+                    PM_progress_tracker * progress,
+                    PM_contig_stream * stream,
+                    PM_mapping_results * MR);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_CIGAR_DEPTH_H
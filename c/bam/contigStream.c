@@ -0,0 +1,53 @@
+//#############################################################################
+//
+//   contigStream.c
+//
+//   Hand each contig's results to a consumer as soon as they are finished
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+
+// local includes
+#include "contigStream.h"
+
+void initContigStream(PM_contig_stream * stream, PM_contig_consumer consumer, void * userData)
+{
+    memset(stream, 0, sizeof(PM_contig_stream));
+    stream->consumer = consumer;
+    stream->user_data = userData;
+    pthread_mutex_init(&stream->lock, NULL);
+}
+
+int emitContig(PM_contig_stream * stream, PM_contig_result * result)
+{
+    pthread_mutex_lock(&stream->lock);
+    if(!stream->cancelled && stream->consumer(result, stream->user_data) != 0)
+        stream->cancelled = 1;
+    pthread_mutex_unlock(&stream->lock);
+    return stream->cancelled;
+}
+
+void destroyContigStream(PM_contig_stream * stream)
+{
+    if(stream == NULL)
+        return;
+    pthread_mutex_destroy(&stream->lock);
+}
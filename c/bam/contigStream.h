@@ -0,0 +1,117 @@
+//#############################################################################
+//
+//   contigStream.h
+//
+//   Hand each contig's results to a consumer as soon as they are finished
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_CONTIG_STREAM_H
+  #define PM_CONTIG_STREAM_H
+
+// system includes
+#include <stdint.h>
+#include <pthread.h>
+
+// local includes
+#include "pairedLink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract One finished contig, only valid for the length of the consumer call
+ @field tid contig id (from the BAM header)
+ @field name contig name
+ @field length positions of the contig that were parsed
+ @field num_bams length of plp_bp and correctors
+ @field plp_bp bases piled up on the contig in each BAM
+ @field correctors contig length correctors for each BAM (NULL unless outlier coverage)
+ @field links links added while this contig was parsed (NULL unless links were asked for)
+ */
+typedef struct {
+    int tid;
+    char * name;
+    uint32_t length;
+    uint32_t num_bams;
+    uint32_t * plp_bp;
+    uint32_t * correctors;
+    PM_link_table * links;
+} PM_contig_result;
+
+/*! @typedef
+ @abstract Called with each finished contig, return non-zero to cancel the parse
+ @discussion Copy anything to be kept, the rows and links are reused for the
+ next contig as soon as this returns. With several contig workers this is
+ called from the worker threads, but never from two at once.
+ */
+typedef int (*PM_contig_consumer)(PM_contig_result * result, void * userData);
+
+/*! @typedef
+ @abstract Where a parse sends its finished contigs
+ @field consumer function to call with each contig
+ @field user_data passed through to consumer
+ @field next_tid first contig not yet handed over (serial parses only)
+ @field lock serialises calls from the contig workers
+ @field cancelled set once the consumer asks to stop
+ */
+typedef struct {
+    PM_contig_consumer consumer;
+    void * user_data;
+    int next_tid;
+    pthread_mutex_t lock;
+    volatile int cancelled;
+} PM_contig_stream;
+
+#define PM_STREAM_IS_CANCELLED(stream) ((stream) != NULL && (stream)->cancelled)
+
+/*!
+ * @abstract Set up a stream
+ *
+ * @param  stream  stream to set up
+ * @param  consumer  function to call with each contig
+ * @param  userData  passed through to consumer
+ * @return void
+ */
+void initContigStream(PM_contig_stream * stream, PM_contig_consumer consumer, void * userData);
+
+/*!
+ * @abstract Hand a finished contig to the consumer
+ *
+ * @param  stream  stream to send it down
+ * @param  result  the contig
+ * @return 1 if the parse has been cancelled, otherwise 0
+ *
+ * @discussion Thread safe. Once cancelled the consumer is not called again.
+ */
+int emitContig(PM_contig_stream * stream, PM_contig_result * result);
+
+/*!
+ * @abstract Clean up a stream
+ *
+ * @param  stream  stream to clean up (may be NULL)
+ * @return void
+ */
+void destroyContigStream(PM_contig_stream * stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_CONTIG_STREAM_H
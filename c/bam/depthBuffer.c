@@ -0,0 +1,177 @@
+//#############################################################################
+//
+//   depthBuffer.c
+//
+//   Reusable per-position depth buffers for a single contig
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+
+// local includes
+#include "depthBuffer.h"
+#include "stats.h"
+
+#define PM_DEPTH_OVERFLOW_MIN 16
+
+PM_depth_buffers * createDepthBuffers(int numBuffers, uint32_t capacity, int useHistograms)
+{
+    int i = 0;
+    PM_depth_buffers * DB = calloc(1, sizeof(PM_depth_buffers));
+    DB->num_buffers = numBuffers;
+    DB->capacity = capacity;
+    DB->buffers = calloc(numBuffers, sizeof(PM_depth_buffer));
+    for(i = 0; i < numBuffers; ++i) {
+        if(useHistograms) {
+            DB->buffers[i].hist = createDepthHistogram();
+        } else {
+            // calloc'd pages stay untouched until a read lands on them
+            DB->buffers[i].depths = calloc((size_t)capacity + 1, sizeof(uint16_t));
+        }
+    }
+    return DB;
+}
+
+void destroyDepthBuffers(PM_depth_buffers * DB)
+{
+    int i = 0;
+    if(DB == NULL)
+        return;
+    for(i = 0; i < DB->num_buffers; ++i) {
+        free(DB->buffers[i].depths);
+        free(DB->buffers[i].overflow);
+        free(DB->buffers[i].hist);
+    }
+    free(DB->buffers);
+    free(DB);
+}
+
+void clearDepthBuffer(PM_depth_buffer * buf)
+{
+    if(buf->hist)
+        clearDepthHistogram(buf->hist);
+    if(buf->hi > buf->lo)
+        memset(buf->depths + buf->lo, 0, (size_t)(buf->hi - buf->lo) * sizeof(uint16_t));
+    buf->lo = 0;
+    buf->hi = 0;
+    buf->num_overflow = 0;
+}
+
+void clearDepthBuffers(PM_depth_buffers * DB)
+{
+    int i = 0;
+    for(i = 0; i < DB->num_buffers; ++i) {
+        clearDepthBuffer(&DB->buffers[i]);
+    }
+}
+
+void addDepthOverflow(PM_depth_buffer * buf, uint32_t pos, uint32_t depth)
+{
+    if(buf->num_overflow == buf->overflow_capacity) {
+        buf->overflow_capacity = (buf->overflow_capacity == 0) ? PM_DEPTH_OVERFLOW_MIN : buf->overflow_capacity * 2;
+        buf->overflow = realloc(buf->overflow, buf->overflow_capacity * sizeof(PM_depth_overflow));
+    }
+    buf->overflow[buf->num_overflow].pos = pos;
+    buf->overflow[buf->num_overflow].depth = depth;
+    ++buf->num_overflow;
+}
+
+uint32_t findDepthOverflow(PM_depth_buffer * buf, uint32_t pos)
+{
+    //-----
+    // entries are added in position order so we can bisect
+    //
+    size_t lo = 0, hi = buf->num_overflow;
+    while(lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if(buf->overflow[mid].pos < pos)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo < buf->num_overflow && buf->overflow[lo].pos == pos)
+        return buf->overflow[lo].depth;
+    return PM_DEPTH_SATURATED;
+}
+
+void appendDepthBuffer(PM_depth_buffer * dest, PM_depth_buffer * src, uint32_t offset)
+{
+    size_t i = 0;
+    if(src->hist) {
+        addDepthHistogram(dest->hist, src->hist);
+        return;
+    }
+    if(src->hi <= src->lo)
+        return;
+    memcpy(dest->depths + offset + src->lo,
+           src->depths + src->lo,
+           (size_t)(src->hi - src->lo) * sizeof(uint16_t));
+    if(dest->lo == dest->hi) dest->lo = offset + src->lo;
+    dest->hi = offset + src->hi;
+    // still in position order as everything in dest comes before offset
+    for(i = 0; i < src->num_overflow; ++i) {
+        addDepthOverflow(dest, offset + src->overflow[i].pos, src->overflow[i].depth);
+    }
+}
+
+void depthBufferMoments(PM_depth_buffer * buf,
+                        uint64_t * sum,
+                        uint64_t * sumSquares)
+{
+    size_t i = 0;
+    PM_sumSquares(buf->depths + buf->lo, buf->hi - buf->lo, sum, sumSquares);
+    // the kernel saw PM_DEPTH_SATURATED for these
+    for(i = 0; i < buf->num_overflow; ++i) {
+        uint64_t d = buf->overflow[i].depth;
+        *sum += d - PM_DEPTH_SATURATED;
+        *sumSquares += d * d - (uint64_t)PM_DEPTH_SATURATED * PM_DEPTH_SATURATED;
+    }
+}
+
+void depthBufferClippedSum(PM_depth_buffer * buf,
+                           uint32_t lower,
+                           uint32_t upper,
+                           uint64_t * kept,
+                           uint64_t * drops)
+{
+    size_t i = 0;
+    uint16_t lower_16 = (lower < PM_DEPTH_SATURATED) ? lower : PM_DEPTH_SATURATED;
+    uint16_t upper_16 = (upper < PM_DEPTH_SATURATED) ? upper : PM_DEPTH_SATURATED;
+    PM_clippedSum(buf->depths + buf->lo, buf->hi - buf->lo, lower_16, upper_16, kept, drops);
+    if(buf->num_overflow == 0)
+        return;
+    //-----
+    // the kernel judged saturated positions as PM_DEPTH_SATURATED so redo them
+    //
+    int saturated_kept = (upper_16 == PM_DEPTH_SATURATED);
+    for(i = 0; i < buf->num_overflow; ++i) {
+        uint32_t d = buf->overflow[i].depth;
+        if(saturated_kept) {
+            *kept -= PM_DEPTH_SATURATED;
+        } else {
+            --*drops;
+        }
+        if(d >= lower && d <= upper) {
+            *kept += d;
+        } else {
+            ++*drops;
+        }
+    }
+}
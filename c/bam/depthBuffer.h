@@ -0,0 +1,239 @@
+//#############################################################################
+//
+//   depthBuffer.h
+//
+//   Reusable per-position depth buffers for a single contig
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_DEPTH_BUFFER_H
+  #define PM_DEPTH_BUFFER_H
+
+// system includes
+#include <stdint.h>
+#include <stddef.h>
+
+// local includes
+#include "depthHistogram.h"
+
+// depths at or above this are looked up in the overflow table
+#define PM_DEPTH_SATURATED 0xFFFF
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract A depth too big to fit in a buffer slot
+ @field pos position on the contig
+ @field depth real depth at pos
+ */
+typedef struct {
+    uint32_t pos;
+    uint32_t depth;
+} PM_depth_overflow;
+
+/*! @typedef
+ @abstract Depths along one contig for one BAM
+ @field depths saturating count at each position (capacity long)
+ @field lo first position written since the last clear
+ @field hi one past the last position written since the last clear
+ @field overflow real depths of saturated positions, in position order
+ @field num_overflow number of entries in overflow
+ @field overflow_capacity number of entries overflow has room for
+ @field hist if not NULL depths are binned here and the other fields are unused
+ */
+typedef struct {
+    uint16_t * depths;
+    uint32_t lo;
+    uint32_t hi;
+    PM_depth_overflow * overflow;
+    size_t num_overflow;
+    size_t overflow_capacity;
+    PM_depth_histogram * hist;
+} PM_depth_buffer;
+
+/*! @typedef
+ @abstract One depth buffer per BAM, all the same size
+ @field buffers the buffers
+ @field num_buffers number of buffers
+ @field capacity number of positions each buffer can hold
+ */
+typedef struct {
+    PM_depth_buffer * buffers;
+    int num_buffers;
+    uint32_t capacity;
+} PM_depth_buffers;
+
+/*!
+ * @abstract Make a set of empty depth buffers
+ *
+ * @param  numBuffers  number of buffers to make (one per BAM)
+ * @param  capacity  positions per buffer, use the longest contig to be parsed
+ * @param  useHistograms  1 to keep a depth histogram instead of per-position depths
+ * @return PM_depth_buffers *
+ *
+ * @discussion Call destroyDepthBuffers when done. Histogram buffers take the
+ * same few KB whatever the contig length.
+ */
+PM_depth_buffers * createDepthBuffers(int numBuffers, uint32_t capacity, int useHistograms);
+
+/*!
+ * @abstract Free depth buffers made by createDepthBuffers
+ *
+ * @param  DB  buffers to destroy
+ * @return void
+ */
+void destroyDepthBuffers(PM_depth_buffers * DB);
+
+/*!
+ * @abstract Zero every buffer ready for the next contig
+ *
+ * @param  DB  buffers to clear
+ * @return void
+ *
+ * @discussion Only the range written since the last clear is touched.
+ */
+void clearDepthBuffers(PM_depth_buffers * DB);
+
+/*!
+ * @abstract Zero a single buffer ready for the next contig
+ *
+ * @param  buf  buffer to clear
+ * @return void
+ */
+void clearDepthBuffer(PM_depth_buffer * buf);
+
+/*!
+ * @abstract Record a depth too big for a buffer slot
+ *
+ * @param  buf  buffer to add to
+ * @param  pos  position on the contig
+ * @param  depth  real depth at pos
+ * @return void
+ *
+ * @discussion Use setDepth rather than calling this directly.
+ */
+void addDepthOverflow(PM_depth_buffer * buf, uint32_t pos, uint32_t depth);
+
+/*!
+ * @abstract Look up the real depth of a saturated position
+ *
+ * @param  buf  buffer to search
+ * @param  pos  position on the contig
+ * @return depth at pos
+ */
+uint32_t findDepthOverflow(PM_depth_buffer * buf, uint32_t pos);
+
+/*!
+ * @abstract Copy the depths of a later stretch of a contig onto the end of a buffer
+ *
+ * @param  dest  buffer holding the contig so far
+ * @param  src  buffer filled with the stretch, its positions counted from the stretch's start
+ * @param  offset  position of the stretch's start in dest
+ * @return void
+ *
+ * @discussion Nothing may have been written to dest at or beyond offset, so
+ * stretches must be appended in order. Afterwards dest is the same as if
+ * the stretch had been set position by position.
+ */
+void appendDepthBuffer(PM_depth_buffer * dest, PM_depth_buffer * src, uint32_t offset);
+
+/*!
+ * @abstract Sum the written depths and their squares in one pass
+ *
+ * @param  buf  buffer to read
+ * @param  sum  set to the sum of the depths
+ * @param  sumSquares  set to the sum of the squared depths
+ * @return void
+ *
+ * @discussion Unwritten positions are zero so add nothing to either sum.
+ */
+void depthBufferMoments(PM_depth_buffer * buf,
+                        uint64_t * sum,
+                        uint64_t * sumSquares);
+
+/*!
+ * @abstract Sum the written depths lying in [lower, upper] and count the rest
+ *
+ * @param  buf  buffer to read
+ * @param  lower  smallest depth kept
+ * @param  upper  largest depth kept
+ * @param  kept  set to the sum of the depths kept
+ * @param  drops  set to the number of written positions outside the range
+ * @return void
+ *
+ * @discussion Only positions in [lo, hi) are looked at, the caller must
+ * account for the zeros outside that range.
+ */
+void depthBufferClippedSum(PM_depth_buffer * buf,
+                           uint32_t lower,
+                           uint32_t upper,
+                           uint64_t * kept,
+                           uint64_t * drops);
+
+/*!
+ * @abstract Set the depth at a position
+ *
+ * @param  buf  buffer to write to
+ * @param  pos  position on the contig (< capacity)
+ * @param  depth  depth at pos
+ * @return void
+ *
+ * @discussion Each position may be set once per contig and positions must
+ * be set in increasing order, which is how both a pileup and a difference
+ * array walk a contig. Zero depths need not be set at all.
+ */
+static inline void setDepth(PM_depth_buffer * buf, uint32_t pos, uint32_t depth)
+{
+    if(depth == 0) return;
+    if(buf->hist) {
+        addToHistogram(buf->hist, depth);
+        return;
+    }
+    if(buf->lo == buf->hi) buf->lo = pos;
+    buf->hi = pos + 1;
+    if(depth < PM_DEPTH_SATURATED) {
+        buf->depths[pos] = (uint16_t)depth;
+    } else {
+        buf->depths[pos] = PM_DEPTH_SATURATED;
+        addDepthOverflow(buf, pos, depth);
+    }
+}
+
+/*!
+ * @abstract Get the depth at a position
+ *
+ * @param  buf  buffer to read from
+ * @param  pos  position on the contig (< capacity)
+ * @return depth at pos
+ *
+ * @discussion Not for histogram buffers.
+ */
+static inline uint32_t getDepth(PM_depth_buffer * buf, uint32_t pos)
+{
+    uint16_t d = buf->depths[pos];
+    if(d < PM_DEPTH_SATURATED) return d;
+    return findDepthOverflow(buf, pos);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_DEPTH_BUFFER_H
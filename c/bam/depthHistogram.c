@@ -0,0 +1,168 @@
+//#############################################################################
+//
+//   depthHistogram.c
+//
+//   Compact histograms of per-position depth and the estimators built on them
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+// local includes
+#include "depthHistogram.h"
+
+PM_depth_histogram * createDepthHistogram(void)
+{
+    return calloc(1, sizeof(PM_depth_histogram));
+}
+
+void clearDepthHistogram(PM_depth_histogram * hist)
+{
+    // only the bins up to max_bin can be non-zero
+    memset(hist->counts, 0, (hist->max_bin + 1) * sizeof(uint64_t));
+    if(hist->max_bin >= PM_HIST_DENSE)
+        memset(hist->sums, 0, (hist->max_bin - PM_HIST_DENSE + 1) * sizeof(uint64_t));
+    hist->total = 0;
+    hist->max_bin = 0;
+}
+
+void finishDepthHistogram(PM_depth_histogram * hist, uint32_t contigLength)
+{
+    hist->counts[0] = (contigLength > hist->total) ? contigLength - hist->total : 0;
+}
+
+void addDepthHistogram(PM_depth_histogram * dest, PM_depth_histogram * src)
+{
+    int i = 0;
+    // bin 0 is left for finishDepthHistogram
+    for(i = 1; i <= src->max_bin; ++i) {
+        dest->counts[i] += src->counts[i];
+    }
+    for(i = PM_HIST_DENSE; i <= src->max_bin; ++i) {
+        dest->sums[i - PM_HIST_DENSE] += src->sums[i - PM_HIST_DENSE];
+    }
+    dest->total += src->total;
+    if(src->max_bin > dest->max_bin) dest->max_bin = src->max_bin;
+}
+
+static uint64_t histogramSize(PM_depth_histogram * hist)
+{
+    return hist->counts[0] + hist->total;
+}
+
+static void findRankBin(PM_depth_histogram * hist,
+                        uint64_t rank,
+                        uint64_t * binStart,
+                        uint64_t * binEnd)
+{
+    //-----
+    // ranks [binStart, binEnd) share the bin holding rank
+    //
+    uint64_t seen = 0;
+    int bin = 0;
+    for(bin = 0; bin <= hist->max_bin; ++bin) {
+        if(rank < seen + hist->counts[bin]) {
+            *binStart = seen;
+            *binEnd = seen + hist->counts[bin];
+            return;
+        }
+        seen += hist->counts[bin];
+    }
+    *binStart = seen;
+    *binEnd = seen;
+}
+
+uint64_t histogramRankSum(PM_depth_histogram * hist, uint64_t firstRank, uint64_t lastRank)
+{
+    uint64_t seen = 0, sum = 0;
+    int bin = 0;
+    for(bin = 0; bin <= hist->max_bin && seen < lastRank; ++bin) {
+        uint64_t count = hist->counts[bin];
+        uint64_t bin_first = seen, bin_last = seen + count;
+        seen = bin_last;
+        if(count == 0 || bin_last <= firstRank)
+            continue;
+        uint64_t take = ((bin_last < lastRank) ? bin_last : lastRank) -
+                        ((bin_first > firstRank) ? bin_first : firstRank);
+        if(bin < PM_HIST_DENSE) {
+            sum += take * (uint64_t)bin;
+        } else if(take == count) {
+            sum += hist->sums[bin - PM_HIST_DENSE];
+        } else {
+            sum += (uint64_t)((double)hist->sums[bin - PM_HIST_DENSE] * take / count + 0.5);
+        }
+    }
+    return sum;
+}
+
+void histogramTrimmedSum(PM_depth_histogram * hist,
+                         double lowerQ,
+                         double upperQ,
+                         uint64_t * kept,
+                         uint64_t * drops)
+{
+    uint64_t num_positions = histogramSize(hist);
+    uint64_t first = (uint64_t)(lowerQ * num_positions);
+    uint64_t last = num_positions - (uint64_t)((1.0 - upperQ) * num_positions);
+    if(last < first) last = first;
+    *kept = histogramRankSum(hist, first, last);
+    *drops = num_positions - (last - first);
+}
+
+void histogramMedianSum(PM_depth_histogram * hist,
+                        uint64_t * kept,
+                        uint64_t * drops)
+{
+    uint64_t num_positions = histogramSize(hist);
+    uint64_t first = 0, last = 0;
+    if(num_positions != 0) {
+        if(num_positions % 2) {
+            first = num_positions / 2;
+            last = first + 1;
+        } else {
+            first = num_positions / 2 - 1;
+            last = first + 2;
+        }
+    }
+    *kept = histogramRankSum(hist, first, last);
+    *drops = num_positions - (last - first);
+}
+
+void histogramPercentileClipSum(PM_depth_histogram * hist,
+                                double lowerQ,
+                                double upperQ,
+                                uint64_t * kept,
+                                uint64_t * drops)
+{
+    uint64_t num_positions = histogramSize(hist);
+    uint64_t first = 0, last = 0, ignore = 0;
+    if(num_positions != 0) {
+        // nearest rank percentiles, then widen to every position in those bins
+        uint64_t lower_rank = (uint64_t)(lowerQ * (num_positions - 1));
+        uint64_t upper_rank = (uint64_t)ceil(upperQ * (num_positions - 1));
+        if(upper_rank >= num_positions) upper_rank = num_positions - 1;
+        if(upper_rank < lower_rank) upper_rank = lower_rank;
+        findRankBin(hist, lower_rank, &first, &ignore);
+        findRankBin(hist, upper_rank, &ignore, &last);
+    }
+    *kept = histogramRankSum(hist, first, last);
+    *drops = num_positions - (last - first);
+}
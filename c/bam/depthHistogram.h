@@ -0,0 +1,197 @@
+//#############################################################################
+//
+//   depthHistogram.h
+//
+//   Compact histograms of per-position depth and the estimators built on them
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_DEPTH_HISTOGRAM_H
+  #define PM_DEPTH_HISTOGRAM_H
+
+// system includes
+#include <stdint.h>
+
+// depths below this get a bin each
+#define PM_HIST_DENSE 1024
+// log2(PM_HIST_DENSE)
+#define PM_HIST_DENSE_BITS 10
+// bins per power of two above PM_HIST_DENSE
+#define PM_HIST_SUB_BITS 4
+#define PM_HIST_SUB (1 << PM_HIST_SUB_BITS)
+// bins for depths from PM_HIST_DENSE up to UINT32_MAX
+#define PM_HIST_LOG_BINS ((32 - PM_HIST_DENSE_BITS) * PM_HIST_SUB)
+#define PM_HIST_BINS (PM_HIST_DENSE + PM_HIST_LOG_BINS)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract Number of positions at each depth along one contig for one BAM
+ @field counts positions in each bin, bin 0 is only filled in by finishDepthHistogram
+ @field sums total depth of the positions in each log bin
+ @field total number of non-zero positions added
+ @field max_bin highest bin used since the last clear
+ */
+typedef struct {
+    uint64_t counts[PM_HIST_BINS];
+    uint64_t sums[PM_HIST_LOG_BINS];
+    uint64_t total;
+    int max_bin;
+} PM_depth_histogram;
+
+/*!
+ * @abstract Make an empty histogram
+ *
+ * @return PM_depth_histogram *
+ *
+ * @discussion Free it with free() or destroyDepthBuffers when it belongs to a buffer.
+ */
+PM_depth_histogram * createDepthHistogram(void);
+
+/*!
+ * @abstract Zero a histogram ready for the next contig
+ *
+ * @param  hist  histogram to clear
+ * @return void
+ */
+void clearDepthHistogram(PM_depth_histogram * hist);
+
+/*!
+ * @abstract Work out the bin a depth falls in
+ *
+ * @param  depth  depth at a position
+ * @return bin index
+ */
+static inline int depthBin(uint32_t depth)
+{
+    if(depth < PM_HIST_DENSE) return (int)depth;
+    int octave = 31 - __builtin_clz(depth);
+    int sub = (depth >> (octave - PM_HIST_SUB_BITS)) & (PM_HIST_SUB - 1);
+    return PM_HIST_DENSE + (octave - PM_HIST_DENSE_BITS) * PM_HIST_SUB + sub;
+}
+
+/*!
+ * @abstract Add a position to a histogram
+ *
+ * @param  hist  histogram to add to
+ * @param  depth  depth at the position (> 0)
+ * @return void
+ */
+static inline void addToHistogram(PM_depth_histogram * hist, uint32_t depth)
+{
+    int bin = depthBin(depth);
+    ++hist->counts[bin];
+    if(bin >= PM_HIST_DENSE) hist->sums[bin - PM_HIST_DENSE] += depth;
+    if(bin > hist->max_bin) hist->max_bin = bin;
+    ++hist->total;
+}
+
+/*!
+ * @abstract Add the positions of one histogram to another
+ *
+ * @param  dest  histogram to add to
+ * @param  src  unfinished histogram of another stretch of the same contig
+ * @return void
+ *
+ * @discussion Adding the histograms of pieces of a contig gives the same
+ * histogram as adding the whole contig position by position.
+ */
+void addDepthHistogram(PM_depth_histogram * dest, PM_depth_histogram * src);
+
+/*!
+ * @abstract Account for the zero depth positions of a contig
+ *
+ * @param  hist  histogram to finish
+ * @param  contigLength  length of the contig the histogram covers
+ * @return void
+ *
+ * @discussion Zero depths are never added one by one, call this once the
+ * contig is done and before any of the estimators below.
+ */
+void finishDepthHistogram(PM_depth_histogram * hist, uint32_t contigLength);
+
+/*!
+ * @abstract Sum the depths of the positions ranked [firstRank, lastRank)
+ *
+ * @param  hist  finished histogram
+ * @param  firstRank  first position to include, in increasing depth order
+ * @param  lastRank  one past the last position to include
+ * @return sum of the depths
+ *
+ * @discussion Exact below PM_HIST_DENSE. Above that a partly included bin
+ * counts each of its positions at the bin's mean depth.
+ */
+uint64_t histogramRankSum(PM_depth_histogram * hist, uint64_t firstRank, uint64_t lastRank);
+
+/*!
+ * @abstract Trimmed mean: drop the lowest and highest ranked positions
+ *
+ * @param  hist  finished histogram
+ * @param  lowerQ  fraction of positions to drop from the bottom
+ * @param  upperQ  positions ranked above this fraction are dropped from the top
+ * @param  kept  set to the sum of the depths kept
+ * @param  drops  set to the number of positions dropped
+ * @return void
+ */
+void histogramTrimmedSum(PM_depth_histogram * hist,
+                         double lowerQ,
+                         double upperQ,
+                         uint64_t * kept,
+                         uint64_t * drops);
+
+/*!
+ * @abstract Median: keep the middle one or two positions
+ *
+ * @param  hist  finished histogram
+ * @param  kept  set to the sum of the depths kept
+ * @param  drops  set to the number of positions dropped
+ * @return void
+ *
+ * @discussion kept / (total - drops) is the median depth.
+ */
+void histogramMedianSum(PM_depth_histogram * hist,
+                        uint64_t * kept,
+                        uint64_t * drops);
+
+/*!
+ * @abstract Percentile clip: drop every position with a depth outside the
+ * lowerQ and upperQ percentile depths
+ *
+ * @param  hist  finished histogram
+ * @param  lowerQ  lower percentile (0 - 1)
+ * @param  upperQ  upper percentile (0 - 1)
+ * @param  kept  set to the sum of the depths kept
+ * @param  drops  set to the number of positions dropped
+ * @return void
+ *
+ * @discussion Unlike the trimmed mean, positions tied with a percentile
+ * depth are all kept.
+ */
+void histogramPercentileClipSum(PM_depth_histogram * hist,
+                                double lowerQ,
+                                double upperQ,
+                                uint64_t * kept,
+                                uint64_t * drops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_DEPTH_HISTOGRAM_H
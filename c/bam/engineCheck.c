@@ -0,0 +1,166 @@
+//#############################################################################
+//
+//   engineCheck.c
+//
+//   Check the CIGAR and pileup engines agree on a set of BAMs
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// local includes
+#include "bamParser.h"
+#include "pairedLink.h"
+
+// the lowest filter that still makes a pileup, it only drops bases of quality 0
+#define PM_CHECK_PILEUP_BASEQ 1
+
+/*! @typedef
+ @abstract One link, flattened so two sets of links can be sorted and compared
+ */
+typedef struct {
+    uint32_t cid_1;
+    uint32_t cid_2;
+    uint32_t pos_1;
+    uint32_t pos_2;
+    uint32_t orient;
+    uint32_t bam_ID;
+} PM_check_link;
+
+static int compareLinks(const void * a, const void * b)
+{
+    return memcmp(a, b, sizeof(PM_check_link));
+}
+
+static PM_check_link * sortedLinks(PM_mapping_results * MR, size_t * numLinks)
+{
+    //-----
+    // the engines find links in different orders so only the sets are compared
+    //
+    PM_link_columns * LC = compactLinks(MR->links);
+    PM_check_link * links = calloc(LC->num_links + 1, sizeof(PM_check_link));
+    size_t i = 0;
+    for(i = 0; i < LC->num_links; ++i) {
+        links[i].cid_1 = LC->cid_1[i];
+        links[i].cid_2 = LC->cid_2[i];
+        links[i].pos_1 = LC->pos_1[i];
+        links[i].pos_2 = LC->pos_2[i];
+        links[i].orient = LC->orient[i];
+        links[i].bam_ID = LC->bam_ID[i];
+    }
+    *numLinks = LC->num_links;
+    qsort(links, *numLinks, sizeof(PM_check_link), compareLinks);
+    destroyLinkColumns(LC);
+    return links;
+}
+
+static int parseWith(int numBams, char ** bamFiles, int baseQ, int mode, PM_mapping_results * MR)
+{
+    PM_parse_options opts;
+    init_parse_options(&opts);
+    opts.baseQ = baseQ;
+    opts.do_links = 1;
+    opts.do_outlier_coverage = mode;
+    opts.cache_dir = NULL; // both engines must really parse
+    return parseCoverageAndLinksWithOptions(numBams, bamFiles, &opts, MR);
+}
+
+static int compareResults(PM_mapping_results * cigars, PM_mapping_results * pileup, int mode)
+{
+    uint32_t tid = 0, bam = 0;
+    size_t num_cigar_links = 0, num_pileup_links = 0, i = 0;
+    int diffs = 0;
+    for(tid = 0; tid < cigars->num_contigs; ++tid) {
+        for(bam = 0; bam < cigars->num_bams; ++bam) {
+            size_t cell = PM_MR_CELL(cigars, tid, bam);
+            if(cigars->plp_bp[cell] != pileup->plp_bp[cell]) {
+                printf("mode %d: %s in BAM %u piles up %u bases with CIGARs and %u in a pileup\n",
+                       mode, cigars->contig_names[tid], bam, cigars->plp_bp[cell], pileup->plp_bp[cell]);
+                ++diffs;
+            }
+            if(cigars->is_outlier_coverage &&
+               cigars->contig_length_correctors[cell] != pileup->contig_length_correctors[cell]) {
+                printf("mode %d: %s in BAM %u has corrector %u with CIGARs and %u in a pileup\n",
+                       mode, cigars->contig_names[tid], bam,
+                       cigars->contig_length_correctors[cell], pileup->contig_length_correctors[cell]);
+                ++diffs;
+            }
+        }
+    }
+
+    PM_check_link * cigar_links = sortedLinks(cigars, &num_cigar_links);
+    PM_check_link * pileup_links = sortedLinks(pileup, &num_pileup_links);
+    if(num_cigar_links != num_pileup_links) {
+        printf("mode %d: %zu links with CIGARs and %zu in a pileup\n", mode, num_cigar_links, num_pileup_links);
+        ++diffs;
+    } else {
+        for(i = 0; i < num_cigar_links; ++i) {
+            if(compareLinks(&cigar_links[i], &pileup_links[i]) != 0) {
+                printf("mode %d: link %zu differs (%u:%u - %u:%u with CIGARs, %u:%u - %u:%u in a pileup)\n",
+                       mode, i,
+                       cigar_links[i].cid_1, cigar_links[i].pos_1, cigar_links[i].cid_2, cigar_links[i].pos_2,
+                       pileup_links[i].cid_1, pileup_links[i].pos_1, pileup_links[i].cid_2, pileup_links[i].pos_2);
+                ++diffs;
+                break;
+            }
+        }
+    }
+    free(cigar_links);
+    free(pileup_links);
+    return diffs;
+}
+
+int main(int argc, char *argv[])
+{
+    //-----
+    // parse the same BAMs with each engine in every coverage mode and
+    // compare depths, correctors and links
+    //
+    int mode = 0, failed = 0;
+    if(argc < 2) {
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Usage: pmEngineCheck in1.bam [in2.bam [...]]\n");
+        fprintf(stderr, "   The BAMs must share a header and have no bases of quality 0\n");
+        fprintf(stderr, "   and no more than 8000 reads over any position.\n");
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    for(mode = PM_COVERAGE_MEAN; mode <= PM_COVERAGE_PERCENTILE_CLIP; ++mode) {
+        PM_mapping_results * cigars = create_MR();
+        PM_mapping_results * pileup = create_MR();
+        int diffs = 0;
+        if(parseWith(argc - 1, argv + 1, 0, mode, cigars) != 0 ||
+           parseWith(argc - 1, argv + 1, PM_CHECK_PILEUP_BASEQ, mode, pileup) != 0) {
+            printf("mode %d: could not parse the BAMs\n", mode);
+            diffs = 1;
+        } else {
+            diffs = compareResults(cigars, pileup, mode);
+        }
+        printf("mode %d: %s (%u contigs, %u BAMs)\n", mode, diffs ? "FAILED" : "ok",
+               cigars->num_contigs, cigars->num_bams);
+        failed += (diffs != 0);
+        destroy_MR(cigars);
+        destroy_MR(pileup);
+        free(cigars);
+        free(pileup);
+    }
+    return failed ? 1 : 0;
+}
@@ -3,24 +3,80 @@
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <signal.h>
 
 // local includes
 #include "bamParser.h"
 #include "pairedLink.h"
+#include "resultsFile.h"
+#include "outputWriter.h"
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void onInterrupt(int sig)
+{
+    interrupted = 1;
+}
+
+static int printProgress(PM_progress * P, void * userData)
+{
+    fprintf(stderr, "%.1f / %.1f MB, contig %d (%d of %d done), %.0fs elapsed",
+            P->bytes_read / 1048576.0, P->bytes_total / 1048576.0,
+            P->tid, P->contigs_done, P->num_contigs, P->elapsed);
+    if (P->eta >= 0) fprintf(stderr, ", ~%.0fs to go", P->eta);
+    fprintf(stderr, "\n");
+    return interrupted; // stop cleanly on Ctrl-C
+}
 
 int main(int argc, char *argv[])
 {
     // parse the command line
-    int n = 0, do_links = 0, baseQ = 0, mapQ = 0, min_len = 0, do_outlier_coverage = 0;
-    while ((n = getopt(argc, argv, "q:Q:l:Lo")) >= 0) {
+    int n = 0;
+    char * save_file = NULL;   // write the results here
+    char * load_file = NULL;   // read results from here instead of parsing
+    char * out_file = "-";     // write the tables here
+    int out_format = PM_OUTPUT_TSV;
+    int verbose = 0;           // print parse stats to stderr
+    PM_parse_options opts;
+    init_parse_options(&opts);
+    opts.regions = calloc(argc, sizeof(char*)); // can't be more regions than arguments
+    while ((n = getopt(argc, argv, "q:Q:l:Low:t:m:p:r:b:s:i:c:O:f:vP:F:A:C:W:n:M:")) >= 0) {
         switch (n) {
-            case 'l': min_len = atoi(optarg); break; // minimum query length
-            case 'q': baseQ = atoi(optarg); break;   // base quality threshold
-            case 'Q': mapQ = atoi(optarg); break;    // mapping quality threshold
-            case 'L': do_links = 1; break;
-            case 'o': do_outlier_coverage = 1; break;
+            case 'l': opts.min_len = atoi(optarg); break; // minimum query length
+            case 'q': opts.baseQ = atoi(optarg); break;   // base quality threshold
+            case 'Q': opts.mapQ = atoi(optarg); break;    // mapping quality threshold
+            case 'L': opts.do_links = 1; break;
+            case 'o': opts.do_outlier_coverage = 1; break;
+            case 'w': opts.num_workers = atoi(optarg); break; // contig worker threads
+            case 't': opts.num_threads = atoi(optarg); break; // BGZF decompression threads
+            case 'm': opts.do_outlier_coverage = atoi(optarg); break; // PM_coverage_mode
+            case 'p': sscanf(optarg, "%f:%f", &opts.coverage_lower, &opts.coverage_upper); break;
+            case 'r': opts.regions[opts.num_regions++] = optarg; break; // contig or contig:beg-end
+            case 'b': opts.bed_file = optarg; break;      // BED file of regions
+            case 's': save_file = optarg; break;
+            case 'i': load_file = optarg; break;
+            case 'c': opts.cache_dir = optarg; break;     // per-BAM result cache
+            case 'O': out_file = optarg; break;
+            case 'f': out_format = atoi(optarg); break;   // PM_output_format
+            case 'v': verbose = 1; break;
+            case 'P': opts.progress = printProgress; opts.progress_mb = atoi(optarg); break;
+            case 'F': opts.num_finalisers = atoi(optarg); break; // contig finaliser threads
+            case 'A': opts.read_ahead = atoi(optarg); break;     // records read ahead per BAM
+            case 'C': opts.chunk_size = atoi(optarg); break;     // bases per work stealing chunk
+            case 'W': opts.num_bam_workers = atoi(optarg); break; // threads parsing whole BAMs
+            case 'n': opts.max_open_files = atoi(optarg); break;  // BAMs open at once
+            case 'M': opts.memory_mb = atoi(optarg); break;       // memory budget for open BAMs
         }
     }
+    if (load_file != NULL) {
+        PM_mapping_results * mr = create_MR();
+        int ret_val = load_MR(load_file, mr);
+        if (ret_val == 0) ret_val = write_MR(mr, out_file, out_format);
+        destroy_MR(mr);
+        free(mr);
+        free(opts.regions);
+        return ret_val;
+    }
     if (optind == argc) {
         fprintf(stderr, "\n");
         fprintf(stderr, "Usage: samtools depth [options] in1.bam [in2.bam [...]]\n");
@@ -30,7 +86,33 @@ int main(int argc, char *argv[])
         fprintf(stderr, "   -q <int>            base quality threshold\n");
         fprintf(stderr, "   -Q <int>            mapping quality threshold\n");
         fprintf(stderr, "   -o                  do outlier coverage corrections\n");
+        fprintf(stderr, "   -m <int>            coverage mode: 0 mean, 1 outlier (-o), 2 trimmed mean,\n");
+        fprintf(stderr, "                       3 median, 4 percentile clip\n");
+        fprintf(stderr, "   -p <float:float>    lower:upper fractions for modes 2 and 4 [0.05:0.95]\n");
+        fprintf(stderr, "   -w <int>            contig worker threads (needs indexed BAMs)\n");
+        fprintf(stderr, "   -t <int>            BGZF decompression threads\n");
+        fprintf(stderr, "   -r <region>         only parse this contig or contig:beg-end (repeatable,\n");
+        fprintf(stderr, "                       needs indexed BAMs)\n");
+        fprintf(stderr, "   -b <file>           only parse the regions in this BED file\n");
+        fprintf(stderr, "   -s <file>           save the results to this file\n");
+        fprintf(stderr, "   -i <file>           print results saved with -s instead of parsing\n");
+        fprintf(stderr, "   -c <dir>            reuse and add to cached per-BAM results [$PM_CACHE_DIR]\n");
+        fprintf(stderr, "   -O <file>           write the tables here [stdout]\n");
+        fprintf(stderr, "   -f <int>            output format: 0 TSV, 1 BGZF'd TSV, 2 binary [0]\n");
+        fprintf(stderr, "   -v                  print timings and filter counts to stderr\n");
+        fprintf(stderr, "   -P <int>            print progress to stderr every <int> MB read,\n");
+        fprintf(stderr, "                       Ctrl-C then stops the parse cleanly\n");
+        fprintf(stderr, "   -F <int>            contig finaliser threads for serial parses\n");
+        fprintf(stderr, "   -A <int>            records to read ahead of a serial parse, per BAM\n");
+        fprintf(stderr, "   -C <int>            split contigs into chunks of <int> bases shared out\n");
+        fprintf(stderr, "                       between the -w workers by work stealing\n");
+        fprintf(stderr, "   -W <int>            threads each piling up whole BAMs on their own instead\n");
+        fprintf(stderr, "                       of all BAMs in lock step (serial parses only)\n");
+        fprintf(stderr, "   -n <int>            most BAMs to have open at once, parsing them in groups\n");
+        fprintf(stderr, "   -M <int>            memory budget in MB for open BAMs, parsing them in groups\n");
+        fprintf(stderr, "                       (with -n or -M up to -w groups are parsed at once)\n");
         fprintf(stderr, "\n");
+        free(opts.regions);
         return 1;
     }
 
@@ -41,23 +123,27 @@ int main(int argc, char *argv[])
         bam_files[i] = strdup(argv[optind+i]);
     }
 
+    if (opts.progress != NULL)
+        signal(SIGINT, onInterrupt);
     PM_mapping_results * mr = calloc(1, sizeof(PM_mapping_results));
-    int ignore_supps = 1;
-    int ret_val = parseCoverageAndLinks(num_bams,
-                                        baseQ,
-                                        mapQ,
-                                        min_len,
-                                        do_links,
-                                        ignore_supps,
-                                        do_outlier_coverage,
-                                        bam_files,
-                                        mr);
-    print_MR(mr);
+    int ret_val = parseCoverageAndLinksWithOptions(num_bams,
+                                                   bam_files,
+                                                   &opts,
+                                                   mr);
+    if (ret_val == PM_PARSE_CANCELLED)
+        fprintf(stderr, "Parse cancelled\n");
+    if (verbose)
+        printParseStats(&mr->stats, mr->bam_file_names, stderr);
+    if (ret_val == 0 && save_file != NULL)
+        ret_val = save_MR(mr, save_file);
+    if (ret_val == 0)
+        ret_val = write_MR(mr, out_file, out_format);
     destroy_MR(mr);
 
     for (i = 0; i < num_bams; ++i) {
         free(bam_files[i]);
     }
     free(bam_files);
+    free(opts.regions);
     return ret_val;
 }
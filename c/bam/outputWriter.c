@@ -0,0 +1,403 @@
+//#############################################################################
+//
+//   outputWriter.c
+//
+//   Write coverage and link tables quickly as TSV, BGZF'd TSV or packed binary
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+// htslib
+#include "htslib/bgzf.h"
+
+// local includes
+#include "outputWriter.h"
+#include "bamParser.h"
+#include "pairedLink.h"
+#include "resultsFile.h"
+
+static const uint64_t PM_POW10[] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL,
+                                    100000ULL, 1000000ULL, 10000000ULL,
+                                    100000000ULL, 1000000000ULL};
+
+static size_t formatUnsigned(char * dest, uint64_t value)
+{
+    //-----
+    // digits come out backwards so write them to the end of a scratch space
+    //
+    char digits[24];
+    size_t n = sizeof(digits);
+    do {
+        digits[--n] = (char)('0' + value % 10);
+        value /= 10;
+    } while(value != 0);
+    memcpy(dest, digits + n, sizeof(digits) - n);
+    return sizeof(digits) - n;
+}
+
+size_t formatFixed(char * dest, double value, int precision)
+{
+    size_t len = 0;
+    uint64_t scaled = 0, frac = 0;
+    int i = 0;
+    if(precision < 0) precision = 0;
+    if(precision > 9) precision = 9;
+    if(isnan(value) || isinf(value))
+        return (size_t)snprintf(dest, PM_OUTPUT_NUMBER_MAX, "%.*f", precision, value);
+    if(value >= 9.0e18 / PM_POW10[precision] || value <= -9.0e18 / PM_POW10[precision])
+        return (size_t)snprintf(dest, PM_OUTPUT_NUMBER_MAX, "%.*e", precision, value);
+
+    if(value < 0) {
+        dest[len++] = '-';
+        value = -value;
+    }
+    // round half to even as printf does, exact for float inputs at the usual precisions
+    value *= (double)PM_POW10[precision];
+    scaled = (uint64_t)value;
+    value -= (double)scaled;
+    if(value > 0.5 || (value == 0.5 && (scaled & 1)))
+        ++scaled;
+    len += formatUnsigned(dest + len, scaled / PM_POW10[precision]);
+    if(precision > 0) {
+        frac = scaled % PM_POW10[precision];
+        dest[len] = '.';
+        for(i = precision; i > 0; --i) {
+            dest[len + i] = (char)('0' + frac % 10);
+            frac /= 10;
+        }
+        len += precision + 1;
+    }
+    return len;
+}
+
+static void writeThrough(PM_output_writer * W, const char * data, size_t length)
+{
+    //-----
+    // hand bytes straight to BGZF or the OS
+    //
+    if(W->error || length == 0)
+        return;
+    if(W->bgzf != NULL) {
+        if(bgzf_write(W->bgzf, data, length) != (ssize_t)length)
+            W->error = 1;
+        return;
+    }
+    while(length > 0) {
+        ssize_t done = write(W->fd, data, length);
+        if(done < 0) {
+            if(errno == EINTR)
+                continue;
+            W->error = 1;
+            return;
+        }
+        data += done;
+        length -= (size_t)done;
+    }
+}
+
+static void flushOutput(PM_output_writer * W)
+{
+    writeThrough(W, W->buffer, W->used);
+    W->used = 0;
+}
+
+static char * reserveOutput(PM_output_writer * W, size_t length)
+{
+    //-----
+    // room for length bytes at the end of the buffer (length <= buffer size)
+    //
+    if(PM_OUTPUT_BUFFER_SIZE - W->used < length)
+        flushOutput(W);
+    return W->buffer + W->used;
+}
+
+static void putBytes(PM_output_writer * W, const void * data, size_t length)
+{
+    if(length >= PM_OUTPUT_BUFFER_SIZE) {
+        flushOutput(W);
+        writeThrough(W, (const char *)data, length);
+        return;
+    }
+    memcpy(reserveOutput(W, length), data, length);
+    W->used += length;
+}
+
+static void putString(PM_output_writer * W, const char * str)
+{
+    putBytes(W, str, strlen(str));
+}
+
+static void putChar(PM_output_writer * W, char c)
+{
+    *reserveOutput(W, 1) = c;
+    ++W->used;
+}
+
+static void putUnsigned(PM_output_writer * W, uint64_t value)
+{
+    W->used += formatUnsigned(reserveOutput(W, PM_OUTPUT_NUMBER_MAX), value);
+}
+
+static void putFixed(PM_output_writer * W, double value)
+{
+    W->used += formatFixed(reserveOutput(W, PM_OUTPUT_NUMBER_MAX), value, PM_OUTPUT_PRECISION);
+}
+
+static void putPadding(PM_output_writer * W, uint64_t size)
+{
+    static const char zeros[PM_RESULTS_ALIGN] = {0};
+    putBytes(W, zeros, (PM_RESULTS_ALIGN - size % PM_RESULTS_ALIGN) % PM_RESULTS_ALIGN);
+}
+
+static PM_output_writer * newOutputWriter(int fd, int ownsFd, PM_output_format format)
+{
+    PM_output_writer * W = NULL;
+    BGZF * bgzf = NULL;
+    if(format == PM_OUTPUT_TSV_GZ) {
+        // bgzf_close closes the fd it was given so give it its own
+        int bgzf_fd = ownsFd ? fd : dup(fd);
+        if(bgzf_fd < 0 || (bgzf = bgzf_dopen(bgzf_fd, "w")) == NULL) {
+            if(bgzf_fd >= 0 && !ownsFd)
+                close(bgzf_fd);
+            return NULL;
+        }
+        fd = -1;
+        ownsFd = 0;
+    }
+    W = calloc(1, sizeof(PM_output_writer));
+    W->format = format;
+    W->fd = fd;
+    W->bgzf = bgzf;
+    W->owns_fd = ownsFd;
+    W->buffer = malloc(PM_OUTPUT_BUFFER_SIZE);
+    return W;
+}
+
+PM_output_writer * openOutputFile(char * fileName, PM_output_format format)
+{
+    PM_output_writer * W = NULL;
+    int fd = 0;
+    if(strcmp(fileName, "-") == 0)
+        return openOutputFd(STDOUT_FILENO, format);
+    fd = open(fileName, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if(fd >= 0)
+        W = newOutputWriter(fd, 1, format);
+    if(W == NULL) {
+        char str[512];
+        snprintf(str, sizeof(str), "Could not open %s for writing", fileName);
+        printError(str, __LINE__);
+        if(fd >= 0)
+            close(fd);
+    }
+    return W;
+}
+
+PM_output_writer * openOutputFd(int fd, PM_output_format format)
+{
+    PM_output_writer * W = newOutputWriter(fd, 0, format);
+    if(W == NULL) {
+        char str[512];
+        snprintf(str, sizeof(str), "Could not write to file descriptor %d", fd);
+        printError(str, __LINE__);
+    }
+    return W;
+}
+
+PM_output_writer * openOutputStream(FILE * fp, PM_output_format format)
+{
+    if(fflush(fp) != 0)
+        return NULL;
+    return openOutputFd(fileno(fp), format);
+}
+
+int closeOutputWriter(PM_output_writer * W)
+{
+    int ret = 0;
+    flushOutput(W);
+    if(W->bgzf != NULL && bgzf_close(W->bgzf) != 0)
+        W->error = 1;
+    if(W->owns_fd && close(W->fd) != 0)
+        W->error = 1;
+    ret = W->error;
+    if(ret != 0)
+        printError("Could not write all of the output", __LINE__);
+    free(W->buffer);
+    free(W);
+    return ret;
+}
+
+static void putNames(PM_output_writer * W, char ** names, int numNames)
+{
+    //-----
+    // NUL terminated, one after the other
+    //
+    int i = 0;
+    for(i = 0; i < numNames; ++i) {
+        putBytes(W, names[i], strlen(names[i]) + 1);
+    }
+}
+
+static uint64_t namesSize(char ** names, int numNames)
+{
+    uint64_t size = 0;
+    int i = 0;
+    for(i = 0; i < numNames; ++i) {
+        size += strlen(names[i]) + 1;
+    }
+    return size;
+}
+
+int writeCoverageTable(PM_output_writer * W, PM_mapping_results * MR)
+{
+    int i = 0, j = 0;
+    float * covs = NULL;
+    if(MR->num_contigs == 0 || MR->num_bams == 0 || MR->plp_bp == NULL)
+        return 0;
+    covs = malloc((size_t)MR->num_contigs * MR->num_bams * sizeof(float));
+    if(calculateCoveragesInto(MR, covs) != 0) {
+        free(covs);
+        return 1;
+    }
+
+    if(W->format == PM_OUTPUT_BINARY) {
+        PM_coverage_table_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PM_OUTPUT_COVERAGE_MAGIC, sizeof(header.magic));
+        header.version = PM_OUTPUT_VERSION;
+        header.byte_order = PM_RESULTS_BYTE_ORDER;
+        header.num_contigs = MR->num_contigs;
+        header.num_bams = MR->num_bams;
+        header.names_size = namesSize(MR->contig_names, MR->num_contigs) +
+                            namesSize(MR->bam_file_names, MR->num_bams);
+        putBytes(W, &header, sizeof(header));
+        putNames(W, MR->contig_names, MR->num_contigs);
+        putNames(W, MR->bam_file_names, MR->num_bams);
+        putPadding(W, header.names_size);
+        for(i = 0; i < MR->num_contigs; ++i) {
+            uint32_t length = PM_MR_LENGTH(MR, i);
+            putBytes(W, &length, sizeof(length));
+        }
+        putBytes(W, covs, (size_t)MR->num_contigs * MR->num_bams * sizeof(float));
+        putPadding(W, (uint64_t)MR->num_contigs * (MR->num_bams + 1) * sizeof(float));
+    }
+    else {
+        putString(W, "Contig\tLength");
+        for(j = 0; j < MR->num_bams; ++j) {
+            putChar(W, '\t');
+            putString(W, MR->bam_file_names[j]);
+        }
+        putChar(W, '\n');
+        for(i = 0; i < MR->num_contigs; ++i) {
+            float * row = covs + (size_t)i * MR->num_bams;
+            if(PM_MR_LENGTH(MR, i) == 0) continue; // not in the regions parsed
+            putString(W, MR->contig_names[i]);
+            putChar(W, '\t');
+            putUnsigned(W, MR->contig_lengths[i]);
+            for(j = 0; j < MR->num_bams; ++j) {
+                putChar(W, '\t');
+                putFixed(W, row[j]);
+            }
+            putChar(W, '\n');
+        }
+    }
+    free(covs);
+    return W->error;
+}
+
+int writeLinkTable(PM_output_writer * W, PM_mapping_results * MR)
+{
+    size_t slot = 0;
+    PM_link_pair * LP = NULL;
+    PM_link_iterator iter;
+    PM_link_info * LI = NULL;
+    if(!MR->is_links_included || MR->links == NULL)
+        return 0;
+
+    if(W->format == PM_OUTPUT_BINARY) {
+        PM_link_table_header header;
+        PM_link_record record;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, PM_OUTPUT_LINKS_MAGIC, sizeof(header.magic));
+        header.version = PM_OUTPUT_VERSION;
+        header.byte_order = PM_RESULTS_BYTE_ORDER;
+        while(nextLinkPair(MR->links, &slot, &LP)) {
+            header.num_links += LP->numLinks;
+        }
+        putBytes(W, &header, sizeof(header));
+        slot = 0;
+        while(nextLinkPair(MR->links, &slot, &LP)) {
+            record.cid_1 = LP->cid_1;
+            record.cid_2 = LP->cid_2;
+            initLinkIterator(LP, &iter);
+            while(nextLinkInfo(&iter, &LI)) {
+                record.pos_1 = LI->pos_1;
+                record.pos_2 = LI->pos_2;
+                record.orient = LI->orient_1 | (LI->orient_2 << 1);
+                record.bam_ID = LI->bam_ID;
+                putBytes(W, &record, sizeof(record));
+            }
+        }
+    }
+    else {
+        putString(W, "Contig1\tPos1\tOrient1\tContig2\tPos2\tOrient2\tBam\n");
+        while(nextLinkPair(MR->links, &slot, &LP)) {
+            char * name_1 = MR->contig_names[LP->cid_1];
+            char * name_2 = MR->contig_names[LP->cid_2];
+            initLinkIterator(LP, &iter);
+            while(nextLinkInfo(&iter, &LI)) {
+                putString(W, name_1);
+                putChar(W, '\t');
+                putUnsigned(W, LI->pos_1);
+                putChar(W, '\t');
+                putChar(W, (char)('0' + LI->orient_1));
+                putChar(W, '\t');
+                putString(W, name_2);
+                putChar(W, '\t');
+                putUnsigned(W, LI->pos_2);
+                putChar(W, '\t');
+                putChar(W, (char)('0' + LI->orient_2));
+                putChar(W, '\t');
+                putString(W, MR->bam_file_names[LI->bam_ID]);
+                putChar(W, '\n');
+            }
+        }
+    }
+    return W->error;
+}
+
+int write_MR(PM_mapping_results * MR, char * fileName, int format)
+{
+    int ret = 0;
+    PM_output_writer * W = openOutputFile(fileName, (PM_output_format)format);
+    if(W == NULL)
+        return 1;
+    ret = writeCoverageTable(W, MR);
+    if(ret == 0)
+        ret = writeLinkTable(W, MR);
+    if(closeOutputWriter(W) != 0)
+        ret = 1;
+    return ret;
+}
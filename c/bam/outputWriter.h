@@ -0,0 +1,239 @@
+//#############################################################################
+//
+//   outputWriter.h
+//
+//   Write coverage and link tables quickly as TSV, BGZF'd TSV or packed binary
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_OUTPUT_WRITER_H
+  #define PM_OUTPUT_WRITER_H
+
+// system includes
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// htslib
+#include "htslib/bgzf.h"
+
+// local includes
+#include "bamParser.h"
+
+// bytes formatted before anything is handed to the OS (or to BGZF)
+#define PM_OUTPUT_BUFFER_SIZE (1 << 20)
+// room needed to format any one number
+#define PM_OUTPUT_NUMBER_MAX 48
+// digits after the point in coverage values (as print_MR's %0.4f)
+#define PM_OUTPUT_PRECISION 4
+// first 8 bytes of a binary coverage table
+#define PM_OUTPUT_COVERAGE_MAGIC "PMCOVRG"
+// first 8 bytes of a binary link table
+#define PM_OUTPUT_LINKS_MAGIC "PMLINKS"
+// bump this whenever the binary layout changes
+#define PM_OUTPUT_VERSION 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract What an output writer writes
+ @constant PM_OUTPUT_TSV tab separated text
+ @constant PM_OUTPUT_TSV_GZ tab separated text, BGZF compressed (gzip compatible)
+ @constant PM_OUTPUT_BINARY native endian packed headers and arrays
+ */
+typedef enum {
+    PM_OUTPUT_TSV = 0,
+    PM_OUTPUT_TSV_GZ,
+    PM_OUTPUT_BINARY
+} PM_output_format;
+
+/*! @typedef
+ @abstract Header in front of a binary coverage table
+ @field magic PM_OUTPUT_COVERAGE_MAGIC
+ @field version PM_OUTPUT_VERSION
+ @field byte_order PM_RESULTS_BYTE_ORDER
+ @field num_contigs rows in the table
+ @field num_bams columns in the table
+ @field names_size bytes of NUL terminated contig names, then bam names
+ @discussion The header is followed by the names, padded to a multiple of
+ 8, then num_contigs uint32_t bases parsed (the contig lengths unless
+ regions were parsed) then num_contigs x num_bams float coverages, row-major,
+ padded to a multiple of 8.
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_contigs;
+    uint32_t num_bams;
+    uint64_t names_size;
+} PM_coverage_table_header;
+
+/*! @typedef
+ @abstract Header in front of a binary link table
+ @field magic PM_OUTPUT_LINKS_MAGIC
+ @field version PM_OUTPUT_VERSION
+ @field byte_order PM_RESULTS_BYTE_ORDER
+ @field num_links number of PM_link_record structs which follow
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t num_links;
+} PM_link_table_header;
+
+/*! @typedef
+ @abstract One link in a binary link table
+ @field cid_1 tid of contig 1 (cid_1 < cid_2)
+ @field cid_2 tid of contig 2
+ @field pos_1 position of read in contig 1
+ @field pos_2 position of read in contig 2
+ @field orient bit 0 is orient_1, bit 1 is orient_2 (as PM_link_columns)
+ @field bam_ID id of the BAM file the link originates from
+ */
+typedef struct {
+    uint32_t cid_1;
+    uint32_t cid_2;
+    uint32_t pos_1;
+    uint32_t pos_2;
+    uint32_t orient;
+    uint32_t bam_ID;
+} PM_link_record;
+
+/*! @typedef
+ @abstract Buffered writer for coverage and link tables
+ @field format PM_output_format being written
+ @field fd file descriptor written to (-1 when writing through bgzf)
+ @field bgzf BGZF stream written to for PM_OUTPUT_TSV_GZ
+ @field owns_fd close fd when the writer is closed
+ @field buffer PM_OUTPUT_BUFFER_SIZE bytes of formatted output
+ @field used bytes of buffer waiting to be written
+ @field error set once any write fails, everything after is dropped
+ */
+typedef struct {
+    PM_output_format format;
+    int fd;
+    BGZF * bgzf;
+    int owns_fd;
+    char * buffer;
+    size_t used;
+    int error;
+} PM_output_writer;
+
+/*!
+ * @abstract Open a file to write tables to
+ *
+ * @param  fileName  file to write ("-" for stdout)
+ * @param  format  PM_output_format to write
+ * @return PM_output_writer * or NULL if the file can't be opened
+ *
+ * @discussion Call closeOutputWriter when done.
+ */
+PM_output_writer * openOutputFile(char * fileName, PM_output_format format);
+
+/*!
+ * @abstract Write tables to a file descriptor
+ *
+ * @param  fd  open file descriptor (stays open after closeOutputWriter)
+ * @param  format  PM_output_format to write
+ * @return PM_output_writer * or NULL if fd can't be used
+ */
+PM_output_writer * openOutputFd(int fd, PM_output_format format);
+
+/*!
+ * @abstract Write tables to a stdio stream
+ *
+ * @param  fp  open stream (stays open after closeOutputWriter)
+ * @param  format  PM_output_format to write
+ * @return PM_output_writer * or NULL if fp can't be used
+ *
+ * @discussion fp is flushed and then bypassed, so don't write to it
+ * yourself until the writer has been closed.
+ */
+PM_output_writer * openOutputStream(FILE * fp, PM_output_format format);
+
+/*!
+ * @abstract Flush and free an output writer
+ *
+ * @param  W  writer to close
+ * @return 0 for success, 1 if any write failed
+ */
+int closeOutputWriter(PM_output_writer * W);
+
+/*!
+ * @abstract Write the coverage of each contig in each BAM
+ *
+ * @param  W  writer to write to
+ * @param  MR  mapping results struct with coverage info
+ * @return 0 for success
+ *
+ * @discussion The text table is the one print_MR prints: a header line then
+ * one line per contig (contigs outside any region parsed are skipped) with
+ * the name, length and PM_OUTPUT_PRECISION digit coverages. The binary
+ * table is described at PM_coverage_table_header.
+ */
+int writeCoverageTable(PM_output_writer * W, PM_mapping_results * MR);
+
+/*!
+ * @abstract Write every link, one per line or record
+ *
+ * @param  W  writer to write to
+ * @param  MR  mapping results struct with links
+ * @return 0 for success (writes nothing if links weren't included)
+ *
+ * @discussion The text table has a header line then contig 1, position 1,
+ * orientation 1, contig 2, position 2, orientation 2 and BAM name for each
+ * link. The binary table is a PM_link_table_header then PM_link_records.
+ * Links are grouped by contig pair in link table order either way.
+ */
+int writeLinkTable(PM_output_writer * W, PM_mapping_results * MR);
+
+/*!
+ * @abstract Write the coverage table and then the link table to a file
+ *
+ * @param  MR  mapping results struct to write
+ * @param  fileName  file to write ("-" for stdout)
+ * @param  format  PM_output_format to write
+ * @return 0 for success
+ */
+int write_MR(PM_mapping_results * MR, char * fileName, int format);
+
+/*!
+ * @abstract Format a number with a fixed number of digits after the point
+ *
+ * @param  dest  at least PM_OUTPUT_NUMBER_MAX bytes to write to
+ * @param  value  number to format
+ * @param  precision  digits after the point (0 to 9)
+ * @return number of characters written (dest is not NUL terminated)
+ *
+ * @discussion Matches printf's %.*f (halves round to even) for anything
+ * which was a float, a double can round the other way in the last digit if
+ * it is within rounding error of a half. Values too big to
+ * scale into 64 bits are written as %.*e, NaNs and infinities as printf
+ * writes them.
+ */
+size_t formatFixed(char * dest, double value, int precision);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_OUTPUT_WRITER_H
@@ -23,23 +23,180 @@
 
 // system includes
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 #include <unistd.h>
 
-// cfuhash
-#include "cfuhash.h"
-
 // local includes
 #include "pairedLink.h"
+#include "pmTrace.h"
+
+// fewer than half the slots in use keeps probe chains short
+#define PM_LINK_TABLE_MIN_SLOTS 64
+#define PM_LINK_TABLE_MAX_LOAD(capacity) ((capacity) >> 1)
+
+// arena slabs and per-pair chunk sizes
+#define PM_LINK_BLOCK_SIZE (1 << 20)
+#define PM_LINK_CHUNK_MIN 4
+#define PM_LINK_CHUNK_MAX 1024
+
+static void * arenaAlloc(PM_link_arena * arena, size_t size)
+{
+    //-----
+    // bump allocate from the current slab, starting a new one when full
+    //
+    size = (size + 7) & ~(size_t)7;
+    PM_link_block * block = arena->blocks;
+    if(block == NULL || block->used + size > block->size) {
+        size_t block_size = (size > PM_LINK_BLOCK_SIZE) ? size : PM_LINK_BLOCK_SIZE;
+        block = (PM_link_block*) malloc(sizeof(PM_link_block) + block_size);
+        block->used = 0;
+        block->size = block_size;
+        block->next = arena->blocks;
+        arena->blocks = block;
+        arena->num_blocks++;
+    }
+    void * ret = block->data + block->used;
+    block->used += size;
+    return ret;
+}
+
+static void freeArena(PM_link_arena * arena)
+{
+    PM_link_block * block = arena->blocks;
+    while(block != NULL) {
+        PM_link_block * next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    arena->num_blocks = 0;
+}
+
+static void takeArena(PM_link_arena * dest, PM_link_arena * src)
+{
+    //-----
+    // move all of src's slabs in behind dest's current slab
+    //
+    PM_link_block * tail = src->blocks;
+    if(tail == NULL)
+        return;
+    if(dest->blocks == NULL) {
+        *dest = *src;
+    } else {
+        while(tail->next != NULL) {tail = tail->next;}
+        tail->next = dest->blocks->next;
+        dest->blocks->next = src->blocks;
+        dest->num_blocks += src->num_blocks;
+    }
+    src->blocks = NULL;
+    src->num_blocks = 0;
+}
+
+static PM_link_chunk * newLinkChunk(PM_link_arena * arena, uint32_t capacity)
+{
+    PM_link_chunk * chunk = (PM_link_chunk*) arenaAlloc(arena,
+                                                        sizeof(PM_link_chunk) + capacity * sizeof(PM_link_info));
+    chunk->next = NULL;
+    chunk->num_links = 0;
+    chunk->capacity = capacity;
+    return chunk;
+}
 
-void makeContigKey(char* keyStore, int cid_1, int cid_2)
+static inline uint64_t makeLinkKey(int cid_1, int cid_2)
 {
     // force cid_1 < cid_2 for consistent keys
-    if(cid_1 < cid_2) {sprintf(keyStore, "%d,%d", cid_1, cid_2);}
-    else {sprintf(keyStore, "%d,%d",cid_2, cid_1);}
+    if(cid_1 < cid_2) {return ((uint64_t)(uint32_t)cid_1 << 32) | (uint32_t)cid_2;}
+    else {return ((uint64_t)(uint32_t)cid_2 << 32) | (uint32_t)cid_1;}
+}
+
+static inline size_t firstSlot(PM_link_table * linkTable, uint64_t key)
+{
+    // fibonacci hashing, the top bits are the best mixed
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> linkTable->shift);
+}
+
+static PM_link_slot * findSlot(PM_link_table * linkTable, uint64_t key)
+{
+    //-----
+    // returns the slot holding key or the empty slot where it should go
+    //
+    size_t mask = linkTable->capacity - 1;
+    size_t i = firstSlot(linkTable, key);
+    while(linkTable->slots[i].LP != NULL && linkTable->slots[i].key != key) {
+        i = (i + 1) & mask;
+    }
+    return &linkTable->slots[i];
+}
+
+static void allocSlots(PM_link_table * linkTable, size_t capacity)
+{
+    int log2_cap = 0;
+    while(((size_t)1 << log2_cap) < capacity) {++log2_cap;}
+    linkTable->capacity = (size_t)1 << log2_cap;
+    linkTable->shift = 64 - log2_cap;
+    linkTable->slots = (PM_link_slot*) calloc(linkTable->capacity, sizeof(PM_link_slot));
 }
 
-void addLink(cfuhash_table_t * linkHash,
+static void growLinkTable(PM_link_table * linkTable)
+{
+    //-----
+    // double the slots and re-place every pair
+    //
+    PM_link_slot * old_slots = linkTable->slots;
+    size_t old_capacity = linkTable->capacity;
+    size_t i = 0;
+    allocSlots(linkTable, old_capacity << 1);
+    for(i = 0; i < old_capacity; ++i) {
+        if(old_slots[i].LP != NULL) {
+            *findSlot(linkTable, old_slots[i].key) = old_slots[i];
+        }
+    }
+    free(old_slots);
+}
+
+static PM_link_slot * claimSlot(PM_link_table * linkTable, uint64_t key)
+{
+    //-----
+    // find the slot for key, growing first if a new pair would overfill us
+    //
+    PM_link_slot * slot = findSlot(linkTable, key);
+    if(slot->LP == NULL && linkTable->num_pairs + 1 > PM_LINK_TABLE_MAX_LOAD(linkTable->capacity)) {
+        growLinkTable(linkTable);
+        slot = findSlot(linkTable, key);
+    }
+    return slot;
+}
+
+PM_link_table * createLinkTable(size_t expectedPairs)
+{
+    PM_link_table * linkTable = (PM_link_table*) calloc(1, sizeof(PM_link_table));
+    size_t capacity = expectedPairs << 1;
+    if(capacity < PM_LINK_TABLE_MIN_SLOTS)
+        capacity = PM_LINK_TABLE_MIN_SLOTS;
+    allocSlots(linkTable, capacity);
+    return linkTable;
+}
+
+PM_link_pair * getLinkPair(PM_link_table * linkTable, int cid_1, int cid_2)
+{
+    return findSlot(linkTable, makeLinkKey(cid_1, cid_2))->LP;
+}
+
+int nextLinkPair(PM_link_table * linkTable, size_t * slot, PM_link_pair ** LP)
+{
+    while(*slot < linkTable->capacity) {
+        PM_link_pair * candidate = linkTable->slots[*slot].LP;
+        ++(*slot);
+        if(candidate != NULL) {
+            *LP = candidate;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void addLink(PM_link_table * linkTable,
              int cid_1,
              int cid_2,
              int pos_1,
@@ -49,8 +206,47 @@ void addLink(cfuhash_table_t * linkHash,
              int bam_ID
             )
 {
+    PM_TRACE5(link_add, cid_1, cid_2, pos_1, pos_2, bam_ID);
+    // see if the key is in the table already
+    uint64_t key = makeLinkKey(cid_1, cid_2);
+    PM_link_slot * slot = claimSlot(linkTable, key);
+    PM_link_pair * LP = slot->LP;
+    if (LP == NULL)
+    {
+        // we'll need to build a bit of infrastructure
+        // store the contig ids once only
+        LP = (PM_link_pair*) arenaAlloc(&linkTable->arena, sizeof(PM_link_pair));
+        if(cid_1 < cid_2)
+        {
+            LP->cid_1 = cid_1;
+            LP->cid_2 = cid_2;
+        }
+        else
+        {
+            LP->cid_1 = cid_2;
+            LP->cid_2 = cid_1;
+        }
+        LP->numLinks = 0;
+        LP->first_chunk = newLinkChunk(&linkTable->arena, PM_LINK_CHUNK_MIN);
+        LP->last_chunk = LP->first_chunk;
+
+        // finally, add the lot to the table
+        slot->key = key;
+        slot->LP = LP;
+        linkTable->num_pairs++;
+    }
+    else if (LP->last_chunk->num_links == LP->last_chunk->capacity)
+    {
+        // busy pairs get bigger chunks
+        uint32_t capacity = LP->last_chunk->capacity << 1;
+        if(capacity > PM_LINK_CHUNK_MAX)
+            capacity = PM_LINK_CHUNK_MAX;
+        LP->last_chunk->next = newLinkChunk(&linkTable->arena, capacity);
+        LP->last_chunk = LP->last_chunk->next;
+    }
+
     // store the link info, swap order of cid_1 and cid_2 if needed
-    PM_link_info* LI = (PM_link_info*) calloc(1, sizeof(PM_link_info));
+    PM_link_info* LI = &LP->last_chunk->links[LP->last_chunk->num_links++];
     if(cid_1 < cid_2){
         LI->orient_1 = orient_1;
         LI->orient_2 = orient_2;
@@ -65,123 +261,219 @@ void addLink(cfuhash_table_t * linkHash,
         LI->pos_2 = pos_1;
     }
     LI->bam_ID = bam_ID;
+    LP->numLinks++;
+}
 
-    PM_link_info** next_link_ptr = (PM_link_info**) &LI->next_link;
+void destroyLinks(PM_link_table * linkTable)
+{
+    if(linkTable == NULL)
+        return;
+    freeArena(&linkTable->arena);
+    free(linkTable->slots);
+    free(linkTable);
+}
 
-    // see if the key is in the hash already
-    char * key = calloc(30, sizeof(char)); // allocate room for the key
-    makeContigKey(key, cid_1, cid_2);
-    PM_link_pair * base_LP = cfuhash_get(linkHash, key);
-    if (base_LP != NULL)
-    {
-        // exists in the hash -> daisy chain it on
-        *next_link_ptr = base_LP->LI;
-        base_LP->LI = LI;
-        base_LP->numLinks++;
+void clearLinks(PM_link_table * linkTable)
+{
+    PM_link_block * keep = linkTable->arena.blocks;
+    if(keep != NULL) {
+        // everything but the slab we'd bump allocate from next
+        linkTable->arena.blocks = keep->next;
+        freeArena(&linkTable->arena);
+        keep->next = NULL;
+        keep->used = 0;
+        linkTable->arena.blocks = keep;
+        linkTable->arena.num_blocks = 1;
     }
-    else
-    {
-        // we'll need to build a bit of infrastructure
-        // store the contig ids once only
-        PM_link_pair * LP = (PM_link_pair*) calloc(1, sizeof(PM_link_pair));
-        if(cid_1 < cid_2)
+    if(linkTable->num_pairs != 0)
+        memset(linkTable->slots, 0, linkTable->capacity * sizeof(PM_link_slot));
+    linkTable->num_pairs = 0;
+}
+
+void spliceLinks(PM_link_table * destTable, PM_link_table * srcTable)
+{
+    size_t slot = 0;
+    PM_link_pair * src_LP = NULL;
+    while(nextLinkPair(srcTable, &slot, &src_LP)) {
+        uint64_t key = srcTable->slots[slot-1].key;
+        PM_link_slot * dest_slot = claimSlot(destTable, key);
+        PM_link_pair * dest_LP = dest_slot->LP;
+        if (dest_LP == NULL)
         {
-            LP->cid_1 = cid_1;
-            LP->cid_2 = cid_2;
+            // first time we've seen this pair, just take it as is
+            dest_slot->key = key;
+            dest_slot->LP = src_LP;
+            destTable->num_pairs++;
         }
         else
         {
-            LP->cid_1 = cid_2;
-            LP->cid_2 = cid_1;
+            // incoming links are newer so they go on the end
+            dest_LP->last_chunk->next = src_LP->first_chunk;
+            dest_LP->last_chunk = src_LP->last_chunk;
+            dest_LP->numLinks += src_LP->numLinks;
         }
-        LP->LI = LI;
-        LP->numLinks = 1;
-        *next_link_ptr = LI; // point to self means end of list
-
-        // finally, add the lot to the hash
-        cfuhash_put(linkHash, key, LP);
     }
-    free(key);
+
+    // the pairs and their memory belong to destTable now
+    takeArena(&destTable->arena, &srcTable->arena);
+    memset(srcTable->slots, 0, srcTable->capacity * sizeof(PM_link_slot));
+    srcTable->num_pairs = 0;
 }
 
-int destroyLinkInfo_andNext(PM_link_info** LI_ptr)
+void copyLinks(PM_link_table * destTable, PM_link_table * srcTable, int bamOffset)
 {
-    PM_link_info* next_link = (PM_link_info*) (*LI_ptr)->next_link;
-    if(*LI_ptr ==  next_link) // at the end of the chain
-    {
-        free(*LI_ptr);
-        return 0;
-    }
-    else // not done yet
-    {
-        PM_link_info* tmp_link = *LI_ptr;
-        free(tmp_link);
-        *LI_ptr = next_link;
-        return 1;
+    size_t slot = 0;
+    PM_link_pair * src_LP = NULL;
+    while(nextLinkPair(srcTable, &slot, &src_LP)) {
+        uint64_t key = srcTable->slots[slot-1].key;
+        PM_link_slot * dest_slot = claimSlot(destTable, key);
+        PM_link_pair * dest_LP = dest_slot->LP;
+        PM_link_chunk * chunk = newLinkChunk(&destTable->arena, src_LP->numLinks);
+        PM_link_chunk * src_chunk = NULL;
+        uint32_t k = 0;
+
+        // one block move per source chunk, then fix up the BAM ids
+        for(src_chunk = src_LP->first_chunk; src_chunk != NULL; src_chunk = src_chunk->next) {
+            memcpy(chunk->links + chunk->num_links, src_chunk->links, src_chunk->num_links * sizeof(PM_link_info));
+            chunk->num_links += src_chunk->num_links;
+        }
+        for(k = 0; k < chunk->num_links; ++k) {
+            chunk->links[k].bam_ID += bamOffset;
+        }
+
+        if (dest_LP == NULL)
+        {
+            dest_LP = (PM_link_pair*) arenaAlloc(&destTable->arena, sizeof(PM_link_pair));
+            dest_LP->cid_1 = src_LP->cid_1;
+            dest_LP->cid_2 = src_LP->cid_2;
+            dest_LP->numLinks = 0;
+            dest_LP->first_chunk = chunk;
+            dest_LP->last_chunk = chunk;
+            dest_slot->key = key;
+            dest_slot->LP = dest_LP;
+            destTable->num_pairs++;
+        }
+        else
+        {
+            dest_LP->last_chunk->next = chunk;
+            dest_LP->last_chunk = chunk;
+        }
+        dest_LP->numLinks += chunk->num_links;
     }
 }
 
-void destroyLinks(cfuhash_table_t * linkHash)
+void initLinkIterator(PM_link_pair * LP, PM_link_iterator * iter)
 {
-    char **keys = NULL;
-    size_t *key_sizes = NULL;
-    size_t key_count = 0;
-    int i = 0;
-    keys = (char **)cfuhash_keys_data(linkHash, &key_count, &key_sizes, 0);
+    iter->chunk = LP->first_chunk;
+    iter->index = 0;
+}
 
-    for (i = 0; i < (int)key_count; i++) {
-        PM_link_pair * base_LP = cfuhash_get(linkHash, keys[i]);
-        if(keys[i] != 0)
-            free(keys[i]);
-        PM_link_info* LI = base_LP->LI;
-        while(destroyLinkInfo_andNext(&LI));
-        if(base_LP !=0)
-            free(base_LP);
+int nextLinkInfo(PM_link_iterator * iter, PM_link_info ** LI)
+{
+    while(iter->chunk != NULL) {
+        if(iter->index < iter->chunk->num_links) {
+            *LI = &iter->chunk->links[iter->index++];
+            return 1;
+        }
+        iter->chunk = iter->chunk->next;
+        iter->index = 0;
     }
-    if(keys != 0)
-        free(keys);
+    return 0;
+}
 
-    if(key_sizes != 0)
-        free(key_sizes);
+static int compareSlotKeys(const void * a, const void * b)
+{
+    uint64_t key_a = ((const PM_link_slot *)a)->key;
+    uint64_t key_b = ((const PM_link_slot *)b)->key;
+    return (key_a > key_b) - (key_a < key_b);
 }
 
-int getNextLinkInfo(PM_link_info** LI_ptr)
+PM_link_columns * compactLinks(PM_link_table * linkTable)
 {
-    PM_link_info* next_link = (PM_link_info*) (*LI_ptr)->next_link;
-    if(*LI_ptr ==  next_link) {return 0;}
-    else
-    {
-        *LI_ptr = next_link;
-        return 1;
+    PM_link_columns * LC = (PM_link_columns*) calloc(1, sizeof(PM_link_columns));
+    size_t slot = 0, p = 0, l = 0;
+    size_t num_pairs = (linkTable == NULL) ? 0 : linkTable->num_pairs;
+    PM_link_pair * LP = NULL;
+
+    //-----
+    // sort the used slots by packed key == sort by (cid_1, cid_2)
+    // no table (links were off) gives empty columns with offsets[0] == 0
+    //
+    PM_link_slot * sorted = (PM_link_slot*) malloc((num_pairs + 1) * sizeof(PM_link_slot));
+    while(linkTable != NULL && nextLinkPair(linkTable, &slot, &LP)) {
+        sorted[LC->num_pairs] = linkTable->slots[slot-1];
+        LC->num_pairs++;
+        LC->num_links += LP->numLinks;
     }
+    qsort(sorted, LC->num_pairs, sizeof(PM_link_slot), compareSlotKeys);
+
+    LC->offsets = (uint64_t*) malloc((LC->num_pairs + 1) * sizeof(uint64_t));
+    LC->cid_1 = (uint32_t*) malloc((LC->num_links + 1) * sizeof(uint32_t));
+    LC->cid_2 = (uint32_t*) malloc((LC->num_links + 1) * sizeof(uint32_t));
+    LC->pos_1 = (uint32_t*) malloc((LC->num_links + 1) * sizeof(uint32_t));
+    LC->pos_2 = (uint32_t*) malloc((LC->num_links + 1) * sizeof(uint32_t));
+    LC->orient = (uint8_t*) malloc((LC->num_links + 1) * sizeof(uint8_t));
+    LC->bam_ID = (uint32_t*) malloc((LC->num_links + 1) * sizeof(uint32_t));
+
+    //-----
+    // copy a chunk at a time
+    //
+    for(p = 0; p < LC->num_pairs; ++p) {
+        PM_link_chunk * chunk = NULL;
+        LP = sorted[p].LP;
+        LC->offsets[p] = l;
+        for(chunk = LP->first_chunk; chunk != NULL; chunk = chunk->next) {
+            uint32_t k = 0;
+            for(k = 0; k < chunk->num_links; ++k, ++l) {
+                PM_link_info * LI = &chunk->links[k];
+                LC->cid_1[l] = LP->cid_1;
+                LC->cid_2[l] = LP->cid_2;
+                LC->pos_1[l] = LI->pos_1;
+                LC->pos_2[l] = LI->pos_2;
+                LC->orient[l] = (uint8_t)(LI->orient_1 | (LI->orient_2 << 1));
+                LC->bam_ID[l] = LI->bam_ID;
+            }
+        }
+    }
+    LC->offsets[LC->num_pairs] = l;
+    free(sorted);
+    return LC;
 }
 
-void printLinks(cfuhash_table_t * linkHash, char ** bamNames, char ** contigNames)
+void destroyLinkColumns(PM_link_columns * LC)
 {
-    char **keys = NULL;
-    size_t *key_sizes = NULL;
-    size_t key_count = 0;
-    int i = 0;
-    keys = (char **)cfuhash_keys_data(linkHash, &key_count, &key_sizes, 0);
+    if(LC == NULL)
+        return;
+    free(LC->offsets);
+    free(LC->cid_1);
+    free(LC->cid_2);
+    free(LC->pos_1);
+    free(LC->pos_2);
+    free(LC->orient);
+    free(LC->bam_ID);
+    free(LC);
+}
 
-    for (i = 0; i < (int)key_count; i++) {
-        PM_link_pair * LP = cfuhash_get(linkHash, keys[i]);
-        free(keys[i]);
+void printLinks(PM_link_table * linkTable, char ** bamNames, char ** contigNames)
+{
+    size_t slot = 0;
+    PM_link_pair * LP = NULL;
+    while(nextLinkPair(linkTable, &slot, &LP)) {
         printLinkPair(LP, bamNames, contigNames);
     }
-    free(keys);
-    free(key_sizes);
 }
 
 void printLinkPair(PM_link_pair* LP, char ** bamNames, char ** contigNames)
 {
     printf("===\n(%s, %s, %d links)\n",  contigNames[LP->cid_1], contigNames[LP->cid_2], LP->numLinks);
-    PM_link_info* LI = LP->LI;
-    do {
+    PM_link_iterator iter;
+    PM_link_info* LI = NULL;
+    initLinkIterator(LP, &iter);
+    while(nextLinkInfo(&iter, &LI)) {
         printf("\t");
         printLinkInfo(LI, bamNames);
         printf("\n");
-    } while(getNextLinkInfo(&LI));
+    }
 }
 
 void printLinkInfo(PM_link_info* LI, char ** bamNames)
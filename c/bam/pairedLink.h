@@ -30,9 +30,6 @@
 #include <unistd.h>
 #include <stdint.h>
 
-// cfuhash
-#include "cfuhash.h"
-
 /*! @typedef
  @abstract Structure for storing information about specific links
  @field pos_1 position of read in contig 1
@@ -40,33 +37,164 @@
  @field pos_2 position of read in contig 2
  @field orient_2 orientation of read in contig 2 (1 == reversed)
  @field bam_ID id of the BAM file link originates from
- @field next_link link to next link info struct (linked list)
  */
 typedef struct {
     uint32_t orient_1:1, pos_1:31;
     uint32_t orient_2:1, pos_2:31;
     uint32_t bam_ID;
-    struct PM_link_info * next_link;
 } PM_link_info;
 
+/*! @typedef
+ * @abstract A run of link infos for one contig pair, stored contiguously
+ * @field next next chunk for the same contig pair (NULL at the end)
+ * @field num_links number of links used in this chunk
+ * @field capacity number of links this chunk can hold
+ * @field links the link infos themselves
+ */
+typedef struct PM_link_chunk {
+    struct PM_link_chunk * next;
+    uint32_t num_links;
+    uint32_t capacity;
+    PM_link_info links[];
+} PM_link_chunk;
+
 /*! @typedef
  * @abstract Structure for storing information about specific links
  * @field cid_1 tid of contig 1 (from BAM header)
  * @field cid_2 tid of contig 2 (cid_1 < cid_2)
- * @field numLinks number of link info structures in linked list
- * @field LI first link info struct for this contig pair
+ * @field numLinks number of link info structures over all chunks
+ * @field first_chunk oldest links for this contig pair
+ * @field last_chunk chunk new links are added to
  */
 typedef struct {
     uint32_t cid_1;
     uint32_t cid_2;
     uint32_t numLinks;
-    PM_link_info * LI;
+    PM_link_chunk * first_chunk;
+    PM_link_chunk * last_chunk;
 } PM_link_pair;
 
+/*! @typedef
+ * @abstract Walks the link infos of one contig pair in the order they were added
+ * @field chunk chunk currently being walked
+ * @field index index of the next link in chunk
+ */
+typedef struct {
+    PM_link_chunk * chunk;
+    uint32_t index;
+} PM_link_iterator;
+
+/*! @typedef
+ * @abstract All links laid out as flat parallel arrays, sorted by contig pair
+ * @field num_pairs number of contig pairs
+ * @field num_links number of links (length of the per-link arrays)
+ * @field offsets links of pair p are [offsets[p], offsets[p+1]) (num_pairs + 1 long)
+ * @field cid_1 tid of contig 1 for each link (cid_1 < cid_2)
+ * @field cid_2 tid of contig 2 for each link
+ * @field pos_1 position of read in contig 1 for each link
+ * @field pos_2 position of read in contig 2 for each link
+ * @field orient bit 0 is orient_1, bit 1 is orient_2 (1 == reversed)
+ * @field bam_ID id of the BAM file each link originates from
+ */
+typedef struct {
+    size_t num_pairs;
+    size_t num_links;
+    uint64_t * offsets;
+    uint32_t * cid_1;
+    uint32_t * cid_2;
+    uint32_t * pos_1;
+    uint32_t * pos_2;
+    uint8_t * orient;
+    uint32_t * bam_ID;
+} PM_link_columns;
+
+/*! @typedef
+ * @abstract One slab of memory handed out by a link arena
+ * @field next next slab in the arena
+ * @field used number of bytes handed out so far
+ * @field size number of bytes available in data
+ * @field data the memory handed out
+ */
+typedef struct PM_link_block {
+    struct PM_link_block * next;
+    size_t used;
+    size_t size;
+    char data[];
+} PM_link_block;
+
+/*! @typedef
+ * @abstract Bump allocator for link pairs and link chunks
+ * @field blocks slabs, the first one is the one being filled
+ * @field num_blocks number of slabs
+ */
+typedef struct {
+    PM_link_block * blocks;
+    size_t num_blocks;
+} PM_link_arena;
+
+/*! @typedef
+ * @abstract A single slot in the link table
+ * @field key packed contig pair (cid_1 << 32 | cid_2)
+ * @field LP link pair stored in this slot (NULL if the slot is empty)
+ */
+typedef struct {
+    uint64_t key;
+    PM_link_pair * LP;
+} PM_link_slot;
+
+/*! @typedef
+ * @abstract Open addressing hash of contig pairs -> link pairs
+ * @field slots linearly probed slots
+ * @field capacity number of slots (always a power of 2)
+ * @field num_pairs number of slots in use
+ * @field shift 64 - log2(capacity), used to fold hashes into slots
+ * @field arena owns every link pair and link chunk in the table
+ */
+typedef struct {
+    PM_link_slot * slots;
+    size_t capacity;
+    size_t num_pairs;
+    int shift;
+    PM_link_arena arena;
+} PM_link_table;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/*!
+ * @abstract Make a new, empty link table
+ *
+ * @param  expectedPairs  number of contig pairs to make room for up front
+ * @return PM_link_table *
+ *
+ * @discussion The table grows as needed so expectedPairs is only a hint.
+ * The number of contigs is usually a good guess. Call destroyLinks when done.
+ */
+PM_link_table * createLinkTable(size_t expectedPairs);
+
+/*!
+ * @abstract Find the link pair for two contigs
+ *
+ * @param  linkTable  table to look in
+ * @param  cid_1  tid of one contig
+ * @param  cid_2  tid of the other contig (order doesn't matter)
+ * @return PM_link_pair * or NULL if there are no links between the contigs
+ */
+PM_link_pair * getLinkPair(PM_link_table * linkTable, int cid_1, int cid_2);
+
+/*!
+ * @abstract Step through every link pair in a table
+ *
+ * @param  linkTable  table to walk
+ * @param  slot  iterator state, set to 0 before the first call
+ * @param  LP  set to the next link pair
+ * @return 1 if LP was set, 0 at the end of the table
+ *
+ * @discussion Nothing is allocated. Pairs come out in slot order.
+ */
+int nextLinkPair(PM_link_table * linkTable, size_t * slot, PM_link_pair ** LP);
+
 /*!
  * @abstract Add a link info struct to the main link table.
  *
@@ -82,7 +210,7 @@ extern "C" {
  * @discussion The contigs can be added in any order hovever the pos and orient_1
  * variables must match this ordering. The code will sort cids accordingly.
  */
-void addLink(cfuhash_table_t * linkTable,
+void addLink(PM_link_table * linkTable,
              int cid_1,
              int cid_2,
              int pos_1,
@@ -92,34 +220,101 @@ void addLink(cfuhash_table_t * linkTable,
              int bam_ID);
 
 /*!
- * @abstract Walk along the link info linked list destoying the current node
+ * @abstract Destroy all links information
  *
- * @param  LI_ptr pointer to the current node
- * @return 1 if should keep walking, 0 is at end of list
+ * @param  linkTable pointer to the table to be desroyed
+ * @return void
+ *
+ * @discussion Link pairs and link infos live in the table's arena so this
+ * is one free per slab, not one per link.
  */
-int destroyLinkInfo_andNext(PM_link_info** LI_ptr);
+void destroyLinks(PM_link_table * linkTable);
 
 /*!
- * @abstract Destroy all links information
+ * @abstract Empty a link table so it can be filled again
+ *
+ * @param  linkTable  table to empty
+ * @return void
+ *
+ * @discussion The slots and the newest arena slab are kept and reused, any
+ * other slabs are freed. Pointers to the old pairs and links are invalid.
+ */
+void clearLinks(PM_link_table * linkTable);
+
+/*!
+ * @abstract Move every link in one link table into another
+ *
+ * @param  destTable  link table to move links into
+ * @param  srcTable  link table to move links out of
+ * @return void
+ *
+ * @discussion Links from srcTable are treated as if they were added to
+ * destTable after all the links already there, so chains keep the same
+ * order they would have had if every link had gone into destTable directly.
+ * Chunks are relinked, not copied, and srcTable's arena slabs are handed to
+ * destTable. srcTable is left empty but must still be destroyed by the caller.
+ */
+void spliceLinks(PM_link_table * destTable, PM_link_table * srcTable);
+
+/*!
+ * @abstract Copy every link in one link table into another
  *
- * @param  linkHash pointer to the hash to be desroyed
+ * @param  destTable  link table to copy links into
+ * @param  srcTable  link table to copy links from (unchanged)
+ * @param  bamOffset  added to the bam_ID of every copied link
  * @return void
+ *
+ * @discussion As spliceLinks the copies go after the links already in
+ * destTable. Each pair is looked up once and its links are copied into a
+ * single chunk sized to fit, so nothing is hashed per link.
+ */
+void copyLinks(PM_link_table * destTable, PM_link_table * srcTable, int bamOffset);
+
+/*!
+ * @abstract Start walking the links of a contig pair
+ *
+ * @param  LP  link pair to walk
+ * @param  iter  iterator to set up
+ * @return void
+ */
+void initLinkIterator(PM_link_pair * LP, PM_link_iterator * iter);
+
+/*!
+ * @abstract Step to the next link info of a contig pair
+ *
+ * @param  iter  iterator set up by initLinkIterator
+ * @param  LI  set to the next link info
+ * @return 1 if LI was set, 0 at the end of the links
  */
-void destroyLinks(cfuhash_table_t * linkHash);
+int nextLinkInfo(PM_link_iterator * iter, PM_link_info ** LI);
 
 /*!
- * @abstract Walk along the link info linked list
+ * @abstract Copy every link out into flat parallel arrays
  *
- * @param  LI_ptr pointer to the current node
- * @return 1 if should keep walking, 0 is at end of list
+ * @param  linkTable  table to copy links from (unchanged), may be NULL
+ * @return PM_link_columns * (never NULL)
+ *
+ * @discussion Pairs are sorted by (cid_1, cid_2) and links within a pair
+ * keep the order they were added in. Each array is a single allocation so
+ * it can be wrapped (e.g. by numpy) without copying. A NULL table (links
+ * were not collected) gives no pairs and no links, with offsets[0] == 0.
+ * Call destroyLinkColumns when done.
+ */
+PM_link_columns * compactLinks(PM_link_table * linkTable);
+
+/*!
+ * @abstract Free the arrays made by compactLinks
+ *
+ * @param  LC  link columns to destroy
+ * @return void
  */
-int getNextLinkInfo(PM_link_info** LI_ptr);
+void destroyLinkColumns(PM_link_columns * LC);
 
         /***********************
         *** PRINTING AND I/O ***
         ***********************/
 
-void printLinks(cfuhash_table_t * linkHash, char ** bamNames, char ** contigNames);
+void printLinks(PM_link_table * linkTable, char ** bamNames, char ** contigNames);
 void printLinkPair(PM_link_pair* LP, char ** bamNames, char ** contigNames);
 void printLinkInfo(PM_link_info* LI, char ** bamNames);
 
@@ -0,0 +1,924 @@
+//#############################################################################
+//
+//   parallelParser.c
+//
+//   Share the contigs of indexed BAM files out between worker threads
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+// htslib
+#include "htslib/sam.h"
+
+// local includes
+#include "parallelParser.h"
+#include "bamParser.h"
+#include "cigarDepth.h"
+#include "pairedLink.h"
+#include "regions.h"
+#include "taskQueue.h"
+#include "pmTrace.h"
+
+void partitionContigs(uint64_t * weights,
+                      int numContigs,
+                      int numWorkers,
+                      int * bounds)
+{
+    //-----
+    // greedy walk along the contigs cutting each time we pass the next target
+    //
+    uint64_t total = 0, so_far = 0;
+    int tid = 0, w = 0;
+    for(tid = 0; tid < numContigs; ++tid) {
+        total += weights[tid];
+    }
+    bounds[0] = 0;
+    tid = 0;
+    for(w = 1; w < numWorkers; ++w) {
+        uint64_t target = (total / numWorkers) * w;
+        while(tid < numContigs && so_far + weights[tid] <= target) {
+            so_far += weights[tid];
+            ++tid;
+        }
+        bounds[w] = tid;
+    }
+    bounds[numWorkers] = numContigs;
+}
+
+static PM_region * contigRegions(PM_worker_shared * S,
+                                 int tid,
+                                 PM_region * whole,
+                                 uint32_t * numRegions)
+{
+    //-----
+    // the stretches of a contig to parse, the whole thing unless we have regions
+    //
+    if(S->regions == NULL) {
+        whole->beg = 0;
+        whole->end = S->MR->contig_lengths[tid];
+        whole->offset = 0;
+        *numRegions = 1;
+        return whole;
+    }
+    *numRegions = S->regions->first[tid + 1] - S->regions->first[tid];
+    return S->regions->regions + S->regions->first[tid];
+}
+
+static int queryRegion(PM_contig_worker * W, int bamID, int tid, PM_region * region)
+{
+    //-----
+    // point a reader at a stretch of a contig using the index
+    //
+    PM_worker_shared * S = W->shared;
+    W->data[bamID]->iter = sam_itr_queryi(S->indexes[bamID], tid, region->beg, region->end);
+    // read_bam would fall back to reading the whole file
+    return (W->data[bamID]->iter == NULL);
+}
+
+static void releaseRegion(PM_contig_worker * W, int bamID)
+{
+    hts_itr_t * iter = W->data[bamID]->iter;
+    int i = 0;
+    if(iter == NULL)
+        return;
+    // count the compressed bytes the index said to read
+    for(i = 0; i < iter->n_off; ++i) {
+        W->bytes_read += (iter->off[i].v >> 16) - (iter->off[i].u >> 16);
+    }
+    hts_itr_destroy(iter);
+    W->data[bamID]->iter = NULL;
+}
+
+static int readFailed(PM_contig_worker * W, int bamID)
+{
+    //-----
+    // a reader hit a truncated or corrupt BAM, which is not the end of it
+    //
+    char str[1024];
+    if(bamID < 0)
+        snprintf(str, sizeof(str), "Could not read a BAM, it may be truncated");
+    else
+        snprintf(str, sizeof(str), "Could not read %s, it may be truncated", W->shared->bam_files[bamID]);
+    printError(str, __LINE__);
+    return 1;
+}
+
+static int reportProgress(PM_contig_worker * W, int tid, int contigs)
+{
+    int cancelled = updateProgress(W->shared->progress, tid, W->bytes_read, contigs);
+    W->bytes_read = 0;
+    return cancelled;
+}
+
+static int finishContig(PM_contig_worker * W, int tid)
+{
+    //-----
+    // hand the contig over if we're streaming, then tell anyone listening
+    //
+    if(W->shared->stream != NULL && streamContig(W->shared->stream, W->MR, tid))
+        return PM_PARSE_CANCELLED;
+    if(reportProgress(W, tid, 1))
+        return PM_PARSE_CANCELLED;
+    return 0;
+}
+
+static int pileupContig(PM_contig_worker * W,
+                        int tid,
+                        PM_region * regions,
+                        uint32_t numRegions,
+                        PM_depth_buffers * depths,
+                        int * n_plp,
+                        const bam_pileup1_t ** plp)
+{
+    //-----
+    // run a multi-pileup over each stretch of a single contig
+    //
+    PM_worker_shared * S = W->shared;
+    PM_mapping_results * MR = W->MR;
+    int i = 0, seen = 0, p_tid = 0, pos = 0, ret = 0, mplp_ret = 0;
+    uint32_t r = 0, columns = 0;
+    PM_TRACE2(contig_start, tid, PM_MR_LENGTH(MR, tid));
+    for(r = 0; r < numRegions && ret == 0; ++r) {
+        PM_region * R = &regions[r];
+        for (i = 0; i < S->num_bams; ++i) {
+            ret |= queryRegion(W, i, tid, R);
+        }
+        if(ret == 0) {
+            bam_mplp_t mplp = bam_mplp_init(S->num_bams, read_bam, (void**)W->data);
+            while ((mplp_ret = bam_mplp_auto(mplp, &p_tid, &pos, n_plp, plp)) > 0) {
+                if (pos < R->beg || pos >= R->end) continue; // reads hanging over the ends
+                if (((++columns) & PM_PROGRESS_COLUMN_MASK) == 0 && PM_PROGRESS_IS_CANCELLED(S->progress)) {
+                    ret = PM_PARSE_CANCELLED;
+                    break;
+                }
+                seen = 1;
+                countPileupColumn(MR, W->links, &W->stats, depths, S->opts, tid, pos, R->offset + (pos - R->beg), n_plp, plp);
+            }
+            bam_mplp_destroy(mplp);
+            if (mplp_ret < 0)
+                ret = readFailed(W, -1);
+        }
+        for (i = 0; i < S->num_bams; ++i) {
+            releaseRegion(W, i);
+        }
+    }
+
+    if(ret != 0)
+        return ret;
+
+    // contigs with nothing piled up are never adjusted by the serial parser
+    if(seen) {
+        uint64_t start = statsClock();
+        PM_MARK_SEEN(S->opts, tid);
+        adjustPlpBp(MR, depths, tid);
+        clearDepthBuffers(depths);
+        W->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - start;
+    }
+    PM_TRACE3(contig_end, tid, PM_MR_LENGTH(MR, tid), contigPlpSum(MR, tid));
+    return finishContig(W, tid);
+}
+
+static void zeroContigRow(PM_mapping_results * MR, int tid)
+{
+    int i = 0;
+    for(i = 0; i < MR->num_bams; ++i) {
+        MR->plp_bp[PM_MR_CELL(MR, tid, i)] = 0;
+        if(MR->contig_length_correctors != NULL)
+            MR->contig_length_correctors[PM_MR_CELL(MR, tid, i)] = 0;
+    }
+}
+
+static int cigarPieces(PM_contig_worker * W,
+                       int bamID,
+                       int tid,
+                       PM_region * regions,
+                       uint32_t numRegions,
+                       PM_depth_buffer * depth,
+                       int32_t * diff,
+                       bam1_t * b,
+                       int * seen)
+{
+    //-----
+    // walk the CIGARs of one BAM's reads on each stretch of a single contig
+    //
+    PM_worker_shared * S = W->shared;
+    PM_mapping_results * MR = W->MR;
+    uint32_t contig_length = MR->contig_lengths[tid];
+    uint32_t r = 0, reads = 0, from = 0, to = 0, prev_end = 0;
+    int read_ret = 0;
+    for (r = 0; r < numRegions; ++r) {
+        if (queryRegion(W, bamID, tid, &regions[r]) != 0) {
+            releaseRegion(W, bamID);
+            return 1;
+        }
+        while ((read_ret = read_bam(W->data[bamID], b)) >= 0) {
+            int64_t read_end = 0;
+            if (b->core.tid != tid) continue;
+            // reads spanning the gap were added with the last region
+            if (b->core.pos < prev_end) continue;
+            read_end = bam_endpos(b);
+            if (read_end > contig_length) read_end = contig_length;
+            if (to == 0) from = b->core.pos;
+            if (read_end + 1 > to) to = read_end + 1;
+            *seen = 1;
+            // only reads starting in the region link, as in a pileup
+            countCigarRead(MR,
+                           (b->core.pos >= regions[r].beg) ? W->links : NULL,
+                           &W->stats, S->opts, b, diff, bamID);
+            if (((++reads) & PM_PROGRESS_COLUMN_MASK) == 0 && PM_PROGRESS_IS_CANCELLED(S->progress)) {
+                releaseRegion(W, bamID);
+                return PM_PARSE_CANCELLED;
+            }
+        }
+        releaseRegion(W, bamID);
+        if (read_ret < -1)
+            return readFailed(W, bamID);
+        prev_end = regions[r].end;
+    }
+    uint64_t start = statsClock();
+    diffToRegionDepth(diff, depth, regions, numRegions, from, to);
+    W->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - start;
+    return 0;
+}
+
+static int cigarContig(PM_contig_worker * W,
+                       int tid,
+                       PM_region * regions,
+                       uint32_t numRegions,
+                       PM_depth_buffer * depth,
+                       int32_t * diff,
+                       bam1_t * b)
+{
+    //-----
+    // walk the CIGARs of every read on each stretch of a single contig
+    //
+    PM_worker_shared * S = W->shared;
+    PM_mapping_results * MR = W->MR;
+    int i = 0, ret = 0, seen = 0;
+    PM_TRACE2(contig_start, tid, PM_MR_LENGTH(MR, tid));
+    for (i = 0; i < S->num_bams; ++i) {
+        ret = cigarPieces(W, i, tid, regions, numRegions, depth, diff, b, &seen);
+        if (ret != 0)
+            return ret;
+        uint64_t start = statsClock();
+        adjustPlpBpColumn(MR, depth, tid, i);
+        clearDepthBuffer(depth);
+        W->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - start;
+    }
+    // the serial parser never gets to a contig without reads, and an empty
+    // histogram still drops positions, so put back the zeros it would leave
+    if (!seen)
+        zeroContigRow(MR, tid);
+    else
+        PM_MARK_SEEN(S->opts, tid);
+    PM_TRACE3(contig_end, tid, PM_MR_LENGTH(MR, tid), contigPlpSum(MR, tid));
+    return finishContig(W, tid);
+}
+
+    /***********************
+    ***   CHUNK TASKS    ***
+    ***********************/
+static int pileupPieces(PM_contig_worker * W,
+                        int bamID,
+                        int tid,
+                        PM_region * regions,
+                        uint32_t numRegions,
+                        PM_depth_buffer * depth,
+                        int * seen)
+{
+    //-----
+    // a single BAM pileup over each stretch of a chunk
+    //
+    PM_worker_shared * S = W->shared;
+    int p_tid = 0, pos = 0, n_plp = 0, ret = 0;
+    uint32_t r = 0, columns = 0;
+    const bam_pileup1_t * plp = NULL;
+    for(r = 0; r < numRegions && ret == 0; ++r) {
+        PM_region * R = &regions[r];
+        ret = queryRegion(W, bamID, tid, R);
+        if(ret == 0) {
+            bam_plp_t iter = bam_plp_init(read_bam, W->data[bamID]);
+            while ((plp = bam_plp_auto(iter, &p_tid, &pos, &n_plp)) != NULL) {
+                if (pos < R->beg || pos >= R->end) continue; // reads hanging over the ends
+                if (((++columns) & PM_PROGRESS_COLUMN_MASK) == 0 && PM_PROGRESS_IS_CANCELLED(S->progress)) {
+                    ret = PM_PARSE_CANCELLED;
+                    break;
+                }
+                *seen = 1;
+                countPileupBam(W->MR, W->links, &W->stats, depth, S->opts, bamID, R->offset + (pos - R->beg), n_plp, plp);
+            }
+            bam_plp_destroy(iter);
+            if (plp == NULL && n_plp < 0)
+                ret = readFailed(W, bamID);
+        }
+        releaseRegion(W, bamID);
+    }
+    return ret;
+}
+
+static void adjustTaskColumn(PM_contig_worker * W, PM_depth_buffer * depth, int tid, int bamID)
+{
+    uint64_t start = statsClock();
+    adjustPlpBpColumn(W->MR, depth, tid, bamID);
+    clearDepthBuffer(depth);
+    W->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - start;
+}
+
+static int finishTaskContig(PM_contig_worker * W, int tid)
+{
+    PM_mapping_results * MR = W->MR;
+    // contigs with nothing piled up are never adjusted by the serial parser
+    if(!__atomic_load_n(&W->shared->contigs[tid].seen, __ATOMIC_RELAXED))
+        zeroContigRow(MR, tid);
+    else
+        PM_MARK_SEEN(W->shared->opts, tid);
+    PM_TRACE3(contig_end, tid, PM_MR_LENGTH(MR, tid), contigPlpSum(MR, tid));
+    return finishContig(W, tid);
+}
+
+static int runTask(PM_contig_worker * W,
+                   PM_task * T,
+                   PM_depth_buffer * whole,
+                   int32_t * diff,
+                   bam1_t * b)
+{
+    PM_worker_shared * S = W->shared;
+    PM_contig_tasks * C = &S->contigs[T->tid];
+    PM_region * pieces = S->pieces + T->first_piece;
+    PM_depth_buffers * partial = NULL;
+    PM_depth_buffer * depth = whole;
+    int seen = 0, ret = 0, k = 0;
+    uint32_t p = 0;
+    if(T->chunk == 0 && T->bam_ID == 0)
+        PM_TRACE2(contig_start, T->tid, PM_MR_LENGTH(W->MR, T->tid));
+
+    if(C->num_chunks > 1) {
+        //-----
+        // a chunk of a split contig fills a buffer of its own, counted from
+        // the chunk's start, and is stitched to the others once they are done
+        //
+        uint32_t base = C->chunk_starts[T->chunk];
+        PM_region * last = &pieces[T->num_pieces - 1];
+        PM_region * rebased = malloc(T->num_pieces * sizeof(PM_region));
+        for(p = 0; p < T->num_pieces; ++p) {
+            rebased[p] = pieces[p];
+            rebased[p].offset -= base;
+        }
+        pieces = rebased;
+        partial = createDepthBuffers(1,
+                                     last->offset + (last->end - last->beg) - base,
+                                     PM_COVERAGE_USES_HISTOGRAM(W->MR->is_outlier_coverage));
+        depth = &partial->buffers[0];
+    }
+
+    if(PM_USE_CIGAR_ENGINE(S->opts))
+        ret = cigarPieces(W, T->bam_ID, T->tid, pieces, T->num_pieces, depth, diff, b, &seen);
+    else
+        ret = pileupPieces(W, T->bam_ID, T->tid, pieces, T->num_pieces, depth, &seen);
+    if(partial != NULL)
+        free(pieces);
+    if(ret != 0) {
+        destroyDepthBuffers(partial);
+        return ret;
+    }
+    if(seen)
+        __atomic_store_n(&C->seen, 1, __ATOMIC_RELAXED);
+
+    if(partial == NULL) {
+        adjustTaskColumn(W, whole, T->tid, T->bam_ID);
+    } else {
+        PM_depth_buffers ** parts = C->partials + (size_t)T->bam_ID * C->num_chunks;
+        parts[T->chunk] = partial;
+        // whoever finishes the BAM's last chunk puts them together in order
+        if(__atomic_sub_fetch(&C->bam_remaining[T->bam_ID], 1, __ATOMIC_ACQ_REL) == 0) {
+            uint64_t start = statsClock();
+            for(k = 0; k < C->num_chunks; ++k) {
+                appendDepthBuffer(whole, &parts[k]->buffers[0], C->chunk_starts[k]);
+                destroyDepthBuffers(parts[k]);
+                parts[k] = NULL;
+            }
+            W->stats.timer_ns[PM_TIMER_MERGE] += statsClock() - start;
+            adjustTaskColumn(W, whole, T->tid, T->bam_ID);
+        }
+    }
+
+    // the rows are all written once the last task of the contig gets here
+    if(__atomic_sub_fetch(&C->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+        return finishTaskContig(W, T->tid);
+    return 0;
+}
+
+static void runTasks(PM_contig_worker * W)
+{
+    PM_worker_shared * S = W->shared;
+    int use_cigars = PM_USE_CIGAR_ENGINE(S->opts);
+    int task = 0;
+    // a whole contig's worth for unsplit contigs and for stitching chunks
+    PM_depth_buffers * depths = createDepthBuffers(1,
+                                                   S->longest,
+                                                   PM_COVERAGE_USES_HISTOGRAM(S->MR->is_outlier_coverage));
+    int32_t * diff = NULL;
+    bam1_t * b = NULL;
+    if(use_cigars) {
+        diff = calloc((size_t)S->longest + 1, sizeof(int32_t));
+        b = bam_init1();
+    }
+    while(W->status == 0 && (task = nextTask(S->queue, W->id)) >= 0) {
+        if(PM_PROGRESS_IS_CANCELLED(S->progress)) {
+            W->status = PM_PARSE_CANCELLED;
+            break;
+        }
+        W->status = runTask(W, &S->tasks[task], &depths->buffers[0], diff, b);
+    }
+    if(b) bam_destroy1(b);
+    free(diff);
+    destroyDepthBuffers(depths);
+}
+
+static int indexesHaveStats(hts_idx_t ** indexes, int numBams, int numContigs)
+{
+    //-----
+    // an index with no read counts for any contig was made without them,
+    // and weighing its BAM by length would mix units with the others
+    //
+    int i = 0, tid = 0;
+    for (i = 0; i < numBams; ++i) {
+        uint64_t mapped = 0, unmapped = 0;
+        for(tid = 0; tid < numContigs; ++tid) {
+            if(hts_idx_get_stat(indexes[i], tid, &mapped, &unmapped) == 0)
+                break;
+        }
+        if(tid == numContigs)
+            return 0;
+    }
+    return 1;
+}
+
+static uint64_t mappedReads(hts_idx_t * index, int tid)
+{
+    uint64_t mapped = 0, unmapped = 0;
+    if(hts_idx_get_stat(index, tid, &mapped, &unmapped) != 0)
+        return 0; // no reads on this contig
+    return mapped;
+}
+
+static int buildTasks(PM_worker_shared * S, uint32_t chunkSize, uint64_t ** taskWeights)
+{
+    //-----
+    // cut each contig's stretches into chunks of chunkSize packed bases and
+    // make a task for each BAM of each chunk, in (tid, chunk, BAM) order
+    //
+    PM_mapping_results * MR = S->MR;
+    size_t num_pieces = 0, pieces_capacity = 0, num_tasks = 0, tasks_capacity = 0;
+    uint64_t * weights = NULL;
+    uint64_t * mapped = calloc(S->num_bams, sizeof(uint64_t));
+    int use_stats = indexesHaveStats(S->indexes, S->num_bams, MR->num_contigs);
+    int tid = 0, i = 0, k = 0;
+    S->contigs = calloc(MR->num_contigs, sizeof(PM_contig_tasks));
+    S->pieces = NULL;
+    S->tasks = NULL;
+    S->longest = 0;
+    for(tid = 0; tid < MR->num_contigs; ++tid) {
+        PM_contig_tasks * C = &S->contigs[tid];
+        PM_region whole;
+        uint32_t num_regions = 0, r = 0, fill = 0;
+        PM_region * regions = contigRegions(S, tid, &whole, &num_regions);
+        uint32_t length = PM_MR_LENGTH(MR, tid);
+        if(num_regions == 0 || length == 0)
+            continue; // not asked for, so no tasks
+        if(MR->contig_lengths[tid] > S->longest)
+            S->longest = MR->contig_lengths[tid];
+
+        // every chunk but the last holds exactly chunkSize bases
+        size_t max_chunks = length / chunkSize + 1;
+        uint32_t * first_pieces = calloc(max_chunks + 1, sizeof(uint32_t));
+        C->chunk_starts = calloc(max_chunks, sizeof(uint32_t));
+        for(r = 0; r < num_regions; ++r) {
+            uint32_t beg = regions[r].beg, offset = regions[r].offset;
+            while(beg < regions[r].end) {
+                uint32_t end = regions[r].end;
+                if(fill == 0) {
+                    first_pieces[C->num_chunks] = num_pieces;
+                    C->chunk_starts[C->num_chunks] = offset;
+                    ++C->num_chunks;
+                }
+                if(end - beg > chunkSize - fill)
+                    end = beg + (chunkSize - fill);
+                if(num_pieces == pieces_capacity) {
+                    pieces_capacity = (pieces_capacity == 0) ? 64 : pieces_capacity * 2;
+                    S->pieces = realloc(S->pieces, pieces_capacity * sizeof(PM_region));
+                }
+                S->pieces[num_pieces].beg = beg;
+                S->pieces[num_pieces].end = end;
+                S->pieces[num_pieces].offset = offset;
+                ++num_pieces;
+                fill += end - beg;
+                offset += end - beg;
+                beg = end;
+                if(fill == chunkSize)
+                    fill = 0;
+            }
+        }
+        first_pieces[C->num_chunks] = num_pieces;
+
+        for (i = 0; i < S->num_bams; ++i) {
+            mapped[i] = use_stats ? mappedReads(S->indexes[i], tid) : 0;
+        }
+        for(k = 0; k < C->num_chunks; ++k) {
+            uint32_t chunk_end = (k + 1 < C->num_chunks) ? C->chunk_starts[k+1] : length;
+            uint64_t bases = chunk_end - C->chunk_starts[k];
+            for (i = 0; i < S->num_bams; ++i) {
+                if(num_tasks == tasks_capacity) {
+                    tasks_capacity = (tasks_capacity == 0) ? 64 : tasks_capacity * 2;
+                    S->tasks = realloc(S->tasks, tasks_capacity * sizeof(PM_task));
+                    weights = realloc(weights, tasks_capacity * sizeof(uint64_t));
+                }
+                S->tasks[num_tasks].bam_ID = i;
+                S->tasks[num_tasks].tid = tid;
+                S->tasks[num_tasks].chunk = k;
+                S->tasks[num_tasks].first_piece = first_pieces[k];
+                S->tasks[num_tasks].num_pieces = first_pieces[k+1] - first_pieces[k];
+                weights[num_tasks] = 1 + (use_stats ? mapped[i] * bases / MR->contig_lengths[tid] : bases);
+                ++num_tasks;
+            }
+        }
+        free(first_pieces);
+        C->remaining = C->num_chunks * S->num_bams;
+        if(C->num_chunks > 1) {
+            C->bam_remaining = calloc(S->num_bams, sizeof(int));
+            for (i = 0; i < S->num_bams; ++i) {
+                C->bam_remaining[i] = C->num_chunks;
+            }
+            C->partials = calloc((size_t)C->num_chunks * S->num_bams, sizeof(PM_depth_buffers*));
+        }
+    }
+    free(mapped);
+    S->num_tasks = (int)num_tasks;
+    *taskWeights = weights;
+    return S->num_tasks;
+}
+
+static void destroyTasks(PM_worker_shared * S)
+{
+    int tid = 0;
+    size_t k = 0;
+    for(tid = 0; tid < S->MR->num_contigs; ++tid) {
+        PM_contig_tasks * C = &S->contigs[tid];
+        if(C->partials != NULL) {
+            // chunks left over if the parse stopped early
+            for(k = 0; k < (size_t)C->num_chunks * S->num_bams; ++k) {
+                destroyDepthBuffers(C->partials[k]);
+            }
+        }
+        free(C->partials);
+        free(C->bam_remaining);
+        free(C->chunk_starts);
+    }
+    free(S->contigs);
+    free(S->pieces);
+    free(S->tasks);
+    S->contigs = NULL;
+    S->pieces = NULL;
+    S->tasks = NULL;
+}
+
+static void * contigWorker(void * arg)
+{
+    PM_contig_worker * W = (PM_contig_worker *)arg;
+    PM_worker_shared * S = W->shared;
+    int i = 0, tid = 0;
+    uint64_t start = statsClock();
+
+    // BGZF handles can't be shared so each worker opens its own
+    W->data = calloc(S->num_bams, sizeof(aux_t*));
+    for (i = 0; i < S->num_bams; ++i) {
+        W->data[i] = calloc(1, sizeof(aux_t));
+        W->data[i]->fp = bgzf_open(S->bam_files[i], "r");
+        if(W->data[i]->fp && S->pool) bgzf_thread_pool(W->data[i]->fp, S->pool, 0);
+        W->data[i]->min_mapQ = S->opts->mapQ;
+        W->data[i]->min_len  = S->opts->min_len;
+        W->data[i]->stats = &W->stats;
+        W->data[i]->bam_ID = i;
+        if(W->data[i]->fp == NULL)
+            W->status = 1;
+    }
+
+    W->MR = S->MR;
+    if(S->stream != NULL) {
+        // a row of our own, handed over and reused for each contig
+        W->window = *S->MR;
+        W->window.plp_bp = NULL;
+        W->window.contig_length_correctors = NULL;
+        W->window.links = W->links;
+        initStreamRows(&W->window);
+        W->MR = &W->window;
+    }
+
+    W->stats.timer_ns[PM_TIMER_SETUP] += statsClock() - start;
+
+    if(W->status == 0 && S->queue != NULL) {
+        start = statsClock();
+        runTasks(W);
+        W->stats.timer_ns[PM_TIMER_PILEUP] += statsClock() - start;
+    } else if(W->status == 0) {
+        int use_cigars = PM_USE_CIGAR_ENGINE(S->opts);
+        uint32_t longest = 0;
+        for(tid = W->first_tid; tid < W->last_tid; ++tid) {
+            if(S->MR->contig_lengths[tid] > longest)
+                longest = S->MR->contig_lengths[tid];
+        }
+        // sized once for the longest contig in our range and reused
+        PM_depth_buffers * depths = createDepthBuffers(use_cigars ? 1 : S->num_bams,
+                                                       longest,
+                                                       PM_COVERAGE_USES_HISTOGRAM(S->MR->is_outlier_coverage));
+        int * n_plp = calloc(S->num_bams, sizeof(int));
+        const bam_pileup1_t ** plp = calloc(S->num_bams, sizeof(void*));
+        int32_t * diff = NULL;
+        bam1_t * b = NULL;
+        if(use_cigars) {
+            diff = calloc((size_t)longest + 1, sizeof(int32_t));
+            b = bam_init1();
+        }
+        start = statsClock();
+        for(tid = W->first_tid; tid < W->last_tid && W->status == 0; ++tid) {
+            PM_region whole;
+            uint32_t num_regions = 0;
+            PM_region * regions = contigRegions(S, tid, &whole, &num_regions);
+            if(S->stream != NULL)
+                W->window.row_offset = tid;
+            if(num_regions == 0) {
+                // not asked for
+                W->status = finishContig(W, tid);
+                continue;
+            }
+            if(use_cigars)
+                W->status = cigarContig(W, tid, regions, num_regions, &depths->buffers[0], diff, b);
+            else
+                W->status = pileupContig(W, tid, regions, num_regions, depths, n_plp, plp);
+        }
+        W->stats.timer_ns[PM_TIMER_PILEUP] += statsClock() - start;
+        if(b) bam_destroy1(b);
+        free(diff);
+        destroyDepthBuffers(depths);
+        free(n_plp);
+        free(plp);
+    }
+
+    for (i = 0; i < S->num_bams; ++i) {
+        if(W->data[i]->fp) bgzf_close(W->data[i]->fp);
+        free(W->data[i]);
+    }
+    free(W->data);
+    W->data = NULL;
+    if(W->MR == &W->window)
+        destroyStreamRows(&W->window);
+    W->MR = NULL;
+    return NULL;
+}
+
+int parseCoverageAndLinksParallel(int numBams,
+                                  char* bamFiles[],
+                                  PM_parse_options * opts,
+                                  hts_tpool * pool,
+                                  PM_mapping_results * MR)
+{
+    int i = 0, w = 0, tid = 0, ret = 0;
+    uint64_t start = statsClock();
+
+    //-----
+    // every BAM needs an index or we can't do this
+    //
+    hts_idx_t ** indexes = calloc(numBams, sizeof(hts_idx_t*));
+    for (i = 0; i < numBams; ++i) {
+        indexes[i] = hts_idx_load(bamFiles[i], HTS_FMT_BAI);
+        if(indexes[i] == NULL) {
+            char str[512];
+            snprintf(str, sizeof(str), "No index found for %s", bamFiles[i]);
+            printError(str, __LINE__);
+            for (w = 0; w < i; ++w) {
+                hts_idx_destroy(indexes[w]);
+            }
+            free(indexes);
+            return PM_PARALLEL_NO_INDEX;
+        }
+    }
+
+    // we only need the header from the first BAM
+    BGZF * fp = bgzf_open(bamFiles[0], "r");
+    if(fp == NULL) {
+        for (i = 0; i < numBams; ++i) {
+            hts_idx_destroy(indexes[i]);
+        }
+        free(indexes);
+        return 1;
+    }
+    bam_hdr_t * h = bam_hdr_read(fp);
+    bgzf_close(fp);
+    init_MR(MR,
+            h,
+            numBams,
+            bamFiles,
+            opts->do_links,
+            opts->do_outlier_coverage,
+            opts->ignore_supps
+           );
+    MR->coverage_lower = opts->coverage_lower;
+    MR->coverage_upper = opts->coverage_upper;
+
+    //-----
+    // work out which bits of which contigs we were asked for
+    //
+    PM_region_set * regions = NULL;
+    if(PM_USE_REGIONS(opts) && MR->num_contigs != 0) {
+        regions = createRegionSet(h, opts->regions, opts->num_regions, opts->bed_file);
+        if(regions == NULL)
+            ret = 1;
+        else {
+            MR->region_lengths = calloc(MR->num_contigs, sizeof(uint32_t));
+            for(tid = 0; tid < MR->num_contigs; ++tid) {
+                MR->region_lengths[tid] = regionBases(regions, tid);
+            }
+            MR->region_digest = regionSetDigest(regions);
+        }
+    }
+    bam_hdr_destroy(h);
+    if(MR->num_contigs == 0 || ret != 0) {
+        for (i = 0; i < numBams; ++i) {
+            hts_idx_destroy(indexes[i]);
+        }
+        free(indexes);
+        return ret;
+    }
+
+    //-----
+    // off they go
+    //
+    PM_worker_shared shared;
+    memset(&shared, 0, sizeof(PM_worker_shared));
+    shared.num_bams = numBams;
+    shared.bam_files = bamFiles;
+    shared.indexes = indexes;
+    shared.opts = opts;
+    shared.pool = pool;
+    shared.MR = MR;
+    shared.regions = regions;
+
+    int num_workers = opts->num_workers;
+    if(num_workers < 1)
+        num_workers = 1;
+    int num_units = MR->num_contigs;
+    uint64_t * weights = NULL;
+    PM_task_queue queue;
+    if(opts->chunk_size > 0 && opts->consumer == NULL) {
+        //-----
+        // chunk tasks balanced the same way, then stolen to even things up
+        //
+        num_units = buildTasks(&shared, (uint32_t)opts->chunk_size, &weights);
+        if(num_units == 0)
+            num_units = 1; // a worker with nothing to do
+    } else {
+        //-----
+        // balance the contigs using the mapped read counts from the index,
+        // or their lengths if any index doesn't have them
+        //
+        int use_stats = indexesHaveStats(indexes, numBams, MR->num_contigs);
+        weights = calloc(MR->num_contigs, sizeof(uint64_t));
+        for(tid = 0; tid < MR->num_contigs; ++tid) {
+            uint32_t length = PM_MR_LENGTH(MR, tid);
+            if(length == 0)
+                continue; // not asked for, so no work
+            weights[tid] = 1;
+            for (i = 0; i < numBams; ++i) {
+                if(use_stats)
+                    weights[tid] += mappedReads(indexes[i], tid) * length / MR->contig_lengths[tid];
+                else
+                    weights[tid] += length;
+            }
+        }
+    }
+    if(num_workers > num_units)
+        num_workers = num_units;
+    int * bounds = calloc(num_workers + 1, sizeof(int));
+    partitionContigs(weights, shared.contigs ? shared.num_tasks : MR->num_contigs, num_workers, bounds);
+    free(weights);
+    if(shared.contigs != NULL) {
+        initTaskQueue(&queue, bounds, num_workers);
+        shared.queue = &queue;
+    }
+    MR->stats.timer_ns[PM_TIMER_SETUP] += statsClock() - start;
+
+    PM_progress_tracker tracker;
+    if(opts->progress != NULL) {
+        initProgress(&tracker, opts->progress, opts->progress_data, opts->progress_contigs,
+                     opts->progress_mb, numBams, bamFiles, MR->num_contigs);
+        shared.progress = &tracker;
+        if(shared.contigs != NULL) {
+            // contigs with no tasks are done already
+            int skipped = 0;
+            for(tid = 0; tid < MR->num_contigs; ++tid) {
+                skipped += (shared.contigs[tid].num_chunks == 0);
+            }
+            updateProgress(shared.progress, 0, 0, skipped);
+        }
+    }
+
+    PM_contig_stream contig_stream;
+    if(opts->consumer != NULL) {
+        // the workers have rows of their own so ours are never filled
+        initContigStream(&contig_stream, opts->consumer, opts->consumer_data);
+        destroyStreamRows(MR);
+        shared.stream = &contig_stream;
+    }
+
+    PM_contig_worker * workers = calloc(num_workers, sizeof(PM_contig_worker));
+    pthread_t * threads = calloc(num_workers, sizeof(pthread_t));
+    int * joinable = calloc(num_workers, sizeof(int));
+    for(w = 0; w < num_workers; ++w) {
+        workers[w].shared = &shared;
+        workers[w].id = w;
+        workers[w].first_tid = bounds[w];
+        workers[w].last_tid = bounds[w+1];
+        initParseStats(&workers[w].stats, numBams);
+        if(MR->is_links_included) {
+            workers[w].links = createLinkTable((shared.queue ? MR->num_contigs / num_workers : bounds[w+1] - bounds[w]));
+        }
+        if(pthread_create(&threads[w], NULL, contigWorker, &workers[w]) == 0) {
+            joinable[w] = 1;
+        } else {
+            // do this one here instead
+            contigWorker(&workers[w]);
+        }
+    }
+    for(w = 0; w < num_workers; ++w) {
+        if(joinable[w])
+            pthread_join(threads[w], NULL);
+        if(workers[w].status == PM_PARSE_CANCELLED) {
+            ret = PM_PARSE_CANCELLED;
+        } else if(workers[w].status != 0 && ret != PM_PARSE_CANCELLED) {
+            char str[80];
+            sprintf(str, "Contig worker %d failed", w);
+            printError(str, __LINE__);
+            ret = 1;
+        }
+    }
+
+    //-----
+    // workers hold contiguous contig ranges so splicing in worker order
+    // gives the same link chains as a serial parse (stolen tasks give the
+    // same links, but a chain's links can come in another order)
+    //
+    start = statsClock();
+    for(w = 0; w < num_workers; ++w) {
+        if(workers[w].links != NULL) {
+            // already handed over if we're streaming
+            if(shared.stream == NULL)
+                spliceLinks(MR->links, workers[w].links);
+            destroyLinks(workers[w].links);
+        }
+        addParseStats(&MR->stats, &workers[w].stats, 0);
+        destroyParseStats(&workers[w].stats);
+    }
+    MR->stats.timer_ns[PM_TIMER_MERGE] += statsClock() - start;
+
+    destroyProgress(shared.progress);
+    if(shared.stream != NULL) {
+        destroyLinks(MR->links);
+        MR->links = NULL;
+        destroyContigStream(shared.stream);
+    }
+    free(joinable);
+    free(threads);
+    free(workers);
+    free(bounds);
+    if(shared.queue != NULL) {
+        destroyTaskQueue(shared.queue);
+        destroyTasks(&shared);
+    }
+    destroyRegionSet(regions);
+    for (i = 0; i < numBams; ++i) {
+        hts_idx_destroy(indexes[i]);
+    }
+    free(indexes);
+    return ret;
+}
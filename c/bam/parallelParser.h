@@ -0,0 +1,215 @@
+//#############################################################################
+//
+//   parallelParser.h
+//
+//   Share the contigs of indexed BAM files out between worker threads
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_PARALLEL_PARSER_H
+  #define PM_PARALLEL_PARSER_H
+
+// system includes
+#include <stdint.h>
+
+// htslib
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+// local includes
+#include "bamParser.h"
+#include "depthBuffer.h"
+#include "regions.h"
+#include "taskQueue.h"
+
+// returned when one or more of the BAMs has no .bai
+#define PM_PARALLEL_NO_INDEX -2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract One BAM's share of one chunk of a contig
+ @field bam_ID BAM to read
+ @field tid contig the chunk is on
+ @field chunk which chunk of the contig, counting from 0
+ @field first_piece first stretch of the chunk in the shared pieces
+ @field num_pieces number of stretches in the chunk
+ */
+typedef struct {
+    int bam_ID;
+    int tid;
+    int chunk;
+    uint32_t first_piece;
+    uint32_t num_pieces;
+} PM_task;
+
+/*! @typedef
+ @abstract How far the tasks of one contig have got
+ @field num_chunks number of chunks the contig is cut into (0 if not parsed)
+ @field chunk_starts depth buffer slot of the first base of each chunk
+ @field remaining tasks of the contig not yet finished
+ @field bam_remaining chunks of each BAM not yet finished (split contigs only)
+ @field partials depths of finished chunks waiting to be stitched, num_chunks per BAM
+ @field seen set once any task has piled up a column or walked a read
+ */
+typedef struct {
+    int num_chunks;
+    uint32_t * chunk_starts;
+    int remaining;
+    int * bam_remaining;
+    PM_depth_buffers ** partials;
+    int seen;
+} PM_contig_tasks;
+
+/*! @typedef
+ @abstract State shared by all the contig workers
+ @field num_bams number of BAM files to parse
+ @field bam_files filenames of BAM files to parse
+ @field indexes loaded .bai for each BAM (read only once loaded)
+ @field opts settings to parse with
+ @field pool BGZF decompression threads (NULL for none)
+ @field MR mapping results struct to write to
+ @field regions parts of the contigs to parse (NULL for all of every contig)
+ @field progress where the workers report progress (NULL for nowhere)
+ @field stream where the workers hand finished contigs (NULL to keep them in MR)
+ @field queue hands out the tasks (NULL to give each worker a range of whole contigs)
+ @field tasks every task, in (tid, chunk, BAM) order
+ @field num_tasks number of tasks
+ @field pieces stretches of contig making up the chunks
+ @field contigs how far each contig's tasks have got
+ @field longest longest contig with any tasks
+ */
+typedef struct {
+    int num_bams;
+    char ** bam_files;
+    hts_idx_t ** indexes;
+    PM_parse_options * opts;
+    hts_tpool * pool;
+    PM_mapping_results * MR;
+    PM_region_set * regions;
+    PM_progress_tracker * progress;
+    PM_contig_stream * stream;
+    PM_task_queue * queue;
+    PM_task * tasks;
+    int num_tasks;
+    PM_region * pieces;
+    PM_contig_tasks * contigs;
+    uint32_t longest;
+} PM_worker_shared;
+
+/*! @typedef
+ @abstract A single contig worker
+ @field shared state shared by all the workers
+ @field id index of the worker, for the task queue
+ @field first_tid first contig this worker processes
+ @field last_tid one past the last contig this worker processes
+ @field data one reader per BAM, owned by this worker
+ @field MR where this worker writes coverage, shared->MR unless streaming
+ @field window the worker's own one row copy of shared->MR when streaming
+ @field links links found by this worker
+ @field stats counters and timers of this worker, added to MR's at the end
+ @field bytes_read compressed bytes read since the last progress update
+ @field status 0 on success
+ */
+typedef struct {
+    PM_worker_shared * shared;
+    int id;
+    int first_tid;
+    int last_tid;
+    aux_t ** data;
+    PM_mapping_results * MR;
+    PM_mapping_results window;
+    PM_link_table * links;
+    PM_parse_stats stats;
+    uint64_t bytes_read;
+    int status;
+} PM_contig_worker;
+
+/*!
+ * @abstract Parse the BAM files with contigs split over several threads
+ *
+ * @param numBams  number of BAM files to parse
+ * @param bamFiles  filenames of BAM files to parse
+ * @param opts  settings to parse with, opts->num_workers threads (at least one) are used
+ * @param pool  BGZF decompression threads shared by all workers (may be NULL)
+ * @param MR  mapping results struct to write to
+ * @return 0 for success, PM_PARALLEL_NO_INDEX if a BAM is not indexed,
+ * PM_PARSE_CANCELLED if opts->progress asked to stop
+ *
+ * @discussion Each worker is given a contiguous range of contigs, balanced
+ * using the mapped read counts stored in the indexes (or the contig lengths
+ * if any index was made without them). Workers open their own
+ * file handles and use one hts_itr_t per BAM per contig. Coverage is written
+ * straight into the rows of MR belonging to the worker's contigs and links
+ * are spliced together in contig order once all workers finish, so the
+ * result is the same as a serial parse. If PM_PARALLEL_NO_INDEX is returned
+ * then MR has not been touched.
+ *
+ * This is also how region restricted parses are done (see regions.h).
+ * Contigs outside the regions are skipped and each region gets its own
+ * hts_itr_t, with its depths packed into the depth buffers end to end.
+ *
+ * Progress is counted from the index chunks each hts_itr_t covers and
+ * workers check for a cancel between contigs and every so often inside
+ * one. A cancelled parse leaves MR for the caller to destroy.
+ *
+ * With opts->consumer set each worker fills a single row of its own and
+ * hands each contig over as it finishes it, so contigs arrive out of order.
+ *
+ * With opts->chunk_size set (and no consumer) the work is cut finer: each
+ * contig's stretches are cut into chunks of that many bases and every BAM
+ * of every chunk is a task of its own, read through the index with a
+ * single BAM pileup. Workers start with balanced ranges of tasks and steal
+ * from each other once theirs run out (see taskQueue.h), so one deep
+ * contig no longer holds up the rest. A read spanning two chunks adds its
+ * depth to each chunk's own bases and is linked only by the chunk it starts
+ * in. Each chunk of a split contig fills a buffer of its own, and whoever
+ * finishes a BAM's last chunk stitches them together in order with
+ * appendDepthBuffer before adjustPlpBpColumn, so the outlier statistics are
+ * those of a whole contig pass. Coverage is the same as a serial parse and
+ * so is the set of links, though a chain's links may come in another order.
+ * The stitched chunks of a BAM are held until its last one is done, so
+ * peak memory grows with the chunks in flight.
+ */
+int parseCoverageAndLinksParallel(int numBams,
+                                  char* bamFiles[],
+                                  PM_parse_options * opts,
+                                  hts_tpool * pool,
+                                  PM_mapping_results * MR);
+
+/*!
+ * @abstract Split contigs into contiguous ranges of roughly equal work
+ *
+ * @param weights  amount of work for each contig
+ * @param numContigs  number of contigs
+ * @param numWorkers  number of ranges to make
+ * @param bounds  (numWorkers + 1) ints, worker w gets [bounds[w], bounds[w+1])
+ * @return void
+ */
+void partitionContigs(uint64_t * weights,
+                      int numContigs,
+                      int numWorkers,
+                      int * bounds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_PARALLEL_PARSER_H
@@ -0,0 +1,105 @@
+//#############################################################################
+//
+//   parseStats.c
+//
+//   Where a parse spent its time and why reads and bases were dropped
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+// local includes
+#include "parseStats.h"
+
+static const char * PM_TIMER_NAMES[PM_NUM_TIMERS] = {
+    "total", "setup", "pileup", "read (est.)", "links (est.)", "adjust", "merge"
+};
+
+uint64_t statsClock(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void initParseStats(PM_parse_stats * stats, int numBams)
+{
+    memset(stats, 0, sizeof(PM_parse_stats));
+    if(numBams > 0) {
+        stats->bytes_inflated = calloc(numBams, sizeof(uint64_t));
+        stats->num_bams = numBams;
+    }
+}
+
+void destroyParseStats(PM_parse_stats * stats)
+{
+    free(stats->bytes_inflated);
+    memset(stats, 0, sizeof(PM_parse_stats));
+}
+
+void addParseStats(PM_parse_stats * dest, PM_parse_stats * src, int bamOffset)
+{
+    uint32_t i = 0;
+    for(i = 0; i < PM_NUM_TIMERS; ++i) {
+        dest->timer_ns[i] += src->timer_ns[i];
+    }
+    dest->records_read += src->records_read;
+    dest->mapq_filtered += src->mapq_filtered;
+    dest->length_filtered += src->length_filtered;
+    dest->del_refskip_rejects += src->del_refskip_rejects;
+    dest->baseq_rejects += src->baseq_rejects;
+    dest->links_added += src->links_added;
+    dest->plp_bp_saturated += src->plp_bp_saturated;
+
+    if(src->num_bams == 0)
+        return;
+    if(bamOffset + src->num_bams > dest->num_bams) {
+        uint32_t num_bams = bamOffset + src->num_bams;
+        dest->bytes_inflated = realloc(dest->bytes_inflated, num_bams * sizeof(uint64_t));
+        memset(dest->bytes_inflated + dest->num_bams, 0, (num_bams - dest->num_bams) * sizeof(uint64_t));
+        dest->num_bams = num_bams;
+    }
+    for(i = 0; i < src->num_bams; ++i) {
+        dest->bytes_inflated[bamOffset + i] += src->bytes_inflated[i];
+    }
+}
+
+void printParseStats(PM_parse_stats * stats, char ** bamNames, FILE * fp)
+{
+    uint32_t i = 0;
+    fprintf(fp, "Timers (seconds):\n");
+    for(i = 0; i < PM_NUM_TIMERS; ++i) {
+        fprintf(fp, "  %-14s %.3f\n", PM_TIMER_NAMES[i], stats->timer_ns[i] * 1e-9);
+    }
+    fprintf(fp, "Records read:        %llu\n", (unsigned long long)stats->records_read);
+    fprintf(fp, "  mapQ filtered:     %llu\n", (unsigned long long)stats->mapq_filtered);
+    fprintf(fp, "  length filtered:   %llu\n", (unsigned long long)stats->length_filtered);
+    fprintf(fp, "Bases rejected:\n");
+    fprintf(fp, "  deletion/refskip:  %llu\n", (unsigned long long)stats->del_refskip_rejects);
+    fprintf(fp, "  low base quality:  %llu\n", (unsigned long long)stats->baseq_rejects);
+    fprintf(fp, "Links added:         %llu\n", (unsigned long long)stats->links_added);
+    fprintf(fp, "Saturated plp_bp:    %llu\n", (unsigned long long)stats->plp_bp_saturated);
+    fprintf(fp, "Bytes inflated:\n");
+    for(i = 0; i < stats->num_bams; ++i) {
+        fprintf(fp, "  %s\t%llu\n", bamNames ? bamNames[i] : "", (unsigned long long)stats->bytes_inflated[i]);
+    }
+}
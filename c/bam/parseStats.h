@@ -0,0 +1,141 @@
+//#############################################################################
+//
+//   parseStats.h
+//
+//   Where a parse spent its time and why reads and bases were dropped
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_PARSE_STATS_H
+  #define PM_PARSE_STATS_H
+
+// system includes
+#include <stdint.h>
+#include <stdio.h>
+
+// 1 in 2^PM_STATS_SAMPLE_SHIFT reads and links are timed, the rest are estimated
+#define PM_STATS_SAMPLE_SHIFT 6
+#define PM_STATS_SAMPLE_MASK ((1ULL << PM_STATS_SAMPLE_SHIFT) - 1)
+// bytes of a BAM record before its variable length data
+#define PM_BAM_CORE_BYTES 36
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract The stage timers of a parse, all in nanoseconds
+ @constant PM_TIMER_TOTAL wall time of the whole parse
+ @constant PM_TIMER_SETUP opening the BAMs, reading headers and indexes, init_MR
+ @constant PM_TIMER_PILEUP the pileup or CIGAR walk, including the three below
+ @constant PM_TIMER_READ inside read_bam: inflating and decoding records (sampled)
+ @constant PM_TIMER_LINKS inside addLink (sampled)
+ @constant PM_TIMER_ADJUST turning depths into counts in adjustPlpBp
+ @constant PM_TIMER_MERGE splicing worker links or merging cached results
+ @discussion With several contig workers every timer but PM_TIMER_TOTAL is
+ summed over the workers, so it can be more than the wall time.
+ */
+typedef enum {
+    PM_TIMER_TOTAL = 0,
+    PM_TIMER_SETUP,
+    PM_TIMER_PILEUP,
+    PM_TIMER_READ,
+    PM_TIMER_LINKS,
+    PM_TIMER_ADJUST,
+    PM_TIMER_MERGE,
+    PM_NUM_TIMERS
+} PM_stats_timer;
+
+/*! @typedef
+ @abstract Counters and timers filled in while parsing
+ @field timer_ns nanoseconds spent in each PM_stats_timer
+ @field records_read BAM records read
+ @field mapq_filtered records dropped by the mapQ filter in read_bam
+ @field length_filtered records dropped by the min_len filter in read_bam
+ @field del_refskip_rejects bases not counted because they were deletions or ref skips
+ @field baseq_rejects bases not counted because of low base quality
+ @field links_added links added to the link table
+ @field bytes_inflated uncompressed record bytes read from each BAM
+ @field num_bams length of bytes_inflated
+ @field plp_bp_saturated plp_bp cells clamped at UINT32_MAX because the count overflowed
+ */
+typedef struct {
+    uint64_t timer_ns[PM_NUM_TIMERS];
+    uint64_t records_read;
+    uint64_t mapq_filtered;
+    uint64_t length_filtered;
+    uint64_t del_refskip_rejects;
+    uint64_t baseq_rejects;
+    uint64_t links_added;
+    uint64_t * bytes_inflated;
+    uint32_t num_bams;
+    uint64_t plp_bp_saturated;
+} PM_parse_stats;
+
+/*!
+ * @abstract Read the monotonic clock
+ *
+ * @return nanoseconds since some fixed point
+ */
+uint64_t statsClock(void);
+
+/*!
+ * @abstract Zero a stats struct and make room for some BAMs
+ *
+ * @param  stats  stats to set up (anything it held is not freed)
+ * @param  numBams  number of BAMs parsed
+ * @return void
+ */
+void initParseStats(PM_parse_stats * stats, int numBams);
+
+/*!
+ * @abstract Free the per BAM counters of a stats struct
+ *
+ * @param  stats  stats to clean up (left zeroed)
+ * @return void
+ */
+void destroyParseStats(PM_parse_stats * stats);
+
+/*!
+ * @abstract Add one stats struct into another
+ *
+ * @param  dest  stats to add to, grown if it has too few BAMs
+ * @param  src  stats to add (unchanged)
+ * @param  bamOffset  BAM src's BAM 0 is in dest
+ * @return void
+ *
+ * @discussion Used to gather worker stats (bamOffset 0) and when merging
+ * mapping results (bamOffset is the number of BAMs already in dest).
+ */
+void addParseStats(PM_parse_stats * dest, PM_parse_stats * src, int bamOffset);
+
+/*!
+ * @abstract Print a stats struct
+ *
+ * @param  stats  stats to print
+ * @param  bamNames  names of the BAMs the stats cover
+ * @param  fp  stream to print to
+ * @return void
+ */
+void printParseStats(PM_parse_stats * stats, char ** bamNames, FILE * fp);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_PARSE_STATS_H
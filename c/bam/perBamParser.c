@@ -0,0 +1,366 @@
+//#############################################################################
+//
+//   perBamParser.c
+//
+//   Parse each BAM on its own, several at a time on worker threads
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+// local includes
+#include "perBamParser.h"
+#include "cigarDepth.h"
+#include "depthBuffer.h"
+
+static int reportBytes(PM_bam_shared * S, aux_t * aux, int tid, uint64_t * bytesDone)
+{
+    uint64_t bytes_now = 0;
+    if(S->progress == NULL || tid < 0)
+        return 0;
+    bytes_now = compressedBytesRead(&aux, 1);
+    if(updateProgress(S->progress, tid, bytes_now - *bytesDone, 0))
+        return 1;
+    *bytesDone = bytes_now;
+    return 0;
+}
+
+static void adjustColumn(PM_bam_worker * W, PM_depth_buffer * depth, int tid, int bamID)
+{
+    uint64_t start = statsClock();
+    adjustPlpBpColumn(W->shared->MR, depth, tid, bamID);
+    clearDepthBuffer(depth);
+    W->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - start;
+}
+
+static int readFailed(PM_bam_shared * S, int bamID)
+{
+    //-----
+    // a truncated or corrupt BAM, which is not the end of it
+    //
+    char str[1024];
+    snprintf(str, sizeof(str), "Could not read %s, it may be truncated", S->bam_files[bamID]);
+    printError(str, __LINE__);
+    return 1;
+}
+
+static int pileupBam(PM_bam_worker * W, aux_t * aux, PM_depth_buffer * depth)
+{
+    //-----
+    // a single BAM pileup over the whole file, adjusting as each contig ends
+    //
+    PM_bam_shared * S = W->shared;
+    PM_mapping_results * MR = S->MR;
+    PM_link_table * links = S->shards[aux->bam_ID];
+    uint8_t * seen = S->seen[aux->bam_ID];
+    const bam_pileup1_t * plp = NULL;
+    int tid = 0, pos = 0, n_plp = 0, prev_tid = -1, ret = 0;
+    uint32_t columns = 0;
+    uint64_t bytes_done = 0;
+    bam_plp_t iter = bam_plp_init(read_bam, aux);
+    while ((plp = bam_plp_auto(iter, &tid, &pos, &n_plp)) != NULL) {
+        if(tid != prev_tid) {
+            if(prev_tid != -1)
+                adjustColumn(W, depth, prev_tid, aux->bam_ID);
+            PM_SET_SEEN(seen, tid);
+            prev_tid = tid;
+            if(reportBytes(S, aux, tid, &bytes_done)) {
+                ret = PM_PARSE_CANCELLED;
+                break;
+            }
+        } else if (((++columns) & PM_PROGRESS_COLUMN_MASK) == 0 &&
+                   (PM_PROGRESS_IS_CANCELLED(S->progress) || reportBytes(S, aux, tid, &bytes_done))) {
+            ret = PM_PARSE_CANCELLED;
+            break;
+        }
+        if(pos >= MR->contig_lengths[tid]) continue; // read hangs off the end of the contig
+        countPileupBam(MR, links, &W->stats, depth, S->opts, aux->bam_ID, pos, n_plp, plp);
+    }
+    if(plp == NULL && n_plp < 0)
+        ret = readFailed(S, aux->bam_ID);
+    if(ret == 0 && prev_tid != -1)
+        adjustColumn(W, depth, prev_tid, aux->bam_ID);
+    clearDepthBuffer(depth);
+    bam_plp_destroy(iter);
+    if(ret == 0)
+        reportBytes(S, aux, prev_tid, &bytes_done);
+    return ret;
+}
+
+static int cigarBam(PM_bam_worker * W, aux_t * aux, PM_depth_buffer * depth, int32_t * diff)
+{
+    //-----
+    // walk the CIGAR of every read in the file, adjusting as each contig ends
+    //
+    PM_bam_shared * S = W->shared;
+    PM_mapping_results * MR = S->MR;
+    PM_link_table * links = S->shards[aux->bam_ID];
+    uint8_t * seen = S->seen[aux->bam_ID];
+    int prev_tid = -1, ret = 0, read_ret = 0;
+    uint32_t reads = 0;
+    uint64_t bytes_done = 0;
+    bam1_t * b = bam_init1();
+    while ((read_ret = read_bam(aux, b)) >= 0) {
+        int tid = b->core.tid;
+        if(tid < 0) break; // unmapped reads come last
+        if(tid != prev_tid) {
+            if(prev_tid != -1) {
+                diffToDepth(diff, depth, MR->contig_lengths[prev_tid]);
+                adjustColumn(W, depth, prev_tid, aux->bam_ID);
+            }
+            PM_SET_SEEN(seen, tid);
+            prev_tid = tid;
+            if(reportBytes(S, aux, tid, &bytes_done)) {
+                ret = PM_PARSE_CANCELLED;
+                break;
+            }
+        } else if (((++reads) & PM_PROGRESS_COLUMN_MASK) == 0 &&
+                   (PM_PROGRESS_IS_CANCELLED(S->progress) || reportBytes(S, aux, tid, &bytes_done))) {
+            ret = PM_PARSE_CANCELLED;
+            break;
+        }
+        countCigarRead(MR, links, &W->stats, S->opts, b, diff, aux->bam_ID);
+    }
+    if(read_ret < -1)
+        ret = readFailed(S, aux->bam_ID);
+    if(ret == 0 && prev_tid != -1) {
+        diffToDepth(diff, depth, MR->contig_lengths[prev_tid]);
+        adjustColumn(W, depth, prev_tid, aux->bam_ID);
+    } else if(prev_tid != -1) {
+        // leave the difference array clean for the next BAM
+        memset(diff, 0, ((size_t)MR->contig_lengths[prev_tid] + 1) * sizeof(int32_t));
+    }
+    clearDepthBuffer(depth);
+    bam_destroy1(b);
+    if(ret == 0)
+        reportBytes(S, aux, prev_tid, &bytes_done);
+    return ret;
+}
+
+static int parseOneBam(PM_bam_worker * W,
+                       int bamID,
+                       PM_depth_buffer * depth,
+                       int32_t * diff)
+{
+    PM_bam_shared * S = W->shared;
+    PM_mapping_results * MR = S->MR;
+    aux_t aux;
+    int ret = 0;
+    uint64_t start = statsClock();
+
+    memset(&aux, 0, sizeof(aux_t));
+    aux.fp = bgzf_open(S->bam_files[bamID], "r");
+    if(aux.fp == NULL) {
+        char str[512];
+        snprintf(str, sizeof(str), "Could not open %s", S->bam_files[bamID]);
+        printError(str, __LINE__);
+        return 1;
+    }
+    if(S->pool) bgzf_thread_pool(aux.fp, S->pool, 0);
+    aux.min_mapQ = S->opts->mapQ;
+    aux.min_len  = S->opts->min_len;
+    aux.stats = &W->stats;
+    aux.bam_ID = bamID;
+    bam_hdr_destroy(bam_hdr_read(aux.fp)); // the first BAM's header is the one in MR
+    if(MR->is_links_included)
+        S->shards[bamID] = createLinkTable(MR->num_contigs);
+    S->seen[bamID] = calloc(((size_t)MR->num_contigs + 7) / 8, 1);
+    W->stats.timer_ns[PM_TIMER_SETUP] += statsClock() - start;
+
+    start = statsClock();
+    if(PM_USE_CIGAR_ENGINE(S->opts))
+        ret = cigarBam(W, &aux, depth, diff);
+    else
+        ret = pileupBam(W, &aux, depth);
+    W->stats.timer_ns[PM_TIMER_PILEUP] += statsClock() - start;
+
+    bgzf_close(aux.fp);
+    return ret;
+}
+
+static void * bamWorker(void * arg)
+{
+    PM_bam_worker * W = (PM_bam_worker *)arg;
+    PM_bam_shared * S = W->shared;
+    PM_mapping_results * MR = S->MR;
+    int use_cigars = PM_USE_CIGAR_ENGINE(S->opts);
+    int bam = 0, tid = 0;
+    uint32_t longest = 0;
+    for(tid = 0; tid < MR->num_contigs; ++tid) {
+        if(MR->contig_lengths[tid] > longest)
+            longest = MR->contig_lengths[tid];
+    }
+    // a single buffer, reused for every contig of every BAM we do
+    PM_depth_buffers * depths = createDepthBuffers(1, longest, PM_COVERAGE_USES_HISTOGRAM(MR->is_outlier_coverage));
+    int32_t * diff = use_cigars ? calloc((size_t)longest + 1, sizeof(int32_t)) : NULL;
+    while(W->status == 0) {
+        bam = __atomic_fetch_add(&S->next_bam, 1, __ATOMIC_RELAXED);
+        if(bam >= S->num_bams)
+            break;
+        W->status = parseOneBam(W, bam, &depths->buffers[0], diff);
+    }
+    free(diff);
+    destroyDepthBuffers(depths);
+    return NULL;
+}
+
+static void adjustUnseen(PM_bam_shared * S)
+{
+    //-----
+    // the multi-pileup adjusts every BAM on a contig any BAM has reads on,
+    // which gives an empty one non-zero correctors in the histogram modes
+    //
+    PM_mapping_results * MR = S->MR;
+    size_t bytes = ((size_t)MR->num_contigs + 7) / 8;
+    uint8_t * any = calloc(bytes, 1);
+    PM_depth_buffers * empty = createDepthBuffers(1, 0, PM_COVERAGE_USES_HISTOGRAM(MR->is_outlier_coverage));
+    size_t k = 0;
+    int i = 0, tid = 0;
+    for(i = 0; i < S->num_bams; ++i) {
+        for(k = 0; k < bytes; ++k) {
+            any[k] |= S->seen[i][k];
+        }
+    }
+    for(k = 0; S->opts->seen_contigs != NULL && k < bytes; ++k) {
+        S->opts->seen_contigs[k] |= any[k];
+    }
+    for(tid = 0; tid < MR->num_contigs; ++tid) {
+        if(!PM_SEEN(any, tid))
+            continue;
+        for(i = 0; i < S->num_bams; ++i) {
+            if(!PM_SEEN(S->seen[i], tid)) {
+                adjustPlpBpColumn(MR, &empty->buffers[0], tid, i);
+                clearDepthBuffer(&empty->buffers[0]);
+            }
+        }
+    }
+    destroyDepthBuffers(empty);
+    free(any);
+}
+
+int parseCoverageAndLinksPerBam(int numBams,
+                                char* bamFiles[],
+                                PM_parse_options * opts,
+                                hts_tpool * pool,
+                                PM_mapping_results * MR)
+{
+    int i = 0, w = 0, ret = 0;
+    uint64_t start = statsClock();
+
+    // we only need the header from the first BAM
+    BGZF * fp = bgzf_open(bamFiles[0], "r");
+    if(fp == NULL)
+        return 1;
+    bam_hdr_t * h = bam_hdr_read(fp);
+    bgzf_close(fp);
+    init_MR(MR,
+            h,
+            numBams,
+            bamFiles,
+            opts->do_links,
+            opts->do_outlier_coverage,
+            opts->ignore_supps
+           );
+    MR->coverage_lower = opts->coverage_lower;
+    MR->coverage_upper = opts->coverage_upper;
+    bam_hdr_destroy(h);
+    MR->stats.timer_ns[PM_TIMER_SETUP] += statsClock() - start;
+
+    //-----
+    // off they go, each taking the next BAM until there are none left
+    //
+    PM_bam_shared shared;
+    memset(&shared, 0, sizeof(PM_bam_shared));
+    shared.num_bams = numBams;
+    shared.bam_files = bamFiles;
+    shared.opts = opts;
+    shared.pool = pool;
+    shared.MR = MR;
+    shared.shards = calloc(numBams, sizeof(PM_link_table*));
+    shared.seen = calloc(numBams, sizeof(uint8_t*));
+
+    PM_progress_tracker tracker;
+    if(opts->progress != NULL) {
+        initProgress(&tracker, opts->progress, opts->progress_data, opts->progress_contigs,
+                     opts->progress_mb, numBams, bamFiles, MR->num_contigs);
+        shared.progress = &tracker;
+    }
+
+    int num_workers = opts->num_bam_workers;
+    if(num_workers < 1)
+        num_workers = 1;
+    if(num_workers > numBams)
+        num_workers = numBams;
+    PM_bam_worker * workers = calloc(num_workers, sizeof(PM_bam_worker));
+    pthread_t * threads = calloc(num_workers, sizeof(pthread_t));
+    int * joinable = calloc(num_workers, sizeof(int));
+    for(w = 0; w < num_workers; ++w) {
+        workers[w].shared = &shared;
+        initParseStats(&workers[w].stats, numBams);
+        if(pthread_create(&threads[w], NULL, bamWorker, &workers[w]) == 0) {
+            joinable[w] = 1;
+        } else {
+            // take BAMs here instead
+            bamWorker(&workers[w]);
+        }
+    }
+    for(w = 0; w < num_workers; ++w) {
+        if(joinable[w])
+            pthread_join(threads[w], NULL);
+        if(workers[w].status == PM_PARSE_CANCELLED) {
+            ret = PM_PARSE_CANCELLED;
+        } else if(workers[w].status != 0 && ret != PM_PARSE_CANCELLED) {
+            char str[80];
+            sprintf(str, "BAM worker %d failed", w);
+            printError(str, __LINE__);
+            ret = 1;
+        }
+    }
+
+    //-----
+    // links go in BAM order, relinking chunks rather than copying links
+    //
+    start = statsClock();
+    if(ret == 0)
+        adjustUnseen(&shared);
+    for(i = 0; i < numBams; ++i) {
+        if(shared.shards[i] != NULL) {
+            spliceLinks(MR->links, shared.shards[i]);
+            destroyLinks(shared.shards[i]);
+        }
+        free(shared.seen[i]);
+    }
+    for(w = 0; w < num_workers; ++w) {
+        addParseStats(&MR->stats, &workers[w].stats, 0);
+        destroyParseStats(&workers[w].stats);
+    }
+    MR->stats.timer_ns[PM_TIMER_MERGE] += statsClock() - start;
+
+    if(ret == 0 && shared.progress != NULL)
+        updateProgress(shared.progress, MR->num_contigs - 1, 0, MR->num_contigs);
+    destroyProgress(shared.progress);
+    free(joinable);
+    free(threads);
+    free(workers);
+    free(shared.shards);
+    free(shared.seen);
+    return ret;
+}
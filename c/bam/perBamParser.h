@@ -0,0 +1,116 @@
+//#############################################################################
+//
+//   perBamParser.h
+//
+//   Parse each BAM on its own, several at a time on worker threads
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_PER_BAM_PARSER_H
+  #define PM_PER_BAM_PARSER_H
+
+// system includes
+#include <stdint.h>
+#include <pthread.h>
+
+// htslib
+#include "htslib/sam.h"
+#include "htslib/thread_pool.h"
+
+// local includes
+#include "bamParser.h"
+#include "pairedLink.h"
+#include "parseStats.h"
+#include "progress.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract State shared by all the BAM workers
+ @field num_bams number of BAM files to parse
+ @field bam_files filenames of BAM files to parse
+ @field opts settings to parse with
+ @field pool BGZF decompression threads (NULL for none)
+ @field MR mapping results struct, each BAM writes only its own column
+ @field progress where the workers report progress (NULL for nowhere)
+ @field next_bam next BAM nobody has started on
+ @field shards links found in each BAM, spliced together in BAM order at the end
+ @field seen bit per contig for each BAM, set if the BAM has any reads there
+ */
+typedef struct {
+    int num_bams;
+    char ** bam_files;
+    PM_parse_options * opts;
+    hts_tpool * pool;
+    PM_mapping_results * MR;
+    PM_progress_tracker * progress;
+    int next_bam;
+    PM_link_table ** shards;
+    uint8_t ** seen;
+} PM_bam_shared;
+
+/*! @typedef
+ @abstract A single BAM worker
+ @field shared state shared by all the workers
+ @field stats counters and timers of this worker, added to MR's at the end
+ @field status 0 on success
+ */
+typedef struct {
+    PM_bam_shared * shared;
+    PM_parse_stats stats;
+    int status;
+} PM_bam_worker;
+
+/*!
+ * @abstract Parse the BAM files one at a time each, several at once
+ *
+ * @param numBams  number of BAM files to parse
+ * @param bamFiles  filenames of BAM files to parse
+ * @param opts  settings to parse with, opts->num_bam_workers threads are used
+ * @param pool  BGZF decompression threads shared by all workers (may be NULL)
+ * @param MR  mapping results struct to write to
+ * @return 0 for success, PM_PARSE_CANCELLED if opts->progress asked to stop
+ *
+ * @discussion Rather than a multi-pileup walking every BAM in lock step,
+ * each worker takes the next BAM nobody has started, runs a single BAM
+ * pileup (or CIGAR walk) over the whole file and moves on. A deep BAM no
+ * longer holds up shallow ones and only one file per worker is open at
+ * once. Each BAM adjusts its own column of MR as it finishes each contig
+ * and keeps its links in a shard of its own. The shards are spliced
+ * together in BAM order at the end, which relinks the chunks of each
+ * contig pair and never copies a link.
+ *
+ * A contig some BAMs have reads on and others don't is still adjusted for
+ * every BAM, as in the multi-pileup, so coverage is the same as a serial
+ * parse. So is the set of links, though a chain's links come BAM by BAM
+ * rather than column by column. Progress counts bytes as the workers go
+ * and contigs only once every BAM is done. No index is needed.
+ */
+int parseCoverageAndLinksPerBam(int numBams,
+                                char* bamFiles[],
+                                PM_parse_options * opts,
+                                hts_tpool * pool,
+                                PM_mapping_results * MR);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_PER_BAM_PARSER_H
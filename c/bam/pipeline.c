@@ -0,0 +1,333 @@
+//#############################################################################
+//
+//   pipeline.c
+//
+//   Decode, pileup and contig finalisation as stages on their own threads
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+// local includes
+#include "pipeline.h"
+#include "pmTrace.h"
+
+// waits spin this many times, then yield this many more, then block
+#define PM_RING_SPINS 64
+#define PM_RING_YIELDS 256
+
+static int ringReady(PM_ring * ring, int forWrite)
+{
+    // each side only needs an acquire on the index the other side moves
+    if(forWrite)
+        return (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) <= ring->mask);
+    return (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) != ring->tail);
+}
+
+static int ringStopped(PM_ring * ring)
+{
+    return (ring->stop != NULL && __atomic_load_n(ring->stop, __ATOMIC_ACQUIRE));
+}
+
+static void ringSleep(PM_ring * ring, int forWrite)
+{
+    //-----
+    // say we are asleep before the last look, and a publish looks for
+    // sleepers after moving its index, so one of the two always sees the other
+    //
+    pthread_mutex_lock(&ring->lock);
+    __atomic_add_fetch(&ring->sleepers, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(!ringReady(ring, forWrite) && !ringStopped(ring))
+        pthread_cond_wait(&ring->wake, &ring->lock);
+    __atomic_sub_fetch(&ring->sleepers, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+static long ringWait(PM_ring * ring, int forWrite)
+{
+    int waits = 0;
+    while(!ringReady(ring, forWrite)) {
+        if(ringStopped(ring))
+            return -1;
+        if(waits < PM_RING_SPINS) {
+            ++waits;
+        } else if(waits < PM_RING_SPINS + PM_RING_YIELDS) {
+            ++waits;
+            sched_yield();
+        } else {
+            ringSleep(ring, forWrite);
+        }
+    }
+    return (long)((forWrite ? ring->head : ring->tail) & ring->mask);
+}
+
+static void ringPublish(PM_ring * ring, size_t * index)
+{
+    __atomic_store_n(index, *index + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if(__atomic_load_n(&ring->sleepers, __ATOMIC_RELAXED) != 0)
+        ringWake(ring);
+}
+
+void initRing(PM_ring * ring, size_t capacity, volatile int * stop)
+{
+    ring->mask = capacity - 1;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->stop = stop;
+    ring->sleepers = 0;
+    pthread_mutex_init(&ring->lock, NULL);
+    pthread_cond_init(&ring->wake, NULL);
+}
+
+void destroyRing(PM_ring * ring)
+{
+    pthread_mutex_destroy(&ring->lock);
+    pthread_cond_destroy(&ring->wake);
+}
+
+void ringWake(PM_ring * ring)
+{
+    pthread_mutex_lock(&ring->lock);
+    pthread_cond_broadcast(&ring->wake);
+    pthread_mutex_unlock(&ring->lock);
+}
+
+long ringWaitWrite(PM_ring * ring)
+{
+    return ringWait(ring, 1);
+}
+
+void ringPublishWrite(PM_ring * ring)
+{
+    ringPublish(ring, &ring->head);
+}
+
+long ringWaitRead(PM_ring * ring)
+{
+    return ringWait(ring, 0);
+}
+
+void ringPublishRead(PM_ring * ring)
+{
+    ringPublish(ring, &ring->tail);
+}
+
+    /***********************
+    ***   READ AHEAD     ***
+    ***********************/
+static void * readAheadThread(void * arg)
+{
+    PM_read_ahead * ahead = (PM_read_ahead *)arg;
+    long slot = 0;
+    int ret = 0;
+    do {
+        slot = ringWaitWrite(&ahead->ring);
+        if(slot < 0)
+            break; // the pileup has gone
+        ret = read_bam(&ahead->reader, ahead->records[slot]);
+        ahead->rets[slot] = ret;
+        __atomic_store_n(&ahead->bytes_read, (uint64_t)bgzf_tell(ahead->reader.fp) >> 16, __ATOMIC_RELAXED);
+        ringPublishWrite(&ahead->ring);
+    } while(ret >= 0);
+    return NULL;
+}
+
+int startReadAhead(aux_t * aux, int numRecords, int numBams)
+{
+    size_t capacity = 1;
+    int i = 0;
+    PM_read_ahead * ahead = calloc(1, sizeof(PM_read_ahead));
+    while(capacity < (size_t)numRecords)
+        capacity <<= 1;
+    ahead->reader = *aux;
+    ahead->reader.ahead = NULL;
+    ahead->reader.stats = &ahead->stats;
+    initParseStats(&ahead->stats, numBams);
+    initRing(&ahead->ring, capacity, &ahead->stop);
+    ahead->records = calloc(capacity, sizeof(bam1_t*));
+    ahead->rets = calloc(capacity, sizeof(int));
+    for(i = 0; i < (int)capacity; ++i) {
+        ahead->records[i] = bam_init1();
+    }
+    if(pthread_create(&ahead->thread, NULL, readAheadThread, ahead) != 0) {
+        for(i = 0; i < (int)capacity; ++i) {
+            bam_destroy1(ahead->records[i]);
+        }
+        free(ahead->records);
+        free(ahead->rets);
+        destroyRing(&ahead->ring);
+        destroyParseStats(&ahead->stats);
+        free(ahead);
+        return 1;
+    }
+    aux->ahead = ahead;
+    return 0;
+}
+
+int readAhead(PM_read_ahead * ahead, bam1_t * b)
+{
+    long slot = 0;
+    int ret = 0;
+    bam1_t tmp;
+    if(ahead->last_ret < 0)
+        return ahead->last_ret; // nothing comes after the end
+    slot = ringWaitRead(&ahead->ring);
+    // swap rather than copy, the thread reads its next record into our old one
+    tmp = *b;
+    *b = *ahead->records[slot];
+    *ahead->records[slot] = tmp;
+    ret = ahead->rets[slot];
+    if(ret < 0)
+        ahead->last_ret = ret;
+    // the slot is the thread's again after this
+    ringPublishRead(&ahead->ring);
+    return ret;
+}
+
+uint64_t readAheadBytes(PM_read_ahead * ahead)
+{
+    return __atomic_load_n(&ahead->bytes_read, __ATOMIC_RELAXED);
+}
+
+void stopReadAhead(aux_t * aux, PM_parse_stats * stats)
+{
+    PM_read_ahead * ahead = aux->ahead;
+    size_t i = 0;
+    if(ahead == NULL)
+        return;
+    __atomic_store_n(&ahead->stop, 1, __ATOMIC_RELEASE);
+    ringWake(&ahead->ring); // it may be blocked on a full ring
+    pthread_join(ahead->thread, NULL);
+    addParseStats(stats, &ahead->stats, 0);
+    destroyParseStats(&ahead->stats);
+    for(i = 0; i <= ahead->ring.mask; ++i) {
+        bam_destroy1(ahead->records[i]);
+    }
+    free(ahead->records);
+    free(ahead->rets);
+    destroyRing(&ahead->ring);
+    free(ahead);
+    aux->ahead = NULL;
+}
+
+    /***********************
+    ***   FINALISERS     ***
+    ***********************/
+static void * finaliserThread(void * arg)
+{
+    PM_finaliser * F = (PM_finaliser *)arg;
+    PM_mapping_results * MR = F->MR;
+    while(1) {
+        long slot = ringWaitRead(&F->todo);
+        PM_finished_contig job = F->todo_slots[slot];
+        ringPublishRead(&F->todo);
+        if(job.tid < 0)
+            break;
+        uint64_t start = statsClock();
+        adjustPlpBp(MR, job.depths, job.tid);
+        clearDepthBuffers(job.depths);
+        F->adjust_ns += statsClock() - start;
+        PM_TRACE3(contig_end, job.tid, PM_MR_LENGTH(MR, job.tid), contigPlpSum(MR, job.tid));
+        // there is always room, the pileup takes one back for each it hands over
+        slot = ringWaitWrite(&F->done);
+        F->done_slots[slot] = job.depths;
+        ringPublishWrite(&F->done);
+    }
+    return NULL;
+}
+
+void startFinalisers(PM_finaliser_pool * pool,
+                     PM_mapping_results * MR,
+                     int numFinalisers,
+                     uint32_t longest,
+                     int useHistograms)
+{
+    int i = 0;
+    long slot = 0;
+    pool->finalisers = calloc(numFinalisers, sizeof(PM_finaliser));
+    pool->num_finalisers = 0;
+    pool->next = 0;
+    for(i = 0; i < numFinalisers; ++i) {
+        PM_finaliser * F = &pool->finalisers[pool->num_finalisers];
+        F->MR = MR;
+        initRing(&F->todo, PM_FINALISER_SLOTS, NULL);
+        initRing(&F->done, PM_FINALISER_SLOTS, NULL);
+        // the spare set the pileup takes the first time it hands a contig over
+        slot = ringWaitWrite(&F->done);
+        F->done_slots[slot] = createDepthBuffers(MR->num_bams, longest, useHistograms);
+        ringPublishWrite(&F->done);
+        if(pthread_create(&F->thread, NULL, finaliserThread, F) != 0) {
+            destroyDepthBuffers(F->done_slots[slot]);
+            destroyRing(&F->todo);
+            destroyRing(&F->done);
+            break;
+        }
+        ++pool->num_finalisers;
+    }
+}
+
+PM_depth_buffers * finaliseContig(PM_finaliser_pool * pool, PM_depth_buffers * depths, int tid)
+{
+    PM_finaliser * F = &pool->finalisers[pool->next];
+    PM_depth_buffers * ret = NULL;
+    long slot = 0;
+    pool->next = (pool->next + 1) % pool->num_finalisers;
+
+    slot = ringWaitWrite(&F->todo);
+    F->todo_slots[slot].tid = tid;
+    F->todo_slots[slot].depths = depths;
+    ringPublishWrite(&F->todo);
+
+    slot = ringWaitRead(&F->done);
+    ret = F->done_slots[slot];
+    ringPublishRead(&F->done);
+    return ret;
+}
+
+void stopFinalisers(PM_finaliser_pool * pool, PM_parse_stats * stats)
+{
+    int i = 0;
+    long slot = 0;
+    for(i = 0; i < pool->num_finalisers; ++i) {
+        PM_finaliser * F = &pool->finalisers[i];
+        slot = ringWaitWrite(&F->todo);
+        F->todo_slots[slot].tid = -1;
+        F->todo_slots[slot].depths = NULL;
+        ringPublishWrite(&F->todo);
+    }
+    for(i = 0; i < pool->num_finalisers; ++i) {
+        PM_finaliser * F = &pool->finalisers[i];
+        pthread_join(F->thread, NULL);
+        // whatever the pileup didn't take back
+        while(F->done.tail != F->done.head) {
+            destroyDepthBuffers(F->done_slots[F->done.tail & F->done.mask]);
+            ++F->done.tail;
+        }
+        stats->timer_ns[PM_TIMER_ADJUST] += F->adjust_ns;
+        destroyRing(&F->todo);
+        destroyRing(&F->done);
+    }
+    free(pool->finalisers);
+    pool->finalisers = NULL;
+    pool->num_finalisers = 0;
+}
@@ -0,0 +1,283 @@
+//#############################################################################
+//
+//   pipeline.h
+//
+//   Decode, pileup and contig finalisation as stages on their own threads
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_PIPELINE_H
+  #define PM_PIPELINE_H
+
+// system includes
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+// htslib
+#include "htslib/sam.h"
+
+// local includes
+#include "bamParser.h"
+#include "depthBuffer.h"
+#include "parseStats.h"
+
+// slots between the pileup and each finaliser, one contig in hand and one done
+#define PM_FINALISER_SLOTS 2
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract Lock-free ring of slot indices between one producer and one consumer
+ @field mask capacity - 1, the capacity is a power of two
+ @field head slots written so far (only the producer stores it)
+ @field tail slots read so far (only the consumer stores it)
+ @field stop if set and non-zero the waits give up (NULL to always wait)
+ @field sleepers waits blocked on wake, publishing only locks when there are some
+ @field lock guards the blocking part of a wait
+ @field wake signalled by a publish (or ringWake) while someone sleeps
+ @discussion The slots themselves live with the caller, the ring only says
+ which one to use next. A waiting side spins for a bit, then yields, then
+ blocks until the other side publishes, so a stalled stage doesn't burn a
+ core and wakes as soon as there is work.
+ */
+typedef struct {
+    size_t mask;
+    size_t head;
+    size_t tail;
+    volatile int * stop;
+    int sleepers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} PM_ring;
+
+/*! @typedef
+ @abstract A thread reading and filtering records from one BAM ahead of the pileup
+ @field reader copy of the BAM's aux_t used by the thread, with its own stats
+ @field ring records ready for the pileup
+ @field records ring slots, swapped with the pileup's records as they are taken
+ @field rets what read_bam returned for each slot
+ @field stats counters of the thread, added to the parse's when it stops
+ @field bytes_read compressed offset the thread has reached, for progress
+ @field last_ret read_bam's value once the end has been taken (0 before)
+ @field stop tells the thread to give up early
+ @field thread the thread
+ */
+typedef struct PM_read_ahead {
+    aux_t reader;
+    PM_ring ring;
+    bam1_t ** records;
+    int * rets;
+    PM_parse_stats stats;
+    uint64_t bytes_read;
+    int last_ret;
+    volatile int stop;
+    pthread_t thread;
+} PM_read_ahead;
+
+/*! @typedef
+ @abstract A contig waiting to be finalised
+ @field tid contig the depths belong to (-1 tells the finaliser to exit)
+ @field depths pileup depths along the contig, one buffer per BAM
+ */
+typedef struct {
+    int tid;
+    PM_depth_buffers * depths;
+} PM_finished_contig;
+
+/*! @typedef
+ @abstract A thread running adjustPlpBp on contigs the pileup has finished
+ @field MR mapping results struct the rows are written to
+ @field todo contigs handed over by the pileup
+ @field done depth buffers cleared and ready to go back to the pileup
+ @field todo_slots slots of todo
+ @field done_slots slots of done
+ @field adjust_ns time spent adjusting, added to the parse's at the end
+ @field thread the thread
+ */
+typedef struct {
+    PM_mapping_results * MR;
+    PM_ring todo;
+    PM_ring done;
+    PM_finished_contig todo_slots[PM_FINALISER_SLOTS];
+    PM_depth_buffers * done_slots[PM_FINALISER_SLOTS];
+    uint64_t adjust_ns;
+    pthread_t thread;
+} PM_finaliser;
+
+/*! @typedef
+ @abstract Finalisers shared out round robin by the pileup
+ @field num_finalisers number of threads running (0 to finalise inline)
+ @field finalisers the threads
+ @field next finaliser to hand the next contig to
+ */
+typedef struct {
+    int num_finalisers;
+    PM_finaliser * finalisers;
+    int next;
+} PM_finaliser_pool;
+
+/*!
+ * @abstract Set up a ring
+ *
+ * @param  ring  ring to set up
+ * @param  capacity  slots in the ring, must be a power of two
+ * @param  stop  waits give up once this is non-zero (NULL for never)
+ * @return void
+ */
+void initRing(PM_ring * ring, size_t capacity, volatile int * stop);
+
+/*!
+ * @abstract Free what initRing set up
+ *
+ * @param  ring  ring nobody is waiting on any more
+ * @return void
+ */
+void destroyRing(PM_ring * ring);
+
+/*!
+ * @abstract Wake anyone blocked on a ring so they look at its stop flag
+ *
+ * @param  ring  ring whose stop flag has just been set
+ * @return void
+ */
+void ringWake(PM_ring * ring);
+
+/*!
+ * @abstract Wait for a free slot to write
+ *
+ * @param  ring  ring to write to (producer only)
+ * @return slot index, or -1 if told to stop
+ */
+long ringWaitWrite(PM_ring * ring);
+
+/*!
+ * @abstract Make the slot from ringWaitWrite visible to the consumer
+ *
+ * @param  ring  ring written to
+ * @return void
+ */
+void ringPublishWrite(PM_ring * ring);
+
+/*!
+ * @abstract Wait for a written slot to read
+ *
+ * @param  ring  ring to read from (consumer only)
+ * @return slot index, or -1 if told to stop
+ */
+long ringWaitRead(PM_ring * ring);
+
+/*!
+ * @abstract Give the slot from ringWaitRead back to the producer
+ *
+ * @param  ring  ring read from
+ * @return void
+ */
+void ringPublishRead(PM_ring * ring);
+
+/*!
+ * @abstract Start reading and filtering a BAM on a thread of its own
+ *
+ * @param  aux  reader the pileup uses, positioned after the header
+ * @param  numRecords  records to read ahead (rounded up to a power of two)
+ * @param  numBams  number of BAMs, to size the thread's stats
+ * @return 0 for success, 1 if the thread could not start (aux reads inline)
+ *
+ * @discussion From here on read_bam(aux) takes records from the thread, and
+ * nothing else may touch aux->fp until stopReadAhead.
+ */
+int startReadAhead(aux_t * aux, int numRecords, int numBams);
+
+/*!
+ * @abstract Take the next record read by the thread
+ *
+ * @param  ahead  thread to take from
+ * @param  b  record to fill, its old contents go back to the thread
+ * @return what read_bam returned for the record
+ */
+int readAhead(PM_read_ahead * ahead, bam1_t * b);
+
+/*!
+ * @abstract Compressed bytes a read ahead thread has got through
+ *
+ * @param  ahead  thread to ask
+ * @return the compressed offset it has reached
+ */
+uint64_t readAheadBytes(PM_read_ahead * ahead);
+
+/*!
+ * @abstract Stop a read ahead thread and go back to reading inline
+ *
+ * @param  aux  reader passed to startReadAhead (nothing happens if it has no thread)
+ * @param  stats  counters to add the thread's to
+ * @return void
+ */
+void stopReadAhead(aux_t * aux, PM_parse_stats * stats);
+
+/*!
+ * @abstract Start threads to finalise contigs while the pileup carries on
+ *
+ * @param  pool  pool to set up
+ * @param  MR  mapping results struct the rows are written to
+ * @param  numFinalisers  number of threads to start
+ * @param  longest  longest contig, to size the spare depth buffers
+ * @param  useHistograms  give the spare depth buffers histograms
+ * @return void
+ *
+ * @discussion Each thread gets a spare set of depth buffers, so the memory
+ * used grows by one set per thread. If no thread starts pool->num_finalisers
+ * is 0 and contigs should be finalised inline.
+ */
+void startFinalisers(PM_finaliser_pool * pool,
+                     PM_mapping_results * MR,
+                     int numFinalisers,
+                     uint32_t longest,
+                     int useHistograms);
+
+/*!
+ * @abstract Hand a contig to the next finaliser
+ *
+ * @param  pool  finalisers started with startFinalisers
+ * @param  depths  pileup depths along the contig, now owned by the finaliser
+ * @param  tid  contig the depths belong to
+ * @return cleared depth buffers to fill with the next contig
+ *
+ * @discussion Waits only if that finaliser is still busy with the contig it
+ * was given last time round.
+ */
+PM_depth_buffers * finaliseContig(PM_finaliser_pool * pool, PM_depth_buffers * depths, int tid);
+
+/*!
+ * @abstract Wait for every handed over contig to be finalised and stop the threads
+ *
+ * @param  pool  finalisers started with startFinalisers
+ * @param  stats  counters to add the time spent adjusting to
+ * @return void
+ *
+ * @discussion Depth buffers still held by the pool are destroyed, the ones
+ * returned by finaliseContig are the caller's to destroy.
+ */
+void stopFinalisers(PM_finaliser_pool * pool, PM_parse_stats * stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_PIPELINE_H
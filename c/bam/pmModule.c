@@ -0,0 +1,637 @@
+//#############################################################################
+//
+//   pmModule.c
+//
+//   Native Python module (parsem._pmbam) around the BAM parser
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// Python first, it may change how the system headers behave
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+
+// local includes
+#include "bamParser.h"
+#include "progress.h"
+#include "resultsFile.h"
+
+#if PY_MAJOR_VERSION >= 3
+  #define PM_PY_STRING(str) PyUnicode_DecodeFSDefault(str)
+#else
+  #define PM_PY_STRING(str) PyString_FromString(str)
+#endif
+
+static PyObject * PMCancelledError = NULL;
+
+/*! @typedef
+ @abstract A PM_mapping_results owned by Python
+ @field MR the results, freed with the object
+ @field busy set while a call is running without the GIL
+ */
+typedef struct {
+    PyObject_HEAD
+    PM_mapping_results * MR;
+    int busy;
+} PMMappingResults;
+
+static PyTypeObject PMMappingResultsType;
+
+/*! @typedef
+ @abstract Everything one parse call needs, including what keeps its strings alive
+ @field opts settings to parse with
+ @field bam_files filenames of the BAMs
+ @field num_bams number of BAMs
+ @field holders Python objects owning the strings in bam_files and opts
+ @field progress Python callable for progress (borrowed, NULL for none)
+ @field error_type exception raised by progress (with error_value and error_tb)
+ */
+typedef struct {
+    PM_parse_options opts;
+    char ** bam_files;
+    int num_bams;
+    PyObject * holders;
+    PyObject * progress;
+    PyObject * error_type;
+    PyObject * error_value;
+    PyObject * error_tb;
+} PM_py_parse;
+
+static int fsPath(PyObject * obj, PyObject * holders, char ** path)
+{
+    //-----
+    // a char * for a str/bytes/path which lives as long as holders
+    //
+    PyObject * bytes = NULL;
+#if PY_MAJOR_VERSION >= 3
+    if(!PyUnicode_FSConverter(obj, &bytes))
+        return -1;
+#else
+    if(PyUnicode_Check(obj))
+        bytes = PyUnicode_AsEncodedString(obj, Py_FileSystemDefaultEncoding, "strict");
+    else if(PyString_Check(obj)) {
+        bytes = obj;
+        Py_INCREF(bytes);
+    } else
+        PyErr_SetString(PyExc_TypeError, "expected a path");
+    if(bytes == NULL)
+        return -1;
+#endif
+    if(PyList_Append(holders, bytes) != 0) {
+        Py_DECREF(bytes);
+        return -1;
+    }
+    *path = PyBytes_AS_STRING(bytes);
+    Py_DECREF(bytes);
+    return 0;
+}
+
+static int pathList(PyObject * obj, PyObject * holders, char *** paths, int * num)
+{
+    PyObject * seq = PySequence_Fast(obj, "expected a list of paths");
+    Py_ssize_t i = 0, n = 0;
+    if(seq == NULL)
+        return -1;
+    n = PySequence_Fast_GET_SIZE(seq);
+    *paths = calloc(n ? n : 1, sizeof(char*));
+    *num = (int)n;
+    for(i = 0; i < n; ++i) {
+        if(fsPath(PySequence_Fast_GET_ITEM(seq, i), holders, &(*paths)[i]) != 0) {
+            Py_DECREF(seq);
+            return -1;
+        }
+    }
+    Py_DECREF(seq);
+    return 0;
+}
+
+static int progressTrampoline(PM_progress * P, void * userData)
+{
+    //-----
+    // called from C threads, so take the GIL before going back into Python
+    //
+    PM_py_parse * parse = (PM_py_parse *)userData;
+    PyGILState_STATE state = PyGILState_Ensure();
+    int cancel = 0;
+    PyObject * ret = PyObject_CallFunction(parse->progress, "{s:K,s:K,s:i,s:i,s:i,s:d,s:d}",
+                                           "bytes_read", (unsigned long long)P->bytes_read,
+                                           "bytes_total", (unsigned long long)P->bytes_total,
+                                           "tid", P->tid,
+                                           "contigs_done", P->contigs_done,
+                                           "num_contigs", P->num_contigs,
+                                           "elapsed", P->elapsed,
+                                           "eta", P->eta);
+    if(ret == NULL) {
+        // keep it for when the parse returns
+        PyErr_Fetch(&parse->error_type, &parse->error_value, &parse->error_tb);
+        cancel = 1;
+    } else {
+        cancel = PyObject_IsTrue(ret);
+        if(cancel < 0) {
+            PyErr_Fetch(&parse->error_type, &parse->error_value, &parse->error_tb);
+            cancel = 1;
+        }
+        Py_DECREF(ret);
+    }
+    PyGILState_Release(state);
+    return cancel;
+}
+
+static void freeParse(PM_py_parse * parse)
+{
+    free(parse->bam_files);
+    free(parse->opts.regions);
+    Py_XDECREF(parse->holders);
+    Py_XDECREF(parse->error_type);
+    Py_XDECREF(parse->error_value);
+    Py_XDECREF(parse->error_tb);
+}
+
+static int setupParse(PM_py_parse * parse, PyObject * args, PyObject * kwds)
+{
+    //-----
+    // keyword arguments straight onto PM_parse_options
+    //
+    static char * kwlist[] = {"bam_files", "base_q", "map_q", "min_len", "links",
+                              "ignore_supps", "coverage_mode", "coverage_lower",
+                              "coverage_upper", "workers", "threads", "regions",
+                              "bed_file", "cache_dir", "progress", "progress_contigs",
+                              "progress_mb", "finalisers", "read_ahead", "chunk_size",
+                              "bam_workers", "max_open_files", "memory_mb", NULL};
+    PyObject * bams = NULL, * regions = Py_None, * bed_file = Py_None, * cache_dir = NULL;
+    PyObject * progress = Py_None;
+    PM_parse_options * opts = &parse->opts;
+    memset(parse, 0, sizeof(PM_py_parse));
+    init_parse_options(opts);
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "O|iiiiiiffiiOOOOiiiiiiii", kwlist,
+                                    &bams, &opts->baseQ, &opts->mapQ, &opts->min_len,
+                                    &opts->do_links, &opts->ignore_supps,
+                                    &opts->do_outlier_coverage, &opts->coverage_lower,
+                                    &opts->coverage_upper, &opts->num_workers,
+                                    &opts->num_threads, &regions, &bed_file, &cache_dir,
+                                    &progress, &opts->progress_contigs, &opts->progress_mb,
+                                    &opts->num_finalisers, &opts->read_ahead,
+                                    &opts->chunk_size, &opts->num_bam_workers,
+                                    &opts->max_open_files, &opts->memory_mb))
+        return -1;
+    if(opts->do_outlier_coverage < PM_COVERAGE_MEAN || opts->do_outlier_coverage > PM_COVERAGE_PERCENTILE_CLIP) {
+        PyErr_SetString(PyExc_ValueError, "coverage_mode must be between 0 and 4");
+        return -1;
+    }
+    if(!(opts->coverage_lower >= 0 && opts->coverage_lower < opts->coverage_upper && opts->coverage_upper <= 1)) {
+        PyErr_SetString(PyExc_ValueError, "need 0 <= coverage_lower < coverage_upper <= 1");
+        return -1;
+    }
+
+    parse->holders = PyList_New(0);
+    if(parse->holders == NULL)
+        return -1;
+    if(pathList(bams, parse->holders, &parse->bam_files, &parse->num_bams) != 0)
+        return -1;
+    if(regions != Py_None &&
+       pathList(regions, parse->holders, &opts->regions, &opts->num_regions) != 0)
+        return -1;
+    if(bed_file != Py_None && fsPath(bed_file, parse->holders, &opts->bed_file) != 0)
+        return -1;
+    // cache_dir defaults to $PM_CACHE_DIR, None turns it off
+    if(cache_dir == Py_None)
+        opts->cache_dir = NULL;
+    else if(cache_dir != NULL && fsPath(cache_dir, parse->holders, &opts->cache_dir) != 0)
+        return -1;
+    if(progress != Py_None) {
+        if(!PyCallable_Check(progress)) {
+            PyErr_SetString(PyExc_TypeError, "progress must be callable");
+            return -1;
+        }
+        parse->progress = progress;
+        opts->progress = progressTrampoline;
+        opts->progress_data = parse;
+    }
+    return 0;
+}
+
+static PM_mapping_results * runParse(PM_py_parse * parse)
+{
+    //-----
+    // parse without the GIL and turn failures into exceptions
+    //
+    PM_mapping_results * MR = create_MR();
+    int ret = 0;
+    if(MR == NULL) {
+        PyErr_NoMemory();
+        return NULL;
+    }
+#if PY_VERSION_HEX < 0x03070000
+    // make sure progress can take the GIL from the worker threads
+    PyEval_InitThreads();
+#endif
+    Py_BEGIN_ALLOW_THREADS
+    ret = parseCoverageAndLinksWithOptions(parse->num_bams, parse->bam_files, &parse->opts, MR);
+    Py_END_ALLOW_THREADS
+    if(ret == 0)
+        return MR;
+
+    destroy_MR(MR);
+    free(MR);
+    if(parse->error_type != NULL) {
+        PyErr_Restore(parse->error_type, parse->error_value, parse->error_tb);
+        parse->error_type = parse->error_value = parse->error_tb = NULL;
+    } else if(ret == PM_PARSE_CANCELLED)
+        PyErr_SetString(PMCancelledError, "parse cancelled by the progress callback");
+    else
+        PyErr_Format(PyExc_RuntimeError, "parsing the BAM files failed (%d)", ret);
+    return NULL;
+}
+
+static PyObject * coverageArray(PM_mapping_results * MR)
+{
+    npy_intp dims[2];
+    dims[0] = MR->num_contigs;
+    dims[1] = MR->num_bams;
+    PyArrayObject * covs = (PyArrayObject *)PyArray_ZEROS(2, dims, NPY_FLOAT32, 0);
+    if(covs == NULL)
+        return NULL;
+    if(PyArray_SIZE(covs) != 0) {
+        Py_BEGIN_ALLOW_THREADS
+        calculateCoveragesInto(MR, (float *)PyArray_DATA(covs));
+        Py_END_ALLOW_THREADS
+    }
+    return (PyObject *)covs;
+}
+
+static PyObject * copyArray(uint32_t * data, int numDims, npy_intp * dims)
+{
+    PyArrayObject * array = (PyArrayObject *)PyArray_ZEROS(numDims, dims, NPY_UINT32, 0);
+    if(array == NULL)
+        return NULL;
+    if(data != NULL && PyArray_SIZE(array) != 0)
+        memcpy(PyArray_DATA(array), data, PyArray_NBYTES(array));
+    return (PyObject *)array;
+}
+
+static PyObject * parsedLengths(PM_mapping_results * MR)
+{
+    // what the coverages are averaged over, the region lengths if there were regions
+    npy_intp dims[1];
+    dims[0] = MR ? MR->num_contigs : 0;
+    return copyArray(MR ? (MR->region_lengths ? MR->region_lengths : MR->contig_lengths) : NULL, 1, dims);
+}
+
+static PyObject * nameList(char ** names, uint32_t num)
+{
+    PyObject * list = NULL;
+    uint32_t i = 0;
+    if(names == NULL)
+        num = 0; // a list of NULLs is no use to anyone
+    list = PyList_New(num);
+    if(list == NULL)
+        return NULL;
+    for(i = 0; i < num; ++i) {
+        PyObject * name = PM_PY_STRING(names[i]);
+        if(name == NULL) {
+            Py_DECREF(list);
+            return NULL;
+        }
+        PyList_SET_ITEM(list, i, name);
+    }
+    return list;
+}
+
+static int claim(PMMappingResults * self)
+{
+    //-----
+    // only one call at a time may use an MR while the GIL is released
+    //
+    if(self->MR == NULL) {
+        PyErr_SetString(PyExc_ValueError, "MappingResults has no results");
+        return -1;
+    }
+    if(self->busy) {
+        PyErr_SetString(PyExc_RuntimeError, "MappingResults is in use by another thread");
+        return -1;
+    }
+    self->busy = 1;
+    return 0;
+}
+
+static PyObject * MR_coverages(PMMappingResults * self, PyObject * unused)
+{
+    PyObject * covs = NULL;
+    if(claim(self) != 0)
+        return NULL;
+    covs = coverageArray(self->MR);
+    self->busy = 0;
+    return covs;
+}
+
+static PyObject * MR_counts(PMMappingResults * self, PyObject * unused)
+{
+    PM_mapping_results * MR = self->MR;
+    PyObject * plp_bp = NULL, * correctors = NULL;
+    npy_intp dims[2];
+    // we hold the GIL throughout, this just checks no merge is running
+    if(claim(self) != 0)
+        return NULL;
+    self->busy = 0;
+    dims[0] = MR->num_contigs;
+    dims[1] = MR->num_bams;
+    plp_bp = copyArray(MR->plp_bp, 2, dims);
+    if(plp_bp == NULL)
+        return NULL;
+    if(MR->is_outlier_coverage) {
+        correctors = copyArray(MR->contig_length_correctors, 2, dims);
+        if(correctors == NULL) {
+            Py_DECREF(plp_bp);
+            return NULL;
+        }
+    } else {
+        correctors = Py_None;
+        Py_INCREF(correctors);
+    }
+    return Py_BuildValue("(NN)", plp_bp, correctors);
+}
+
+static PyObject * MR_merge(PMMappingResults * self, PyObject * args)
+{
+    PMMappingResults * other = NULL;
+    int ret = 0;
+    if(!PyArg_ParseTuple(args, "O!", &PMMappingResultsType, &other))
+        return NULL;
+    if(other == self) {
+        PyErr_SetString(PyExc_ValueError, "can't merge MappingResults with itself");
+        return NULL;
+    }
+    if(claim(self) != 0)
+        return NULL;
+    if(claim(other) != 0) {
+        self->busy = 0;
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    ret = merge_MRs_many(self->MR, &other->MR, 1);
+    Py_END_ALLOW_THREADS
+    self->busy = 0;
+    other->busy = 0;
+    if(ret != 0) {
+        PyErr_SetString(PyExc_ValueError, "the BAM headers of the results differ");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject * MR_get_num_contigs(PMMappingResults * self, void * closure)
+{
+    return PyLong_FromUnsignedLong(self->MR ? self->MR->num_contigs : 0);
+}
+
+static PyObject * MR_get_num_bams(PMMappingResults * self, void * closure)
+{
+    return PyLong_FromUnsignedLong(self->MR ? self->MR->num_bams : 0);
+}
+
+static PyObject * MR_get_contig_names(PMMappingResults * self, void * closure)
+{
+    if(self->MR == NULL)
+        return PyList_New(0);
+    return nameList(self->MR->contig_names, self->MR->num_contigs);
+}
+
+static PyObject * MR_get_bam_names(PMMappingResults * self, void * closure)
+{
+    if(self->MR == NULL)
+        return PyList_New(0);
+    // a running merge reallocates the names
+    if(claim(self) != 0)
+        return NULL;
+    self->busy = 0;
+    return nameList(self->MR->bam_file_names, self->MR->num_bams);
+}
+
+static PyObject * MR_get_contig_lengths(PMMappingResults * self, void * closure)
+{
+    npy_intp dims[1];
+    dims[0] = self->MR ? self->MR->num_contigs : 0;
+    return copyArray(self->MR ? self->MR->contig_lengths : NULL, 1, dims);
+}
+
+static PyObject * MR_get_parsed_lengths(PMMappingResults * self, void * closure)
+{
+    return parsedLengths(self->MR);
+}
+
+static void MR_dealloc(PMMappingResults * self)
+{
+    if(self->MR != NULL) {
+        destroy_MR(self->MR);
+        free(self->MR);
+    }
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyMethodDef MR_methods[] = {
+    {"coverages", (PyCFunction)MR_coverages, METH_NOARGS,
+     "coverages() -> float32 array (rows = contigs, cols = BAMs)"},
+    {"counts", (PyCFunction)MR_counts, METH_NOARGS,
+     "counts() -> (plp_bp, contig_length_correctors or None), uint32 copies"},
+    {"merge", (PyCFunction)MR_merge, METH_VARARGS,
+     "merge(other) -> None, append the BAMs of other (unchanged) to these results"},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyGetSetDef MR_getset[] = {
+    {"num_contigs", (getter)MR_get_num_contigs, NULL, "number of contigs", NULL},
+    {"num_bams", (getter)MR_get_num_bams, NULL, "number of BAMs", NULL},
+    {"contig_names", (getter)MR_get_contig_names, NULL, "list of contig names", NULL},
+    {"bam_names", (getter)MR_get_bam_names, NULL, "list of BAM file names", NULL},
+    {"contig_lengths", (getter)MR_get_contig_lengths, NULL, "uint32 array of whole contig lengths from the header", NULL},
+    {"parsed_lengths", (getter)MR_get_parsed_lengths, NULL,
+     "uint32 array of bases parsed per contig, what coverages() averages over (the region lengths if regions were given)", NULL},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static PyTypeObject PMMappingResultsType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "parsem._pmbam.MappingResults",     // tp_name
+    sizeof(PMMappingResults),           // tp_basicsize
+};
+
+static PyObject * wrapMR(PM_mapping_results * MR)
+{
+    PMMappingResults * ret = PyObject_New(PMMappingResults, &PMMappingResultsType);
+    if(ret == NULL) {
+        destroy_MR(MR);
+        free(MR);
+        return NULL;
+    }
+    ret->MR = MR;
+    ret->busy = 0;
+    return (PyObject *)ret;
+}
+
+static PyObject * pm_parse(PyObject * module, PyObject * args, PyObject * kwds)
+{
+    PM_py_parse parse;
+    PM_mapping_results * MR = NULL;
+    if(setupParse(&parse, args, kwds) == 0)
+        MR = runParse(&parse);
+    freeParse(&parse);
+    if(MR == NULL)
+        return NULL;
+    return wrapMR(MR);
+}
+
+static PyObject * pm_load(PyObject * module, PyObject * args)
+{
+    PyObject * path = NULL, * holders = NULL;
+    char * file_name = NULL;
+    PM_mapping_results * MR = NULL;
+    int ret = 0;
+    if(!PyArg_ParseTuple(args, "O", &path))
+        return NULL;
+    holders = PyList_New(0);
+    if(holders == NULL)
+        return NULL;
+    if(fsPath(path, holders, &file_name) != 0) {
+        Py_DECREF(holders);
+        return NULL;
+    }
+    MR = create_MR();
+    Py_BEGIN_ALLOW_THREADS
+    ret = load_MR(file_name, MR);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(holders);
+    if(ret != 0) {
+        destroy_MR(MR);
+        free(MR);
+        PyErr_Format(PyExc_IOError, "could not load mapping results from %R", path);
+        return NULL;
+    }
+    return wrapMR(MR);
+}
+
+static PyObject * pm_parse_coverages(PyObject * module, PyObject * args, PyObject * kwds)
+{
+    PM_py_parse parse;
+    PM_mapping_results * MR = NULL;
+    PyObject * covs = NULL, * names = NULL, * lengths = NULL;
+    if(setupParse(&parse, args, kwds) == 0)
+        MR = runParse(&parse);
+    freeParse(&parse);
+    if(MR == NULL)
+        return NULL;
+    covs = coverageArray(MR);
+    names = nameList(MR->contig_names, MR->num_contigs);
+    lengths = parsedLengths(MR);
+    destroy_MR(MR);
+    free(MR);
+    if(covs == NULL || names == NULL || lengths == NULL) {
+        Py_XDECREF(covs);
+        Py_XDECREF(names);
+        Py_XDECREF(lengths);
+        return NULL;
+    }
+    return Py_BuildValue("(NNN)", covs, names, lengths);
+}
+
+#define PM_PARSE_DOC \
+"bam_files, base_q=0, map_q=0, min_len=0, links=0, ignore_supps=1,\n" \
+"coverage_mode=0, coverage_lower=0.05, coverage_upper=0.95, workers=1,\n" \
+"threads=1, regions=None, bed_file=None, cache_dir=$PM_CACHE_DIR,\n" \
+"progress=None, progress_contigs=0, progress_mb=64, finalisers=0,\n" \
+"read_ahead=0, chunk_size=0, bam_workers=0, max_open_files=0,\n" \
+"memory_mb=0\n\n" \
+"The GIL is released while the BAMs are parsed so several threads can parse\n" \
+"at once. progress(dict) is called with bytes_read, bytes_total, tid,\n" \
+"contigs_done, num_contigs, elapsed and eta; a true return raises Cancelled\n" \
+"and an exception it raises is passed on. A coverage_mode outside 0..4 or\n" \
+"fractions not satisfying 0 <= lower < upper <= 1 raise ValueError.\n"
+
+static PyMethodDef pm_methods[] = {
+    {"parse", (PyCFunction)(void (*)(void))pm_parse, METH_VARARGS | METH_KEYWORDS,
+     "parse(" PM_PARSE_DOC "\n-> MappingResults"},
+    {"parse_coverages", (PyCFunction)(void (*)(void))pm_parse_coverages, METH_VARARGS | METH_KEYWORDS,
+     "parse_coverages(" PM_PARSE_DOC "\n-> (coverages, contig_names, parsed_lengths), the lengths being\n"
+     "what the coverages are averaged over (the region lengths if regions were given)"},
+    {"load", (PyCFunction)pm_load, METH_VARARGS,
+     "load(path) -> MappingResults saved with save_MR"},
+    {NULL, NULL, 0, NULL}
+};
+
+static int setupModule(PyObject * module)
+{
+    PMMappingResultsType.tp_flags = Py_TPFLAGS_DEFAULT;
+    PMMappingResultsType.tp_doc = "Coverage and links of a set of BAM files, made by parse()";
+    PMMappingResultsType.tp_dealloc = (destructor)MR_dealloc;
+    PMMappingResultsType.tp_methods = MR_methods;
+    PMMappingResultsType.tp_getset = MR_getset;
+    if(PyType_Ready(&PMMappingResultsType) < 0)
+        return -1;
+    Py_INCREF(&PMMappingResultsType);
+    PyModule_AddObject(module, "MappingResults", (PyObject *)&PMMappingResultsType);
+
+    PMCancelledError = PyErr_NewException("parsem._pmbam.Cancelled", PyExc_RuntimeError, NULL);
+    if(PMCancelledError == NULL)
+        return -1;
+    Py_INCREF(PMCancelledError);
+    PyModule_AddObject(module, "Cancelled", PMCancelledError);
+
+    PyModule_AddIntConstant(module, "COVERAGE_MEAN", PM_COVERAGE_MEAN);
+    PyModule_AddIntConstant(module, "COVERAGE_OUTLIER_SD", PM_COVERAGE_OUTLIER_SD);
+    PyModule_AddIntConstant(module, "COVERAGE_TRIMMED_MEAN", PM_COVERAGE_TRIMMED_MEAN);
+    PyModule_AddIntConstant(module, "COVERAGE_MEDIAN", PM_COVERAGE_MEDIAN);
+    PyModule_AddIntConstant(module, "COVERAGE_PERCENTILE_CLIP", PM_COVERAGE_PERCENTILE_CLIP);
+    return 0;
+}
+
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef pm_module = {
+    PyModuleDef_HEAD_INIT,
+    "_pmbam",
+    "Native bindings for the ParseM BAM parser",
+    -1,
+    pm_methods
+};
+
+PyMODINIT_FUNC PyInit__pmbam(void)
+{
+    PyObject * module = NULL;
+    import_array();
+    module = PyModule_Create(&pm_module);
+    if(module == NULL)
+        return NULL;
+    if(setupModule(module) != 0) {
+        Py_DECREF(module);
+        return NULL;
+    }
+    return module;
+}
+#else
+PyMODINIT_FUNC init_pmbam(void)
+{
+    PyObject * module = NULL;
+    import_array();
+    module = Py_InitModule3("_pmbam", pm_methods, "Native bindings for the ParseM BAM parser");
+    if(module != NULL)
+        setupModule(module);
+}
+#endif
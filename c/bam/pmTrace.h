@@ -0,0 +1,64 @@
+//#############################################################################
+//
+//   pmTrace.h
+//
+//   User space static tracepoints (USDT) for perf, bpftrace and systemtap
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_TRACE_H
+  #define PM_TRACE_H
+
+//-----
+// Build with -DPM_ENABLE_USDT (make PM_USDT_FLAGS=-DPM_ENABLE_USDT) and
+// <sys/sdt.h> from systemtap to get the probes. Otherwise the macros are
+// empty and their arguments are never evaluated.
+//
+// Every probe is in the "parsem" provider:
+//
+//   parse_start(num_bams, num_workers)
+//   parse_end(ret)
+//   contig_start(tid, length)            length is PM_MR_LENGTH, the bases
+//                                        inside the regions when there are any
+//   contig_end(tid, length, depth_sum)   depth_sum over every BAM
+//   read(bam_ID, tid, pos, flag)         every record out of read_bam
+//   link_add(cid_1, cid_2, pos_1, pos_2, bam_ID)
+//   adjust(tid, bam_ID, depth_sum, kept, drops)
+//                                        depth_sum is kept when the robust
+//                                        estimators run off the histogram
+//   merge_start(num_in, num_bams_after)
+//   merge_end(ret)
+//
+// See tracing/ for bpftrace scripts which use them.
+//
+#ifdef PM_ENABLE_USDT
+  #include <sys/sdt.h>
+  #define PM_TRACE1(name, a) DTRACE_PROBE1(parsem, name, a)
+  #define PM_TRACE2(name, a, b) DTRACE_PROBE2(parsem, name, a, b)
+  #define PM_TRACE3(name, a, b, c) DTRACE_PROBE3(parsem, name, a, b, c)
+  #define PM_TRACE4(name, a, b, c, d) DTRACE_PROBE4(parsem, name, a, b, c, d)
+  #define PM_TRACE5(name, a, b, c, d, e) DTRACE_PROBE5(parsem, name, a, b, c, d, e)
+#else
+  #define PM_TRACE1(name, a) do {} while(0)
+  #define PM_TRACE2(name, a, b) do {} while(0)
+  #define PM_TRACE3(name, a, b, c) do {} while(0)
+  #define PM_TRACE4(name, a, b, c, d) do {} while(0)
+  #define PM_TRACE5(name, a, b, c, d, e) do {} while(0)
+#endif
+
+#endif // PM_TRACE_H
@@ -0,0 +1,123 @@
+//#############################################################################
+//
+//   progress.c
+//
+//   Progress callbacks and cooperative cancellation for long parses
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// local includes
+#include "progress.h"
+#include "parseStats.h"
+
+void initProgress(PM_progress_tracker * tracker,
+                  PM_progress_callback callback,
+                  void * userData,
+                  int everyContigs,
+                  int everyMB,
+                  int numBams,
+                  char * bamFiles[],
+                  int numContigs)
+{
+    int i = 0;
+    struct stat st;
+    memset(tracker, 0, sizeof(PM_progress_tracker));
+    tracker->callback = callback;
+    tracker->user_data = userData;
+    if(everyContigs <= 0 && everyMB <= 0)
+        everyContigs = 1;
+    if(everyContigs > 0) {
+        tracker->every_contigs = everyContigs;
+        tracker->next_contigs = everyContigs;
+    }
+    if(everyMB > 0) {
+        tracker->every_bytes = (uint64_t)everyMB << 20;
+        tracker->next_bytes = tracker->every_bytes;
+    }
+    for(i = 0; i < numBams; ++i) {
+        if(stat(bamFiles[i], &st) == 0)
+            tracker->progress.bytes_total += st.st_size;
+    }
+    tracker->progress.tid = -1;
+    tracker->progress.num_contigs = numContigs;
+    tracker->progress.eta = -1;
+    tracker->start_ns = statsClock();
+    pthread_mutex_init(&tracker->lock, NULL);
+}
+
+static void estimateRemaining(PM_progress * P)
+{
+    //-----
+    // straight line from what's been done, by bytes if we know the total
+    //
+    double done = 0;
+    if(P->bytes_total > 0 && P->bytes_read > 0) {
+        done = (double)P->bytes_read / (double)P->bytes_total;
+    } else if(P->num_contigs > 0 && P->contigs_done > 0) {
+        done = (double)P->contigs_done / (double)P->num_contigs;
+    }
+    if(done <= 0) {
+        P->eta = -1;
+        return;
+    }
+    if(done > 1)
+        done = 1;
+    P->eta = P->elapsed * (1 - done) / done;
+}
+
+int updateProgress(PM_progress_tracker * tracker, int tid, uint64_t bytes, int contigs)
+{
+    int report = 0;
+    if(tracker == NULL)
+        return 0;
+    pthread_mutex_lock(&tracker->lock);
+    PM_progress * P = &tracker->progress;
+    P->bytes_read += bytes;
+    P->contigs_done += contigs;
+    P->tid = tid;
+    if(tracker->every_contigs && P->contigs_done >= tracker->next_contigs) {
+        report = 1;
+        while(tracker->next_contigs <= P->contigs_done)
+            tracker->next_contigs += tracker->every_contigs;
+    }
+    if(tracker->every_bytes && P->bytes_read >= tracker->next_bytes) {
+        report = 1;
+        while(tracker->next_bytes <= P->bytes_read)
+            tracker->next_bytes += tracker->every_bytes;
+    }
+    if(report && tracker->callback != NULL && !tracker->cancelled) {
+        P->elapsed = (statsClock() - tracker->start_ns) * 1e-9;
+        estimateRemaining(P);
+        if(tracker->callback(P, tracker->user_data) != 0)
+            tracker->cancelled = 1;
+    }
+    pthread_mutex_unlock(&tracker->lock);
+    return tracker->cancelled;
+}
+
+void destroyProgress(PM_progress_tracker * tracker)
+{
+    if(tracker == NULL)
+        return;
+    pthread_mutex_destroy(&tracker->lock);
+}
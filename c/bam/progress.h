@@ -0,0 +1,148 @@
+//#############################################################################
+//
+//   progress.h
+//
+//   Progress callbacks and cooperative cancellation for long parses
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_PROGRESS_H
+  #define PM_PROGRESS_H
+
+// system includes
+#include <stdint.h>
+#include <pthread.h>
+
+// returned by a parse stopped by its progress callback
+#define PM_PARSE_CANCELLED -3
+// report at least this often (in MB of compressed input) unless told otherwise
+#define PM_PROGRESS_DEFAULT_MB 64
+// pileup columns between checks for a cancel inside a contig
+#define PM_PROGRESS_COLUMN_MASK 0xFFFF
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract What a progress callback is told
+ @field bytes_read compressed bytes consumed so far over all the BAMs
+ @field bytes_total compressed size of all the BAMs (0 if unknown)
+ @field tid contig last worked on
+ @field contigs_done contigs finished so far
+ @field num_contigs contigs in the parse
+ @field elapsed seconds since the parse started
+ @field eta estimated seconds left (negative until there is something to go on)
+ */
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_total;
+    int tid;
+    int contigs_done;
+    int num_contigs;
+    double elapsed;
+    double eta;
+} PM_progress;
+
+/*! @typedef
+ @abstract Called as a parse makes progress, return non-zero to cancel it
+ @discussion With several contig workers this is called from the worker
+ threads, but never from two at once.
+ */
+typedef int (*PM_progress_callback)(PM_progress * progress, void * userData);
+
+/*! @typedef
+ @abstract Tracks the progress of one parse and whether it was cancelled
+ @field callback function to report to (NULL to never report)
+ @field user_data passed through to callback
+ @field every_bytes report after this many more compressed bytes (0 for never)
+ @field every_contigs report after this many more contigs (0 for never)
+ @field next_bytes bytes_read at which to report next
+ @field next_contigs contigs_done at which to report next
+ @field start_ns statsClock() when the parse started
+ @field progress what the callback is told
+ @field lock serialises updates from the contig workers
+ @field cancelled set once the callback asks to stop
+ */
+typedef struct {
+    PM_progress_callback callback;
+    void * user_data;
+    uint64_t every_bytes;
+    int every_contigs;
+    uint64_t next_bytes;
+    int next_contigs;
+    uint64_t start_ns;
+    PM_progress progress;
+    pthread_mutex_t lock;
+    volatile int cancelled;
+} PM_progress_tracker;
+
+// cheap enough to test in the inner loops
+#define PM_PROGRESS_IS_CANCELLED(tracker) ((tracker) != NULL && (tracker)->cancelled)
+
+/*!
+ * @abstract Set up a tracker
+ *
+ * @param  tracker  tracker to set up
+ * @param  callback  function to report to (NULL to only track)
+ * @param  userData  passed through to callback
+ * @param  everyContigs  report after this many contigs (<= 0 for never)
+ * @param  everyMB  report after this many MB of compressed input (<= 0 for never)
+ * @param  numBams  number of BAM files being parsed
+ * @param  bamFiles  filenames of the BAM files, to get their sizes
+ * @param  numContigs  contigs in the parse
+ * @return void
+ *
+ * @discussion If both everyContigs and everyMB are <= 0 the callback is
+ * called after every contig.
+ */
+void initProgress(PM_progress_tracker * tracker,
+                  PM_progress_callback callback,
+                  void * userData,
+                  int everyContigs,
+                  int everyMB,
+                  int numBams,
+                  char * bamFiles[],
+                  int numContigs);
+
+/*!
+ * @abstract Record some progress, reporting it if it's time to
+ *
+ * @param  tracker  tracker to update (may be NULL)
+ * @param  tid  contig being worked on
+ * @param  bytes  compressed bytes consumed since the last update
+ * @param  contigs  contigs finished since the last update
+ * @return 1 if the parse has been cancelled, otherwise 0
+ *
+ * @discussion Thread safe. Once cancelled the callback is not called again.
+ */
+int updateProgress(PM_progress_tracker * tracker, int tid, uint64_t bytes, int contigs);
+
+/*!
+ * @abstract Clean up a tracker
+ *
+ * @param  tracker  tracker to clean up (may be NULL)
+ * @return void
+ */
+void destroyProgress(PM_progress_tracker * tracker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_PROGRESS_H
@@ -0,0 +1,292 @@
+//#############################################################################
+//
+//   regions.c
+//
+//   Restrict parsing to named contigs, contig:beg-end strings or BED regions
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+
+// htslib
+#include "htslib/sam.h"
+
+// local includes
+#include "regions.h"
+#include "bamParser.h"
+#include "resultCache.h"
+
+#define PM_REGIONS_MIN 64
+
+/*! @typedef
+ @abstract A region before it is grouped by contig
+ @field tid contig the region is on
+ @field region where on the contig
+ */
+typedef struct {
+    int tid;
+    PM_region region;
+} PM_raw_region;
+
+typedef struct {
+    PM_raw_region * items;
+    size_t size;
+    size_t capacity;
+} PM_raw_regions;
+
+static void addRawRegion(PM_raw_regions * raw, int tid, uint32_t beg, uint32_t end)
+{
+    if(raw->size == raw->capacity) {
+        raw->capacity = (raw->capacity == 0) ? PM_REGIONS_MIN : raw->capacity * 2;
+        raw->items = realloc(raw->items, raw->capacity * sizeof(PM_raw_region));
+    }
+    raw->items[raw->size].tid = tid;
+    raw->items[raw->size].region.beg = beg;
+    raw->items[raw->size].region.end = end;
+    raw->items[raw->size].region.offset = 0;
+    ++raw->size;
+}
+
+static int compareRawRegions(const void * a, const void * b)
+{
+    const PM_raw_region * ra = (const PM_raw_region *)a;
+    const PM_raw_region * rb = (const PM_raw_region *)b;
+    if(ra->tid != rb->tid) return (ra->tid < rb->tid) ? -1 : 1;
+    if(ra->region.beg != rb->region.beg) return (ra->region.beg < rb->region.beg) ? -1 : 1;
+    return 0;
+}
+
+static const char * parseCoordinate(const char * str, uint64_t * value)
+{
+    //-----
+    // read a number which may have thousands separators, NULL if there isn't one
+    //
+    int digits = 0;
+    *value = 0;
+    for(; *str != '\0'; ++str) {
+        if(isdigit((unsigned char)*str)) {
+            *value = *value * 10 + (uint64_t)(*str - '0');
+            ++digits;
+        } else if(*str != ',') {
+            break;
+        }
+    }
+    return (digits > 0) ? str : NULL;
+}
+
+int parseRegionString(bam_hdr_t * h,
+                      const char * str,
+                      int * tid,
+                      uint32_t * beg,
+                      uint32_t * end)
+{
+    uint64_t first = 1, last = 0;
+    const char * colon = NULL;
+    const char * rest = NULL;
+    char * name = NULL;
+
+    // a bare contig name, which may itself contain a ':'
+    *tid = bam_name2id(h, str);
+    if(*tid >= 0) {
+        *beg = 0;
+        *end = h->target_len[*tid];
+        return 0;
+    }
+
+    colon = strrchr(str, ':');
+    if(colon == NULL)
+        return 1;
+    name = strndup(str, colon - str);
+    *tid = bam_name2id(h, name);
+    free(name);
+    if(*tid < 0)
+        return 1;
+
+    last = h->target_len[*tid];
+    rest = parseCoordinate(colon + 1, &first);
+    if(rest == NULL)
+        return 1;
+    if(*rest == '-') {
+        rest = parseCoordinate(rest + 1, &last);
+        if(rest == NULL)
+            return 1;
+    }
+    if(*rest != '\0')
+        return 1;
+
+    // 1 indexed and inclusive -> 0 indexed and half open
+    if(first == 0) first = 1;
+    if(last > h->target_len[*tid]) last = h->target_len[*tid];
+    if(first > last)
+        return 1;
+    *beg = (uint32_t)(first - 1);
+    *end = (uint32_t)last;
+    return 0;
+}
+
+static int readBedFile(bam_hdr_t * h, char * bedFile, PM_raw_regions * raw)
+{
+    //-----
+    // add every region in a BED file, 1 if the file is bad
+    //
+    char * line = NULL;
+    size_t line_capacity = 0;
+    int line_num = 0, ret = 0;
+    char str[512];
+    FILE * fp = fopen(bedFile, "r");
+    if(fp == NULL) {
+        snprintf(str, sizeof(str), "Could not open BED file %s", bedFile);
+        printError(str, __LINE__);
+        return 1;
+    }
+    while(getline(&line, &line_capacity, fp) != -1) {
+        char * save = NULL;
+        char * name = NULL;
+        char * beg_str = NULL;
+        char * end_str = NULL;
+        char * tail = NULL;
+        unsigned long beg = 0, end = 0;
+        int tid = 0;
+        ++line_num;
+        name = strtok_r(line, " \t\r\n", &save);
+        if(name == NULL || name[0] == '#' ||
+           strcmp(name, "track") == 0 || strcmp(name, "browser") == 0)
+            continue;
+        beg_str = strtok_r(NULL, " \t\r\n", &save);
+        end_str = strtok_r(NULL, " \t\r\n", &save);
+        if(beg_str == NULL || end_str == NULL) {
+            snprintf(str, sizeof(str), "Too few columns on line %d of %s", line_num, bedFile);
+            printError(str, __LINE__);
+            ret = 1;
+            break;
+        }
+        beg = strtoul(beg_str, &tail, 10);
+        if(*tail != '\0') {ret = 1;}
+        end = strtoul(end_str, &tail, 10);
+        if(*tail != '\0') {ret = 1;}
+        tid = bam_name2id(h, name);
+        if(ret != 0 || tid < 0) {
+            snprintf(str, sizeof(str), "Bad region on line %d of %s", line_num, bedFile);
+            printError(str, __LINE__);
+            ret = 1;
+            break;
+        }
+        if(end > h->target_len[tid]) end = h->target_len[tid];
+        if(beg < end)
+            addRawRegion(raw, tid, (uint32_t)beg, (uint32_t)end);
+    }
+    free(line);
+    fclose(fp);
+    return ret;
+}
+
+PM_region_set * createRegionSet(bam_hdr_t * h,
+                                char ** regionStrings,
+                                int numRegions,
+                                char * bedFile)
+{
+    PM_raw_regions raw = {NULL, 0, 0};
+    PM_region_set * RS = NULL;
+    size_t i = 0;
+    int tid = 0;
+    uint32_t beg = 0, end = 0;
+
+    //-----
+    // gather everything up
+    //
+    for(i = 0; i < (size_t)numRegions; ++i) {
+        if(parseRegionString(h, regionStrings[i], &tid, &beg, &end) != 0) {
+            char str[512];
+            snprintf(str, sizeof(str), "Could not read region %s", regionStrings[i]);
+            printError(str, __LINE__);
+            free(raw.items);
+            return NULL;
+        }
+        addRawRegion(&raw, tid, beg, end);
+    }
+    if(bedFile != NULL && readBedFile(h, bedFile, &raw) != 0) {
+        free(raw.items);
+        return NULL;
+    }
+
+    //-----
+    // sort, merge overlaps and pack each contig's regions end to end
+    //
+    qsort(raw.items, raw.size, sizeof(PM_raw_region), compareRawRegions);
+    RS = calloc(1, sizeof(PM_region_set));
+    RS->num_contigs = h->n_targets;
+    RS->first = calloc((size_t)h->n_targets + 1, sizeof(uint32_t));
+    RS->regions = calloc((raw.size > 0) ? raw.size : 1, sizeof(PM_region));
+    for(i = 0; i < raw.size; ++i) {
+        PM_raw_region * R = &raw.items[i];
+        PM_region * prev = (RS->num_regions > 0) ? &RS->regions[RS->num_regions - 1] : NULL;
+        int same_contig = (i > 0 && raw.items[i - 1].tid == R->tid);
+        if(same_contig && R->region.beg <= prev->end) {
+            if(R->region.end > prev->end)
+                prev->end = R->region.end;
+            continue;
+        }
+        RS->regions[RS->num_regions] = R->region;
+        RS->regions[RS->num_regions].offset = same_contig ? prev->offset + (prev->end - prev->beg) : 0;
+        ++RS->first[R->tid + 1];
+        ++RS->num_regions;
+    }
+    for(tid = 0; tid < RS->num_contigs; ++tid) {
+        RS->first[tid + 1] += RS->first[tid];
+    }
+    free(raw.items);
+    return RS;
+}
+
+void destroyRegionSet(PM_region_set * RS)
+{
+    if(RS == NULL)
+        return;
+    free(RS->first);
+    free(RS->regions);
+    free(RS);
+}
+
+uint32_t regionBases(PM_region_set * RS, int tid)
+{
+    PM_region * last = NULL;
+    if(RS->first[tid] == RS->first[tid + 1])
+        return 0;
+    last = &RS->regions[RS->first[tid + 1] - 1];
+    return last->offset + (last->end - last->beg);
+}
+
+uint64_t regionSetDigest(PM_region_set * RS)
+{
+    uint64_t hash = PM_FNV_OFFSET;
+    uint32_t i = 0;
+    int tid = 0;
+    for(tid = 0; tid < RS->num_contigs; ++tid) {
+        for(i = RS->first[tid]; i < RS->first[tid + 1]; ++i) {
+            hash = hashBytes(hash, &tid, sizeof(int));
+            hash = hashBytes(hash, &RS->regions[i].beg, sizeof(uint32_t));
+            hash = hashBytes(hash, &RS->regions[i].end, sizeof(uint32_t));
+        }
+    }
+    // 0 means whole contigs were parsed
+    return (hash == 0) ? 1 : hash;
+}
@@ -0,0 +1,139 @@
+//#############################################################################
+//
+//   regions.h
+//
+//   Restrict parsing to named contigs, contig:beg-end strings or BED regions
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_REGIONS_H
+  #define PM_REGIONS_H
+
+// system includes
+#include <stdint.h>
+
+// htslib
+#include "htslib/sam.h"
+
+// local includes
+#include "bamParser.h"
+
+// regions can only be reached through the BAM index
+#define PM_USE_REGIONS(opts) ((opts)->num_regions > 0 || (opts)->bed_file != NULL)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract A stretch of a contig to parse
+ @field beg first position (0 indexed)
+ @field end one past the last position
+ @field offset depth buffer slot of beg, the regions of a contig are packed end to end
+ */
+typedef struct {
+    uint32_t beg;
+    uint32_t end;
+    uint32_t offset;
+} PM_region;
+
+/*! @typedef
+ @abstract Sorted, non-overlapping regions grouped by contig
+ @field num_contigs number of contigs in the BAM header
+ @field first regions of contig tid are [first[tid], first[tid+1]) (num_contigs + 1 long)
+ @field regions the regions, sorted by contig then position
+ @field num_regions number of regions
+ */
+typedef struct {
+    int num_contigs;
+    uint32_t * first;
+    PM_region * regions;
+    uint32_t num_regions;
+} PM_region_set;
+
+/*!
+ * @abstract Work out which contig and stretch a region string names
+ *
+ * @param  h  BAM header to look contig names up in
+ * @param  str  contig name, contig:beg or contig:beg-end (1 indexed, inclusive)
+ * @param  tid  set to the contig's index
+ * @param  beg  set to the first position (0 indexed)
+ * @param  end  set to one past the last position
+ * @return 0 for success, 1 if the contig is unknown or the range is bad
+ *
+ * @discussion As with samtools, commas in the numbers are ignored and a
+ * string which is exactly a contig name is taken to be that contig, even if
+ * it contains a ':'. Ranges are clipped to the end of the contig.
+ */
+int parseRegionString(bam_hdr_t * h,
+                      const char * str,
+                      int * tid,
+                      uint32_t * beg,
+                      uint32_t * end);
+
+/*!
+ * @abstract Make the set of regions to parse
+ *
+ * @param  h  BAM header to look contig names up in
+ * @param  regionStrings  region strings (see parseRegionString), may be NULL
+ * @param  numRegions  number of region strings
+ * @param  bedFile  BED file of regions to add (NULL for none)
+ * @return PM_region_set * or NULL if any region could not be read
+ *
+ * @discussion BED lines are 0 indexed and half open. Header, track and
+ * browser lines are skipped. Overlapping and touching regions are merged.
+ * Call destroyRegionSet when done.
+ */
+PM_region_set * createRegionSet(bam_hdr_t * h,
+                                char ** regionStrings,
+                                int numRegions,
+                                char * bedFile);
+
+/*!
+ * @abstract Free a region set made by createRegionSet
+ *
+ * @param  RS  region set to destroy
+ * @return void
+ */
+void destroyRegionSet(PM_region_set * RS);
+
+/*!
+ * @abstract Number of bases of a contig inside the regions
+ *
+ * @param  RS  region set to look in
+ * @param  tid  contig to count
+ * @return bases covered, 0 if the contig was not asked for
+ */
+uint32_t regionBases(PM_region_set * RS, int tid);
+
+/*!
+ * @abstract Hash the coordinates of every region in a set
+ *
+ * @param  RS  region set to hash
+ * @return digest of each region's contig, start and end (never 0)
+ *
+ * @discussion Two sets with the same region lengths can still cover
+ * different bases, so this is what merge_MRs_many compares.
+ */
+uint64_t regionSetDigest(PM_region_set * RS);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_REGIONS_H
@@ -0,0 +1,337 @@
+//#############################################################################
+//
+//   resultCache.c
+//
+//   Keep each BAM's mapping results on disk so unchanged BAMs aren't re-parsed
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// local includes
+#include "resultCache.h"
+#include "resultsFile.h"
+#include "bamParser.h"
+#include "depthBuffer.h"
+
+#define PM_FNV_PRIME 0x100000001b3ULL
+
+uint64_t hashBytes(uint64_t hash, const void * data, size_t length)
+{
+    const unsigned char * bytes = (const unsigned char *)data;
+    size_t i = 0;
+    for(i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= PM_FNV_PRIME;
+    }
+    return hash;
+}
+
+static uint64_t hashString(uint64_t hash, const char * str)
+{
+    // the NUL keeps "ab","c" apart from "a","bc"
+    return hashBytes(hash, str, strlen(str) + 1);
+}
+
+static int hashFileRange(uint64_t * hash, int fd, off_t offset, size_t length, char * buffer)
+{
+    ssize_t got = pread(fd, buffer, length, offset);
+    if(got != (ssize_t)length)
+        return 1;
+    *hash = hashBytes(*hash, buffer, length);
+    return 0;
+}
+
+static int hashFile(uint64_t * hash, char * fileName, int wholeFile)
+{
+    //-----
+    // identity, then the first and last few blocks (or everything)
+    //
+    struct stat st;
+    int64_t size = 0, mtime = 0;
+    size_t head = 0, tail = 0;
+    char * buffer = NULL;
+    int ret = 0;
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0)
+        return 1;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return 1;
+    }
+    size = st.st_size;
+    mtime = st.st_mtime;
+    *hash = hashBytes(*hash, &size, sizeof(size));
+    if(!wholeFile)
+        *hash = hashBytes(*hash, &mtime, sizeof(mtime));
+
+    head = (wholeFile || size < PM_CACHE_DIGEST_BYTES) ? (size_t)size : PM_CACHE_DIGEST_BYTES;
+    tail = (size - (int64_t)head < PM_CACHE_DIGEST_BYTES) ? (size_t)(size - head) : PM_CACHE_DIGEST_BYTES;
+    buffer = malloc(head > PM_CACHE_DIGEST_BYTES ? head : PM_CACHE_DIGEST_BYTES);
+    ret = hashFileRange(hash, fd, 0, head, buffer);
+    if(ret == 0 && tail > 0)
+        ret = hashFileRange(hash, fd, size - tail, tail, buffer);
+    free(buffer);
+    close(fd);
+    return ret;
+}
+
+int cacheKey(char * bamFile, PM_parse_options * opts, char * key)
+{
+    uint64_t hash = PM_FNV_OFFSET;
+    int32_t version = PM_RESULTS_VERSION;
+    int32_t settings[6];
+    int i = 0;
+
+    if(hashFile(&hash, bamFile, 0) != 0)
+        return 1;
+
+    settings[0] = opts->baseQ;
+    settings[1] = opts->mapQ;
+    settings[2] = opts->min_len;
+    settings[3] = opts->do_links;
+    settings[4] = opts->ignore_supps;
+    settings[5] = opts->do_outlier_coverage;
+    hash = hashBytes(hash, &version, sizeof(version));
+    hash = hashBytes(hash, settings, sizeof(settings));
+    hash = hashBytes(hash, &opts->coverage_lower, sizeof(float));
+    hash = hashBytes(hash, &opts->coverage_upper, sizeof(float));
+    for(i = 0; i < opts->num_regions; ++i) {
+        hash = hashString(hash, opts->regions[i]);
+    }
+    if(opts->bed_file != NULL && hashFile(&hash, opts->bed_file, 1) != 0)
+        return 1;
+
+    snprintf(key, PM_CACHE_KEY_LEN + 1, "%016llx", (unsigned long long)hash);
+    return 0;
+}
+
+static int bamContigs(char * bamFile)
+{
+    // number of contigs in the header, -1 if it can't be read
+    int num_contigs = -1;
+    BGZF * fp = bgzf_open(bamFile, "r");
+    if(fp == NULL)
+        return -1;
+    bam_hdr_t * h = bam_hdr_read(fp);
+    if(h != NULL) {
+        num_contigs = h->n_targets;
+        bam_hdr_destroy(h);
+    }
+    bgzf_close(fp);
+    return num_contigs;
+}
+
+static int passProgress(PM_cache_progress * P, int tid, uint64_t bytes, int contigs)
+{
+    //-----
+    // each contig a BAM finishes is a num_bams share of one contig of the
+    // whole parse, so the count reaches num_contigs with the last BAM
+    //
+    int before = P->contig_shares;
+    P->contig_shares += contigs;
+    P->bytes_reported += bytes;
+    P->contigs_reported += contigs;
+    return updateProgress(P->tracker, tid, bytes,
+                          P->contig_shares / P->num_bams - before / P->num_bams);
+}
+
+static int cacheProgress(PM_progress * progress, void * userData)
+{
+    PM_cache_progress * P = (PM_cache_progress *)userData;
+    return passProgress(P, progress->tid,
+                        progress->bytes_read - P->bytes_reported,
+                        progress->contigs_done - P->contigs_reported);
+}
+
+static int finishBamProgress(PM_cache_progress * P, char * bamFile)
+{
+    //-----
+    // whatever the BAM's last report left out, or all of it for a hit
+    //
+    struct stat st;
+    uint64_t size = 0;
+    int ret = 0;
+    if(P->tracker == NULL)
+        return 0;
+    if(stat(bamFile, &st) == 0)
+        size = st.st_size;
+    ret = passProgress(P, P->num_contigs - 1,
+                       (size > P->bytes_reported) ? size - P->bytes_reported : 0,
+                       P->num_contigs - P->contigs_reported);
+    P->bytes_reported = 0;
+    P->contigs_reported = 0;
+    return ret;
+}
+
+static int loadOrParseBam(char * bamFile,
+                          PM_parse_options * opts,
+                          PM_parse_options * uncached,
+                          PM_cache_progress * progress,
+                          PM_mapping_results * MR)
+{
+    //-----
+    // one BAM from the cache if we have it, otherwise parse it and keep it
+    //
+    char key[PM_CACHE_KEY_LEN + 1];
+    char * path = NULL;
+    int ret = 0, num_contigs = 0;
+    if(cacheKey(bamFile, opts, key) == 0) {
+        path = malloc(strlen(opts->cache_dir) + PM_CACHE_KEY_LEN + 8);
+        sprintf(path, "%s/%s.pmr", opts->cache_dir, key);
+        if(access(path, R_OK) == 0 && load_MR(path, MR) == 0) {
+            // the key ignores the path so the BAM may have moved
+            if(MR->bam_file_names != NULL) {
+                free(MR->bam_file_names[0]);
+                MR->bam_file_names[0] = strdup(bamFile);
+            }
+            free(path);
+            return finishBamProgress(progress, bamFile) ? PM_PARSE_CANCELLED : 0;
+        }
+    }
+
+    //-----
+    // the contigs it has reads on are kept with it for adjustUnseenBams
+    //
+    num_contigs = bamContigs(bamFile);
+    if(num_contigs > 0)
+        uncached->seen_contigs = calloc(((size_t)num_contigs + 7) / 8, 1);
+    ret = parseCoverageAndLinksWithOptions(1, &bamFile, uncached, MR);
+    if(ret == 0 && MR->num_contigs == (uint32_t)num_contigs) {
+        MR->seen_contigs = uncached->seen_contigs;
+        uncached->seen_contigs = NULL;
+    }
+    free(uncached->seen_contigs);
+    uncached->seen_contigs = NULL;
+    // a failed save just means parsing again next time
+    if(ret == 0 && path != NULL)
+        save_MR(MR, path);
+    free(path);
+    if(ret == 0 && finishBamProgress(progress, bamFile))
+        ret = PM_PARSE_CANCELLED;
+    return ret;
+}
+
+static void adjustUnseenBams(PM_mapping_results ** MRs, int numBams, PM_parse_options * opts)
+{
+    //-----
+    // the multi-pileup adjusts every BAM on a contig any BAM has reads on,
+    // which gives an empty one non-zero correctors in the histogram modes
+    //
+    PM_mapping_results * MR = MRs[0];
+    size_t bytes = ((size_t)MR->num_contigs + 7) / 8, k = 0;
+    uint8_t * any = NULL;
+    PM_depth_buffers * empty = NULL;
+    uint32_t tid = 0;
+    int i = 0;
+    for(i = 0; i < numBams; ++i) {
+        // merge_MRs_many says why if the headers differ
+        if(MRs[i]->seen_contigs == NULL || MRs[i]->num_contigs != MR->num_contigs)
+            return;
+    }
+    any = calloc(bytes, 1);
+    for(i = 0; i < numBams; ++i) {
+        for(k = 0; k < bytes; ++k) {
+            any[k] |= MRs[i]->seen_contigs[k];
+        }
+    }
+    for(k = 0; opts->seen_contigs != NULL && k < bytes; ++k) {
+        opts->seen_contigs[k] |= any[k];
+    }
+    if(!MR->is_outlier_coverage) {
+        free(any);
+        return; // nothing piled up is zero either way
+    }
+    empty = createDepthBuffers(1, 0, PM_COVERAGE_USES_HISTOGRAM(MR->is_outlier_coverage));
+    for(tid = 0; tid < MR->num_contigs; ++tid) {
+        if(!PM_SEEN(any, tid))
+            continue;
+        for(i = 0; i < numBams; ++i) {
+            if(!PM_SEEN(MRs[i]->seen_contigs, tid)) {
+                adjustPlpBpColumn(MRs[i], &empty->buffers[0], tid, 0);
+                clearDepthBuffer(&empty->buffers[0]);
+            }
+        }
+    }
+    destroyDepthBuffers(empty);
+    free(any);
+}
+
+int parseCoverageAndLinksCached(int numBams,
+                                char* bamFiles[],
+                                PM_parse_options * opts,
+                                PM_mapping_results * MR)
+{
+    int i = 0, ret = 0;
+    PM_parse_options uncached = *opts;
+    PM_progress_tracker tracker;
+    PM_cache_progress progress;
+    uncached.cache_dir = NULL;
+    uncached.seen_contigs = NULL;
+    mkdir(opts->cache_dir, 0777); // fine if it's already there
+    if(numBams == 0)
+        return 0;
+
+    //-----
+    // one tracker for the whole set, each BAM's parse reports into it
+    //
+    memset(&progress, 0, sizeof(PM_cache_progress));
+    if(opts->progress != NULL) {
+        progress.num_bams = numBams;
+        progress.num_contigs = bamContigs(bamFiles[0]);
+        if(progress.num_contigs < 0)
+            progress.num_contigs = 0;
+        initProgress(&tracker, opts->progress, opts->progress_data, opts->progress_contigs,
+                     opts->progress_mb, numBams, bamFiles, progress.num_contigs);
+        progress.tracker = &tracker;
+        uncached.progress = cacheProgress;
+        uncached.progress_data = &progress;
+    }
+
+    //-----
+    // the first BAM goes straight into MR and the rest are merged onto it in one go
+    //
+    PM_mapping_results ** MRs = calloc(numBams, sizeof(PM_mapping_results*));
+    MRs[0] = MR;
+    ret = loadOrParseBam(bamFiles[0], opts, &uncached, &progress, MR);
+    for(i = 1; i < numBams && ret == 0; ++i) {
+        MRs[i] = create_MR();
+        ret = loadOrParseBam(bamFiles[i], opts, &uncached, &progress, MRs[i]);
+    }
+    if(ret == 0) {
+        uint64_t start = statsClock();
+        adjustUnseenBams(MRs, numBams, opts);
+        MR->stats.timer_ns[PM_TIMER_ADJUST] += statsClock() - start;
+        start = statsClock();
+        ret = merge_MRs_many(MR, MRs + 1, numBams - 1);
+        MR->stats.timer_ns[PM_TIMER_MERGE] += statsClock() - start;
+    }
+    for(i = 1; i < numBams && MRs[i] != NULL; ++i) {
+        destroy_MR(MRs[i]);
+        free(MRs[i]);
+    }
+    free(MRs);
+    destroyProgress(progress.tracker);
+    return ret;
+}
@@ -0,0 +1,120 @@
+//#############################################################################
+//
+//   resultCache.h
+//
+//   Keep each BAM's mapping results on disk so unchanged BAMs aren't re-parsed
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_RESULT_CACHE_H
+  #define PM_RESULT_CACHE_H
+
+// system includes
+#include <stdint.h>
+#include <stddef.h>
+
+// local includes
+#include "bamParser.h"
+
+// hex digits in a cache key
+#define PM_CACHE_KEY_LEN 16
+// bytes digested from each end of a BAM (the header blocks and the EOF block)
+#define PM_CACHE_DIGEST_BYTES 65536
+// environment variable init_parse_options takes the cache directory from
+#define PM_CACHE_DIR_ENV "PM_CACHE_DIR"
+// starting value for hashBytes
+#define PM_FNV_OFFSET 0xcbf29ce484222325ULL
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract Progress of a cached parse, passed on one BAM at a time
+ @field tracker tracker of the whole parse
+ @field num_bams number of BAMs in the parse
+ @field num_contigs contigs in each BAM
+ @field contig_shares contigs finished, summed over the BAMs
+ @field bytes_reported compressed bytes of the current BAM already passed on
+ @field contigs_reported contigs of the current BAM already passed on
+ */
+typedef struct {
+    PM_progress_tracker * tracker;
+    int num_bams;
+    int num_contigs;
+    int contig_shares;
+    uint64_t bytes_reported;
+    int contigs_reported;
+} PM_cache_progress;
+
+/*!
+ * @abstract Fold some bytes into a 64 bit FNV-1a hash
+ *
+ * @param  hash  hash so far (PM_FNV_OFFSET to start)
+ * @param  data  bytes to add
+ * @param  length  number of bytes
+ * @return the new hash
+ */
+uint64_t hashBytes(uint64_t hash, const void * data, size_t length);
+
+/*!
+ * @abstract Work out the cache key of a BAM parsed with some settings
+ *
+ * @param  bamFile  BAM file to make a key for
+ * @param  opts  settings the BAM would be parsed with
+ * @param  key  set to the key (PM_CACHE_KEY_LEN hex digits and a NUL)
+ * @return 0 for success, 1 if the BAM can't be read
+ *
+ * @discussion The key is a 64 bit FNV-1a digest of the file's size and
+ * mtime, its first and last PM_CACHE_DIGEST_BYTES, every setting which
+ * changes the results (baseQ, mapQ, min_len, do_links, ignore_supps,
+ * do_outlier_coverage, the coverage fractions and any regions, including
+ * the contents of the BED file) and PM_RESULTS_VERSION. The path is not
+ * part of the key so a BAM which is moved or renamed is still found.
+ */
+int cacheKey(char * bamFile, PM_parse_options * opts, char * key);
+
+/*!
+ * @abstract Parse the BAM files, reusing any results already in the cache
+ *
+ * @param numBams  number of BAM files to parse
+ * @param bamFiles  filenames of BAM files to parse
+ * @param opts  settings to parse with, opts->cache_dir must be set
+ * @param MR  mapping results struct to write to
+ * @return 0 for success
+ *
+ * @discussion Each BAM is looked up in opts->cache_dir (made if need be).
+ * BAMs which are missing are parsed on their own and saved there with
+ * save_MR along with the contigs they had reads on. Before the single BAM
+ * results are spliced together in the order given with merge_MRs_many, each
+ * BAM is adjusted with nothing piled up on the contigs only the others had
+ * reads on, as the multi-pileup does, so MR is the same as if all the BAMs
+ * had been parsed together. Links from each BAM are grouped together in the
+ * link chains rather than in pileup order. A hit counts as the whole BAM
+ * read in one go towards the progress of the parse.
+ */
+int parseCoverageAndLinksCached(int numBams,
+                                char* bamFiles[],
+                                PM_parse_options * opts,
+                                PM_mapping_results * MR);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_RESULT_CACHE_H
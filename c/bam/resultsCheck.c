@@ -0,0 +1,274 @@
+//#############################################################################
+//
+//   resultsCheck.c
+//
+//   Check results files and the cache give back exactly what was parsed
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+
+// local includes
+#include "bamParser.h"
+#include "pairedLink.h"
+#include "resultsFile.h"
+#include "resultCache.h"
+
+// where the results files and the cache go, removed afterwards
+#define PM_CHECK_DIR_TEMPLATE "/tmp/pmResultsCheck.XXXXXX"
+
+/*! @typedef
+ @abstract One link, flattened so two sets of links can be sorted and compared
+ */
+typedef struct {
+    uint32_t cid_1;
+    uint32_t cid_2;
+    uint32_t pos_1;
+    uint32_t pos_2;
+    uint32_t orient;
+    uint32_t bam_ID;
+} PM_check_link;
+
+static int compareLinks(const void * a, const void * b)
+{
+    return memcmp(a, b, sizeof(PM_check_link));
+}
+
+static PM_check_link * flatLinks(PM_link_columns * LC, int sorted)
+{
+    PM_check_link * links = calloc(LC->num_links + 1, sizeof(PM_check_link));
+    size_t i = 0;
+    for(i = 0; i < LC->num_links; ++i) {
+        links[i].cid_1 = LC->cid_1[i];
+        links[i].cid_2 = LC->cid_2[i];
+        links[i].pos_1 = LC->pos_1[i];
+        links[i].pos_2 = LC->pos_2[i];
+        links[i].orient = LC->orient[i];
+        links[i].bam_ID = LC->bam_ID[i];
+    }
+    if(sorted)
+        qsort(links, LC->num_links, sizeof(PM_check_link), compareLinks);
+    return links;
+}
+
+static int compareLinkColumns(PM_mapping_results * A, PM_mapping_results * B, const char * what, int exact)
+{
+    //-----
+    // exact compares the columns as they come out, otherwise only the sets
+    // (the cache groups links by BAM rather than in pileup order)
+    //
+    PM_link_columns * LA = compactLinks(A->links);
+    PM_link_columns * LB = compactLinks(B->links);
+    PM_check_link * la = NULL, * lb = NULL;
+    int diffs = 0;
+    if(LA->num_links != LB->num_links || LA->num_pairs != LB->num_pairs) {
+        printf("%s: %zu links in %zu pairs against %zu in %zu\n", what,
+               (size_t)LA->num_links, (size_t)LA->num_pairs, (size_t)LB->num_links, (size_t)LB->num_pairs);
+        diffs = 1;
+    } else {
+        if(exact && memcmp(LA->offsets, LB->offsets, (LA->num_pairs + 1) * sizeof(uint64_t)) != 0) {
+            printf("%s: link pairs differ\n", what);
+            diffs = 1;
+        }
+        la = flatLinks(LA, !exact);
+        lb = flatLinks(LB, !exact);
+        if(memcmp(la, lb, LA->num_links * sizeof(PM_check_link)) != 0) {
+            printf("%s: links differ\n", what);
+            diffs = 1;
+        }
+        free(la);
+        free(lb);
+    }
+    destroyLinkColumns(LA);
+    destroyLinkColumns(LB);
+    return diffs;
+}
+
+static int compareResults(PM_mapping_results * A, PM_mapping_results * B, const char * what, int exactLinks)
+{
+    uint32_t tid = 0, bam = 0;
+    int diffs = 0;
+    if(A->num_contigs != B->num_contigs || A->num_bams != B->num_bams ||
+       A->is_outlier_coverage != B->is_outlier_coverage ||
+       A->is_links_included != B->is_links_included ||
+       A->region_digest != B->region_digest ||
+       (A->region_lengths == NULL) != (B->region_lengths == NULL)) {
+        printf("%s: the results describe different parses\n", what);
+        return 1;
+    }
+    for(tid = 0; tid < A->num_contigs; ++tid) {
+        if(strcmp(A->contig_names[tid], B->contig_names[tid]) != 0 ||
+           A->contig_lengths[tid] != B->contig_lengths[tid] ||
+           PM_MR_LENGTH(A, tid) != PM_MR_LENGTH(B, tid)) {
+            printf("%s: contig %u is %s (%u, %u parsed) against %s (%u, %u parsed)\n", what, tid,
+                   A->contig_names[tid], A->contig_lengths[tid], PM_MR_LENGTH(A, tid),
+                   B->contig_names[tid], B->contig_lengths[tid], PM_MR_LENGTH(B, tid));
+            ++diffs;
+        }
+        for(bam = 0; bam < A->num_bams; ++bam) {
+            size_t cell = PM_MR_CELL(A, tid, bam);
+            if(A->plp_bp[cell] != B->plp_bp[cell] ||
+               (A->is_outlier_coverage &&
+                A->contig_length_correctors[cell] != B->contig_length_correctors[cell])) {
+                printf("%s: %s in BAM %u has %u bases and corrector %u against %u and %u\n", what,
+                       A->contig_names[tid], bam, A->plp_bp[cell],
+                       A->is_outlier_coverage ? A->contig_length_correctors[cell] : 0, B->plp_bp[cell],
+                       B->is_outlier_coverage ? B->contig_length_correctors[cell] : 0);
+                ++diffs;
+            }
+        }
+    }
+    return diffs + compareLinkColumns(A, B, what, exactLinks);
+}
+
+static int checkRoundTrip(PM_mapping_results * parsed, char * dir, const char * what)
+{
+    //-----
+    // save_MR then load_MR must give back the same results
+    //
+    char path[256], str[256];
+    PM_mapping_results * loaded = create_MR();
+    int diffs = 0;
+    snprintf(path, sizeof(path), "%s/check.pmr", dir);
+    snprintf(str, sizeof(str), "%s saved and loaded", what);
+    if(save_MR(parsed, path) != 0 || load_MR(path, loaded) != 0) {
+        printf("%s: could not save and load the results\n", what);
+        diffs = 1;
+    } else {
+        diffs = compareResults(parsed, loaded, str, 1);
+    }
+    destroy_MR(loaded);
+    free(loaded);
+    unlink(path);
+    return diffs;
+}
+
+static int checkCache(int numBams, char ** bamFiles, PM_parse_options * opts,
+                      PM_mapping_results * parsed, char * dir, const char * what)
+{
+    //-----
+    // the first cached parse fills the cache, the second must read nothing
+    // but the cache and both must match a plain parse
+    //
+    char str[256], key[PM_CACHE_KEY_LEN + 1], path[256];
+    PM_parse_options cached = *opts;
+    PM_mapping_results * miss = create_MR();
+    PM_mapping_results * hit = create_MR();
+    int diffs = 0, i = 0;
+    cached.cache_dir = dir;
+    if(parseCoverageAndLinksWithOptions(numBams, bamFiles, &cached, miss) != 0 ||
+       parseCoverageAndLinksWithOptions(numBams, bamFiles, &cached, hit) != 0) {
+        printf("%s: could not parse the BAMs with a cache\n", what);
+        diffs = 1;
+    } else {
+        if(hit->stats.records_read != 0) {
+            printf("%s: the second cached parse read %llu records\n", what,
+                   (unsigned long long)hit->stats.records_read);
+            ++diffs;
+        }
+        snprintf(str, sizeof(str), "%s cache miss", what);
+        diffs += compareResults(parsed, miss, str, 0);
+        snprintf(str, sizeof(str), "%s cache hit", what);
+        diffs += compareResults(miss, hit, str, 1);
+    }
+    for(i = 0; i < numBams; ++i) {
+        if(cacheKey(bamFiles[i], &cached, key) == 0) {
+            snprintf(path, sizeof(path), "%s/%s.pmr", dir, key);
+            unlink(path);
+        }
+    }
+    destroy_MR(miss);
+    destroy_MR(hit);
+    free(miss);
+    free(hit);
+    return diffs;
+}
+
+static int checkMode(int numBams, char ** bamFiles, int mode, char * region, char * dir)
+{
+    char what[64];
+    PM_parse_options opts;
+    PM_mapping_results * parsed = create_MR();
+    int diffs = 0;
+    init_parse_options(&opts);
+    opts.do_links = 1;
+    opts.do_outlier_coverage = mode;
+    opts.cache_dir = NULL;
+    if(region != NULL) {
+        opts.regions = &region;
+        opts.num_regions = 1;
+    }
+    snprintf(what, sizeof(what), "mode %d%s", mode, region ? " in a region" : "");
+    if(parseCoverageAndLinksWithOptions(numBams, bamFiles, &opts, parsed) != 0) {
+        printf("%s: could not parse the BAMs\n", what);
+        diffs = 1;
+    } else {
+        diffs = checkRoundTrip(parsed, dir, what) + checkCache(numBams, bamFiles, &opts, parsed, dir, what);
+    }
+    printf("%s: %s (%u contigs, %u BAMs)\n", what, diffs ? "FAILED" : "ok",
+           parsed->num_contigs, parsed->num_bams);
+    destroy_MR(parsed);
+    free(parsed);
+    return diffs;
+}
+
+int main(int argc, char *argv[])
+{
+    //-----
+    // parse the same BAMs in every coverage mode, over whole contigs and
+    // over the first half of the first contig, and check the results come
+    // back unchanged from a results file and from the cache
+    //
+    char dir[] = PM_CHECK_DIR_TEMPLATE;
+    char region[256];
+    int mode = 0, failed = 0;
+    if(argc < 2) {
+        fprintf(stderr, "\n");
+        fprintf(stderr, "Usage: pmResultsCheck in1.bam [in2.bam [...]]\n");
+        fprintf(stderr, "   The BAMs must share a header and be indexed.\n");
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    if(mkdtemp(dir) == NULL) {
+        printError("Could not make a directory for the results files", __LINE__);
+        return 1;
+    }
+
+    // the region needs a contig name from the header
+    region[0] = '\0';
+    PM_mapping_results * MR = create_MR();
+    PM_parse_options opts;
+    init_parse_options(&opts);
+    opts.cache_dir = NULL;
+    if(parseCoverageAndLinksWithOptions(argc - 1, argv + 1, &opts, MR) == 0 && MR->num_contigs != 0)
+        snprintf(region, sizeof(region), "%s:1-%u", MR->contig_names[0], (MR->contig_lengths[0] + 1) / 2);
+    destroy_MR(MR);
+    free(MR);
+
+    for(mode = PM_COVERAGE_MEAN; mode <= PM_COVERAGE_PERCENTILE_CLIP; ++mode) {
+        failed += (checkMode(argc - 1, argv + 1, mode, NULL, dir) != 0);
+        if(region[0] != '\0')
+            failed += (checkMode(argc - 1, argv + 1, mode, region, dir) != 0);
+    }
+    rmdir(dir);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,371 @@
+//#############################################################################
+//
+//   resultsFile.c
+//
+//   Save mapping results to disk and map them back in without parsing
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// local includes
+#include "resultsFile.h"
+#include "bamParser.h"
+#include "pairedLink.h"
+
+#define PM_RESULTS_ALIGN_UP(x) (((x) + PM_RESULTS_ALIGN - 1) & ~(uint64_t)(PM_RESULTS_ALIGN - 1))
+
+static char * joinNames(char ** names, uint32_t numNames, uint64_t * size)
+{
+    //-----
+    // pack names end to end, each with its NUL
+    //
+    uint32_t i = 0;
+    char * pool = NULL, * cursor = NULL;
+    *size = 0;
+    for(i = 0; i < numNames; ++i) {
+        *size += strlen(names[i]) + 1;
+    }
+    pool = malloc(*size + 1);
+    cursor = pool;
+    for(i = 0; i < numNames; ++i) {
+        size_t len = strlen(names[i]) + 1;
+        memcpy(cursor, names[i], len);
+        cursor += len;
+    }
+    return pool;
+}
+
+static int splitNames(char * pool, uint64_t size, uint32_t numNames, char ** names)
+{
+    //-----
+    // point names at each string in the pool, 1 if the count is wrong
+    //
+    uint32_t i = 0;
+    uint64_t pos = 0;
+    for(i = 0; i < numNames; ++i) {
+        char * end = (pos < size) ? memchr(pool + pos, '\0', size - pos) : NULL;
+        if(end == NULL)
+            return 1;
+        names[i] = pool + pos;
+        pos = (uint64_t)(end - pool) + 1;
+    }
+    return (pos != size);
+}
+
+int save_MR(PM_mapping_results * MR, char * fileName)
+{
+    PM_results_header H;
+    const void * data[PM_NUM_SECTIONS];
+    char * contig_pool = NULL, * bam_pool = NULL;
+    PM_link_columns * LC = NULL;
+    size_t cells = (size_t)MR->num_contigs * MR->num_bams;
+    uint64_t offset = 0, written = 0;
+    static const char padding[PM_RESULTS_ALIGN] = {0};
+    char * tmp_name = NULL;
+    FILE * fp = NULL;
+    int s = 0, ret = 0;
+
+    memset(&H, 0, sizeof(PM_results_header));
+    memset(data, 0, sizeof(data));
+    memcpy(H.magic, PM_RESULTS_MAGIC, sizeof(H.magic));
+    H.version = PM_RESULTS_VERSION;
+    H.byte_order = PM_RESULTS_BYTE_ORDER;
+    H.num_bams = MR->num_bams;
+    H.num_contigs = MR->num_contigs;
+    H.is_links_included = MR->is_links_included;
+    H.is_outlier_coverage = MR->is_outlier_coverage;
+    H.is_ignore_supps = MR->is_ignore_supps;
+    H.coverage_lower = MR->coverage_lower;
+    H.coverage_upper = MR->coverage_upper;
+    H.region_digest = MR->region_digest;
+
+    //-----
+    // work out what goes in each section
+    //
+    if(MR->num_contigs != 0 && MR->num_bams != 0) {
+        data[PM_SECTION_CONTIG_LENGTHS] = MR->contig_lengths;
+        H.sections[PM_SECTION_CONTIG_LENGTHS].size = MR->num_contigs * sizeof(uint32_t);
+        data[PM_SECTION_PLP_BP] = MR->plp_bp;
+        H.sections[PM_SECTION_PLP_BP].size = cells * sizeof(uint32_t);
+        if(MR->contig_length_correctors != NULL) {
+            data[PM_SECTION_CORRECTORS] = MR->contig_length_correctors;
+            H.sections[PM_SECTION_CORRECTORS].size = cells * sizeof(uint32_t);
+        }
+        if(MR->region_lengths != NULL) {
+            data[PM_SECTION_REGION_LENGTHS] = MR->region_lengths;
+            H.sections[PM_SECTION_REGION_LENGTHS].size = MR->num_contigs * sizeof(uint32_t);
+        }
+        if(MR->seen_contigs != NULL) {
+            data[PM_SECTION_SEEN_CONTIGS] = MR->seen_contigs;
+            H.sections[PM_SECTION_SEEN_CONTIGS].size = ((uint64_t)MR->num_contigs + 7) / 8;
+        }
+        contig_pool = joinNames(MR->contig_names, MR->num_contigs, &H.sections[PM_SECTION_CONTIG_NAMES].size);
+        data[PM_SECTION_CONTIG_NAMES] = contig_pool;
+        bam_pool = joinNames(MR->bam_file_names, MR->num_bams, &H.sections[PM_SECTION_BAM_NAMES].size);
+        data[PM_SECTION_BAM_NAMES] = bam_pool;
+    }
+    if(MR->is_links_included && MR->links != NULL) {
+        LC = compactLinks(MR->links);
+        data[PM_SECTION_LINK_OFFSETS] = LC->offsets;
+        H.sections[PM_SECTION_LINK_OFFSETS].size = (LC->num_pairs + 1) * sizeof(uint64_t);
+        data[PM_SECTION_LINK_CID_1] = LC->cid_1;
+        data[PM_SECTION_LINK_CID_2] = LC->cid_2;
+        data[PM_SECTION_LINK_POS_1] = LC->pos_1;
+        data[PM_SECTION_LINK_POS_2] = LC->pos_2;
+        data[PM_SECTION_LINK_ORIENT] = LC->orient;
+        data[PM_SECTION_LINK_BAM_ID] = LC->bam_ID;
+        H.sections[PM_SECTION_LINK_CID_1].size = LC->num_links * sizeof(uint32_t);
+        H.sections[PM_SECTION_LINK_CID_2].size = LC->num_links * sizeof(uint32_t);
+        H.sections[PM_SECTION_LINK_POS_1].size = LC->num_links * sizeof(uint32_t);
+        H.sections[PM_SECTION_LINK_POS_2].size = LC->num_links * sizeof(uint32_t);
+        H.sections[PM_SECTION_LINK_ORIENT].size = LC->num_links * sizeof(uint8_t);
+        H.sections[PM_SECTION_LINK_BAM_ID].size = LC->num_links * sizeof(uint32_t);
+    }
+
+    //-----
+    // lay the sections out one after the other
+    //
+    offset = PM_RESULTS_ALIGN_UP(sizeof(PM_results_header));
+    for(s = 0; s < PM_NUM_SECTIONS; ++s) {
+        H.sections[s].offset = offset;
+        offset = PM_RESULTS_ALIGN_UP(offset + H.sections[s].size);
+    }
+    H.file_size = offset;
+
+    //-----
+    // write it all out and only then put it where it belongs
+    //
+    tmp_name = malloc(strlen(fileName) + 32);
+    sprintf(tmp_name, "%s.tmp.%d", fileName, (int)getpid());
+    fp = fopen(tmp_name, "wb");
+    if(fp == NULL) {
+        char str[512];
+        snprintf(str, sizeof(str), "Could not open %s for writing", tmp_name);
+        printError(str, __LINE__);
+        ret = 1;
+    } else {
+        if(fwrite(&H, sizeof(PM_results_header), 1, fp) != 1)
+            ret = 1;
+        written = sizeof(PM_results_header);
+        for(s = 0; s < PM_NUM_SECTIONS && ret == 0; ++s) {
+            if(written < H.sections[s].offset) {
+                if(fwrite(padding, H.sections[s].offset - written, 1, fp) != 1)
+                    ret = 1;
+                written = H.sections[s].offset;
+            }
+            if(H.sections[s].size != 0) {
+                if(fwrite(data[s], H.sections[s].size, 1, fp) != 1)
+                    ret = 1;
+                written += H.sections[s].size;
+            }
+        }
+        if(ret == 0 && written < H.file_size) {
+            if(fwrite(padding, H.file_size - written, 1, fp) != 1)
+                ret = 1;
+        }
+        if(fclose(fp) != 0)
+            ret = 1;
+        if(ret == 0 && rename(tmp_name, fileName) != 0)
+            ret = 1;
+        if(ret != 0) {
+            char str[512];
+            snprintf(str, sizeof(str), "Could not write results to %s", fileName);
+            printError(str, __LINE__);
+            unlink(tmp_name);
+        }
+    }
+
+    free(tmp_name);
+    free(contig_pool);
+    free(bam_pool);
+    destroyLinkColumns(LC);
+    return ret;
+}
+
+static int checkHeader(PM_results_header * H, uint64_t fileSize)
+{
+    //-----
+    // 0 if the header describes a file we can use as is
+    //
+    size_t cells = (size_t)H->num_contigs * H->num_bams;
+    int has_counts = (cells != 0);
+    int s = 0;
+    uint64_t num_links = 0;
+    if(memcmp(H->magic, PM_RESULTS_MAGIC, sizeof(H->magic)) != 0 ||
+       H->version != PM_RESULTS_VERSION ||
+       H->byte_order != PM_RESULTS_BYTE_ORDER ||
+       H->file_size != fileSize)
+        return 1;
+    for(s = 0; s < PM_NUM_SECTIONS; ++s) {
+        if(H->sections[s].offset % PM_RESULTS_ALIGN != 0 ||
+           H->sections[s].offset > fileSize ||
+           H->sections[s].size > fileSize - H->sections[s].offset)
+            return 1;
+    }
+    if(H->sections[PM_SECTION_CONTIG_LENGTHS].size != (has_counts ? H->num_contigs * sizeof(uint32_t) : 0) ||
+       H->sections[PM_SECTION_PLP_BP].size != (has_counts ? cells * sizeof(uint32_t) : 0) ||
+       H->sections[PM_SECTION_CORRECTORS].size != ((has_counts && H->is_outlier_coverage) ? cells * sizeof(uint32_t) : 0))
+        return 1;
+    if(H->sections[PM_SECTION_REGION_LENGTHS].size != 0 &&
+       H->sections[PM_SECTION_REGION_LENGTHS].size != H->num_contigs * sizeof(uint32_t))
+        return 1;
+    if(H->sections[PM_SECTION_SEEN_CONTIGS].size != 0 &&
+       H->sections[PM_SECTION_SEEN_CONTIGS].size != ((uint64_t)H->num_contigs + 7) / 8)
+        return 1;
+    num_links = H->sections[PM_SECTION_LINK_POS_1].size / sizeof(uint32_t);
+    if(H->sections[PM_SECTION_LINK_CID_1].size != num_links * sizeof(uint32_t) ||
+       H->sections[PM_SECTION_LINK_CID_2].size != num_links * sizeof(uint32_t) ||
+       H->sections[PM_SECTION_LINK_POS_2].size != num_links * sizeof(uint32_t) ||
+       H->sections[PM_SECTION_LINK_ORIENT].size != num_links * sizeof(uint8_t) ||
+       H->sections[PM_SECTION_LINK_BAM_ID].size != num_links * sizeof(uint32_t))
+        return 1;
+    return 0;
+}
+
+int load_MR(char * fileName, PM_mapping_results * MR)
+{
+    struct stat st;
+    char * base = NULL;
+    PM_results_header * H = NULL;
+    uint32_t i = 0;
+    uint64_t l = 0, num_links = 0;
+    char str[512];
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0 || (uint64_t)st.st_size < sizeof(PM_results_header)) {
+        snprintf(str, sizeof(str), "Could not read results from %s", fileName);
+        printError(str, __LINE__);
+        if(fd >= 0) close(fd);
+        return 1;
+    }
+    // private so that adjusting the counts in memory never reaches the file
+    base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) {
+        snprintf(str, sizeof(str), "Could not map %s", fileName);
+        printError(str, __LINE__);
+        return 1;
+    }
+    H = (PM_results_header *)base;
+    if(checkHeader(H, (uint64_t)st.st_size) != 0) {
+        snprintf(str, sizeof(str), "%s is not a version %d results file", fileName, PM_RESULTS_VERSION);
+        printError(str, __LINE__);
+        munmap(base, st.st_size);
+        return 1;
+    }
+
+    memset(MR, 0, sizeof(PM_mapping_results));
+    MR->mapping = base;
+    MR->mapping_size = st.st_size;
+    MR->num_bams = H->num_bams;
+    MR->num_contigs = H->num_contigs;
+    MR->is_links_included = H->is_links_included;
+    MR->is_outlier_coverage = H->is_outlier_coverage;
+    MR->is_ignore_supps = H->is_ignore_supps;
+    MR->coverage_lower = H->coverage_lower;
+    MR->coverage_upper = H->coverage_upper;
+    MR->region_digest = H->region_digest;
+
+    //-----
+    // the big stuff stays where it is
+    //
+#define PM_SECTION_DATA(id) ((H->sections[id].size != 0) ? (void *)(base + H->sections[id].offset) : NULL)
+    if(MR->num_contigs != 0 && MR->num_bams != 0) {
+        MR->contig_lengths = PM_SECTION_DATA(PM_SECTION_CONTIG_LENGTHS);
+        MR->plp_bp = PM_SECTION_DATA(PM_SECTION_PLP_BP);
+        MR->contig_length_correctors = PM_SECTION_DATA(PM_SECTION_CORRECTORS);
+        MR->region_lengths = PM_SECTION_DATA(PM_SECTION_REGION_LENGTHS);
+        MR->seen_contigs = PM_SECTION_DATA(PM_SECTION_SEEN_CONTIGS);
+        // the names need pointers, but the strings stay in the file
+        MR->contig_names = calloc(MR->num_contigs, sizeof(char*));
+        MR->bam_file_names = calloc(MR->num_bams, sizeof(char*));
+        if(splitNames(base + H->sections[PM_SECTION_CONTIG_NAMES].offset,
+                      H->sections[PM_SECTION_CONTIG_NAMES].size,
+                      MR->num_contigs,
+                      MR->contig_names) != 0 ||
+           splitNames(base + H->sections[PM_SECTION_BAM_NAMES].offset,
+                      H->sections[PM_SECTION_BAM_NAMES].size,
+                      MR->num_bams,
+                      MR->bam_file_names) != 0) {
+            snprintf(str, sizeof(str), "Bad names in %s", fileName);
+            printError(str, __LINE__);
+            free(MR->contig_names);
+            free(MR->bam_file_names);
+            munmap(base, st.st_size);
+            memset(MR, 0, sizeof(PM_mapping_results));
+            return 1;
+        }
+        // merge_MRs replaces these so they have to be ours
+        for(i = 0; i < MR->num_bams; ++i) {
+            MR->bam_file_names[i] = strdup(MR->bam_file_names[i]);
+        }
+    }
+
+    //-----
+    // the link table is a hash so it has to be rebuilt
+    //
+    if(MR->is_links_included) {
+        uint32_t * cid_1 = PM_SECTION_DATA(PM_SECTION_LINK_CID_1);
+        uint32_t * cid_2 = PM_SECTION_DATA(PM_SECTION_LINK_CID_2);
+        uint32_t * pos_1 = PM_SECTION_DATA(PM_SECTION_LINK_POS_1);
+        uint32_t * pos_2 = PM_SECTION_DATA(PM_SECTION_LINK_POS_2);
+        uint8_t * orient = PM_SECTION_DATA(PM_SECTION_LINK_ORIENT);
+        uint32_t * bam_ID = PM_SECTION_DATA(PM_SECTION_LINK_BAM_ID);
+        num_links = H->sections[PM_SECTION_LINK_POS_1].size / sizeof(uint32_t);
+        MR->links = createLinkTable(MR->num_contigs);
+        for(l = 0; l < num_links; ++l) {
+            addLink(MR->links,
+                    cid_1[l],
+                    cid_2[l],
+                    pos_1[l],
+                    pos_2[l],
+                    orient[l] & 1,
+                    (orient[l] >> 1) & 1,
+                    bam_ID[l]);
+        }
+    }
+#undef PM_SECTION_DATA
+    return 0;
+}
+
+void freeMRBlock(PM_mapping_results * MR, void * block)
+{
+    char * p = (char *)block;
+    char * base = (char *)MR->mapping;
+    if(block == NULL)
+        return;
+    if(base != NULL && p >= base && p < base + MR->mapping_size)
+        return; // goes with the mapping
+    free(block);
+}
+
+void unmapMR(PM_mapping_results * MR)
+{
+    if(MR->mapping == NULL)
+        return;
+    munmap(MR->mapping, MR->mapping_size);
+    MR->mapping = NULL;
+    MR->mapping_size = 0;
+}
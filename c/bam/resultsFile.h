@@ -0,0 +1,178 @@
+//#############################################################################
+//
+//   resultsFile.h
+//
+//   Save mapping results to disk and map them back in without parsing
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_RESULTS_FILE_H
+  #define PM_RESULTS_FILE_H
+
+// system includes
+#include <stdint.h>
+#include <stddef.h>
+
+// local includes
+#include "bamParser.h"
+
+// first 8 bytes of every results file
+#define PM_RESULTS_MAGIC "PMRESLT"
+// bump this whenever the layout changes
+#define PM_RESULTS_VERSION 3
+// written natively, reads back as something else on a machine of the other endianness
+#define PM_RESULTS_BYTE_ORDER 0x01020304
+// every section starts on a multiple of this
+#define PM_RESULTS_ALIGN 8
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract The sections of a results file, in the order they are written
+ @constant PM_SECTION_CONTIG_LENGTHS uint32_t per contig
+ @constant PM_SECTION_PLP_BP uint32_t per contig per BAM, row-major
+ @constant PM_SECTION_CORRECTORS as PM_SECTION_PLP_BP, empty without outlier coverage
+ @constant PM_SECTION_REGION_LENGTHS uint32_t per contig, empty if whole contigs were parsed
+ @constant PM_SECTION_CONTIG_NAMES NUL terminated contig names, one after the other
+ @constant PM_SECTION_BAM_NAMES NUL terminated BAM file names, one after the other
+ @constant PM_SECTION_LINK_OFFSETS uint64_t per link pair plus one (see PM_link_columns)
+ @constant PM_SECTION_LINK_CID_1 uint32_t per link
+ @constant PM_SECTION_LINK_CID_2 uint32_t per link
+ @constant PM_SECTION_LINK_POS_1 uint32_t per link
+ @constant PM_SECTION_LINK_POS_2 uint32_t per link
+ @constant PM_SECTION_LINK_ORIENT uint8_t per link
+ @constant PM_SECTION_LINK_BAM_ID uint32_t per link
+ @constant PM_SECTION_SEEN_CONTIGS bit per contig (see PM_SEEN), empty if the MR didn't keep them
+ */
+typedef enum {
+    PM_SECTION_CONTIG_LENGTHS = 0,
+    PM_SECTION_PLP_BP,
+    PM_SECTION_CORRECTORS,
+    PM_SECTION_REGION_LENGTHS,
+    PM_SECTION_CONTIG_NAMES,
+    PM_SECTION_BAM_NAMES,
+    PM_SECTION_LINK_OFFSETS,
+    PM_SECTION_LINK_CID_1,
+    PM_SECTION_LINK_CID_2,
+    PM_SECTION_LINK_POS_1,
+    PM_SECTION_LINK_POS_2,
+    PM_SECTION_LINK_ORIENT,
+    PM_SECTION_LINK_BAM_ID,
+    PM_SECTION_SEEN_CONTIGS,
+    PM_NUM_SECTIONS
+} PM_results_section_id;
+
+/*! @typedef
+ @abstract Where a section lives in a results file
+ @field offset bytes from the start of the file
+ @field size bytes in the section (0 if it is empty)
+ */
+typedef struct {
+    uint64_t offset;
+    uint64_t size;
+} PM_results_section;
+
+/*! @typedef
+ @abstract Fixed size header at the start of a results file
+ @field magic PM_RESULTS_MAGIC
+ @field version PM_RESULTS_VERSION
+ @field byte_order PM_RESULTS_BYTE_ORDER
+ @field num_bams number of BAM files parsed
+ @field num_contigs number of reference sequences
+ @field is_links_included are links included
+ @field is_outlier_coverage PM_coverage_mode used
+ @field is_ignore_supps were supplementary alignments ignored
+ @field coverage_lower lower fraction used by the trimmed mean and percentile clip
+ @field coverage_upper upper fraction used by the trimmed mean and percentile clip
+ @field file_size total size of the file in bytes
+ @field region_digest regionSetDigest of the parsed regions (0 if whole contigs were parsed)
+ @field sections where each of the PM_results_section_id sections is
+ */
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t num_bams;
+    uint32_t num_contigs;
+    int32_t is_links_included;
+    int32_t is_outlier_coverage;
+    int32_t is_ignore_supps;
+    float coverage_lower;
+    float coverage_upper;
+    uint32_t reserved;
+    uint64_t file_size;
+    uint64_t region_digest;
+    PM_results_section sections[PM_NUM_SECTIONS];
+} PM_results_header;
+
+/*!
+ * @abstract Write mapping results to a file
+ *
+ * @param  MR  mapping results struct to save (unchanged)
+ * @param  fileName  file to write
+ * @return 0 for success
+ *
+ * @discussion The file is written next to fileName and renamed into place
+ * so a reader never sees half a file. The layout is native endian, the
+ * header records the byte order and load_MR refuses files that don't match.
+ */
+int save_MR(PM_mapping_results * MR, char * fileName);
+
+/*!
+ * @abstract Map a file made by save_MR back into a mapping results struct
+ *
+ * @param  fileName  file to read
+ * @param  MR  empty mapping results struct (from create_MR) to fill
+ * @return 0 for success
+ *
+ * @discussion The file is mmap'd privately and the counts, lengths and
+ * contig names point straight into it, so nothing is copied no matter how
+ * big the matrices are. Writes land in private copies of the pages and
+ * never reach the file. The link table is rebuilt from the stored columns
+ * as it has to be a hash. Call destroy_MR when done, which unmaps the file.
+ */
+int load_MR(char * fileName, PM_mapping_results * MR);
+
+/*!
+ * @abstract Free a block hanging off a mapping results struct
+ *
+ * @param  MR  mapping results struct the block belongs to
+ * @param  block  block to free (may be NULL)
+ * @return void
+ *
+ * @discussion Blocks inside a file mapped by load_MR are left alone.
+ */
+void freeMRBlock(PM_mapping_results * MR, void * block);
+
+/*!
+ * @abstract Unmap the file behind a mapping results struct
+ *
+ * @param  MR  mapping results struct to unmap
+ * @return void
+ *
+ * @discussion Does nothing if MR was not loaded with load_MR.
+ */
+void unmapMR(PM_mapping_results * MR);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_RESULTS_FILE_H
@@ -0,0 +1,267 @@
+//#############################################################################
+//
+//   stats.c
+//
+//   Single pass statistics over arrays of depths
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+// local includes
+#include "stats.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define PM_STATS_X86 1
+  #include <immintrin.h>
+#endif
+
+// vector iterations before the 32 bit lane sums must be widened;
+// each lane gets at most 2 x 65535 per iteration
+#define PM_STATS_BLOCK 32768
+
+//-----
+// scalar
+//
+static void sumSquaresScalar(const uint16_t * values, size_t size, uint64_t * sum, uint64_t * sumSquares)
+{
+    uint64_t s = 0, q = 0;
+    size_t i = 0;
+    for(i = 0; i < size; ++i) {
+        uint64_t v = values[i];
+        s += v;
+        q += v * v;
+    }
+    *sum = s;
+    *sumSquares = q;
+}
+
+static void clippedSumScalar(const uint16_t * values, size_t size, uint16_t lower, uint16_t upper, uint64_t * kept, uint64_t * drops)
+{
+    uint64_t k = 0, d = 0;
+    size_t i = 0;
+    for(i = 0; i < size; ++i) {
+        uint16_t v = values[i];
+        if(v >= lower && v <= upper)
+            k += v;
+        else
+            ++d;
+    }
+    *kept = k;
+    *drops = d;
+}
+
+#ifdef PM_STATS_X86
+//-----
+// SSE4.2
+//
+__attribute__((target("sse4.2")))
+static uint64_t hsum64x2(__m128i v)
+{
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, v);
+    return lanes[0] + lanes[1];
+}
+
+__attribute__((target("sse4.2")))
+static void sumSquaresSSE42(const uint16_t * values, size_t size, uint64_t * sum, uint64_t * sumSquares)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i s64 = zero, q64 = zero;
+    size_t i = 0, vec_end = size & ~(size_t)7;
+    while(i < vec_end) {
+        size_t stop = (vec_end - i > (size_t)PM_STATS_BLOCK * 8) ? i + (size_t)PM_STATS_BLOCK * 8 : vec_end;
+        __m128i s32 = zero;
+        for(; i < stop; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(values + i));
+            __m128i lo = _mm_unpacklo_epi16(x, zero);
+            __m128i hi = _mm_unpackhi_epi16(x, zero);
+            s32 = _mm_add_epi32(s32, _mm_add_epi32(lo, hi));
+            // squares of the even then odd 32 bit lanes as 64 bit values
+            q64 = _mm_add_epi64(q64, _mm_mul_epu32(lo, lo));
+            q64 = _mm_add_epi64(q64, _mm_mul_epu32(_mm_srli_epi64(lo, 32), _mm_srli_epi64(lo, 32)));
+            q64 = _mm_add_epi64(q64, _mm_mul_epu32(hi, hi));
+            q64 = _mm_add_epi64(q64, _mm_mul_epu32(_mm_srli_epi64(hi, 32), _mm_srli_epi64(hi, 32)));
+        }
+        s64 = _mm_add_epi64(s64, _mm_unpacklo_epi32(s32, zero));
+        s64 = _mm_add_epi64(s64, _mm_unpackhi_epi32(s32, zero));
+    }
+    sumSquaresScalar(values + vec_end, size - vec_end, sum, sumSquares);
+    *sum += hsum64x2(s64);
+    *sumSquares += hsum64x2(q64);
+}
+
+__attribute__((target("sse4.2")))
+static void clippedSumSSE42(const uint16_t * values, size_t size, uint16_t lower, uint16_t upper, uint64_t * kept, uint64_t * drops)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i vlo = _mm_set1_epi16((short)lower);
+    const __m128i vhi = _mm_set1_epi16((short)upper);
+    __m128i k64 = zero, n64 = zero;
+    size_t i = 0, vec_end = size & ~(size_t)7;
+    while(i < vec_end) {
+        size_t stop = (vec_end - i > (size_t)PM_STATS_BLOCK * 8) ? i + (size_t)PM_STATS_BLOCK * 8 : vec_end;
+        __m128i k32 = zero, n16 = zero;
+        for(; i < stop; i += 8) {
+            __m128i x = _mm_loadu_si128((const __m128i *)(values + i));
+            __m128i in = _mm_and_si128(_mm_cmpeq_epi16(_mm_max_epu16(x, vlo), x),
+                                       _mm_cmpeq_epi16(_mm_min_epu16(x, vhi), x));
+            __m128i k = _mm_and_si128(x, in);
+            k32 = _mm_add_epi32(k32, _mm_add_epi32(_mm_unpacklo_epi16(k, zero), _mm_unpackhi_epi16(k, zero)));
+            n16 = _mm_sub_epi16(n16, in); // in is -1 for kept lanes
+        }
+        k64 = _mm_add_epi64(k64, _mm_unpacklo_epi32(k32, zero));
+        k64 = _mm_add_epi64(k64, _mm_unpackhi_epi32(k32, zero));
+        __m128i n32 = _mm_add_epi32(_mm_unpacklo_epi16(n16, zero), _mm_unpackhi_epi16(n16, zero));
+        n64 = _mm_add_epi64(n64, _mm_unpacklo_epi32(n32, zero));
+        n64 = _mm_add_epi64(n64, _mm_unpackhi_epi32(n32, zero));
+    }
+    clippedSumScalar(values + vec_end, size - vec_end, lower, upper, kept, drops);
+    *kept += hsum64x2(k64);
+    *drops += vec_end - hsum64x2(n64);
+}
+
+//-----
+// AVX2
+//
+__attribute__((target("avx2")))
+static uint64_t hsum64x4(__m256i v)
+{
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, v);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target("avx2")))
+static void sumSquaresAVX2(const uint16_t * values, size_t size, uint64_t * sum, uint64_t * sumSquares)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i s64 = zero, q64 = zero;
+    size_t i = 0, vec_end = size & ~(size_t)15;
+    while(i < vec_end) {
+        size_t stop = (vec_end - i > (size_t)PM_STATS_BLOCK * 16) ? i + (size_t)PM_STATS_BLOCK * 16 : vec_end;
+        __m256i s32 = zero;
+        for(; i < stop; i += 16) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(values + i));
+            __m256i lo = _mm256_unpacklo_epi16(x, zero);
+            __m256i hi = _mm256_unpackhi_epi16(x, zero);
+            s32 = _mm256_add_epi32(s32, _mm256_add_epi32(lo, hi));
+            q64 = _mm256_add_epi64(q64, _mm256_mul_epu32(lo, lo));
+            q64 = _mm256_add_epi64(q64, _mm256_mul_epu32(_mm256_srli_epi64(lo, 32), _mm256_srli_epi64(lo, 32)));
+            q64 = _mm256_add_epi64(q64, _mm256_mul_epu32(hi, hi));
+            q64 = _mm256_add_epi64(q64, _mm256_mul_epu32(_mm256_srli_epi64(hi, 32), _mm256_srli_epi64(hi, 32)));
+        }
+        s64 = _mm256_add_epi64(s64, _mm256_unpacklo_epi32(s32, zero));
+        s64 = _mm256_add_epi64(s64, _mm256_unpackhi_epi32(s32, zero));
+    }
+    sumSquaresScalar(values + vec_end, size - vec_end, sum, sumSquares);
+    *sum += hsum64x4(s64);
+    *sumSquares += hsum64x4(q64);
+}
+
+__attribute__((target("avx2")))
+static void clippedSumAVX2(const uint16_t * values, size_t size, uint16_t lower, uint16_t upper, uint64_t * kept, uint64_t * drops)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i vlo = _mm256_set1_epi16((short)lower);
+    const __m256i vhi = _mm256_set1_epi16((short)upper);
+    __m256i k64 = zero, n64 = zero;
+    size_t i = 0, vec_end = size & ~(size_t)15;
+    while(i < vec_end) {
+        size_t stop = (vec_end - i > (size_t)PM_STATS_BLOCK * 16) ? i + (size_t)PM_STATS_BLOCK * 16 : vec_end;
+        __m256i k32 = zero, n16 = zero;
+        for(; i < stop; i += 16) {
+            __m256i x = _mm256_loadu_si256((const __m256i *)(values + i));
+            __m256i in = _mm256_and_si256(_mm256_cmpeq_epi16(_mm256_max_epu16(x, vlo), x),
+                                          _mm256_cmpeq_epi16(_mm256_min_epu16(x, vhi), x));
+            __m256i k = _mm256_and_si256(x, in);
+            k32 = _mm256_add_epi32(k32, _mm256_add_epi32(_mm256_unpacklo_epi16(k, zero), _mm256_unpackhi_epi16(k, zero)));
+            n16 = _mm256_sub_epi16(n16, in); // in is -1 for kept lanes
+        }
+        k64 = _mm256_add_epi64(k64, _mm256_unpacklo_epi32(k32, zero));
+        k64 = _mm256_add_epi64(k64, _mm256_unpackhi_epi32(k32, zero));
+        __m256i n32 = _mm256_add_epi32(_mm256_unpacklo_epi16(n16, zero), _mm256_unpackhi_epi16(n16, zero));
+        n64 = _mm256_add_epi64(n64, _mm256_unpacklo_epi32(n32, zero));
+        n64 = _mm256_add_epi64(n64, _mm256_unpackhi_epi32(n32, zero));
+    }
+    clippedSumScalar(values + vec_end, size - vec_end, lower, upper, kept, drops);
+    *kept += hsum64x4(k64);
+    *drops += vec_end - hsum64x4(n64);
+}
+#endif // PM_STATS_X86
+
+//-----
+// dispatch
+//
+static PM_stats_kernel kernel_level = PM_STATS_SCALAR;
+static void (*sum_squares_kernel)(const uint16_t *, size_t, uint64_t *, uint64_t *) = sumSquaresScalar;
+static void (*clipped_sum_kernel)(const uint16_t *, size_t, uint16_t, uint16_t, uint64_t *, uint64_t *) = clippedSumScalar;
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+static void chooseKernels(void)
+{
+    PM_stats_kernel cap = PM_STATS_AVX2;
+    const char * env = getenv("PM_STATS_KERNEL");
+    if(env != NULL) {
+        if(strcmp(env, "scalar") == 0) cap = PM_STATS_SCALAR;
+        else if(strcmp(env, "sse4.2") == 0) cap = PM_STATS_SSE42;
+    }
+#ifdef PM_STATS_X86
+    __builtin_cpu_init();
+    if(cap >= PM_STATS_AVX2 && __builtin_cpu_supports("avx2")) {
+        kernel_level = PM_STATS_AVX2;
+        sum_squares_kernel = sumSquaresAVX2;
+        clipped_sum_kernel = clippedSumAVX2;
+    } else if(cap >= PM_STATS_SSE42 && __builtin_cpu_supports("sse4.2")) {
+        kernel_level = PM_STATS_SSE42;
+        sum_squares_kernel = sumSquaresSSE42;
+        clipped_sum_kernel = clippedSumSSE42;
+    }
+#else
+    (void)cap;
+#endif
+}
+
+PM_stats_kernel PM_statsKernel(void)
+{
+    pthread_once(&kernel_once, chooseKernels);
+    return kernel_level;
+}
+
+void PM_sumSquares(const uint16_t * values,
+                   size_t size,
+                   uint64_t * sum,
+                   uint64_t * sumSquares)
+{
+    pthread_once(&kernel_once, chooseKernels);
+    sum_squares_kernel(values, size, sum, sumSquares);
+}
+
+void PM_clippedSum(const uint16_t * values,
+                   size_t size,
+                   uint16_t lower,
+                   uint16_t upper,
+                   uint64_t * kept,
+                   uint64_t * drops)
+{
+    pthread_once(&kernel_once, chooseKernels);
+    clipped_sum_kernel(values, size, lower, upper, kept, drops);
+}
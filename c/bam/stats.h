@@ -1,8 +1,8 @@
 //#############################################################################
 //
 //   stats.h
-//   
-//   Curse you C!!!!!
+//
+//   Single pass statistics over arrays of depths
 //
 //   Copyright (C) Michael Imelfort
 //
@@ -21,43 +21,73 @@
 //
 //#############################################################################
 
-#include <stdio.h> 
+#ifndef PM_STATS_H
+  #define PM_STATS_H
+
+// system includes
 #include <stdint.h>
-#include <math.h> 
-
-/*find and print the average*/ 
-float PM_mean(uint32_t * values, uint32_t size) 
-{ 
-    uint32_t sum = 0; 
-    int i = 0; 
-    for( i = 0; i < size; ++i) {
-        sum += *(values + i); 
-    }
-    return (float)sum/(float)size; 
-} 
-
-float PM_stdDev(uint32_t * values, uint32_t size, float m) 
-{ 
-    float sum = 0; 
-    int i = 0; 
-    if(m == -1)
-        m = PM_mean(values, size); 
-    for(i = 0; i < size; ++i) {
-        sum += pow((float)*(values + i) - m, 2); 
-    }
-    return sqrt(sum/(float)size); 
-} 
-
-float PM_fakeStdDev(uint32_t * values, uint32_t size) 
-{ 
-    // everything is 3 stdevs from the mean right?
-    uint32_t max = 0, min = 1<<30; 
-    int i = 0; 
-    for( i = 0; i < size; ++i) {
-        if (*(values + i) > max)
-            max = *(values + i);
-        else if (*(values + i) < min)
-            min = *(values + i);
-    }
-    return (float)(max-min)/6; 
-} 
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract Instruction sets the kernels can be run with
+ */
+typedef enum {
+    PM_STATS_SCALAR = 0,
+    PM_STATS_SSE42,
+    PM_STATS_AVX2
+} PM_stats_kernel;
+
+/*!
+ * @abstract Find out which kernels are being used
+ *
+ * @return the best instruction set this CPU supports
+ *
+ * @discussion Worked out once on first use. Setting the environment variable
+ * PM_STATS_KERNEL to "scalar" or "sse4.2" caps the choice, which is handy for
+ * benchmarking.
+ */
+PM_stats_kernel PM_statsKernel(void);
+
+/*!
+ * @abstract Sum the values and their squares in one pass
+ *
+ * @param  values  array of depths
+ * @param  size  number of values
+ * @param  sum  set to the sum of values
+ * @param  sumSquares  set to the sum of the squared values
+ * @return void
+ *
+ * @discussion Both sums are 64 bit so deep, long contigs can't overflow.
+ */
+void PM_sumSquares(const uint16_t * values,
+                   size_t size,
+                   uint64_t * sum,
+                   uint64_t * sumSquares);
+
+/*!
+ * @abstract Sum the values lying in [lower, upper] and count the rest
+ *
+ * @param  values  array of depths
+ * @param  size  number of values
+ * @param  lower  smallest value kept
+ * @param  upper  largest value kept
+ * @param  kept  set to the sum of the values kept
+ * @param  drops  set to the number of values outside the range
+ * @return void
+ */
+void PM_clippedSum(const uint16_t * values,
+                   size_t size,
+                   uint16_t lower,
+                   uint16_t upper,
+                   uint64_t * kept,
+                   uint64_t * drops);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_STATS_H
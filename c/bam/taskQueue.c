@@ -0,0 +1,102 @@
+//#############################################################################
+//
+//   taskQueue.c
+//
+//   Hand out tasks to worker threads, letting idle workers steal from busy ones
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+// system includes
+#include <stdlib.h>
+
+// local includes
+#include "taskQueue.h"
+
+#define PM_RANGE(next, end) (((uint64_t)(end) << 32) | (uint32_t)(next))
+#define PM_RANGE_NEXT(range) ((uint32_t)(range))
+#define PM_RANGE_END(range) ((uint32_t)((range) >> 32))
+
+void initTaskQueue(PM_task_queue * Q, int * bounds, int numWorkers)
+{
+    int w = 0;
+    Q->num_workers = numWorkers;
+    Q->ranges = calloc(numWorkers, sizeof(PM_task_range));
+    for(w = 0; w < numWorkers; ++w) {
+        Q->ranges[w].range = PM_RANGE(bounds[w], bounds[w+1]);
+    }
+}
+
+void destroyTaskQueue(PM_task_queue * Q)
+{
+    free(Q->ranges);
+    Q->ranges = NULL;
+    Q->num_workers = 0;
+}
+
+static int takeOwn(PM_task_range * R)
+{
+    uint64_t range = __atomic_load_n(&R->range, __ATOMIC_ACQUIRE);
+    while(PM_RANGE_NEXT(range) < PM_RANGE_END(range)) {
+        uint64_t taken = PM_RANGE(PM_RANGE_NEXT(range) + 1, PM_RANGE_END(range));
+        if(__atomic_compare_exchange_n(&R->range, &range, taken, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return (int)PM_RANGE_NEXT(range);
+        // a thief got in first, range now holds what it left us
+    }
+    return -1;
+}
+
+static int steal(PM_task_queue * Q, int worker)
+{
+    //-----
+    // task numbers are only ever handed out once, so a range word can't come
+    // back round to a value a thief has already read and the CAS is ABA safe
+    //
+    while(1) {
+        int w = 0, victim = -1;
+        uint32_t most = 0;
+        uint64_t range = 0;
+        for(w = 0; w < Q->num_workers; ++w) {
+            uint64_t r = __atomic_load_n(&Q->ranges[w].range, __ATOMIC_ACQUIRE);
+            uint32_t left = PM_RANGE_END(r) - PM_RANGE_NEXT(r);
+            if(w != worker && PM_RANGE_NEXT(r) < PM_RANGE_END(r) && left > most) {
+                most = left;
+                victim = w;
+                range = r;
+            }
+        }
+        if(victim < 0)
+            return -1;
+        uint32_t next = PM_RANGE_NEXT(range), end = PM_RANGE_END(range);
+        uint32_t mid = end - (end - next + 1) / 2;
+        if(__atomic_compare_exchange_n(&Q->ranges[victim].range, &range, PM_RANGE(next, mid),
+                                       0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            // keep the first of the stolen tasks and the rest become ours
+            __atomic_store_n(&Q->ranges[worker].range, PM_RANGE(mid + 1, end), __ATOMIC_RELEASE);
+            return (int)mid;
+        }
+        // the victim moved on, look again
+    }
+}
+
+int nextTask(PM_task_queue * Q, int worker)
+{
+    int task = takeOwn(&Q->ranges[worker]);
+    if(task < 0)
+        task = steal(Q, worker);
+    return task;
+}
@@ -0,0 +1,96 @@
+//#############################################################################
+//
+//   taskQueue.h
+//
+//   Hand out tasks to worker threads, letting idle workers steal from busy ones
+//
+//   Copyright (C) Michael Imelfort
+//
+//   This program is free software: you can redistribute it and/or modify
+//   it under the terms of the GNU General Public License as published by
+//   the Free Software Foundation, either version 3 of the License, or
+//   (at your option) any later version.
+//
+//   This program is distributed in the hope that it will be useful,
+//   but WITHOUT ANY WARRANTY; without even the implied warranty of
+//   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//   GNU General Public License for more details.
+//
+//   You should have received a copy of the GNU General Public License
+//   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+//#############################################################################
+
+#ifndef PM_TASK_QUEUE_H
+  #define PM_TASK_QUEUE_H
+
+// system includes
+#include <stdint.h>
+
+// keeps each worker's range on a cache line of its own
+#define PM_TASK_RANGE_PAD 64
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*! @typedef
+ @abstract The tasks a worker has yet to start
+ @field range (end << 32) | next, the worker owns tasks [next, end)
+ @discussion Both halves live in one word so the owner taking from the front
+ and a thief taking from the back are each a single compare and swap.
+ */
+typedef struct {
+    uint64_t range;
+    char pad[PM_TASK_RANGE_PAD - sizeof(uint64_t)];
+} PM_task_range;
+
+/*! @typedef
+ @abstract Tasks numbered 0 to n - 1 shared out between workers
+ @field ranges one range per worker
+ @field num_workers number of workers
+ */
+typedef struct {
+    PM_task_range * ranges;
+    int num_workers;
+} PM_task_queue;
+
+/*!
+ * @abstract Give each worker its starting range of tasks
+ *
+ * @param  Q  queue to set up
+ * @param  bounds  (numWorkers + 1) ints, worker w starts with [bounds[w], bounds[w+1])
+ * @param  numWorkers  number of workers
+ * @return void
+ *
+ * @discussion partitionContigs makes suitable bounds from task weights.
+ */
+void initTaskQueue(PM_task_queue * Q, int * bounds, int numWorkers);
+
+/*!
+ * @abstract Free a queue set up by initTaskQueue
+ *
+ * @param  Q  queue to clean up
+ * @return void
+ */
+void destroyTaskQueue(PM_task_queue * Q);
+
+/*!
+ * @abstract Claim the next task for a worker
+ *
+ * @param  Q  queue to take from
+ * @param  worker  worker asking
+ * @return task number, or -1 once every task has been claimed
+ *
+ * @discussion Lock free and thread safe. Each worker takes its own tasks in
+ * order. Once they run out it steals the back half of whichever worker has
+ * the most left, so neighbouring tasks tend to stay with the same worker.
+ * Every task is returned exactly once.
+ */
+int nextTask(PM_task_queue * Q, int worker);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PM_TASK_QUEUE_H
@@ -35,24 +35,124 @@ __status__ = "Dev"
 
 ###############################################################################
 import os
+import threading
+try:
+    import queue
+except ImportError:
+    import Queue as queue
 import ctypes as c
 import pkg_resources
+import numpy as np
 
 ###############################################################################
 ###############################################################################
 ###############################################################################
 ###############################################################################
 
-# fields defined in cfuhash.c but not accessed at this level
-class cfuhash_table_t(c.Structure):
-    pass
+# PM_output_format
+PM_OUTPUT_TSV = 0
+PM_OUTPUT_TSV_GZ = 1
+PM_OUTPUT_BINARY = 2
+
+# link table structures
+"""
+typedef struct {
+    uint64_t key;
+    PM_link_pair * LP;
+} PM_link_slot;
+
+typedef struct {
+    PM_link_block * blocks;
+    size_t num_blocks;
+} PM_link_arena;
+
+typedef struct {
+    PM_link_slot * slots;
+    size_t capacity;
+    size_t num_pairs;
+    int shift;
+    PM_link_arena arena;
+} PM_link_table;
+"""
+class PM_link_slot(c.Structure):
+    _fields_ = [("key",c.c_uint64),
+                ("LP",c.c_void_p)
+                ]
+
+class PM_link_arena(c.Structure):
+    _fields_ = [("blocks",c.c_void_p),
+                ("num_blocks",c.c_size_t)
+                ]
+
+class PM_link_table(c.Structure):
+    _fields_ = [("slots",c.POINTER(PM_link_slot)),
+                ("capacity",c.c_size_t),
+                ("num_pairs",c.c_size_t),
+                ("shift",c.c_int),
+                ("arena",PM_link_arena)
+                ]
+
+# flat link arrays structure
+"""
+typedef struct {
+    size_t num_pairs;
+    size_t num_links;
+    uint64_t * offsets;
+    uint32_t * cid_1;
+    uint32_t * cid_2;
+    uint32_t * pos_1;
+    uint32_t * pos_2;
+    uint8_t * orient;
+    uint32_t * bam_ID;
+} PM_link_columns;
+"""
+class PM_link_columns(c.Structure):
+    _fields_ = [("num_pairs",c.c_size_t),
+                ("num_links",c.c_size_t),
+                ("offsets",c.POINTER(c.c_uint64)),
+                ("cid_1",c.POINTER(c.c_uint32)),
+                ("cid_2",c.POINTER(c.c_uint32)),
+                ("pos_1",c.POINTER(c.c_uint32)),
+                ("pos_2",c.POINTER(c.c_uint32)),
+                ("orient",c.POINTER(c.c_uint8)),
+                ("bam_ID",c.POINTER(c.c_uint32))
+                ]
+
+# parse stats structure
+PM_TIMER_NAMES = ['total', 'setup', 'pileup', 'read', 'links', 'adjust', 'merge']
+"""
+typedef struct {
+    uint64_t timer_ns[PM_NUM_TIMERS];
+    uint64_t records_read;
+    uint64_t mapq_filtered;
+    uint64_t length_filtered;
+    uint64_t del_refskip_rejects;
+    uint64_t baseq_rejects;
+    uint64_t links_added;
+    uint64_t * bytes_inflated;
+    uint32_t num_bams;
+    uint64_t plp_bp_saturated;
+} PM_parse_stats;
+"""
+class PM_parse_stats(c.Structure):
+    _fields_ = [("timer_ns",c.c_uint64 * len(PM_TIMER_NAMES)),
+                ("records_read",c.c_uint64),
+                ("mapq_filtered",c.c_uint64),
+                ("length_filtered",c.c_uint64),
+                ("del_refskip_rejects",c.c_uint64),
+                ("baseq_rejects",c.c_uint64),
+                ("links_added",c.c_uint64),
+                ("bytes_inflated",c.POINTER(c.c_uint64)),
+                ("num_bams",c.c_uint32),
+                ("plp_bp_saturated",c.c_uint64)
+                ]
 
 # mapping results structure
 """
 typedef struct {
-    uint32_t ** plp_bp;
+    uint32_t * plp_bp;
     uint32_t * contig_lengths;
-    uint32_t ** contig_length_correctors;
+    uint32_t * contig_length_correctors;
     uint32_t num_bams;
     uint32_t num_contigs;
     char ** contig_names;
@@ -60,13 +160,22 @@ typedef struct {
     int is_links_included;
     int is_outlier_coverage;
     int is_ignore_supps;
-    cfuhash_table_t * links;
+    PM_link_table * links;
+    float coverage_lower;
+    float coverage_upper;
+    uint32_t * region_lengths;
+    void * mapping;
+    size_t mapping_size;
+    PM_parse_stats stats;
+    int row_offset;
+    uint64_t region_digest;
+    uint8_t * seen_contigs;
 } PM_mapping_results;
 """
 class PM_mapping_results(c.Structure):
-    _fields_ = [("plp_bp", c.POINTER(c.POINTER(c.c_uint32))),
+    _fields_ = [("plp_bp", c.POINTER(c.c_uint32)),
                 ("contig_lengths",c.POINTER(c.c_uint32)),
-                ("contig_length_correctors",c.POINTER(c.POINTER(c.c_uint32))),
+                ("contig_length_correctors",c.POINTER(c.c_uint32)),
                 ("num_bams",c.c_uint32),
                 ("num_contigs",c.c_uint32),
                 ("contig_names",c.POINTER(c.POINTER(c.c_char))),
@@ -74,11 +183,149 @@ class PM_mapping_results(c.Structure):
                 ("is_links_included",c.c_int),
                 ("is_outlier_coverage",c.c_int),
                 ("is_ignore_supps",c.c_int),
-                ("links",c.POINTER(cfuhash_table_t))
+                ("links",c.POINTER(PM_link_table)),
+                ("coverage_lower",c.c_float),
+                ("coverage_upper",c.c_float),
+                ("region_lengths",c.POINTER(c.c_uint32)),
+                ("mapping",c.c_void_p),
+                ("mapping_size",c.c_size_t),
+                ("stats",PM_parse_stats),
+                ("row_offset",c.c_int),
+                ("region_digest",c.c_uint64),
+                ("seen_contigs",c.POINTER(c.c_uint8))
+                ]
+
+# coverage modes (PM_coverage_mode), set as do_outlier_coverage
+PM_COVERAGE_MEAN = 0
+PM_COVERAGE_OUTLIER_SD = 1
+PM_COVERAGE_TRIMMED_MEAN = 2
+PM_COVERAGE_MEDIAN = 3
+PM_COVERAGE_PERCENTILE_CLIP = 4
+
+# progress structure and callback
+PM_PARSE_CANCELLED = -3
+# how often a parse from the main thread looks for a Ctrl-C without a callback
+PM_INTERRUPT_CONTIGS = 1000
+PM_INTERRUPT_MB = 16
+"""
+typedef struct {
+    uint64_t bytes_read;
+    uint64_t bytes_total;
+    int tid;
+    int contigs_done;
+    int num_contigs;
+    double elapsed;
+    double eta;
+} PM_progress;
+
+typedef int (*PM_progress_callback)(PM_progress * progress, void * userData);
+"""
+class PM_progress(c.Structure):
+    _fields_ = [("bytes_read",c.c_uint64),
+                ("bytes_total",c.c_uint64),
+                ("tid",c.c_int),
+                ("contigs_done",c.c_int),
+                ("num_contigs",c.c_int),
+                ("elapsed",c.c_double),
+                ("eta",c.c_double)
+                ]
+
+PM_progress_callback = c.CFUNCTYPE(c.c_int, c.POINTER(PM_progress), c.c_void_p)
+
+# streamed contig structure and consumer
+"""
+typedef struct {
+    int tid;
+    char * name;
+    uint32_t length;
+    uint32_t num_bams;
+    uint32_t * plp_bp;
+    uint32_t * correctors;
+    PM_link_table * links;
+} PM_contig_result;
+
+typedef int (*PM_contig_consumer)(PM_contig_result * result, void * userData);
+"""
+class PM_contig_result(c.Structure):
+    _fields_ = [("tid",c.c_int),
+                ("name",c.c_char_p),
+                ("length",c.c_uint32),
+                ("num_bams",c.c_uint32),
+                ("plp_bp",c.POINTER(c.c_uint32)),
+                ("correctors",c.POINTER(c.c_uint32)),
+                ("links",c.POINTER(PM_link_table))
+                ]
+
+PM_contig_consumer = c.CFUNCTYPE(c.c_int, c.POINTER(PM_contig_result), c.c_void_p)
+
+# parse options structure
+"""
+typedef struct {
+    int baseQ;
+    int mapQ;
+    int min_len;
+    int do_links;
+    int ignore_supps;
+    int do_outlier_coverage;
+    int num_workers;
+    int num_threads;
+    float coverage_lower;
+    float coverage_upper;
+    char ** regions;
+    int num_regions;
+    char * bed_file;
+    char * cache_dir;
+    PM_progress_callback progress;
+    void * progress_data;
+    int progress_contigs;
+    int progress_mb;
+    PM_contig_consumer consumer;
+    void * consumer_data;
+    int num_finalisers;
+    int read_ahead;
+    int chunk_size;
+    int num_bam_workers;
+    int max_open_files;
+    int memory_mb;
+    uint8_t * seen_contigs;
+} PM_parse_options;
+"""
+class PM_parse_options(c.Structure):
+    _fields_ = [("baseQ",c.c_int),
+                ("mapQ",c.c_int),
+                ("min_len",c.c_int),
+                ("do_links",c.c_int),
+                ("ignore_supps",c.c_int),
+                ("do_outlier_coverage",c.c_int),
+                ("num_workers",c.c_int),
+                ("num_threads",c.c_int),
+                ("coverage_lower",c.c_float),
+                ("coverage_upper",c.c_float),
+                ("regions",c.POINTER(c.c_char_p)),
+                ("num_regions",c.c_int),
+                ("bed_file",c.c_char_p),
+                ("cache_dir",c.c_char_p),
+                ("progress",PM_progress_callback),
+                ("progress_data",c.c_void_p),
+                ("progress_contigs",c.c_int),
+                ("progress_mb",c.c_int),
+                ("consumer",PM_contig_consumer),
+                ("consumer_data",c.c_void_p),
+                ("num_finalisers",c.c_int),
+                ("read_ahead",c.c_int),
+                ("chunk_size",c.c_int),
+                ("num_bam_workers",c.c_int),
+                ("max_open_files",c.c_int),
+                ("memory_mb",c.c_int),
+                ("seen_contigs",c.POINTER(c.c_uint8))
                 ]
 
 class BamParser:
-    """Main class for reading in and parsing contigs"""
+    """Main class for reading in and parsing contigs
+
+    parsem._pmbam (c/bam/pmModule.c) is a compiled alternative for parsing,
+    coverages and merging which releases the GIL and returns numpy arrays.
+    """
     def __init__(self):
         # load the c library
         package_dir, filename = os.path.split(__file__)
@@ -103,6 +350,22 @@ class BamParser:
         void merge_MRs(PM_mapping_results * MR_A, PM_mapping_results * MR_B);
         """
 
+        self.merge_MRs_many = self.libPMBam.merge_MRs_many
+        """
+        @abstract Append the contents of several MRs to another in one go
+
+        @param  MR_out  mapping results struct to copy to
+        @param  MR_in  mapping results structs to copy from, in BAM order
+        @param  numIn  number of structs in MR_in
+        @return 0 for success, 1 if the headers don't match (MR_out is unchanged)
+
+        @discussion The MR_in are unchanged. The combined matrices are
+        allocated once and links are copied a pair at a time, so merging n MRs
+        costs the same as one pass over their data.
+
+        int merge_MRs_many(PM_mapping_results * MR_out, PM_mapping_results ** MR_in, int numIn);
+        """
+
         self.destroy_MR = self.libPMBam.destroy_MR
         """
         @abstract Free all the memory calloced in init_MR
@@ -110,9 +373,43 @@ class BamParser:
         @param  MR  mapping results struct to destroy
         @return void
 
+        @discussion If MR came from load_MR the file is unmapped as well.
+
         void destroy_MR(PM_mapping_results * MR)
         """
 
+        self.save_MR = self.libPMBam.save_MR
+        """
+        @abstract Write mapping results to a file
+
+        @param  MR  mapping results struct to save (unchanged)
+        @param  fileName  file to write
+        @return 0 for success
+
+        @discussion The file is written next to fileName and renamed into place
+        so a reader never sees half a file. The layout is native endian, the
+        header records the byte order and load_MR refuses files that don't match.
+
+        int save_MR(PM_mapping_results * MR, char * fileName)
+        """
+
+        self.load_MR = self.libPMBam.load_MR
+        """
+        @abstract Map a file made by save_MR back into a mapping results struct
+
+        @param  fileName  file to read
+        @param  MR  empty mapping results struct to fill
+        @return 0 for success
+
+        @discussion The file is mmap'd privately and the counts, lengths and
+        contig names point straight into it, so nothing is copied no matter how
+        big the matrices are. Writes land in private copies of the pages and
+        never reach the file. The link table is rebuilt from the stored columns
+        as it has to be a hash. Call destroy_MR when done, which unmaps the file.
+
+        int load_MR(char * fileName, PM_mapping_results * MR)
+        """
+
         self.parseCoverageAndLinks = self.libPMBam.parseCoverageAndLinks
         """
         @abstract Initialise the mapping results struct <- read in the BAM files
@@ -123,7 +420,8 @@ class BamParser:
         @param minLen  min query length
         @param doLinks  1 if links should be calculated
         @param ignoreSuppAlignments  only use primary alignments
-        @param doOutlierCoverage  set to 1 if should initialise contig_length_correctors
+        @param doOutlierCoverage  PM_coverage_mode, 1 clips at a stdev either side of the mean
+        @param numThreads  number of BGZF decompression threads (<= 1 for none)
         @param bamFiles  filenames of BAM files to parse
         @param MR  mapping results struct to write to
         @return 0 for success
@@ -132,6 +430,11 @@ class BamParser:
         init_MR and stores info accordingly. TL;DR If you call this function
         then you MUST call destroy_MR when you're done.
 
+        When numThreads > 1 a single htslib thread pool is attached to every
+        BAM so blocks are inflated ahead of the pileup.
+
+        If PM_CACHE_DIR is set results are cached there.
+
         int parseCoverageAndLinks(int numBams,
                                   int baseQ,
                                   int mapQ,
@@ -139,26 +442,99 @@ class BamParser:
                                   int doLinks,
                                   int ignoreSuppAlignments,
                                   int doOutlierCoverage,
+                                  int numThreads,
                                   char* bamFiles[],
                                   PM_mapping_results * MR
                                  )
         """
 
+        self.init_parse_options = self.libPMBam.init_parse_options
+        """
+        @abstract Set the parse options to their default values
+
+        @param opts  options struct to initialise
+        @return void
+
+        @discussion cache_dir is taken from the PM_CACHE_DIR environment
+        variable if it is set.
+
+        void init_parse_options(PM_parse_options * opts)
+        """
+
+        self.parseCoverageAndLinksWithOptions = self.libPMBam.parseCoverageAndLinksWithOptions
+        """
+        @abstract Initialise the mapping results struct <- read in the BAM files
+
+        @param numBams  number of BAM files to parse
+        @param bamFiles  filenames of BAM files to parse
+        @param opts  settings to parse with (see PM_parse_options)
+        @param MR  mapping results struct to write to
+        @return 0 for success, PM_PARSE_CANCELLED if opts->progress asked to stop
+
+        @discussion Same contract as parseCoverageAndLinks. If opts->num_workers
+        is more than 1 and every BAM is indexed then contigs are shared out
+        between worker threads. The results are identical to those of the
+        serial parser.
+
+        If opts->regions or opts->bed_file are set only those regions are read,
+        using the index of every BAM, and the parse fails if a BAM has no .bai.
+        MR still has a row for every contig but only the requested ones are
+        filled. MR->region_lengths is set and coverage is averaged over just the
+        bases inside the regions. Links are kept for reads starting inside them.
+
+        If opts->cache_dir is set BAMs already parsed with the same settings are
+        loaded from there instead and only new or changed BAMs are decoded.
+
+        If opts->progress is set it is called every opts->progress_contigs
+        contigs or opts->progress_mb MB of compressed input. If it returns
+        non-zero the parse stops, everything is freed and MR is left empty.
+        See setProgress and parseWithOptions.
+
+        If opts->consumer is set each contig's row and links are handed to it
+        as soon as the contig is finished and then reused, so memory stays
+        flat. MR is left with only the names, lengths and stats. See
+        streamContigs.
+
+        opts->read_ahead and opts->num_finalisers move reading and filtering
+        and the end of contig adjustments of a serial parse onto threads of
+        their own so the pileup doesn't stall at contig boundaries. The
+        results are the same.
+
+        opts->chunk_size cuts contigs into chunks of that many bases for a
+        parallel parse and lets idle workers steal (BAM, chunk) tasks from
+        busy ones. Coverage is the same, links may come in another order.
+
+        opts->num_bam_workers has a serial parse pile up each BAM on its own,
+        that many at once on threads, rather than all of them in lock step.
+        Coverage is the same, links may come in another order.
+
+        opts->max_open_files and opts->memory_mb cap the BAMs open at once.
+        If they don't all fit they are parsed in groups, up to
+        opts->num_workers at once, and put together into one MR.
+
+        int parseCoverageAndLinksWithOptions(int numBams,
+                                             char* bamFiles[],
+                                             PM_parse_options * opts,
+                                             PM_mapping_results * MR)
+        """
+
         self.adjustPlpBp = self.libPMBam.adjustPlpBp
         """
         @abstract Adjust (reduce) the number of piled-up bases along a contig
 
         @param  MR  mapping results struct to write to
-        @param  position_holder  array of pileup depths
+        @param  depths  pileup depths along the contig, one buffer per BAM
         @param  tid  contig currently being processed
-        @param  doOutlierCoverage  remove effects fo very high or very low regions
         @return void
 
         @discussion This function expects MR to be initialised.
-        it can change the values of contig_length_correctors and plp_bp
+        it can change the values of contig_length_correctors and plp_bp.
+        If MR->is_outlier_coverage is set the effects of very high or very low
+        regions are removed, using the histograms for the PM_COVERAGE_USES_HISTOGRAM
+        modes.
 
         void adjustPlpBp(PM_mapping_results * MR,
-                         uint32_t ** position_holder,
+                         PM_depth_buffers * depths,
                          int tid)
         """
 
@@ -171,11 +547,26 @@ class BamParser:
 
         @discussion This function expects MR to be initialised.
         NOTE: YOU are responsible for freeing the return value
-        recommended method is to use destroyCoverages
+        recommended method is to use destroyCoverages. The rows all sit in one
+        block starting at ret[0].
 
         float ** calculateCoverages(PM_mapping_results * MR);
         """
 
+        self.calculateCoveragesInto = self.libPMBam.calculateCoveragesInto
+        """
+        @abstract Calculate the coverage for each contig for each BAM into a buffer
+
+        @param  MR  mapping results struct with mapping info
+        @param  out  num_contigs x num_bams floats, written row-major
+        @return 0 for success
+
+        @discussion This function expects MR to be initialised. Nothing is
+        allocated so out can be memory owned by the caller (e.g. a numpy array).
+
+        int calculateCoveragesInto(PM_mapping_results * MR, float * out);
+        """
+
         self.destroyCoverages = self.libPMBam.destroyCoverages
         """
         @abstract Destroy the coverages structure
@@ -196,6 +587,334 @@ class BamParser:
         void print_MR(PM_mapping_results * MR)
         """
 
+        self.write_MR = self.libPMBam.write_MR
+        """
+        @abstract Write the coverage table and then the link table to a file
+
+        @param  MR  mapping results struct to write
+        @param  fileName  file to write ("-" for stdout)
+        @param  format  0 TSV, 1 BGZF compressed TSV, 2 packed binary
+        @return 0 for success
+
+        int write_MR(PM_mapping_results * MR, char * fileName, int format)
+        """
+
+        self.compactLinks = self.libPMBam.compactLinks
+        self.compactLinks.restype = c.POINTER(PM_link_columns)
+        """
+        @abstract Copy every link out into flat parallel arrays
+
+        @param  linkTable  table to copy links from (unchanged)
+        @return PM_link_columns * (never NULL)
+
+        @discussion Pairs are sorted by (cid_1, cid_2) and links within a pair
+        keep the order they were added in. Call destroyLinkColumns when done.
+
+        PM_link_columns * compactLinks(PM_link_table * linkTable)
+        """
+
+        self.destroyLinkColumns = self.libPMBam.destroyLinkColumns
+        """
+        @abstract Free the arrays made by compactLinks
+
+        @param  LC  link columns to destroy
+        @return void
+
+        void destroyLinkColumns(PM_link_columns * LC)
+        """
+
+    def setRegions(self, opts, regions=None, bedFile=None):
+        """Restrict a parse with opts to some regions of the BAMs
+
+        regions is a list of contig names or 'contig:beg-end' strings (1 based,
+        inclusive) and bedFile is the path of a BED file, either can be None.
+        The BAMs must be indexed. The strings are kept on opts so they live as
+        long as it does.
+        """
+        encoded = [self._asBytes(region) for region in (regions or [])]
+        opts._region_strings = (c.c_char_p * max(len(encoded), 1))(*encoded)
+        opts.regions = opts._region_strings
+        opts.num_regions = len(encoded)
+        opts._bed_file = None if bedFile is None else self._asBytes(bedFile)
+        opts.bed_file = opts._bed_file
+
+    def setCacheDir(self, opts, cacheDir):
+        """Reuse and add to the per-BAM results cached in cacheDir (None to turn off)
+
+        The path is kept on opts so it lives as long as it does.
+        """
+        opts._cache_dir = None if cacheDir is None else self._asBytes(cacheDir)
+        opts.cache_dir = opts._cache_dir
+
+    def setProgress(self, opts, callback, everyContigs=0, everyMB=64):
+        """Call callback(progress) as a parse with opts goes (None to turn off)
+
+        progress is a PM_progress: bytes_read and bytes_total (compressed),
+        tid, contigs_done, num_contigs, elapsed and eta (seconds, negative
+        until known). Return True to cancel the parse. It is called every
+        everyContigs contigs or everyMB MB, whichever comes first (<= 0 for
+        never, both <= 0 for every contig). It is called from the thread
+        parseWithOptions parses on, or the contig workers' threads, one at a
+        time, never from the main thread.
+
+        An exception in callback cancels the parse and is re-raised by
+        parseWithOptions, as is a Ctrl-C while it waits (see there). The
+        wrapper is kept on opts so it lives as long as it does.
+        """
+        opts._progress_error = None
+        if callback is None:
+            opts._progress = None
+            opts.progress = PM_progress_callback()
+            return
+
+        def wrapper(progress, userData):
+            if opts._progress_error is not None:
+                return 1 # interrupted while waiting
+            try:
+                return 1 if callback(progress.contents) else 0
+            except BaseException as e:
+                opts._progress_error = e
+                return 1
+
+        opts._progress = PM_progress_callback(wrapper)
+        opts.progress = opts._progress
+        opts.progress_contigs = everyContigs
+        opts.progress_mb = everyMB
+
+    def parseWithOptions(self, bamFiles, opts, MR):
+        """Parse bamFiles into MR with opts, see parseCoverageAndLinksWithOptions
+
+        Returns 0 for success or PM_PARSE_CANCELLED if the progress callback
+        asked to stop, in which case MR is empty. If the callback raised, the
+        exception is raised here once the C side has cleaned up.
+
+        Python only sees a Ctrl-C on the main thread, and not while that
+        thread is inside the C library, so when called from the main thread
+        the parse runs on a thread of its own and this one waits for it. A
+        KeyboardInterrupt while waiting cancels the parse through the progress
+        callback (a quiet one is set for the call if there is none, every
+        PM_INTERRUPT_CONTIGS contigs or PM_INTERRUPT_MB MB) and is raised once
+        the parse has stopped, so it can take until the next callback.
+        """
+        files = (c.c_char_p * max(len(bamFiles), 1))(*[self._asBytes(f) for f in bamFiles])
+        opts._progress_error = None
+        if not self._onMainThread():
+            ret = self.parseCoverageAndLinksWithOptions(len(bamFiles), files, c.byref(opts), c.byref(MR))
+        else:
+            ret = self._parseInterruptibly(files, len(bamFiles), opts, MR)
+        if getattr(opts, '_progress_error', None) is not None:
+            error = opts._progress_error
+            opts._progress_error = None
+            raise error
+        return ret
+
+    def _parseInterruptibly(self, files, numFiles, opts, MR):
+        """Parse on another thread so a Ctrl-C on this one can cancel it"""
+        quiet = not opts.progress
+        if quiet:
+            saved = (opts.progress_contigs, opts.progress_mb)
+            self.setProgress(opts, lambda progress: False, PM_INTERRUPT_CONTIGS, PM_INTERRUPT_MB)
+        result = {'ret': 1}
+
+        def parse():
+            result['ret'] = self.parseCoverageAndLinksWithOptions(numFiles, files, c.byref(opts), c.byref(MR))
+
+        worker = threading.Thread(target=parse)
+        worker.daemon = True
+        worker.start()
+        try:
+            while worker.is_alive():
+                try:
+                    worker.join(0.1)
+                except KeyboardInterrupt as e:
+                    # the wrapper cancels at its next call, then we wait for C to clean up
+                    if opts._progress_error is None:
+                        opts._progress_error = e
+        finally:
+            if quiet:
+                opts._progress = None
+                opts.progress = PM_progress_callback()
+                opts.progress_contigs, opts.progress_mb = saved
+        return result['ret']
+
+    def streamContigs(self, bamFiles, opts, queueSize=16):
+        """Parse bamFiles with opts, yielding each contig as soon as it is finished
+
+        Each item is a dict of 'tid', 'name', 'length', 'plp_bp' and
+        'correctors' (numpy arrays with one entry per BAM, correctors is None
+        unless outlier coverage is on) and 'links' (None unless links are on,
+        otherwise a dict of columns as from getLinkColumns with just the links
+        found on this contig). Everything is copied. Contigs come in order
+        unless opts.num_workers is more than 1, and ones with no reads are
+        yielded as zeros.
+
+        The parse runs in a thread of its own and waits once queueSize
+        contigs are waiting to be taken, so only a few rows are ever held.
+        Closing the generator early cancels the parse. Errors from the parse,
+        including those from a progress callback, are raised here. The cache
+        is not used.
+        """
+        items = queue.Queue(max(queueSize, 1))
+        finished = object()
+        state = {'stop': False, 'error': None, 'ret': 0}
+
+        def consumer(result, userData):
+            try:
+                R = result.contents
+                item = {'tid': R.tid,
+                        'name': R.name if isinstance(R.name, str) else R.name.decode(),
+                        'length': R.length,
+                        'plp_bp': self._asArray(R.plp_bp, R.num_bams).copy(),
+                        'correctors': None,
+                        'links': None}
+                if R.correctors:
+                    item['correctors'] = self._asArray(R.correctors, R.num_bams).copy()
+                if R.links:
+                    LC = self.compactLinks(R.links)
+                    num_links = LC.contents.num_links
+                    links = {'offsets': self._asArray(LC.contents.offsets, LC.contents.num_pairs + 1).copy()}
+                    for field in ['cid_1', 'cid_2', 'pos_1', 'pos_2', 'orient', 'bam_ID']:
+                        links[field] = self._asArray(getattr(LC.contents, field), num_links).copy()
+                    self.destroyLinkColumns(LC)
+                    item['links'] = links
+                while not state['stop']:
+                    try:
+                        items.put(item, timeout=0.1)
+                        return 0
+                    except queue.Full:
+                        pass
+                return 1
+            except BaseException as e:
+                state['error'] = e
+                return 1
+
+        def parse():
+            MR = PM_mapping_results()
+            try:
+                state['ret'] = self.parseWithOptions(bamFiles, opts, MR)
+            except BaseException as e:
+                state['error'] = e
+            finally:
+                self.destroy_MR(c.byref(MR))
+                items.put(finished)
+
+        opts._consumer = PM_contig_consumer(consumer)
+        opts.consumer = opts._consumer
+        worker = threading.Thread(target=parse)
+        worker.daemon = True
+        worker.start()
+        try:
+            while True:
+                item = items.get()
+                if item is finished:
+                    break
+                yield item
+        finally:
+            # stop the parse if we were closed early, then let it drain out
+            state['stop'] = True
+            while worker.is_alive():
+                try:
+                    items.get(timeout=0.1)
+                except queue.Empty:
+                    pass
+            opts.consumer = PM_contig_consumer()
+            opts._consumer = None
+        if state['error'] is not None:
+            raise state['error']
+        if state['ret'] != 0 and state['ret'] != PM_PARSE_CANCELLED:
+            raise RuntimeError("Parse of %s failed (%d)" % (bamFiles, state['ret']))
+
+    def writeTables(self, MR, fileName, format=PM_OUTPUT_TSV):
+        """Write the coverage and link tables of MR to fileName
+
+        format is one of PM_OUTPUT_TSV, PM_OUTPUT_TSV_GZ or PM_OUTPUT_BINARY.
+        Returns 0 for success.
+        """
+        return self.write_MR(c.byref(MR), self._asBytes(fileName), format)
+
+    def getCoverages(self, MR):
+        """Get the coverage matrix of MR as a numpy array (rows = contigs, cols = BAMs)
+
+        The array is allocated by numpy and filled in place by the C library
+        so it is safe to keep after destroy_MR.
+        """
+        covs = np.zeros((MR.num_contigs, MR.num_bams), dtype=np.float32)
+        if covs.size != 0:
+            self.calculateCoveragesInto(c.byref(MR),
+                                        covs.ctypes.data_as(c.POINTER(c.c_float)))
+        return covs
+
+    def getPileupCounts(self, MR):
+        """Get the raw counts of MR as numpy arrays (rows = contigs, cols = BAMs)
+
+        Returns (plp_bp, contig_length_correctors). These are views onto the
+        memory owned by MR, nothing is copied. contig_length_correctors is
+        None unless outlier coverage was calculated. The arrays must not be
+        used after destroy_MR(MR).
+        """
+        shape = (MR.num_contigs, MR.num_bams)
+        plp_bp = self._asArray(MR.plp_bp, shape[0] * shape[1]).reshape(shape)
+        correctors = None
+        if MR.is_outlier_coverage:
+            correctors = self._asArray(MR.contig_length_correctors, shape[0] * shape[1]).reshape(shape)
+        return (plp_bp, correctors)
+
+    def getLinkColumns(self, MR):
+        """Get every link in MR as numpy arrays, sorted by contig pair
+
+        Returns (LC, columns). columns maps 'offsets', 'cid_1', 'cid_2',
+        'pos_1', 'pos_2', 'orient' and 'bam_ID' to numpy arrays which are
+        views onto memory owned by LC, nothing is copied. Links of pair p are
+        [offsets[p], offsets[p+1]). Bit 0 of orient is orient_1 and bit 1 is
+        orient_2. If links were not collected every column is empty apart
+        from offsets, which is [0]. Call destroyLinkColumns(LC) once the
+        arrays are finished with; they must not be used after that.
+        """
+        LC = self.compactLinks(MR.links)
+        num_links = LC.contents.num_links
+        columns = {}
+        columns['offsets'] = self._asArray(LC.contents.offsets, LC.contents.num_pairs + 1)
+        for field in ['cid_1', 'cid_2', 'pos_1', 'pos_2', 'orient', 'bam_ID']:
+            columns[field] = self._asArray(getattr(LC.contents, field), num_links)
+        return (LC, columns)
+
+    def getParseStats(self, MR):
+        """Get the timers and counters of the parse that made MR as a dict
+
+        Timers are in seconds under 'timers'. With several contig workers all
+        but 'total' are summed over the workers. 'read' and 'links' are
+        estimated from a sample of calls. 'bytes_inflated' has one entry per
+        BAM. 'plp_bp_saturated' counts plp_bp cells stored as 2**32 - 1
+        because the real count did not fit. Everything is copied so it is
+        safe to keep after destroy_MR.
+        """
+        stats = MR.stats
+        ret = {'timers': dict(zip(PM_TIMER_NAMES, [t * 1e-9 for t in stats.timer_ns]))}
+        for field in ['records_read', 'mapq_filtered', 'length_filtered',
+                      'del_refskip_rejects', 'baseq_rejects', 'links_added',
+                      'plp_bp_saturated']:
+            ret[field] = getattr(stats, field)
+        ret['bytes_inflated'] = [stats.bytes_inflated[i] for i in range(stats.num_bams)]
+        return ret
+
+    def _onMainThread(self):
+        """True on the thread Python delivers Ctrl-C to (main_thread is 3.4+)"""
+        if hasattr(threading, 'main_thread'):
+            return threading.current_thread() is threading.main_thread()
+        return isinstance(threading.current_thread(), threading._MainThread)
+
+    def _asBytes(self, string):
+        """C strings must be bytes"""
+        if isinstance(string, bytes):
+            return string
+        return string.encode()
+
+    def _asArray(self, pointer, length):
+        """Wrap length items at a ctypes pointer as a numpy array without copying"""
+        if length == 0:
+            return np.zeros(0, dtype=np.dtype(pointer._type_))
+        return np.ctypeslib.as_array(pointer, shape=(length,))
+
 ###############################################################################
 ###############################################################################
 ###############################################################################
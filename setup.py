@@ -1,15 +1,29 @@
-from distutils.core import setup
+from distutils.core import setup, Extension
 from distutils.command.install import INSTALL_SCHEMES
 import sys
 from subprocess import call
 from os.path import join, abspath
 from os import chdir, getcwd
 
-xtra_opts = {"--with-libcfu-inc":"libcfu headers at this location",
-             "--with-libcfu-lib":"libcfu library at this location",
-             "--with-libhts-inc":"htslib headers at this location",
+xtra_opts = {"--with-libhts-inc":"htslib headers at this location",
              "--with-libhts-lib":"htslib library at this location"}
 
+# the native module is built from the library sources, not libPMBam.a
+ext_include_dirs = [join('c', 'bam')]
+ext_library_dirs = []
+try:
+    import numpy
+    ext_include_dirs.append(numpy.get_include())
+except ImportError:
+    pass
+
+def pmBamSources():
+    """The library sources, as listed in c/bam/Makefile.in"""
+    for line in open(join('c', 'bam', 'Makefile.in')):
+        if line.startswith('LIB_SOURCES'):
+            return [join('c', 'bam', f) for f in line.split('=', 1)[1].split()]
+    return []
+
 
 if '--help' not in sys.argv:
     if 'sdist' not in sys.argv:
@@ -23,6 +37,10 @@ if '--help' not in sys.argv:
             try:
                 opt_idx = sys.argv.index(opt)
                 configure_args.append(opt+"="+abspath(sys.argv[opt_idx+1]))
+                if opt.endswith('-inc'):
+                    ext_include_dirs.append(abspath(sys.argv[opt_idx+1]))
+                else:
+                    ext_library_dirs.append(abspath(sys.argv[opt_idx+1]))
                 del sys.argv[opt_idx+1]
                 sys.argv.remove(opt)
             except ValueError:
@@ -53,7 +71,15 @@ setup(
     license='GPLv3',
     description='ParseM',
     long_description=open('README.md').read(),
-    install_requires=[],
-    data_files=[('', ['c/bam/libPMBam.a'])]
+    install_requires=['numpy'],
+    data_files=[('', ['c/bam/libPMBam.a'])],
+    ext_modules=[Extension('parsem._pmbam',
+                           sources=[join('c', 'bam', 'pmModule.c')] + pmBamSources(),
+                           include_dirs=ext_include_dirs,
+                           library_dirs=ext_library_dirs,
+                           runtime_library_dirs=ext_library_dirs,
+                           libraries=['hts', 'z', 'm'],
+                           extra_compile_args=['-std=gnu99', '-pthread'],
+                           extra_link_args=['-pthread'])]
 )
 